@@ -0,0 +1,11 @@
+; Та же программа, что HelloWorld.txt, на ассемблере: xvasm examples/HelloWorld.s hello.txt
+        goto start
+text:   .ascii "Hello, world!\n"
+start:  loc r1 start        ; адрес за концом строки
+        loc r2 text
+loop:   lodr r0 r2
+        prts r0 0
+        addc r2 r2 1
+        cmp r2 r1
+        jmp < loop
+        halt
@@ -0,0 +1,473 @@
+#pragma once
+
+#include <climits>
+#include <cstdint>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "core.hpp"
+
+/*
+ Перевод программы xvproc в C++ до запуска (ahead-of-time)
+
+ Программа проверяется как в доверенном режиме (verify_program), затем инструкции, достижимые из точки входа
+ (и из обработчиков прерываний, чьи адреса задаются loc в r13 или в регистр seti), переводятся в одну функцию:
+ у каждой инструкции своя метка, jmp/goto/call - goto на метку цели, ret и запись в r14 - переход через switch
+ по всем переведённым адресам. Базовый блок вычитает свои инструкции из обратного отсчёта ядра разом,
+ а если отсчёта не хватает, возвращается к ядру до первой инструкции, поэтому таймер, бюджет и срок
+ срабатывают на тех же инструкциях, что и у интерпретатора
+
+ Функция подключается к ядру (core::set_native) и исполняется им вместо движков с кэшем. Всё, что перевод
+ не исполняет сам, он отдаёт ядру, возвращая адрес инструкции: порты, прерывания, halt, amin/setl/setf,
+ атомарные операции, ошибки (выход за ОЗУ или стек, деление на ноль), запись в ячейку переведённой инструкции
+ и переход на непереведённый адрес. Ядро исполняет одну инструкцию своим интерпретатором и снова вызывает перевод,
+ а после записи в код перевод отключается до конца запуска
+
+ Выход - исходный файл с программой, таблицей переведённых ячеек, функцией и main, который загружает программу
+ в ядро с тем же набором портов, что у xvprocexe
+*/
+
+namespace aot_unit {
+
+    using cpu_unit::OpCode;
+
+    struct translate_stats {
+        std::size_t instructions = 0;   // Достижимые инструкции
+        std::size_t native = 0;         // Из них исполняются переводом
+        std::size_t blocks = 0;         // Базовые блоки
+    };
+
+    class translator {
+    public:
+        // code - область программы, entry - точка входа, memory_words - размер ОЗУ, для которого проверяются прямые адреса
+        translator(std::vector<int> program, std::size_t entry_address, std::size_t memory_words)
+            : code(std::move(program)), entry(entry_address), ram(memory_words) {
+            cpu_unit::core check;
+            check.init(code, ram);
+            check.set_register(14, static_cast<int>(entry));
+            check.set_trusted(true);
+        }
+
+        // Сегмент данных образа: words ячеек с адреса address, записывается в ОЗУ после программы
+        void set_data(std::size_t address, std::vector<int> words) {
+            if (address < code.size()) {throw std::runtime_error("Data segment overlaps code");}
+            if (address + words.size() > ram) {throw std::runtime_error("Data segment does not fit in memory");}
+            data_address = address;
+            data = std::move(words);
+        }
+
+        translate_stats write(std::ostream &out, const std::string &source_name) {
+            walk();
+            split_blocks();
+            translate_stats stats;
+            stats.blocks = blocks.size();
+            for (std::size_t adr = 0; adr < code.size(); adr++) {
+                if (not reached[adr]) {continue;}
+                stats.instructions++;
+                if (supported(adr)) {stats.native++;}
+            }
+
+            out << "// " << source_name << ", переведённая в C++ программой xvaot (см. source/aot.hpp)\n"
+                << "// Сборка: c++ -O2 -std=c++17 -I <каталог source> этот_файл -pthread\n"
+                << "// Запуск: программа [ram_size] [-limit N] [-timeout S] [-interpret]\n\n"
+                << "#include <climits>\n#include <cstdlib>\n#include <cstring>\n#include <iostream>\n#include \"core.hpp\"\n\n"
+                << "namespace {\n\n";
+            write_words(out, "const int code_words[]", code);
+            std::vector<int> map(code.size(), 0);
+            for (std::size_t adr = 0; adr < code.size(); adr++) {
+                if (reached[adr]) {
+                    for (std::size_t k = 0; k < 4; k++) {map[adr + k] = 1;}
+                }
+            }
+            write_words(out, "const unsigned char code_map[]", map);
+            write_words(out, "const int data_words[]", data);
+            out << "const std::size_t code_size = " << code.size() << ";\n"
+                << "const std::size_t data_address = " << data_address << ";\n"
+                << "const std::size_t data_size = " << data.size() << ";\n"
+                << "const int entry = " << entry << ";\n"
+                << "const std::size_t memory_words = " << ram << ";\n"
+                << "const std::uint64_t code_hash = " << cpu_unit::program_hash([this](std::size_t i) {return code[i];}, code.size())
+                << "ULL;\n\n"
+                << "inline int add_(int x, int y) {return static_cast<int>(static_cast<unsigned>(x) + static_cast<unsigned>(y));}\n"
+                << "inline int sub_(int x, int y) {return static_cast<int>(static_cast<unsigned>(x) - static_cast<unsigned>(y));}\n"
+                << "inline int mul_(int x, int y) {return static_cast<int>(static_cast<unsigned>(x) * static_cast<unsigned>(y));}\n\n";
+            write_function(out);
+            out << "}\n\n";
+            write_main(out);
+            return stats;
+        }
+
+    private:
+        std::vector<int> code;
+        std::size_t entry;
+        std::size_t ram;
+        std::size_t data_address = 0;
+        std::vector<int> data;
+
+        std::vector<char> reached;
+        std::vector<char> leader;
+        // Базовые блоки: адреса инструкций подряд через 4
+        std::vector<std::vector<std::size_t>> blocks;
+
+        static bool reg(int r) {
+            return r >= 0 and r < 16;
+        }
+
+        int op(std::size_t adr) const {return code[adr];}
+        int arg(std::size_t adr, int k) const {return code[adr + k];}
+
+        // Регистр-приёмник инструкции или -1
+        int destination(std::size_t adr) const {
+            switch (static_cast<OpCode>(op(adr))) {
+                case OpCode::LODI: case OpCode::LODR: case OpCode::MOV: case OpCode::ADD: case OpCode::ADDC:
+                case OpCode::LOC: case OpCode::SUB: case OpCode::MULT: case OpCode::DIV: case OpCode::MOD:
+                case OpCode::LCMP: case OpCode::OR: case OpCode::AND: case OpCode::NOT: case OpCode::PRTG:
+                case OpCode::PRCG: case OpCode::FADD: case OpCode::SPAWN: case OpCode::POP: case OpCode::STKR:
+                case OpCode::VSUM: case OpCode::VMIN: case OpCode::VMAX:
+                    return arg(adr, 1);
+                case OpCode::PRTR: case OpCode::CAS:
+                    return arg(adr, 2);
+                default:
+                    return -1;
+            }
+        }
+
+        // Все операнды-регистры инструкций, которые исполняет перевод, - номера 0-15
+        bool registers_ok(std::size_t adr) const {
+            auto r = [&](int k) {return reg(arg(adr, k));};
+            switch (static_cast<OpCode>(op(adr))) {
+                case OpCode::LODI: case OpCode::LOC: case OpCode::LCMP: case OpCode::PUSH: case OpCode::POP:
+                case OpCode::STKR:
+                    return r(1);
+                case OpCode::STRI:
+                    return r(2);
+                case OpCode::LODR: case OpCode::STRR: case OpCode::MOV: case OpCode::NOT: case OpCode::ADDC:
+                case OpCode::CMP:
+                    return r(1) and r(2);
+                case OpCode::ADD: case OpCode::SUB: case OpCode::MULT: case OpCode::DIV: case OpCode::MOD:
+                case OpCode::OR: case OpCode::AND:
+                    return r(1) and r(2) and r(3);
+                default:
+                    return true;
+            }
+        }
+
+        // Исполняет ли инструкцию перевод (иначе - ядро)
+        bool supported(std::size_t adr) const {
+            if (not registers_ok(adr)) {return false;}
+            switch (static_cast<OpCode>(op(adr))) {
+                case OpCode::LODI:
+                    return static_cast<std::size_t>(arg(adr, 2)) < ram;
+                case OpCode::STRI: {
+                    std::size_t a = static_cast<std::size_t>(arg(adr, 1));
+                    return a < ram and not (a < code.size() and code_cell(a));
+                }
+                case OpCode::LODR: case OpCode::STRR: case OpCode::MOV: case OpCode::ADD: case OpCode::ADDC:
+                case OpCode::LOC: case OpCode::SUB: case OpCode::MULT: case OpCode::DIV: case OpCode::MOD:
+                case OpCode::CMP: case OpCode::JMP: case OpCode::GOTO: case OpCode::LCMP: case OpCode::OR:
+                case OpCode::AND: case OpCode::NOT: case OpCode::PUSH: case OpCode::POP: case OpCode::CALL:
+                case OpCode::RET: case OpCode::STKR:
+                    return true;
+                default:
+                    return false;
+            }
+        }
+
+        bool code_cell(std::size_t a) const {
+            for (std::size_t k = 0; k < 4 and k <= a; k++) {
+                if (reached[a - k]) {return true;}
+            }
+            return false;
+        }
+
+        // Кончается ли на инструкции базовый блок
+        bool ends_block(std::size_t adr) const {
+            if (not supported(adr) or destination(adr) == 14) {return true;}
+            switch (static_cast<OpCode>(op(adr))) {
+                case OpCode::JMP: case OpCode::GOTO: case OpCode::CALL: case OpCode::RET:
+                    return true;
+                default:
+                    return false;
+            }
+        }
+
+        bool is_instruction(long long adr) const {
+            return adr >= 0 and static_cast<std::size_t>(adr) + 3 < code.size() and reached[adr];
+        }
+
+        // Обход достижимых инструкций, как у verify_program, и адресов обработчиков прерываний
+        void walk() {
+            reached.assign(code.size(), 0);
+            leader.assign(code.size(), 0);
+            std::vector<long long> work = {static_cast<long long>(entry)};
+            auto start = [&](long long adr) {
+                if (adr >= 0 and static_cast<std::size_t>(adr) + 3 < code.size()) {
+                    leader[adr] = 1;
+                    work.push_back(adr);
+                }
+            };
+            start(static_cast<long long>(entry));
+            std::vector<char> handler_register(16, 0);
+            handler_register[13] = 1;
+            bool more = true;
+            while (more) {
+                while (not work.empty()) {
+                    long long adr = work.back();
+                    work.pop_back();
+                    if (adr < 0 or static_cast<std::size_t>(adr) + 3 >= code.size() or reached[adr]) {continue;}
+                    reached[adr] = 1;
+                    int a = arg(adr, 1);
+                    switch (static_cast<OpCode>(op(adr))) {
+                        case OpCode::HALT: case OpCode::RET: case OpCode::IRET: continue;
+                        case OpCode::JMP: start(arg(adr, 2)); start(adr + 4); continue;
+                        case OpCode::GOTO: start(a); continue;
+                        case OpCode::CALL: start(a); start(adr + 4); continue;
+                        case OpCode::SETI: if (reg(arg(adr, 2))) {handler_register[arg(adr, 2)] = 1;} break;
+                        case OpCode::LOC: if (a == 14) {start(static_cast<long long>(arg(adr, 2)) + 4); continue;} break;
+                        default: break;
+                    }
+                    if (destination(adr) == 14) {continue;}
+                    if (not supported(adr)) {start(adr + 4);}
+                    work.push_back(adr + 4);
+                }
+                // Адреса обработчиков: loc в регистр, который потом становится r13 или обработчиком seti
+                more = false;
+                for (std::size_t adr = 0; adr + 3 < code.size(); adr++) {
+                    if (reached[adr] and op(adr) == static_cast<int>(OpCode::LOC) and reg(arg(adr, 1))
+                        and handler_register[arg(adr, 1)] and is_candidate(arg(adr, 2))) {
+                        start(arg(adr, 2));
+                        more = true;
+                    }
+                }
+            }
+        }
+
+        bool is_candidate(long long adr) const {
+            return adr >= 0 and static_cast<std::size_t>(adr) + 3 < code.size() and not reached[adr];
+        }
+
+        void split_blocks() {
+            blocks.clear();
+            std::vector<char> placed(code.size(), 0);
+            for (std::size_t adr = 0; adr < code.size(); adr++) {
+                if (not reached[adr] or placed[adr]) {continue;}
+                blocks.emplace_back();
+                std::size_t at = adr;
+                while (true) {
+                    blocks.back().push_back(at);
+                    placed[at] = 1;
+                    if (ends_block(at) or not is_instruction(at + 4) or leader[at + 4] or placed[at + 4]) {break;}
+                    at += 4;
+                }
+                leader[adr] = 1;
+            }
+        }
+
+        static std::string number(long long v) {
+            if (v == INT_MIN) {return "(-2147483647 - 1)";}
+            return std::to_string(v);
+        }
+
+        template <typename T>
+        static void write_words(std::ostream &out, const char *declaration, const std::vector<T> &words) {
+            out << declaration << " = {";
+            for (std::size_t i = 0; i < words.size(); i++) {
+                out << (i % 16 == 0 ? "\n    " : " ") << number(words[i]) << ",";
+            }
+            // Пустой массив недопустим
+            if (words.empty()) {out << "0";}
+            out << "\n};\n";
+        }
+
+        // Чтение регистра: r14 - адрес самой инструкции
+        static std::string R(std::size_t adr, int r) {
+            return r == 14 ? std::to_string(adr) : "r[" + std::to_string(r) + "]";
+        }
+
+        // Запись регистра: r14 - во временную переменную, после инструкции переход на nx + 4
+        static std::string D(int r) {
+            return r == 14 ? std::string("nx") : "r[" + std::to_string(r) + "]";
+        }
+
+        // Переход на адрес target после исполнения инструкции
+        std::string go(long long target) const {
+            if (is_instruction(target) and leader[target]) {return "goto b" + std::to_string(target) + ";";}
+            if (is_instruction(target)) {return "{pc = " + std::to_string(target) + "; goto dispatch;}";}
+            return "{pc = " + number(static_cast<int>(target)) + "; goto out;}";
+        }
+
+        void write_instruction(std::ostream &out, std::size_t adr, std::size_t rest) const {
+            const std::string exit = "{cd += " + std::to_string(rest) + "; pc = " + std::to_string(adr) + "; goto out;}";
+            if (not supported(adr)) {
+                out << "    " << exit << "\n";
+                return;
+            }
+            int a = arg(adr, 1), b = arg(adr, 2), c = arg(adr, 3);
+            const std::string stack_write = "if (t < SL or t >= SH or (t < CS and code_map[t])) " + exit;
+            const std::string stack_read = "if (t < SL or t >= SH) " + exit;
+            out << "    ";
+            switch (static_cast<OpCode>(op(adr))) {
+                case OpCode::LODI: out << D(a) << " = M[" << b << "];"; break;
+                case OpCode::LODR:
+                    out << "{std::size_t t = static_cast<std::size_t>(" << R(adr, b) << "); if (t >= MS) " << exit
+                        << " " << D(a) << " = M[t];}";
+                    break;
+                case OpCode::STRI: out << "M[" << a << "] = " << R(adr, b) << ";"; break;
+                case OpCode::STRR:
+                    out << "{std::size_t t = static_cast<std::size_t>(" << R(adr, a) << "); if (t >= MS or (t < CS and code_map[t])) "
+                        << exit << " M[t] = " << R(adr, b) << ";}";
+                    break;
+                case OpCode::MOV: out << D(a) << " = " << R(adr, b) << ";"; break;
+                case OpCode::ADD: out << D(a) << " = add_(" << R(adr, b) << ", " << R(adr, c) << ");"; break;
+                case OpCode::ADDC: out << D(a) << " = add_(" << R(adr, b) << ", " << number(c) << ");"; break;
+                case OpCode::LOC: out << D(a) << " = " << number(b) << ";"; break;
+                case OpCode::SUB: out << D(a) << " = sub_(" << R(adr, b) << ", " << R(adr, c) << ");"; break;
+                case OpCode::MULT: out << D(a) << " = mul_(" << R(adr, b) << ", " << R(adr, c) << ");"; break;
+                case OpCode::DIV: case OpCode::MOD:
+                    // Деление на ноль и INT_MIN / -1 исполняет ядро, как интерпретатор
+                    out << "if (" << R(adr, c) << " == 0 or (" << R(adr, b) << " == INT_MIN and " << R(adr, c) << " == -1)) " << exit
+                        << " " << D(a) << " = " << R(adr, b) << (op(adr) == static_cast<int>(OpCode::DIV) ? " / " : " % ") << R(adr, c) << ";";
+                    break;
+                case OpCode::CMP:
+                    out << "flag = (" << R(adr, a) << " > " << R(adr, b) << ") - (" << R(adr, a) << " < " << R(adr, b) << ");";
+                    break;
+                case OpCode::JMP: {
+                    const char *condition = nullptr;
+                    switch (a) {
+                        case 0: condition = "flag == 0"; break;
+                        case 1: condition = "flag == 1"; break;
+                        case -1: condition = "flag == -1"; break;
+                        case 2: condition = "flag == 0 or flag == 1"; break;
+                        case -2: condition = "flag == 0 or flag == -1"; break;
+                        case 3: condition = "flag != 0"; break;
+                        default: break;
+                    }
+                    if (condition != nullptr) {out << "if (" << condition << ") " << go(b) << "\n    ";}
+                    out << go(static_cast<long long>(adr) + 4);
+                    break;
+                }
+                case OpCode::GOTO: out << go(a); break;
+                case OpCode::LCMP: out << D(a) << " = flag;"; break;
+                case OpCode::OR: out << D(a) << " = " << R(adr, b) << " or " << R(adr, c) << ";"; break;
+                case OpCode::AND: out << D(a) << " = " << R(adr, b) << " and " << R(adr, c) << ";"; break;
+                case OpCode::NOT: out << D(a) << " = not " << R(adr, b) << ";"; break;
+                case OpCode::PUSH:
+                    out << "{long long t = static_cast<long long>(r[15]) - 1; " << stack_write << " M[t] = " << R(adr, a)
+                        << "; r[15] = static_cast<int>(t);}";
+                    break;
+                case OpCode::POP:
+                    out << "{long long t = r[15]; " << stack_read << " int v = M[t]; r[15] = static_cast<int>(t + 1); " << D(a) << " = v;}";
+                    break;
+                case OpCode::CALL:
+                    out << "{long long t = static_cast<long long>(r[15]) - 1; " << stack_write << " M[t] = " << adr + 4
+                        << "; r[15] = static_cast<int>(t);}\n    " << go(a);
+                    break;
+                case OpCode::RET:
+                    out << "{long long t = r[15]; " << stack_read << " pc = M[t]; r[15] = static_cast<int>(t + 1);}\n    goto dispatch;";
+                    break;
+                case OpCode::STKR:
+                    out << "{long long t = static_cast<long long>(r[15]) + " << b << "; " << stack_read << " " << D(a) << " = M[t];}";
+                    break;
+                default:
+                    break;
+            }
+            out << "\n";
+            if (destination(adr) == 14) {out << "    pc = add_(nx, 4);\n    goto dispatch;\n";}
+        }
+
+        void write_function(std::ostream &out) const {
+            out << "int run(cpu_unit::native_frame &f) {\n"
+                << "    int *const M = f.memory;\n"
+                << "    [[maybe_unused]] const std::size_t MS = f.memory_size;\n"
+                << "    [[maybe_unused]] const long long SL = static_cast<long long>(f.stack_low);\n"
+                << "    [[maybe_unused]] const long long SH = static_cast<long long>(f.stack_high);\n"
+                << "    [[maybe_unused]] const long long CS = static_cast<long long>(code_size);\n"
+                << "    [[maybe_unused]] int nx = 0;\n"
+                << "    long long cd = *f.countdown;\n"
+                << "    int flag = *f.cmp_flag;\n"
+                << "    int r[16];\n"
+                << "    std::memcpy(r, f.registers, sizeof(r));\n"
+                << "    int pc = f.registers[14];\n"
+                << "dispatch:\n"
+                << "    switch (pc) {\n";
+            for (auto &block : blocks) {
+                out << "        case " << block[0] << ": goto b" << block[0] << ";\n";
+                for (std::size_t i = 1; i < block.size(); i++) {
+                    std::size_t rest = block.size() - i;
+                    out << "        case " << block[i] << ": if ((cd -= " << rest << ") < 0) {cd += " << rest << "; goto out;} goto i"
+                        << block[i] << ";\n";
+                }
+            }
+            out << "        default: goto out;\n"
+                << "    }\n";
+            for (auto &block : blocks) {
+                out << "b" << block[0] << ":\n"
+                    << "    if ((cd -= " << block.size() << ") < 0) {cd += " << block.size() << "; pc = " << block[0] << "; goto out;}\n";
+                for (std::size_t i = 0; i < block.size(); i++) {
+                    if (i > 0) {out << "i" << block[i] << ":\n";}
+                    write_instruction(out, block[i], block.size() - i);
+                }
+                std::size_t last = block.back();
+                if (not ends_block(last)) {out << "    " << go(static_cast<long long>(last) + 4) << "\n";}
+            }
+            out << "out:\n"
+                << "    std::memcpy(f.registers, r, sizeof(r));\n"
+                << "    *f.cmp_flag = flag;\n"
+                << "    *f.countdown = cd;\n"
+                << "    return pc;\n"
+                << "}\n";
+        }
+
+        void write_main(std::ostream &out) const {
+            out << "int main(int argc, char **argv) {\n"
+                << "    std::size_t size = memory_words;\n"
+                << "    cpu_unit::run_limits limits;\n"
+                << "    bool interpret = false;\n"
+                << "    for (int i = 1; i < argc; i++) {\n"
+                << "        if (std::strcmp(argv[i], \"-limit\") == 0 and i + 1 < argc) {\n"
+                << "            limits.instructions = std::strtoll(argv[++i], nullptr, 10);\n"
+                << "        } else if (std::strcmp(argv[i], \"-timeout\") == 0 and i + 1 < argc) {\n"
+                << "            limits.seconds = std::strtod(argv[++i], nullptr);\n"
+                << "        } else if (std::strcmp(argv[i], \"-interpret\") == 0) {\n"
+                << "            interpret = true;\n"
+                << "        } else if (argv[i][0] != '-') {\n"
+                << "            size = std::strtoul(argv[i], nullptr, 10);\n"
+                << "        } else {\n"
+                << "            std::cerr << \"Unknown flag: \" << argv[i] << \"\\n\";\n"
+                << "            return 1;\n"
+                << "        }\n"
+                << "    }\n\n"
+                << "    cpu_unit::core cpu;\n"
+                << "    cpu.set_engine(cpu_unit::Engine::PREDECODED);\n"
+                << "    cpu.set_memory_mode(cpu_unit::MemoryMode::FLAT);\n"
+                << "    if (not interpret) {\n"
+                << "        cpu_unit::native_program native;\n"
+                << "        native.run = run;\n"
+                << "        native.code_size = code_size;\n"
+                << "        native.code_hash = code_hash;\n"
+                << "        native.memory_words = memory_words;\n"
+                << "        native.code_map = code_map;\n"
+                << "        cpu.set_native(native);\n"
+                << "    }\n"
+                << "    cpu_unit::run_result result;\n"
+                << "    try {\n"
+                << "        cpu.init(std::vector<int>(code_words, code_words + code_size), size);\n"
+                << "        if (data_address + data_size > size) {throw std::runtime_error(\"Init error...\");}\n"
+                << "        for (std::size_t i = 0; i < data_size; i++) {cpu.shared_memory()->set_to_memory(data_address + i, data_words[i]);}\n"
+                << "        cpu.set_register(14, entry);\n"
+                << "        result = cpu.start_process(false, limits);\n"
+                << "    } catch (std::runtime_error &e) {\n"
+                << "        std::cerr << e.what();\n"
+                << "        return 3;\n"
+                << "    }\n"
+                << "    if (result.reason == cpu_unit::ExitReason::BUDGET or result.reason == cpu_unit::ExitReason::DEADLINE) {\n"
+                << "        std::cerr << \"Stopped: \" << cpu_unit::exit_reason_name(result.reason) << \" after \"\n"
+                << "                  << result.instructions << \" instructions at address \" << result.registers[14] << \"\\n\";\n"
+                << "        return 4;\n"
+                << "    }\n"
+                << "    return 0;\n"
+                << "}\n";
+        }
+    };
+}
@@ -0,0 +1,61 @@
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include "aot.hpp"
+
+// Перевод программы в C++ до запуска (см. source/aot.hpp)
+// Запуск: xvaot program ram_size output.cpp [-stats]
+//   program - текстовая программа или бинарный образ xvimage (сегмент данных и точка входа переносятся)
+//   ram_size - размер ОЗУ, для которого проверяется программа (у собранной программы - размер по умолчанию и наименьший)
+//   -stats - напечатать в stderr, сколько инструкций исполняет перевод
+// Сборка результата: c++ -O2 -std=c++17 -I source output.cpp -o program -pthread
+
+int main(int argc, char **argv) {
+  if (argc < 4) {
+    std::cerr << "Invalid arguments\n";
+    std::cout << "Usage: " << argv[0] << " program ram_size output.cpp [-stats]\n";
+    return 1;
+  }
+  bool stats = false;
+  for (int i = 4; i < argc; i++) {
+    if (std::strcmp(argv[i], "-stats") == 0) {
+      stats = true;
+    } else {
+      std::cerr << "Unknown flag: " << argv[i] << "\n";
+      return 1;
+    }
+  }
+
+  try {
+    std::size_t size = std::stoul(argv[2]);
+    std::unique_ptr<aot_unit::translator> translator;
+    if (loader_unit::is_image(argv[1])) {
+      loader_unit::program_image image(argv[1]);
+      const loader_unit::image_header &h = image.header();
+      std::vector<int> code(h.code_words);
+      for (std::size_t i = 0; i < code.size(); i++) {code[i] = image.code_word(i);}
+      translator = std::make_unique<aot_unit::translator>(std::move(code), h.entry, size);
+      if (h.data_offset != 0) {
+        std::vector<int> data(h.data_words);
+        for (std::size_t i = 0; i < data.size(); i++) {data[i] = image.data_word(i);}
+        translator->set_data(h.data_address, std::move(data));
+      }
+    } else {
+      std::vector<int> code;
+      loader_unit::load_text_program(argv[1], code);
+      translator = std::make_unique<aot_unit::translator>(std::move(code), 0, size);
+    }
+    std::ofstream out(argv[3], std::ios::trunc);
+    aot_unit::translate_stats s = translator->write(out, argv[1]);
+    if (not out) {throw std::runtime_error(std::string("Cannot write ") + argv[3]);}
+    if (stats) {
+      std::cerr << "instructions: " << s.instructions << ", translated: " << s.native << ", blocks: " << s.blocks << "\n";
+    }
+  } catch (std::exception &e) {
+    std::cerr << e.what() << "\n";
+    return 2;
+  }
+  return 0;
+}
@@ -0,0 +1,65 @@
+#include <cstring>
+#include <iostream>
+#include <string>
+#include "assembler.hpp"
+
+// Ассемблер: перевод мнемоник в текстовую программу или бинарный образ (синтаксис в source/assembler.hpp)
+// Запуск: xvasm input.s output [-image] [-O] [-stats] [-word 16|32|64]
+//   -image - записать бинарный образ с таблицей меток вместо текстового формата
+//   -O     - оптимизировать программу перед раскладкой адресов
+//   -stats - напечатать в stderr, что сделала оптимизация
+//   -word  - ширина слова ядра (как -word у xvprocexe, по умолчанию 32): диапазон чисел и свёртка констант
+
+int main(int argc, char **argv) {
+  if (argc < 3) {
+    std::cerr << "Invalid arguments\n";
+    std::cout << "Usage: " << argv[0] << " input.s output [-image] [-O] [-stats] [-word 16|32|64]\n";
+    return 1;
+  }
+  bool image = false, optimize = false, stats = false;
+  int word_width = 32;
+  for (int i = 3; i < argc; i++) {
+    if (std::strcmp(argv[i], "-image") == 0) {
+      image = true;
+    } else if (std::strcmp(argv[i], "-O") == 0) {
+      optimize = true;
+    } else if (std::strcmp(argv[i], "-stats") == 0) {
+      stats = true;
+    } else if (std::strcmp(argv[i], "-word") == 0 and i + 1 < argc) {
+      word_width = std::atoi(argv[++i]);
+      if (word_width != 16 and word_width != 32 and word_width != 64) {
+        std::cerr << "Bad word width\n";
+        return 1;
+      }
+    } else {
+      std::cerr << "Unknown flag: " << argv[i] << "\n";
+      return 1;
+    }
+  }
+
+  try {
+    assembler_unit::program program;
+    program.word_bits = word_width;
+    program.parse(argv[1]);
+    std::size_t before = program.instruction_count();
+    if (optimize) {
+      assembler_unit::optimize_stats s = assembler_unit::optimizer(program).run();
+      if (not s.skipped.empty()) {
+        std::cerr << "Not optimized: " << s.skipped << "\n";
+      } else if (stats) {
+        std::cerr << "instructions: " << before << " -> " << program.instruction_count() << "\n"
+                  << "folded: " << s.folded << ", dead: " << s.dead << ", threaded: " << s.threaded
+                  << ", unreachable: " << s.unreachable << ", hoisted: " << s.hoisted << "\n";
+      }
+    }
+    if (image) {
+      program.write_image(argv[2]);
+    } else {
+      program.write_text(argv[2]);
+    }
+  } catch (std::runtime_error &e) {
+    std::cerr << e.what() << "\n";
+    return 2;
+  }
+  return 0;
+}
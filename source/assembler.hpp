@@ -0,0 +1,1271 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <istream>
+#include <limits>
+#include <map>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "core.hpp"
+#include "loader.hpp"
+
+/*
+ Ассемблер xvproc
+
+ Строка программы: [метка:]... [инструкция | директива] [; комментарий] (комментарий можно начать и с #)
+ Инструкции - мнемоники из описания в начале core.hpp с операндами через пробелы или запятые:
+   регистры r0..r15, числа (десятичные, 0x.., символы 'a'), метки и константы со смещением (table+4)
+   условие jmp пишется знаком: = > < >= <= != (или числом, как в машинном коде)
+ Директивы:
+   .const NAME value   - константа (объявляется до использования)
+   .word v1 v2 ...     - ячейки данных (числа, метки, константы)
+   .zero n             - n нулевых ячеек
+   .ascii "text"       - по ячейке на символ, .asciz - то же с нулём в конце
+   .entry label        - точка входа (текстовый формат всегда начинается с адреса 0, поэтому только для образа)
+ Инструкции и данные идут в ОЗУ подряд в порядке записи, с адреса 0
+ Числа и адреса - слова ядра шириной program::word_bits (16, 32 или 64 бита, по умолчанию 32): допустимо
+   слово со знаком или его запись без знака (0xffffffff - то же, что -1), образ хранит только 32-битные ячейки
+
+ Оптимизация (optimizer) переписывает программу на уровне инструкций, до раскладки адресов:
+   свёртка и распространение констант: вычислимые значения превращаются в loc, add/sub с известным
+     слагаемым - в addc, переходы по известному флагу - в goto или удаляются; арифметика идёт по модулю
+     слова той же ширины, что у ядра (word_bits), поэтому программу для -word 64 нужно собирать с -word 64
+   удаление мёртвых записей: регистров, которые дальше не читаются, и stri, перезаписанных до чтения
+   прыжки через прыжки: переход на goto (или на jmp с тем же исходом) сразу идёт в конечную точку,
+     переход на следующую инструкцию и недостижимый код удаляются
+   вынос инвариантов цикла: чистые вычисления, не зависящие от цикла, переносятся перед ним
+ Оптимизатор считает, что программа не меняет свой код, не вычисляет адреса инструкций (кроме меток
+ целиком) и не читает r14, а прерывания и call сохраняют регистры, которые не описаны как результат
+ (call и системные вызовы считаются изменяющими все регистры). Программа, где это видно из текста
+ (запись или чтение r14, переход по числу, смещение от метки кода), не оптимизируется
+*/
+
+namespace assembler_unit {
+
+    using cpu_unit::OpCode;
+
+    // Операнды: r - регистр, i - число, c - условие jmp, l - адрес перехода
+    struct instruction_info {
+        const char *name;
+        OpCode op;
+        const char *operands;
+    };
+
+    inline const std::vector<instruction_info> &instruction_table() {
+        static const std::vector<instruction_info> table = {
+            {"halt", OpCode::HALT, ""}, {"lodi", OpCode::LODI, "ri"}, {"lodr", OpCode::LODR, "rr"},
+            {"stri", OpCode::STRI, "ir"}, {"strr", OpCode::STRR, "rr"}, {"mov", OpCode::MOV, "rr"},
+            {"amin", OpCode::AMIN, "rr"}, {"setl", OpCode::SETL, ""}, {"setf", OpCode::SETF, ""},
+            {"add", OpCode::ADD, "rrr"}, {"addc", OpCode::ADDC, "rri"}, {"loc", OpCode::LOC, "ri"},
+            {"sub", OpCode::SUB, "rrr"}, {"mult", OpCode::MULT, "rrr"}, {"div", OpCode::DIV, "rrr"},
+            {"mod", OpCode::MOD, "rrr"}, {"cmp", OpCode::CMP, "rr"}, {"jmp", OpCode::JMP, "cl"},
+            {"goto", OpCode::GOTO, "l"}, {"lcmp", OpCode::LCMP, "r"}, {"or", OpCode::OR, "rrr"},
+            {"and", OpCode::AND, "rrr"}, {"not", OpCode::NOT, "rr"}, {"prts", OpCode::PRTS, "ri"},
+            {"prcs", OpCode::PRCS, "ii"}, {"prtg", OpCode::PRTG, "ri"}, {"prcg", OpCode::PRCG, "ri"},
+            {"prtw", OpCode::PRTW, "rri"}, {"prtr", OpCode::PRTR, "rri"}, {"push", OpCode::PUSH, "r"},
+            {"pop", OpCode::POP, "r"}, {"call", OpCode::CALL, "l"}, {"ret", OpCode::RET, ""},
+            {"stkr", OpCode::STKR, "ri"}, {"cas", OpCode::CAS, "rrr"}, {"fadd", OpCode::FADD, "rrr"},
+            {"fence", OpCode::FENCE, ""}, {"spawn", OpCode::SPAWN, "rrr"}, {"join", OpCode::JOIN, "r"},
+            {"intr", OpCode::INTR, "i"}, {"scall", OpCode::SCALL, ""}, {"iret", OpCode::IRET, ""},
+            {"seti", OpCode::SETI, "ir"}, {"timer", OpCode::TIMER, "r"}, {"serr", OpCode::SERR, "i"},
+            {"cerr", OpCode::CERR, ""}, {"vadd", OpCode::VADD, "rrr"}, {"vsub", OpCode::VSUB, "rrr"},
+            {"vmul", OpCode::VMUL, "rrr"}, {"vand", OpCode::VAND, "rrr"}, {"vor", OpCode::VOR, "rrr"},
+            {"vsum", OpCode::VSUM, "rrr"}, {"vmin", OpCode::VMIN, "rrr"}, {"vmax", OpCode::VMAX, "rrr"},
+            {"vfill", OpCode::VFILL, "rrr"}, {"vcopy", OpCode::VCOPY, "rrr"},
+        };
+        return table;
+    }
+
+    inline const instruction_info *find_instruction(const std::string &name) {
+        for (auto &i : instruction_table()) {
+            if (name == i.name) {return &i;}
+        }
+        return nullptr;
+    }
+
+    inline const instruction_info &instruction_of(OpCode op) {
+        for (auto &i : instruction_table()) {
+            if (i.op == op) {return i;}
+        }
+        throw std::runtime_error("Unknown opcode");
+    }
+
+    // Значение операнда: метка (пусто - без метки) плюс смещение, у регистра и условия - только смещение
+    struct value {
+        std::string symbol;
+        long long offset = 0;
+
+        bool operator==(const value &other) const {
+            return symbol == other.symbol and offset == other.offset;
+        }
+
+        bool operator!=(const value &other) const {
+            return not (*this == other);
+        }
+
+        // Число без метки, известное до раскладки
+        bool is_number() const {
+            return symbol.empty();
+        }
+    };
+
+    inline value number(long long n) {
+        return {std::string(), n};
+    }
+
+    enum class StatementKind {LABEL, INSTRUCTION, DATA};
+
+    // Элемент программы: метка, инструкция или ячейки данных
+    struct statement {
+        StatementKind kind = StatementKind::INSTRUCTION;
+        int line = 0;
+        std::string label;
+        OpCode op = OpCode::HALT;
+        value args[3];
+        std::vector<value> words;
+    };
+
+    class program {
+    public:
+        std::vector<statement> statements;
+        // Метка точки входа, пусто - адрес 0
+        std::string entry;
+        // Ширина слова ядра, для которого собирается программа: 16, 32 или 64 бита (см. word.hpp)
+        // Задаётся до parse: от неё зависят допустимые числа и свёртка констант оптимизатором
+        int word_bits = 32;
+
+        // Разбор исходного текста, ошибка бросает исключение с именем файла и номером строки
+        void parse(const std::string &filename) {
+            std::ifstream f(filename);
+            if (not f) {throw std::runtime_error("Cannot open " + filename);}
+            parse(f, filename);
+        }
+
+        void parse(std::istream &in, const std::string &name) {
+            source = name;
+            line = 0;
+            std::string text;
+            while (std::getline(in, text)) {
+                line++;
+                parse_line(text);
+            }
+            // Все метки должны быть объявлены: проверка раскладкой
+            line = 0;
+            resolve_all();
+        }
+
+        // Число как слово программы: младшие word_bits бит со знаком
+        long long wrap(long long n) const {
+            auto bits = static_cast<unsigned long long>(n);
+            if (word_bits == 16) {return cpu_unit::wrap_word<std::int16_t>(bits);}
+            if (word_bits == 32) {return cpu_unit::wrap_word<int>(bits);}
+            return cpu_unit::wrap_word<long long>(bits);
+        }
+
+        // Наименьшее слово (его деление на -1 и смена знака переполняются)
+        long long word_min() const {
+            return word_bits < 64 ? -(1LL << (word_bits - 1)) : std::numeric_limits<long long>::min();
+        }
+
+        // Число помещается в слово со знаком или без знака (0xffff для 16 бит - то же, что -1)
+        bool in_range(long long n) const {
+            return word_bits >= 64 or (n >= word_min() and n <= (1LL << word_bits) - 1);
+        }
+
+        std::size_t instruction_count() const {
+            return std::count_if(statements.begin(), statements.end(),
+                                 [](const statement &s) {return s.kind == StatementKind::INSTRUCTION;});
+        }
+
+        // Адреса меток
+        std::map<std::string, long long> layout() const {
+            std::map<std::string, long long> labels;
+            long long address = 0;
+            for (auto &s : statements) {
+                if (s.kind == StatementKind::LABEL) {labels[s.label] = address;}
+                if (s.kind == StatementKind::INSTRUCTION) {address += 4;}
+                if (s.kind == StatementKind::DATA) {address += static_cast<long long>(s.words.size());}
+            }
+            return labels;
+        }
+
+        // Машинный код с адреса 0, symbols - таблица меток для образа (внутренние метки оптимизатора не попадают)
+        std::vector<long long> assemble(std::uint64_t &entry_address, std::vector<loader_unit::image_symbol> *symbols = nullptr) const {
+            std::map<std::string, long long> labels = layout();
+            std::vector<long long> code;
+            for (auto &s : statements) {
+                line = s.line;
+                if (s.kind == StatementKind::INSTRUCTION) {
+                    code.push_back(static_cast<long long>(s.op));
+                    for (int i = 0; i < 3; i++) {code.push_back(resolve(s.args[i], labels));}
+                } else if (s.kind == StatementKind::DATA) {
+                    for (auto &w : s.words) {code.push_back(resolve(w, labels));}
+                }
+            }
+            line = 0;
+            entry_address = 0;
+            if (not entry.empty()) {entry_address = static_cast<std::uint64_t>(resolve({entry, 0}, labels));}
+            if (symbols != nullptr) {
+                for (auto &l : labels) {
+                    if (l.first[0] != '.') {symbols->push_back({l.first, static_cast<std::uint64_t>(l.second)});}
+                }
+            }
+            return code;
+        }
+
+        // Текстовый формат load_text_program: инструкция на строку, данные по 16 ячеек на строку
+        void write_text(const std::string &filename) const {
+            std::uint64_t entry_address;
+            std::vector<long long> code = assemble(entry_address);
+            if (entry_address != 0) {throw std::runtime_error("Text programs start at address 0, entry needs an image");}
+            std::ofstream f(filename, std::ios::trunc);
+            std::size_t at = 0;
+            for (auto &s : statements) {
+                std::size_t words = s.kind == StatementKind::INSTRUCTION ? 4 : s.kind == StatementKind::DATA ? s.words.size() : 0;
+                for (std::size_t i = 0; i < words; i++) {
+                    f << code[at + i] << ((i + 1) % 16 == 0 or i + 1 == words ? "\n" : " ");
+                }
+                at += words;
+            }
+            if (not f) {throw std::runtime_error("Cannot write " + filename);}
+        }
+
+        // Ячейки образа 32-битные, поэтому программа для 64-битного слова должна в них помещаться
+        void write_image(const std::string &filename) const {
+            std::uint64_t entry_address;
+            std::vector<loader_unit::image_symbol> symbols;
+            std::vector<long long> words = assemble(entry_address, &symbols);
+            std::vector<int> code;
+            code.reserve(words.size());
+            for (long long w : words) {
+                if (not cpu_unit::fits_word<int>(w)) {fail("Value does not fit a 32-bit image cell: " + std::to_string(w));}
+                code.push_back(static_cast<int>(w));
+            }
+            loader_unit::write_image(filename, code, entry_address, {}, 0, symbols);
+        }
+
+    private:
+        std::map<std::string, long long> constants;
+        std::string source;
+        mutable int line = 0;
+
+        [[noreturn]] void fail(const std::string &what) const {
+            throw std::runtime_error(line > 0 ? source + ":" + std::to_string(line) + ": " + what : source + ": " + what);
+        }
+
+        static bool is_identifier(const std::string &name) {
+            if (name.empty() or not (std::isalpha(static_cast<unsigned char>(name[0])) or name[0] == '_')) {return false;}
+            return std::all_of(name.begin(), name.end(), [](char c) {
+                return std::isalnum(static_cast<unsigned char>(c)) or c == '_' or c == '.';
+            });
+        }
+
+        // Разбиение на слова по пробелам и запятым, кавычки ('a', "text") не разбиваются, комментарий отбрасывается
+        std::vector<std::string> split(const std::string &text) const {
+            std::vector<std::string> words;
+            std::string word;
+            char quote = 0;
+            for (std::size_t i = 0; i < text.size(); i++) {
+                char c = text[i];
+                if (quote != 0) {
+                    word += c;
+                    if (c == '\\' and i + 1 < text.size()) {
+                        word += text[++i];
+                    } else if (c == quote) {
+                        quote = 0;
+                    }
+                    continue;
+                }
+                if (c == ';' or c == '#') {break;}
+                if (c == '\'' or c == '"') {quote = c;}
+                if (std::isspace(static_cast<unsigned char>(c)) or c == ',') {
+                    if (not word.empty()) {words.push_back(word);}
+                    word.clear();
+                    continue;
+                }
+                word += c;
+            }
+            if (quote != 0) {fail("Unterminated quote");}
+            if (not word.empty()) {words.push_back(word);}
+            return words;
+        }
+
+        // Символ строки или символьной константы после обратной косой черты
+        static char escape(char c) {
+            switch (c) {
+                case 'n': return '\n';
+                case 't': return '\t';
+                case 'r': return '\r';
+                case '0': return '\0';
+                default: return c;
+            }
+        }
+
+        std::string parse_string(const std::string &word) const {
+            if (word.size() < 2 or word.front() != '"' or word.back() != '"') {fail("Expected string in quotes");}
+            std::string text;
+            for (std::size_t i = 1; i + 1 < word.size(); i++) {
+                text += word[i] == '\\' ? escape(word[++i]) : word[i];
+            }
+            return text;
+        }
+
+        // Выражение: слагаемые через + и -, из них не больше одной метки (со знаком +)
+        value parse_value(const std::string &word) const {
+            value v;
+            std::size_t i = 0;
+            bool first = true;
+            while (i < word.size() or first) {
+                int sign = 1;
+                if (i < word.size() and (word[i] == '+' or word[i] == '-')) {
+                    sign = word[i] == '-' ? -1 : 1;
+                    i++;
+                } else if (not first) {
+                    fail("Bad expression: " + word);
+                }
+                first = false;
+                if (i >= word.size()) {fail("Bad expression: " + word);}
+                long long term;
+                if (word[i] == '\'') {
+                    if (i + 2 >= word.size()) {fail("Bad character: " + word);}
+                    char c = word[i + 1];
+                    i += 2;
+                    if (c == '\\') {c = escape(word[i++]);}
+                    if (i >= word.size() or word[i] != '\'') {fail("Bad character: " + word);}
+                    i++;
+                    term = static_cast<unsigned char>(c);
+                } else if (std::isdigit(static_cast<unsigned char>(word[i]))) {
+                    std::size_t used = 0;
+                    try {
+                        term = std::stoll(word.substr(i), &used, 0);
+                    } catch (std::exception &) {
+                        fail("Bad number: " + word);
+                    }
+                    i += used;
+                } else {
+                    std::size_t end = i;
+                    while (end < word.size() and word[end] != '+' and word[end] != '-') {end++;}
+                    std::string name = word.substr(i, end - i);
+                    i = end;
+                    if (not is_identifier(name)) {fail("Bad expression: " + word);}
+                    auto c = constants.find(name);
+                    if (c != constants.end()) {
+                        term = c->second;
+                    } else {
+                        if (sign < 0 or not v.symbol.empty()) {fail("Only one label can be added in an expression: " + word);}
+                        v.symbol = name;
+                        continue;
+                    }
+                }
+                // Для 64-битного слова сумма переносится по модулю 2^64, как и в ядре
+                v.offset = static_cast<long long>(static_cast<unsigned long long>(v.offset) + static_cast<unsigned long long>(sign * term));
+                if (not in_range(v.offset)) {
+                    fail("Number out of range: " + word);
+                }
+            }
+            return v;
+        }
+
+        long long parse_number(const std::string &word) const {
+            value v = parse_value(word);
+            if (not v.is_number()) {fail("Expected a number: " + word);}
+            return v.offset;
+        }
+
+        int parse_register(const std::string &word) const {
+            if (word.size() >= 2 and word[0] == 'r' and std::all_of(word.begin() + 1, word.end(), [](char c) {return c >= '0' and c <= '9';})) {
+                int r = std::stoi(word.substr(1));
+                if (r < 16) {return r;}
+            }
+            fail("Expected register r0..r15: " + word);
+        }
+
+        long long parse_condition(const std::string &word) const {
+            static const std::map<std::string, int> conditions = {
+                {"=", 0}, {"==", 0}, {">", 1}, {"<", -1}, {">=", 2}, {"<=", -2}, {"!=", 3}};
+            auto c = conditions.find(word);
+            return c != conditions.end() ? c->second : parse_number(word);
+        }
+
+        void add_label(const std::string &name) {
+            if (not is_identifier(name)) {fail("Bad label: " + name);}
+            if (constants.count(name) != 0) {fail("Label redefines a constant: " + name);}
+            for (auto &s : statements) {
+                if (s.kind == StatementKind::LABEL and s.label == name) {fail("Duplicate label: " + name);}
+            }
+            statement s;
+            s.kind = StatementKind::LABEL;
+            s.line = line;
+            s.label = name;
+            statements.push_back(s);
+        }
+
+        void parse_line(const std::string &text) {
+            std::vector<std::string> words = split(text);
+            std::size_t i = 0;
+            while (i < words.size() and words[i].size() > 1 and words[i].back() == ':') {
+                add_label(words[i].substr(0, words[i].size() - 1));
+                i++;
+            }
+            if (i == words.size()) {return;}
+            const std::string &head = words[i];
+            std::vector<std::string> rest(words.begin() + i + 1, words.end());
+            if (head[0] == '.') {
+                parse_directive(head, rest);
+                return;
+            }
+            const instruction_info *info = find_instruction(head);
+            if (info == nullptr) {fail("Unknown instruction: " + head);}
+            std::size_t count = std::char_traits<char>::length(info->operands);
+            if (rest.size() != count) {fail(std::string(info->name) + " takes " + std::to_string(count) + " operands");}
+            statement s;
+            s.line = line;
+            s.op = info->op;
+            for (std::size_t k = 0; k < count; k++) {
+                switch (info->operands[k]) {
+                    case 'r': s.args[k] = number(parse_register(rest[k])); break;
+                    case 'c': s.args[k] = number(parse_condition(rest[k])); break;
+                    default: s.args[k] = parse_value(rest[k]); break;
+                }
+            }
+            statements.push_back(s);
+        }
+
+        void parse_directive(const std::string &name, const std::vector<std::string> &args) {
+            statement s;
+            s.kind = StatementKind::DATA;
+            s.line = line;
+            if (name == ".const") {
+                if (args.size() != 2 or not is_identifier(args[0])) {fail(".const takes a name and a value");}
+                if (constants.count(args[0]) != 0) {fail("Duplicate constant: " + args[0]);}
+                constants[args[0]] = parse_number(args[1]);
+                return;
+            } else if (name == ".entry") {
+                if (args.size() != 1 or not is_identifier(args[0])) {fail(".entry takes a label");}
+                entry = args[0];
+                return;
+            } else if (name == ".word") {
+                if (args.empty()) {fail(".word takes values");}
+                for (auto &a : args) {s.words.push_back(parse_value(a));}
+            } else if (name == ".zero") {
+                if (args.size() != 1) {fail(".zero takes a count");}
+                long long n = parse_number(args[0]);
+                if (n < 0 or n > (1LL << 28)) {fail("Bad .zero count");}
+                s.words.assign(static_cast<std::size_t>(n), number(0));
+            } else if (name == ".ascii" or name == ".asciz") {
+                if (args.size() != 1) {fail(name + " takes a string");}
+                for (char c : parse_string(args[0])) {s.words.push_back(number(static_cast<unsigned char>(c)));}
+                if (name == ".asciz") {s.words.push_back(number(0));}
+            } else {
+                fail("Unknown directive: " + name);
+            }
+            if (not s.words.empty()) {statements.push_back(s);}
+        }
+
+        long long resolve(const value &v, const std::map<std::string, long long> &labels) const {
+            long long n = v.offset;
+            if (not v.symbol.empty()) {
+                auto l = labels.find(v.symbol);
+                if (l == labels.end()) {fail("Unknown label: " + v.symbol);}
+                n = static_cast<long long>(static_cast<unsigned long long>(n) + static_cast<unsigned long long>(l->second));
+            }
+            if (not in_range(n)) {fail("Value out of range: " + std::to_string(n));}
+            return wrap(n);
+        }
+
+        void resolve_all() const {
+            std::uint64_t entry_address;
+            assemble(entry_address);
+        }
+    };
+
+    // Итог оптимизации: сколько инструкций изменено каждым преобразованием
+    struct optimize_stats {
+        std::size_t folded = 0;        // свёрнуто или упрощено константами
+        std::size_t dead = 0;          // удалено мёртвых записей
+        std::size_t threaded = 0;      // перенаправлено или удалено переходов
+        std::size_t unreachable = 0;   // удалено недостижимых инструкций
+        std::size_t hoisted = 0;       // вынесено из циклов
+        std::string skipped;           // почему программа не оптимизировалась (пусто - оптимизировалась)
+    };
+
+    // Регистры и флаг сравнения как биты: 0-15 - регистры, 16 - флаг
+    using reg_set = std::uint32_t;
+    constexpr reg_set flag_bit = reg_set(1) << 16;
+    constexpr reg_set all_regs = (reg_set(1) << 17) - 1;
+    // r13 (системный обработчик), r14 (адрес инструкции) и r15 (стек) читаются неявно, записи в них не удаляются
+    constexpr reg_set implicit_regs = (reg_set(1) << 13) | (reg_set(1) << 14) | (reg_set(1) << 15);
+
+    inline reg_set reg_bit(const value &v) {
+        return reg_set(1) << v.offset;
+    }
+
+    // Регистры и флаг, которые инструкция читает
+    inline reg_set uses(const statement &s) {
+        const value *a = s.args;
+        reg_set sp = reg_set(1) << 15;
+        switch (s.op) {
+            case OpCode::LODR: case OpCode::MOV: case OpCode::NOT: case OpCode::ADDC: return reg_bit(a[1]);
+            case OpCode::STRI: return reg_bit(a[1]);
+            case OpCode::STRR: case OpCode::AMIN: case OpCode::PRTW: case OpCode::PRTR: return reg_bit(a[0]) | reg_bit(a[1]);
+            case OpCode::ADD: case OpCode::SUB: case OpCode::MULT: case OpCode::DIV: case OpCode::MOD:
+            case OpCode::OR: case OpCode::AND: case OpCode::FADD: case OpCode::SPAWN: return reg_bit(a[1]) | reg_bit(a[2]);
+            case OpCode::CMP: return reg_bit(a[0]) | reg_bit(a[1]);
+            case OpCode::CAS: case OpCode::VADD: case OpCode::VSUB: case OpCode::VMUL: case OpCode::VAND: case OpCode::VOR:
+            case OpCode::VFILL: case OpCode::VCOPY: return reg_bit(a[0]) | reg_bit(a[1]) | reg_bit(a[2]);
+            case OpCode::VSUM: case OpCode::VMIN: case OpCode::VMAX: return reg_bit(a[1]) | reg_bit(a[2]);
+            case OpCode::JMP: case OpCode::LCMP: return flag_bit;
+            case OpCode::PRTS: case OpCode::JOIN: case OpCode::TIMER: return reg_bit(a[0]);
+            case OpCode::SETI: return reg_bit(a[1]);
+            case OpCode::PUSH: return reg_bit(a[0]) | sp;
+            case OpCode::POP: case OpCode::STKR: case OpCode::CALL: return sp;
+            // Выход из программы или из функции и обработчики: всё может быть прочитано
+            case OpCode::HALT: case OpCode::RET: case OpCode::IRET: case OpCode::INTR: case OpCode::SCALL: return all_regs;
+            default: return 0;
+        }
+    }
+
+    // Регистры и флаг, которые инструкция записывает
+    inline reg_set defs(const statement &s) {
+        const value *a = s.args;
+        reg_set sp = reg_set(1) << 15;
+        switch (s.op) {
+            case OpCode::LODI: case OpCode::LODR: case OpCode::MOV: case OpCode::ADD: case OpCode::ADDC: case OpCode::LOC:
+            case OpCode::SUB: case OpCode::MULT: case OpCode::DIV: case OpCode::MOD: case OpCode::OR: case OpCode::AND:
+            case OpCode::NOT: case OpCode::LCMP: case OpCode::PRTG: case OpCode::PRCG: case OpCode::STKR:
+            case OpCode::FADD: case OpCode::SPAWN: case OpCode::VSUM: case OpCode::VMIN: case OpCode::VMAX: return reg_bit(a[0]);
+            case OpCode::PRTR: return reg_bit(a[1]);
+            case OpCode::CMP: return flag_bit;
+            case OpCode::CAS: return reg_bit(a[1]) | flag_bit;
+            case OpCode::PUSH: case OpCode::CALL: case OpCode::RET: return sp;
+            case OpCode::POP: return reg_bit(a[0]) | sp;
+            case OpCode::INTR: case OpCode::SCALL: return all_regs;
+            default: return 0;
+        }
+    }
+
+    // Регистры, записанные в поля инструкции (r14 в них - вычисляемый переход)
+    inline reg_set named_regs(const statement &s) {
+        const char *kinds = instruction_of(s.op).operands;
+        reg_set regs = 0;
+        for (int i = 0; kinds[i] != 0; i++) {
+            if (kinds[i] == 'r') {regs |= reg_bit(s.args[i]);}
+        }
+        return regs;
+    }
+
+    inline bool is_jump(OpCode op) {
+        return op == OpCode::JMP or op == OpCode::GOTO or op == OpCode::CALL;
+    }
+
+    // Метка перехода: у jmp - второй операнд
+    inline value &jump_target(statement &s) {
+        return s.op == OpCode::JMP ? s.args[1] : s.args[0];
+    }
+
+    // Конец базового блока: после инструкции исполнение не идёт (только) на следующую
+    inline bool ends_block(OpCode op) {
+        return is_jump(op) or op == OpCode::RET or op == OpCode::IRET or op == OpCode::HALT;
+    }
+
+    inline bool falls_through(OpCode op) {
+        return op != OpCode::GOTO and op != OpCode::RET and op != OpCode::IRET and op != OpCode::HALT;
+    }
+
+    // Чистые вычисления над регистрами без ошибок и побочных эффектов
+    inline bool is_pure(OpCode op) {
+        switch (op) {
+            case OpCode::LOC: case OpCode::ADDC: case OpCode::ADD: case OpCode::SUB: case OpCode::MULT:
+            case OpCode::AND: case OpCode::OR: case OpCode::NOT: case OpCode::MOV: return true;
+            default: return false;
+        }
+    }
+
+    // Значения флага, при которых jmp с условием condition переходит: биты 0, 1, 2 для флага -1, 0, 1
+    inline int taken_flags(long long condition) {
+        switch (condition) {
+            case 0: return 2;
+            case 1: return 4;
+            case -1: return 1;
+            case 2: return 6;
+            case -2: return 3;
+            case 3: return 5;
+            default: return 0;
+        }
+    }
+
+    class optimizer {
+    public:
+        explicit optimizer(program &source) : prog(source), code(source.statements) {}
+
+        // Преобразования повторяются, пока меняют программу
+        optimize_stats run() {
+            stats = optimize_stats();
+            stats.skipped = check();
+            if (not stats.skipped.empty()) {return stats;}
+            for (int round = 0; round < 200; round++) {
+                bool changed = fold_constants();
+                changed |= thread_jumps();
+                changed |= remove_unreachable();
+                changed |= remove_dead();
+                changed |= hoist_invariants();
+                if (not changed) {break;}
+            }
+            return stats;
+        }
+
+    private:
+        // Базовый блок: инструкции подряд, вход только в первую
+        struct block {
+            std::vector<std::size_t> statements;
+            std::vector<std::size_t> succs;
+            std::vector<std::size_t> preds;
+            // Вход не только по известным переходам: начало программы, метка-адрес, возврат из call
+            bool unknown_entry = false;
+            // Выход в неизвестность (halt, ret, iret, данные): после блока читается всё
+            bool open_exit = false;
+        };
+
+        // Известные значения регистров и флага: бит known - значение в v известно
+        struct constants {
+            bool reached = false;
+            reg_set known = 0;
+            long long v[17] = {};
+
+            bool has(std::size_t r) const {
+                return known & (reg_set(1) << r);
+            }
+
+            void set(std::size_t r, long long value) {
+                known |= reg_set(1) << r;
+                v[r] = value;
+            }
+
+            // Слияние путей: остаются значения, одинаковые на обоих
+            bool meet(const constants &other) {
+                if (not reached) {
+                    *this = other;
+                    return true;
+                }
+                reg_set old = known;
+                for (std::size_t r = 0; r < 17; r++) {
+                    if (has(r) and (not other.has(r) or other.v[r] != v[r])) {known &= ~(reg_set(1) << r);}
+                }
+                return known != old;
+            }
+        };
+
+        static constexpr std::size_t none = static_cast<std::size_t>(-1);
+
+        program &prog;
+        std::vector<statement> &code;
+        optimize_stats stats;
+        std::vector<block> blocks;
+        std::vector<std::size_t> block_of;
+        std::map<std::string, std::size_t> label_at;
+        std::set<std::string> address_taken;
+        std::vector<reg_set> live_in;
+        std::size_t next_label = 0;
+
+        // Признаки программы, которую нельзя оптимизировать, и метки, адрес которых берётся как число
+        std::string check() {
+            std::set<std::string> code_labels;
+            for (std::size_t i = 0; i < code.size(); i++) {
+                if (code[i].kind != StatementKind::LABEL) {continue;}
+                std::size_t next = skip_labels(i);
+                if (next != none and code[next].kind == StatementKind::INSTRUCTION) {code_labels.insert(code[i].label);}
+            }
+            auto take = [&](const value &v) {
+                if (v.symbol.empty()) {return true;}
+                address_taken.insert(v.symbol);
+                return v.offset == 0 or code_labels.count(v.symbol) == 0;
+            };
+            if (not prog.entry.empty()) {address_taken.insert(prog.entry);}
+            for (auto &s : code) {
+                if (s.kind == StatementKind::DATA) {
+                    for (auto &w : s.words) {
+                        if (not take(w)) {return "offset from a code label";}
+                    }
+                }
+                if (s.kind != StatementKind::INSTRUCTION) {continue;}
+                if ((named_regs(s) & (reg_set(1) << 14)) != 0) {return "program uses r14";}
+                const char *kinds = instruction_of(s.op).operands;
+                for (int k = 0; kinds[k] != 0; k++) {
+                    if (kinds[k] == 'l' and (s.args[k].symbol.empty() or s.args[k].offset != 0)) {return "jump to a computed address";}
+                    if (kinds[k] == 'i' and not take(s.args[k])) {return "offset from a code label";}
+                }
+            }
+            return std::string();
+        }
+
+        // Первый элемент не метка, начиная с i
+        std::size_t skip_labels(std::size_t i) const {
+            while (i < code.size() and code[i].kind == StatementKind::LABEL) {i++;}
+            return i < code.size() ? i : none;
+        }
+
+        // Инструкция по метке перехода (none - данные или конец программы)
+        std::size_t target_of(const std::string &label) const {
+            std::size_t i = skip_labels(label_at.at(label));
+            return i != none and code[i].kind == StatementKind::INSTRUCTION ? i : none;
+        }
+
+        void index_labels() {
+            label_at.clear();
+            for (std::size_t i = 0; i < code.size(); i++) {
+                if (code[i].kind == StatementKind::LABEL) {label_at[code[i].label] = i;}
+            }
+        }
+
+        // Граф базовых блоков
+        void build() {
+            index_labels();
+            blocks.clear();
+            block_of.assign(code.size(), none);
+            bool leader = true;
+            bool unknown = true;
+            for (std::size_t i = 0; i < code.size(); i++) {
+                const statement &s = code[i];
+                if (s.kind == StatementKind::LABEL) {
+                    leader = true;
+                    if (address_taken.count(s.label) != 0) {unknown = true;}
+                    continue;
+                }
+                if (s.kind == StatementKind::DATA) {
+                    // Код сразу после данных без метки достижим только исполнением данных
+                    leader = true;
+                    unknown = true;
+                    continue;
+                }
+                if (leader) {
+                    blocks.emplace_back();
+                    blocks.back().unknown_entry = unknown;
+                }
+                blocks.back().statements.push_back(i);
+                block_of[i] = blocks.size() - 1;
+                leader = ends_block(s.op);
+                unknown = s.op == OpCode::CALL;
+            }
+            for (std::size_t b = 0; b < blocks.size(); b++) {
+                block &bl = blocks[b];
+                std::size_t last = bl.statements.back();
+                const statement &s = code[last];
+                auto link = [&](std::size_t to) {
+                    if (to == none) {
+                        bl.open_exit = true;
+                        return;
+                    }
+                    std::size_t target = block_of[to];
+                    if (std::find(bl.succs.begin(), bl.succs.end(), target) == bl.succs.end()) {bl.succs.push_back(target);}
+                };
+                if (is_jump(s.op)) {link(target_of(jump_target(code[last]).symbol));}
+                if (s.op == OpCode::HALT or s.op == OpCode::RET or s.op == OpCode::IRET) {bl.open_exit = true;}
+                // call возвращается в блок после себя через ret, а не ребром графа
+                if (falls_through(s.op) and s.op != OpCode::CALL) {
+                    std::size_t next = skip_labels(last + 1);
+                    link(next != none and code[next].kind == StatementKind::INSTRUCTION ? next : none);
+                }
+            }
+            for (std::size_t b = 0; b < blocks.size(); b++) {
+                for (std::size_t s : blocks[b].succs) {blocks[s].preds.push_back(b);}
+            }
+        }
+
+        // Удаление отмеченных элементов
+        void erase(const std::vector<bool> &removed) {
+            std::size_t out = 0;
+            for (std::size_t i = 0; i < code.size(); i++) {
+                if (removed[i]) {continue;}
+                if (out != i) {code[out] = std::move(code[i]);}
+                out++;
+            }
+            code.resize(out);
+        }
+
+        std::string new_label() {
+            std::string name;
+            do {
+                name = ".L" + std::to_string(next_label++);
+            } while (label_at.count(name) != 0);
+            return name;
+        }
+
+        // Арифметика по модулю слова программы (prog.word_bits), как в ядре той же ширины
+        long long wrap_add(long long a, long long b) const {
+            return prog.wrap(static_cast<long long>(static_cast<unsigned long long>(a) + static_cast<unsigned long long>(b)));
+        }
+
+        long long wrap_mul(long long a, long long b) const {
+            return prog.wrap(static_cast<long long>(static_cast<unsigned long long>(a) * static_cast<unsigned long long>(b)));
+        }
+
+        // Значение результата по известным операндам (false - не вычисляется)
+        bool evaluate(const statement &s, const constants &c, long long &result) const {
+            auto known = [&](int k) {return c.has(static_cast<std::size_t>(s.args[k].offset));};
+            auto val = [&](int k) {return c.v[s.args[k].offset];};
+            switch (s.op) {
+                case OpCode::LOC:
+                    if (not s.args[1].is_number()) {return false;}
+                    result = prog.wrap(s.args[1].offset);
+                    return true;
+                case OpCode::ADDC:
+                    if (not known(1) or not s.args[2].is_number()) {return false;}
+                    result = wrap_add(val(1), prog.wrap(s.args[2].offset));
+                    return true;
+                case OpCode::MOV: case OpCode::NOT:
+                    if (not known(1)) {return false;}
+                    result = s.op == OpCode::MOV ? val(1) : val(1) == 0;
+                    return true;
+                case OpCode::LCMP:
+                    if (not c.has(16)) {return false;}
+                    result = c.v[16];
+                    return true;
+                case OpCode::ADD: case OpCode::SUB: case OpCode::MULT: case OpCode::DIV: case OpCode::MOD:
+                case OpCode::AND: case OpCode::OR:
+                    break;
+                default:
+                    return false;
+            }
+            if (not known(1) or not known(2)) {return false;}
+            long long x = val(1), y = val(2);
+            switch (s.op) {
+                case OpCode::ADD: result = wrap_add(x, y); return true;
+                case OpCode::SUB: result = wrap_add(x, wrap_mul(y, -1)); return true;
+                case OpCode::MULT: result = wrap_mul(x, y); return true;
+                case OpCode::AND: result = x != 0 and y != 0; return true;
+                case OpCode::OR: result = x != 0 or y != 0; return true;
+                default:
+                    // Деление на 0 и переполнение деления остаются ошибкой времени исполнения
+                    if (y == 0 or (x == prog.word_min() and y == -1)) {return false;}
+                    result = s.op == OpCode::DIV ? x / y : x % y;
+                    return true;
+            }
+        }
+
+        // Переход состояния через инструкцию
+        void transfer(const statement &s, constants &c) const {
+            long long result = 0;
+            bool computed = evaluate(s, c, result);
+            if (s.op == OpCode::CMP) {
+                bool both = c.has(s.args[0].offset) and c.has(s.args[1].offset);
+                long long x = c.v[s.args[0].offset], y = c.v[s.args[1].offset];
+                c.known &= ~flag_bit;
+                if (both) {c.set(16, x == y ? 0 : x > y ? 1 : -1);}
+                return;
+            }
+            c.known &= ~defs(s);
+            if (computed) {c.set(static_cast<std::size_t>(s.args[0].offset), result);}
+        }
+
+        // Свёртка и распространение констант
+        bool fold_constants() {
+            build();
+            std::vector<constants> in(blocks.size());
+            std::vector<std::size_t> work;
+            for (std::size_t b = 0; b < blocks.size(); b++) {
+                if (blocks[b].unknown_entry) {
+                    in[b].reached = true;
+                    work.push_back(b);
+                }
+            }
+            while (not work.empty()) {
+                std::size_t b = work.back();
+                work.pop_back();
+                constants c = in[b];
+                for (std::size_t i : blocks[b].statements) {transfer(code[i], c);}
+                for (std::size_t s : blocks[b].succs) {
+                    if (in[s].meet(c)) {work.push_back(s);}
+                }
+            }
+            std::vector<bool> removed(code.size(), false);
+            bool changed = false;
+            for (std::size_t b = 0; b < blocks.size(); b++) {
+                if (not in[b].reached) {continue;}
+                constants c = in[b];
+                for (std::size_t i : blocks[b].statements) {
+                    statement &s = code[i];
+                    constants before = c;
+                    transfer(s, c);
+                    if (s.op == OpCode::JMP and before.has(16)) {
+                        // Исход перехода известен
+                        if (taken_flags(s.args[0].offset) & (1 << (before.v[16] + 1))) {
+                            s.op = OpCode::GOTO;
+                            s.args[0] = s.args[1];
+                            s.args[1] = number(0);
+                        } else {
+                            removed[i] = true;
+                        }
+                        stats.folded++;
+                        changed = true;
+                        continue;
+                    }
+                    if (not is_pure(s.op) and s.op != OpCode::LCMP and s.op != OpCode::DIV and s.op != OpCode::MOD) {continue;}
+                    std::size_t dest = static_cast<std::size_t>(s.args[0].offset);
+                    long long result;
+                    if (evaluate(s, before, result)) {
+                        if (before.has(dest) and before.v[dest] == result) {
+                            removed[i] = true;
+                        } else if (s.op == OpCode::LOC) {
+                            continue;
+                        } else {
+                            s.op = OpCode::LOC;
+                            s.args[1] = number(result);
+                            s.args[2] = number(0);
+                        }
+                        stats.folded++;
+                        changed = true;
+                        continue;
+                    }
+                    // Известное слагаемое переходит в константу addc
+                    auto has = [&](int k) {return before.has(static_cast<std::size_t>(s.args[k].offset));};
+                    auto val = [&](int k) {return before.v[s.args[k].offset];};
+                    if (s.op == OpCode::ADD and (has(1) or has(2))) {
+                        int k = has(2) ? 2 : 1;
+                        long long known_value = val(k);
+                        s.args[1] = s.args[3 - k];
+                        s.args[2] = number(known_value);
+                    } else if (s.op == OpCode::SUB and has(2) and val(2) != prog.word_min()) {
+                        s.args[2] = number(-val(2));
+                    } else {
+                        continue;
+                    }
+                    s.op = OpCode::ADDC;
+                    stats.folded++;
+                    changed = true;
+                }
+            }
+            erase(removed);
+            return changed;
+        }
+
+        // Прыжки через прыжки и переходы на следующую инструкцию
+        bool thread_jumps() {
+            index_labels();
+            bool changed = false;
+            for (std::size_t i = 0; i < code.size(); i++) {
+                statement &s = code[i];
+                if (s.kind != StatementKind::INSTRUCTION or not is_jump(s.op)) {continue;}
+                std::string label = jump_target(s).symbol;
+                for (int hops = 0; hops < 16; hops++) {
+                    std::size_t t = target_of(label);
+                    if (t == none or t == i) {break;}
+                    const statement &to = code[t];
+                    if (to.op == OpCode::GOTO) {
+                        if (to.args[0].symbol == label) {break;}
+                        label = to.args[0].symbol;
+                        continue;
+                    }
+                    if (s.op != OpCode::JMP or to.op != OpCode::JMP) {break;}
+                    // Флаг между двумя jmp не меняется
+                    int mine = taken_flags(s.args[0].offset), theirs = taken_flags(to.args[0].offset);
+                    if ((mine & theirs) == mine) {
+                        if (to.args[1].symbol == label) {break;}
+                        label = to.args[1].symbol;
+                    } else if ((mine & theirs) == 0) {
+                        std::size_t after = t + 1;
+                        if (after < code.size() and code[after].kind == StatementKind::LABEL) {
+                            label = code[after].label;
+                        } else {
+                            statement l;
+                            l.kind = StatementKind::LABEL;
+                            l.line = to.line;
+                            l.label = new_label();
+                            label = l.label;
+                            code.insert(code.begin() + static_cast<std::ptrdiff_t>(after), l);
+                            // Индексы сдвинулись: переход перенаправляется, остальное - на следующем круге
+                            jump_target(code[i < after ? i : i + 1]).symbol = label;
+                            stats.threaded++;
+                            return true;
+                        }
+                    } else {
+                        break;
+                    }
+                }
+                if (label != jump_target(s).symbol) {
+                    jump_target(s).symbol = label;
+                    stats.threaded++;
+                    changed = true;
+                }
+                std::size_t t = target_of(label);
+                if (s.op == OpCode::GOTO and t != none and code[t].op == OpCode::RET) {
+                    s.op = OpCode::RET;
+                    s.args[0] = number(0);
+                    stats.threaded++;
+                    changed = true;
+                }
+            }
+            // Переход на следующую инструкцию и jmp, который никогда не переходит
+            std::vector<bool> removed(code.size(), false);
+            for (std::size_t i = 0; i < code.size(); i++) {
+                statement &s = code[i];
+                if (s.kind != StatementKind::INSTRUCTION or (s.op != OpCode::JMP and s.op != OpCode::GOTO)) {continue;}
+                bool never = s.op == OpCode::JMP and taken_flags(s.args[0].offset) == 0;
+                std::size_t t = target_of(jump_target(s).symbol);
+                if (never or (t != none and t == skip_labels(i + 1))) {
+                    removed[i] = true;
+                    stats.threaded++;
+                    changed = true;
+                }
+            }
+            erase(removed);
+            return changed;
+        }
+
+        bool remove_unreachable() {
+            build();
+            std::vector<bool> reached(blocks.size(), false);
+            std::vector<std::size_t> work;
+            for (std::size_t b = 0; b < blocks.size(); b++) {
+                if (blocks[b].unknown_entry) {
+                    reached[b] = true;
+                    work.push_back(b);
+                }
+            }
+            while (not work.empty()) {
+                std::size_t b = work.back();
+                work.pop_back();
+                for (std::size_t s : blocks[b].succs) {
+                    if (not reached[s]) {
+                        reached[s] = true;
+                        work.push_back(s);
+                    }
+                }
+            }
+            std::vector<bool> removed(code.size(), false);
+            bool changed = false;
+            for (std::size_t b = 0; b < blocks.size(); b++) {
+                if (reached[b]) {continue;}
+                for (std::size_t i : blocks[b].statements) {removed[i] = true;}
+                stats.unreachable += blocks[b].statements.size();
+                changed = true;
+            }
+            erase(removed);
+            return changed;
+        }
+
+        // Живые на входе в блоки регистры (build() уже вызван)
+        void liveness() {
+            live_in.assign(blocks.size(), 0);
+            bool changed = true;
+            while (changed) {
+                changed = false;
+                for (std::size_t b = blocks.size(); b-- > 0;) {
+                    reg_set live = live_out(b);
+                    for (auto i = blocks[b].statements.rbegin(); i != blocks[b].statements.rend(); ++i) {
+                        live = (live & ~defs(code[*i])) | uses(code[*i]);
+                    }
+                    if (live != live_in[b]) {
+                        live_in[b] = live;
+                        changed = true;
+                    }
+                }
+            }
+        }
+
+        reg_set live_out(std::size_t b) const {
+            reg_set live = blocks[b].open_exit ? all_regs : 0;
+            for (std::size_t s : blocks[b].succs) {live |= live_in[s];}
+            // call: вызванная функция читает то, что живо на её входе, а её ret читает всё
+            return live | implicit_regs;
+        }
+
+        // Удаление мёртвых записей в регистры и stri, перезаписанных до чтения
+        bool remove_dead() {
+            build();
+            liveness();
+            std::vector<bool> removed(code.size(), false);
+            bool changed = false;
+            for (std::size_t b = 0; b < blocks.size(); b++) {
+                reg_set live = live_out(b);
+                const std::vector<std::size_t> &list = blocks[b].statements;
+                for (auto i = list.rbegin(); i != list.rend(); ++i) {
+                    const statement &s = code[*i];
+                    reg_set d = defs(s);
+                    if ((is_pure(s.op) or s.op == OpCode::LCMP or s.op == OpCode::CMP) and (d & (live | implicit_regs)) == 0) {
+                        removed[*i] = true;
+                        stats.dead++;
+                        changed = true;
+                        continue;
+                    }
+                    live = (live & ~d) | uses(s);
+                }
+                // stri, после которой в блоке есть stri по тому же адресу, а между ними только чистые вычисления
+                for (std::size_t k = 0; k < list.size(); k++) {
+                    const statement &s = code[list[k]];
+                    if (s.op != OpCode::STRI or removed[list[k]]) {continue;}
+                    for (std::size_t m = k + 1; m < list.size(); m++) {
+                        const statement &t = code[list[m]];
+                        if (t.op == OpCode::STRI and t.args[0] == s.args[0]) {
+                            removed[list[k]] = true;
+                            stats.dead++;
+                            changed = true;
+                            break;
+                        }
+                        bool other_store = t.op == OpCode::STRI and t.args[0].is_number() and s.args[0].is_number();
+                        if (not is_pure(t.op) and t.op != OpCode::CMP and t.op != OpCode::LCMP and not other_store) {break;}
+                    }
+                }
+            }
+            erase(removed);
+            return changed;
+        }
+
+        // Доминаторы: множество блоков, через которые проходит любой путь из входов программы
+        std::vector<std::vector<bool>> dominators() const {
+            std::size_t n = blocks.size();
+            std::vector<std::vector<bool>> dom(n, std::vector<bool>(n, true));
+            for (std::size_t b = 0; b < n; b++) {
+                if (blocks[b].unknown_entry or blocks[b].preds.empty()) {
+                    dom[b].assign(n, false);
+                    dom[b][b] = true;
+                }
+            }
+            bool changed = true;
+            while (changed) {
+                changed = false;
+                for (std::size_t b = 0; b < n; b++) {
+                    if (blocks[b].unknown_entry or blocks[b].preds.empty()) {continue;}
+                    std::vector<bool> d(n, true);
+                    for (std::size_t p : blocks[b].preds) {
+                        for (std::size_t k = 0; k < n; k++) {d[k] = d[k] and dom[p][k];}
+                    }
+                    d[b] = true;
+                    if (d != dom[b]) {
+                        dom[b] = std::move(d);
+                        changed = true;
+                    }
+                }
+            }
+            return dom;
+        }
+
+        // Вынос инвариантов: за раз обрабатывается один цикл, граф затем строится заново
+        bool hoist_invariants() {
+            build();
+            liveness();
+            std::vector<std::vector<bool>> dom = dominators();
+            // Циклы по заголовкам: обратное ребро b -> h, где h доминирует над b
+            std::map<std::size_t, std::set<std::size_t>> loops;
+            for (std::size_t b = 0; b < blocks.size(); b++) {
+                for (std::size_t h : blocks[b].succs) {
+                    if (not dom[b][h]) {continue;}
+                    std::set<std::size_t> &body = loops[h];
+                    body.insert(h);
+                    std::vector<std::size_t> work = {b};
+                    while (not work.empty()) {
+                        std::size_t x = work.back();
+                        work.pop_back();
+                        if (not body.insert(x).second) {continue;}
+                        for (std::size_t p : blocks[x].preds) {work.push_back(p);}
+                    }
+                }
+            }
+            // Сначала внутренние (меньшие) циклы
+            std::vector<std::pair<std::size_t, std::size_t>> order;
+            for (auto &l : loops) {order.push_back({l.second.size(), l.first});}
+            std::sort(order.begin(), order.end());
+            for (auto &o : order) {
+                if (hoist_loop(o.second, loops[o.second], dom)) {return true;}
+            }
+            return false;
+        }
+
+        bool hoist_loop(std::size_t header, const std::set<std::size_t> &body, const std::vector<std::vector<bool>> &dom) {
+            std::size_t first = blocks[header].statements.front();
+            std::size_t insert_at = first;
+            while (insert_at > 0 and code[insert_at - 1].kind == StatementKind::LABEL) {insert_at--;}
+            if (insert_at == first) {return false;}
+            // В заголовок можно попасть сверху только снаружи цикла
+            if (insert_at > 0) {
+                const statement &above = code[insert_at - 1];
+                if (above.kind == StatementKind::DATA) {return false;}
+                if (falls_through(above.op) and body.count(block_of[insert_at - 1]) != 0) {return false;}
+            }
+            int def_count[17] = {};
+            reg_set exit_live = 0;
+            std::vector<std::size_t> exits;
+            for (std::size_t b : body) {
+                if (blocks[b].unknown_entry) {return false;}
+                for (std::size_t i : blocks[b].statements) {
+                    const statement &s = code[i];
+                    if (s.op == OpCode::CALL or defs(s) == all_regs) {return false;}
+                    reg_set d = defs(s);
+                    for (std::size_t r = 0; r < 17; r++) {
+                        if (d & (reg_set(1) << r)) {def_count[r]++;}
+                    }
+                }
+                bool exiting = blocks[b].open_exit;
+                if (blocks[b].open_exit) {exit_live = all_regs;}
+                for (std::size_t s : blocks[b].succs) {
+                    if (body.count(s) == 0) {
+                        exiting = true;
+                        exit_live |= live_in[s];
+                    }
+                }
+                if (exiting) {exits.push_back(b);}
+            }
+            // Инструкции цикла в порядке программы
+            std::vector<std::size_t> list;
+            for (std::size_t b : body) {
+                list.insert(list.end(), blocks[b].statements.begin(), blocks[b].statements.end());
+            }
+            std::sort(list.begin(), list.end());
+            std::vector<bool> hoisted(code.size(), false);
+            reg_set hoisted_regs = 0;
+            std::vector<std::size_t> moved;
+            bool found = true;
+            while (found) {
+                found = false;
+                for (std::size_t i : list) {
+                    const statement &s = code[i];
+                    if (hoisted[i] or not is_pure(s.op)) {continue;}
+                    reg_set d = defs(s);
+                    std::size_t r = static_cast<std::size_t>(s.args[0].offset);
+                    if ((d & implicit_regs) != 0 or def_count[r] != 1 or (live_in[header] & d) != 0) {continue;}
+                    reg_set u = uses(s);
+                    bool invariant = (u & d) == 0;
+                    for (std::size_t k = 0; k < 16 and invariant; k++) {
+                        reg_set bit = reg_set(1) << k;
+                        if ((u & bit) != 0 and def_count[k] != 0 and (hoisted_regs & bit) == 0) {invariant = false;}
+                    }
+                    if (not invariant) {continue;}
+                    if ((exit_live & d) != 0) {
+                        bool dominates = std::all_of(exits.begin(), exits.end(), [&](std::size_t e) {return dom[e][block_of[i]];});
+                        if (not dominates) {continue;}
+                    }
+                    hoisted[i] = true;
+                    hoisted_regs |= d;
+                    moved.push_back(i);
+                    found = true;
+                }
+            }
+            if (moved.empty()) {return false;}
+            std::sort(moved.begin(), moved.end());
+            // Переходы в заголовок снаружи цикла идут на вынесенные инструкции
+            std::set<std::string> header_labels;
+            for (std::size_t i = insert_at; i < first; i++) {header_labels.insert(code[i].label);}
+            std::string entry = new_label();
+            for (std::size_t i = 0; i < code.size(); i++) {
+                statement &s = code[i];
+                if (s.kind != StatementKind::INSTRUCTION or not is_jump(s.op)) {continue;}
+                if (header_labels.count(jump_target(s).symbol) != 0 and body.count(block_of[i]) == 0) {jump_target(s).symbol = entry;}
+            }
+            std::vector<statement> preheader;
+            statement l;
+            l.kind = StatementKind::LABEL;
+            l.line = code[first].line;
+            l.label = entry;
+            preheader.push_back(l);
+            for (std::size_t i : moved) {preheader.push_back(code[i]);}
+            insert_at -= static_cast<std::size_t>(std::count_if(moved.begin(), moved.end(), [&](std::size_t i) {return i < insert_at;}));
+            erase(hoisted);
+            code.insert(code.begin() + static_cast<std::ptrdiff_t>(insert_at), preheader.begin(), preheader.end());
+            stats.hoisted += moved.size();
+            return true;
+        }
+    };
+}
@@ -0,0 +1,496 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include "memory.hpp"
+#include "thread_pool.hpp"
+#include "utility_units.hpp"
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#define XVPROC_IO_URING 1
+#endif
+#endif
+#ifndef XVPROC_IO_URING
+#define XVPROC_IO_URING 0
+#endif
+
+/*
+ Асинхронный файловый порт (порт 2)
+
+ Программа ставит запросы чтения и записи файла в ячейки ОЗУ и продолжает работать,
+ пока их исполняет io_uring (если ядро ОС его даёт) или пул потоков с pread/pwrite
+ Ячейка передаётся как 4 байта файла (int32 в порядке байт машины), смещение в файле тоже в ячейках
+
+ Протокол:
+ - пока файл не открыт, prts передаёт символы имени файла (как у fileunit)
+ - prcs 1 / 2 / 3 - открыть для чтения / для записи (создать или очистить) / для чтения и записи (создать)
+ - когда файл открыт, prts передаёт параметры запроса: id adr count offset (берутся 4 последних)
+ - prcs 4 - поставить запрос чтения count ячеек со смещения offset в ОЗУ с адреса adr, prcs 5 - запрос записи
+ - prcs 6 - ждать, пока не завершится хотя бы один запрос (если есть незавершённые)
+ - prcs 0 - дождаться всех запросов и закрыть файл
+ - prcg - количество завершённых, но не забранных запросов, или код ошибки последней команды:
+   -1 - файл не открылся, -2 - неверный запрос (параметры, адрес, режим файла, больше max_requests запросов), -3 - неверная команда
+   Код ошибки выдаётся один раз
+ - prtg забирает завершённые запросы в порядке завершения, каждый - два значения: id, затем результат
+   (сколько ячеек передано, меньше count - конец файла, -1 - ошибка ввода-вывода); нет завершённых - id равен -1
+   prtr с len_reg 2 забирает запрос одной инструкцией
+
+ Чтение нельзя направить в область программы: её копии держат кэши движков
+ До того как запрос забран, его ячейки ОЗУ могут меняться в любой момент (как при DMA)
+ Неполная последняя ячейка при чтении дополняется нулями
+*/
+
+namespace utility_units {
+
+#if XVPROC_IO_URING
+    // Минимальное кольцо io_uring на системных вызовах (без liburing)
+    // Запросы ставятся и забираются одним потоком
+    class io_ring {
+    private:
+        int ring_fd = -1;
+        void *sq_ring = MAP_FAILED;
+        void *cq_ring = MAP_FAILED;
+        std::size_t sq_ring_size = 0;
+        std::size_t cq_ring_size = 0;
+        io_uring_sqe *sqes = static_cast<io_uring_sqe *>(MAP_FAILED);
+        std::size_t sqes_size = 0;
+
+        unsigned *sq_tail = nullptr;
+        unsigned *sq_mask = nullptr;
+        unsigned *sq_array = nullptr;
+        unsigned *cq_head = nullptr;
+        unsigned *cq_tail = nullptr;
+        unsigned *cq_mask = nullptr;
+        io_uring_cqe *cqes = nullptr;
+
+        int enter(unsigned submit, unsigned wait, unsigned flags) {
+            int r;
+            do {
+                r = static_cast<int>(syscall(__NR_io_uring_enter, ring_fd, submit, wait, flags, nullptr, 0));
+            } while (r < 0 and errno == EINTR);
+            return r;
+        }
+
+        void release() {
+            if (sqes != MAP_FAILED) {munmap(sqes, sqes_size);}
+            if (cq_ring != MAP_FAILED and cq_ring != sq_ring) {munmap(cq_ring, cq_ring_size);}
+            if (sq_ring != MAP_FAILED) {munmap(sq_ring, sq_ring_size);}
+            if (ring_fd >= 0) {close(ring_fd);}
+            sqes = static_cast<io_uring_sqe *>(MAP_FAILED);
+            sq_ring = cq_ring = MAP_FAILED;
+            ring_fd = -1;
+        }
+
+    public:
+        io_ring() = default;
+        io_ring(const io_ring &) = delete;
+        io_ring &operator=(const io_ring &) = delete;
+
+        // false - io_uring недоступен (старое ядро ОС, запрещён политикой безопасности)
+        bool open(unsigned entries) {
+            io_uring_params p;
+            std::memset(&p, 0, sizeof(p));
+            ring_fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &p));
+            if (ring_fd < 0) {return false;}
+            sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+            cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+            bool single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+            if (single) {sq_ring_size = cq_ring_size = std::max(sq_ring_size, cq_ring_size);}
+            sq_ring = mmap(nullptr, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+            if (sq_ring == MAP_FAILED) {release(); return false;}
+            cq_ring = single ? sq_ring
+                             : mmap(nullptr, cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+            if (cq_ring == MAP_FAILED) {release(); return false;}
+            sqes_size = p.sq_entries * sizeof(io_uring_sqe);
+            sqes = static_cast<io_uring_sqe *>(mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES));
+            if (sqes == MAP_FAILED) {release(); return false;}
+            char *sq = static_cast<char *>(sq_ring);
+            char *cq = static_cast<char *>(cq_ring);
+            sq_tail = reinterpret_cast<unsigned *>(sq + p.sq_off.tail);
+            sq_mask = reinterpret_cast<unsigned *>(sq + p.sq_off.ring_mask);
+            sq_array = reinterpret_cast<unsigned *>(sq + p.sq_off.array);
+            cq_head = reinterpret_cast<unsigned *>(cq + p.cq_off.head);
+            cq_tail = reinterpret_cast<unsigned *>(cq + p.cq_off.tail);
+            cq_mask = reinterpret_cast<unsigned *>(cq + p.cq_off.ring_mask);
+            cqes = reinterpret_cast<io_uring_cqe *>(cq + p.cq_off.cqes);
+            return true;
+        }
+
+        // Постановка readv/writev одного буфера, io должен жить до завершения запроса
+        // Незавершённых запросов не больше entries, поэтому очередь постановки не переполняется
+        void submit(bool read, int fd, const iovec *io, std::uint64_t offset, std::uint64_t user) {
+            unsigned tail = *sq_tail;
+            unsigned index = tail & *sq_mask;
+            io_uring_sqe &e = sqes[index];
+            std::memset(&e, 0, sizeof(e));
+            e.opcode = read ? IORING_OP_READV : IORING_OP_WRITEV;
+            e.fd = fd;
+            e.addr = reinterpret_cast<std::uint64_t>(io);
+            e.len = 1;
+            e.off = offset;
+            e.user_data = user;
+            sq_array[index] = index;
+            __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+            // Не принятый ядром ОС запрос остался бы в очереди и исполнился позже, поэтому это ошибка
+            if (enter(1, 0, 0) != 1) {throw std::runtime_error("io_uring submit failed");}
+        }
+
+        // Забрать одно завершение, wait - ждать, если завершений нет
+        bool pop(std::uint64_t &user, int &result, bool wait) {
+            unsigned head = *cq_head;
+            while (head == __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) {
+                if (not wait or enter(0, 1, IORING_ENTER_GETEVENTS) < 0) {return false;}
+            }
+            const io_uring_cqe &e = cqes[head & *cq_mask];
+            user = e.user_data;
+            result = e.res;
+            __atomic_store_n(cq_head, head + 1, __ATOMIC_RELEASE);
+            return true;
+        }
+
+        ~io_ring() {
+            release();
+        }
+    };
+#endif
+
+    class async_file : public virtual_port {
+    public:
+        // Наибольшее количество запросов, поставленных и ещё не забранных программой
+        static constexpr std::size_t max_requests = 64;
+
+    private:
+        struct request {
+            bool busy = false;
+            bool read = false;
+            int id = 0;
+            std::size_t adr = 0;
+            std::size_t count = 0;
+            std::uint64_t offset = 0;
+            // Ячейки запроса: само ОЗУ у плоской памяти, иначе промежуточный буфер
+            int *cells = nullptr;
+            std::vector<int> bounce;
+            iovec io{};
+            // Байт передано или -errno
+            long long bytes = 0;
+        };
+
+        std::shared_ptr<cpu_unit::memory> ram;
+        std::size_t ram_size;
+        std::size_t code_limit;
+        bool allow_ring;
+
+        std::string filename;
+        int file = -1;
+        int mode = 0;
+        std::vector<int> params;
+
+        std::vector<request> requests = std::vector<request>(max_requests);
+        std::size_t in_flight = 0;
+        // Завершённые запросы в порядке завершения, ждут prtg
+        std::deque<std::size_t> ready;
+        // Результат забранного запроса, который выдаст следующий prtg
+        bool has_result = false;
+        int result = 0;
+
+    #if XVPROC_IO_URING
+        std::unique_ptr<io_ring> ring;
+    #endif
+        // Запасной путь: pread/pwrite в пуле потоков, завершения передаются через done
+        std::unique_ptr<thread_pool> pool;
+        std::mutex done_lock;
+        std::condition_variable done_signal;
+        std::deque<std::size_t> done;
+
+        void start_backend() {
+        #if XVPROC_IO_URING
+            if (ring or pool) {return;}
+            if (allow_ring) {
+                ring = std::make_unique<io_ring>();
+                if (ring->open(max_requests)) {return;}
+                ring.reset();
+            }
+        #endif
+            if (not pool) {pool = std::make_unique<thread_pool>(4);}
+        }
+
+        // Исполнение запроса в потоке пула
+        void transfer(std::size_t index) {
+            request &r = requests[index];
+            char *data = reinterpret_cast<char *>(r.cells);
+            std::size_t total = r.count * sizeof(int);
+            std::size_t done_bytes = 0;
+            long long bytes = 0;
+            while (done_bytes < total) {
+                off_t at = static_cast<off_t>(r.offset * sizeof(int) + done_bytes);
+                ssize_t n = r.read ? pread(file, data + done_bytes, total - done_bytes, at)
+                                   : pwrite(file, data + done_bytes, total - done_bytes, at);
+                if (n < 0 and errno == EINTR) {continue;}
+                if (n < 0) {bytes = -errno; break;}
+                if (n == 0) {break;}
+                done_bytes += n;
+                bytes = static_cast<long long>(done_bytes);
+            }
+            r.bytes = bytes;
+            std::lock_guard<std::mutex> guard(done_lock);
+            done.push_back(index);
+            done_signal.notify_one();
+        }
+
+        // Завершение запроса в потоке процессора: чтение дополняется нулями и переносится из буфера в ОЗУ
+        void complete(std::size_t index) {
+            request &r = requests[index];
+            in_flight--;
+            if (r.read and r.bytes > 0) {
+                std::size_t words = (static_cast<std::size_t>(r.bytes) + sizeof(int) - 1) / sizeof(int);
+                std::size_t tail = static_cast<std::size_t>(r.bytes) % sizeof(int);
+                if (tail != 0) {std::memset(reinterpret_cast<char *>(r.cells) + r.bytes, 0, sizeof(int) - tail);}
+                if (not r.bounce.empty()) {
+                    const int *from = r.bounce.data();
+                    ram->write_spans(r.adr, words, [&from](int *to, std::size_t n) {
+                        std::memcpy(to, from, n * sizeof(int));
+                        from += n;
+                        return n;
+                    });
+                }
+            }
+            ready.push_back(index);
+        }
+
+        // Перенос завершённых запросов в ready, wait - ждать хотя бы одного
+        void harvest(bool wait) {
+            if (in_flight == 0) {return;}
+        #if XVPROC_IO_URING
+            if (ring) {
+                std::uint64_t user;
+                int bytes;
+                while (ring->pop(user, bytes, wait)) {
+                    requests[user].bytes = bytes;
+                    complete(user);
+                    wait = false;
+                    if (in_flight == 0) {break;}
+                }
+                return;
+            }
+        #endif
+            std::deque<std::size_t> finished;
+            {
+                std::unique_lock<std::mutex> guard(done_lock);
+                if (wait) {done_signal.wait(guard, [this]() {return not done.empty();});}
+                finished.swap(done);
+            }
+            for (std::size_t index : finished) {complete(index);}
+        }
+
+        void submit(bool read) {
+            if (file < 0 or params.size() < 4 or (read and mode == 2) or (not read and mode == 1)) {
+                return_state = -2;
+                params.clear();
+                return;
+            }
+            int id = params[params.size() - 4];
+            long long adr = params[params.size() - 3];
+            long long count = params[params.size() - 2];
+            long long offset = params[params.size() - 1];
+            params.clear();
+            std::size_t index = 0;
+            while (index < max_requests and requests[index].busy) {index++;}
+            if (adr < 0 or count <= 0 or offset < 0 or static_cast<std::size_t>(adr + count) > ram_size
+                or (read and static_cast<std::size_t>(adr) < code_limit) or index == max_requests) {
+                return_state = -2;
+                return;
+            }
+            request &r = requests[index];
+            r.busy = true;
+            r.read = read;
+            r.id = id;
+            r.adr = static_cast<std::size_t>(adr);
+            r.count = static_cast<std::size_t>(count);
+            r.offset = static_cast<std::uint64_t>(offset);
+            r.bytes = 0;
+            if (ram->data() != nullptr) {
+                r.cells = ram->data() + r.adr;
+                r.bounce.clear();
+            } else {
+                // Страничное ОЗУ не терпит доступа из других потоков: запись берёт копию сейчас, чтение переносится в complete()
+                r.bounce.assign(r.count, 0);
+                r.cells = r.bounce.data();
+                if (not read) {
+                    int *to = r.bounce.data();
+                    ram->read_spans(r.adr, r.count, [&to](const int *from, std::size_t n) {
+                        std::memcpy(to, from, n * sizeof(int));
+                        to += n;
+                    });
+                }
+            }
+            r.io.iov_base = r.cells;
+            r.io.iov_len = r.count * sizeof(int);
+            in_flight++;
+        #if XVPROC_IO_URING
+            if (ring) {
+                ring->submit(read, file, &r.io, r.offset * sizeof(int), index);
+                return;
+            }
+        #endif
+            pool->submit([this, index]() {transfer(index);});
+        }
+
+        void wait_all() {
+            while (in_flight > 0) {harvest(true);}
+        }
+
+        void close_file() {
+            wait_all();
+            for (auto &r : requests) {
+                r.busy = false;
+                r.bounce.clear();
+            }
+            ready.clear();
+            has_result = false;
+            params.clear();
+            if (file >= 0) {close(file);}
+            file = -1;
+            mode = 0;
+        }
+
+        void take(int &answer) {
+            if (has_result) {
+                answer = result;
+                has_result = false;
+                return;
+            }
+            harvest(false);
+            if (ready.empty()) {
+                answer = -1;
+                return;
+            }
+            request &r = requests[ready.front()];
+            ready.pop_front();
+            r.busy = false;
+            answer = r.id;
+            result = r.bytes < 0 ? -1 : static_cast<int>((r.bytes + sizeof(int) - 1) / sizeof(int));
+            has_result = true;
+        }
+
+    public:
+        // ram - ОЗУ процессора размером size, code_size - область программы, в которую чтение запрещено
+        // use_ring - пробовать io_uring (false - всегда пул потоков)
+        async_file(std::shared_ptr<cpu_unit::memory> memory, std::size_t size, std::size_t code_size, bool use_ring = true)
+            : ram(std::move(memory)), ram_size(size), code_limit(code_size), allow_ring(use_ring) {}
+
+        async_file(const async_file &) = delete;
+        async_file &operator=(const async_file &) = delete;
+
+        void send_value(int value) override {
+            if (file < 0) {
+                filename += char(value);
+                return;
+            }
+            params.push_back(value);
+            if (params.size() > 4) {params.erase(params.begin());}
+        }
+
+        void send_signal(int value) override {
+            switch (value) {
+                case 0:
+                    close_file();
+                    filename.clear();
+                    return_state = 0;
+                    break;
+                case 1:
+                case 2:
+                case 3: {
+                    if (file >= 0) {
+                        return_state = -2;
+                        break;
+                    }
+                    int flags = value == 1 ? O_RDONLY : value == 2 ? O_WRONLY | O_CREAT | O_TRUNC : O_RDWR | O_CREAT;
+                    file = open(filename.c_str(), flags | O_CLOEXEC, 0644);
+                    filename.clear();
+                    if (file < 0) {
+                        return_state = -1;
+                        break;
+                    }
+                    mode = value;
+                    start_backend();
+                    return_state = 0;
+                    break;
+                }
+                case 4:
+                case 5:
+                    submit(value == 4);
+                    break;
+                case 6:
+                    if (ready.empty()) {harvest(true);}
+                    break;
+                default:
+                    return_state = -3;
+            }
+        }
+
+        void ret_value(int &answer) override {
+            take(answer);
+        }
+
+        // Ошибка последней команды или количество завершённых запросов
+        void ret_signal(int &answer) override {
+            if (return_state < 0) {
+                answer = return_state;
+                return_state = 0;
+                return;
+            }
+            harvest(false);
+            answer = static_cast<int>(ready.size());
+        }
+
+        // Забирает запросы парами id, результат; меньше count - завершённых запросов больше нет
+        std::size_t ret_block(int *data, std::size_t count) override {
+            std::size_t got = 0;
+            while (got < count) {
+                if (not has_result) {
+                    harvest(false);
+                    if (ready.empty()) {break;}
+                }
+                take(data[got++]);
+            }
+            return got;
+        }
+
+        // Открытый файл и запросы в снимок не переносятся, переносится набранное имя файла и параметры
+        void save_state(state_writer &out) override {
+            if (file >= 0) {throw std::runtime_error("Cannot snapshot port 2 with an open file");}
+            out.put_string(filename);
+            out.put(return_state);
+            out.put(static_cast<long long>(params.size()));
+            for (int v : params) {out.put(v);}
+        }
+
+        void load_state(state_reader &in) override {
+            close_file();
+            filename = in.get_string();
+            return_state = static_cast<int>(in.get());
+            params.resize(static_cast<std::size_t>(in.get(0, 4)));
+            for (int &v : params) {v = static_cast<int>(in.get());}
+        }
+
+        // Запросы пишут в ОЗУ, поэтому порт не переживает их: закрытие ждёт все
+        ~async_file() override {
+            close_file();
+        }
+    };
+}
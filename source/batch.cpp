@@ -0,0 +1,206 @@
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "core.hpp"
+#include "thread_pool.hpp"
+
+// Пакетный запуск множества независимых программ в одном процессе
+// Запуск: xvbatch jobs.txt [-threads N] [-predecode | -threaded | -jit] [-nofusion] [-trusted [-lean]] [-paged] [-limit N] [-timeout S]
+// Каждая строка jobs.txt - задача: program ram_size [stdin_file] [stdout_file]
+// "-" вместо stdin_file - пустой ввод, вместо stdout_file (или без него) - вывод в stdout после всех задач в порядке строк
+// Пустые строки и строки с # пропускаются
+// Каждая программа загружается один раз и только читается всеми её задачами,
+// терминал каждой задачи работает со своими буферами в памяти, задачи исполняются пулом потоков с кражей работы
+// -limit и -timeout ограничивают каждую задачу: зациклившаяся задача останавливается с ошибкой и не держит поток
+// С -trusted -lean программы без setl исполняются ядром lean_core без проверок amin и отладочных режимов
+// (setl, который программа построит в своём коде во время работы, остановит её исключением)
+
+struct job {
+  std::string program;
+  std::size_t ram_size;
+  std::string input;
+  std::string output;
+};
+
+// Загруженная программа, общая для всех её задач
+struct shared_program {
+  std::vector<int> words;
+  std::unique_ptr<loader_unit::program_image> image;
+  bool uses_bounds = true; // Может включить границы amin (см. cpu_unit::program_uses_bounds)
+};
+
+struct job_result {
+  std::string output;
+  std::string error;
+};
+
+struct core_options {
+  cpu_unit::Engine engine = cpu_unit::Engine::SWITCH;
+  bool fusion = true;
+  bool trusted = false;
+  bool lean = false;
+  bool paged = false;
+  cpu_unit::run_limits limits;
+};
+
+std::vector<job> read_jobs(const std::string &filename) {
+  std::ifstream f(filename);
+  if (not f) {throw std::runtime_error("Cannot open job list " + filename);}
+  std::vector<job> jobs;
+  std::string line;
+  for (std::size_t number = 1; std::getline(f, line); number++) {
+    std::istringstream fields(line);
+    job j;
+    if (not (fields >> j.program) or j.program[0] == '#') {continue;}
+    if (not (fields >> j.ram_size)) {
+      throw std::runtime_error("Bad job at line " + std::to_string(number));
+    }
+    if (not (fields >> j.input)) {j.input = "-";}
+    if (not (fields >> j.output)) {j.output = "-";}
+    jobs.push_back(j);
+  }
+  return jobs;
+}
+
+std::string read_file(const std::string &filename) {
+  if (filename == "-") {return "";}
+  std::ifstream f(filename, std::ios::binary);
+  if (not f) {throw std::runtime_error("Cannot open input " + filename);}
+  std::ostringstream content;
+  content << f.rdbuf();
+  return content.str();
+}
+
+template <typename Core>
+void run_job(const job &j, const shared_program &program, const core_options &options, job_result &result) {
+  try {
+    std::istringstream in(read_file(j.input));
+    std::ostringstream out;
+    {
+      Core cpu;
+      cpu.set_terminal(in, out);
+      if (options.paged) {cpu.set_memory_mode(cpu_unit::MemoryMode::PAGED);}
+      if (program.image) {
+        cpu.init(*program.image, j.ram_size);
+      } else {
+        cpu.init(program.words, j.ram_size);
+      }
+      cpu.set_engine(options.engine);
+      cpu.set_fusion(options.fusion);
+      if (options.trusted) {cpu.set_trusted(true);}
+      cpu_unit::run_result run = cpu.start_process(false, options.limits);
+      if (run.reason == cpu_unit::ExitReason::BUDGET or run.reason == cpu_unit::ExitReason::DEADLINE) {
+        result.error = std::string(cpu_unit::exit_reason_name(run.reason)) + " after " + std::to_string(run.instructions) + " instructions";
+      }
+    }
+    if (j.output == "-") {
+      result.output = out.str();
+    } else {
+      std::ofstream f(j.output, std::ios::binary | std::ios::trunc);
+      if (not (f << out.str())) {throw std::runtime_error("Cannot write output " + j.output);}
+    }
+  } catch (std::exception &e) {
+    result.error = e.what();
+  }
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    std::cerr << "Invalid arguments\n";
+    std::cout << "Usage: " << argv[0] << " jobs.txt [-threads N] [-predecode | -threaded | -jit] [-nofusion] [-trusted [-lean]] [-paged] [-limit N] [-timeout S]\n";
+    return 1;
+  }
+  std::size_t thread_count = 0;
+  core_options options;
+  for (int i = 2; i < argc; i++) {
+    if (std::strcmp(argv[i], "-threads") == 0 and i + 1 < argc) {
+      thread_count = std::stoul(argv[++i]);
+    } else if (std::strcmp(argv[i], "-predecode") == 0) {
+      options.engine = cpu_unit::Engine::PREDECODED;
+    } else if (std::strcmp(argv[i], "-threaded") == 0) {
+      options.engine = cpu_unit::Engine::THREADED;
+    } else if (std::strcmp(argv[i], "-jit") == 0) {
+      options.engine = cpu_unit::Engine::JIT;
+    } else if (std::strcmp(argv[i], "-nofusion") == 0) {
+      options.fusion = false;
+    } else if (std::strcmp(argv[i], "-trusted") == 0) {
+      options.trusted = true;
+    } else if (std::strcmp(argv[i], "-lean") == 0) {
+      options.lean = true;
+    } else if (std::strcmp(argv[i], "-paged") == 0) {
+      options.paged = true;
+    } else if (std::strcmp(argv[i], "-limit") == 0 and i + 1 < argc) {
+      options.limits.instructions = std::stoll(argv[++i]);
+    } else if (std::strcmp(argv[i], "-timeout") == 0 and i + 1 < argc) {
+      options.limits.seconds = std::stod(argv[++i]);
+    } else {
+      std::cerr << "Unknown flag: " << argv[i] << "\n";
+      return 1;
+    }
+  }
+  if (options.lean and not options.trusted) {
+    std::cerr << "-lean needs -trusted\n";
+    return 1;
+  }
+
+  std::vector<job> jobs;
+  std::map<std::string, std::unique_ptr<shared_program>> programs;
+  try {
+    jobs = read_jobs(argv[1]);
+    // Каждая программа разбирается один раз
+    for (auto &j : jobs) {
+      std::unique_ptr<shared_program> &p = programs[j.program];
+      if (p) {continue;}
+      p = std::make_unique<shared_program>();
+      if (loader_unit::is_image(j.program)) {
+        p->image = std::make_unique<loader_unit::program_image>(j.program);
+        const loader_unit::program_image &image = *p->image;
+        p->uses_bounds = cpu_unit::program_uses_bounds([&image](std::size_t i) {return image.code_word(i);}, image.header().code_words)
+                         or cpu_unit::program_uses_bounds([&image](std::size_t i) {return image.data_word(i);}, image.header().data_words);
+      } else {
+        loader_unit::load_text_program(j.program, p->words);
+        const std::vector<int> &words = p->words;
+        p->uses_bounds = cpu_unit::program_uses_bounds([&words](std::size_t i) {return words[i];}, words.size());
+      }
+    }
+  } catch (std::runtime_error &e) {
+    std::cerr << e.what() << "\n";
+    return 2;
+  }
+
+  std::vector<job_result> results(jobs.size());
+  auto start = std::chrono::steady_clock::now();
+  {
+    utility_units::thread_pool pool(thread_count);
+    for (std::size_t i = 0; i < jobs.size(); i++) {
+      const shared_program &program = *programs[jobs[i].program];
+      if (options.lean and not program.uses_bounds) {
+        pool.submit([&jobs, &program, &options, &results, i]() {run_job<cpu_unit::lean_core>(jobs[i], program, options, results[i]);});
+      } else {
+        pool.submit([&jobs, &program, &options, &results, i]() {run_job<cpu_unit::core>(jobs[i], program, options, results[i]);});
+      }
+    }
+    pool.wait();
+    thread_count = pool.size();
+  }
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+  std::size_t failed = 0;
+  for (std::size_t i = 0; i < jobs.size(); i++) {
+    std::cout << results[i].output;
+    if (not results[i].error.empty()) {
+      failed++;
+      std::cerr << "job " << i << " (" << jobs[i].program << "): " << results[i].error << "\n";
+    }
+  }
+  std::cout.flush();
+  std::cerr << jobs.size() << " jobs, " << failed << " failed, " << thread_count << " threads, "
+            << elapsed.count() << " s\n";
+  return failed == 0 ? 0 : 3;
+}
@@ -0,0 +1,681 @@
+#include <chrono>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <thread>
+#include "machine.hpp"
+
+// Замер скорости движков исполнения на синтетической программе без обращения к портам
+// Запуск: xvprocbench [iterations] [startup_words]
+
+// Программа-цикл по r1 от 0 до iterations с арифметикой над r3, r4, r5 (без переполнений)
+// Возвращает программу, в count записывает количество исполняемых инструкций
+std::vector<int> make_loop_program(int iterations, long long &count) {
+  std::vector<int> program = {
+    22, 1, 0, 0,           // 0:  loc  r1 0
+    22, 2, iterations, 0,  // 4:  loc  r2 iterations
+    22, 7, 3, 0,           // 8:  loc  r7 3
+    20, 3, 1, 1,           // 12: add  r3 r1 r1
+    23, 4, 3, 1,           // 16: sub  r4 r3 r1
+    24, 5, 4, 7,           // 20: mult r5 r4 r7
+    21, 1, 1, 1,           // 24: addc r1 r1 1
+    30, 1, 2, 0,           // 28: cmp  r1 r2
+    31, -1, 12, 0,         // 32: jmp  < 12
+    0, 0, 0, 0             // 36: halt
+  };
+  count = 3 + 6LL * iterations + 1;
+  return program;
+}
+
+struct bench_result {
+  double seconds;
+  int checksum; // Свёртка регистров результата для сверки движков между собой
+};
+
+// Лучшее время из нескольких прогонов, чтобы меньше зависеть от шума планировщика
+template <typename Core>
+bench_result run_engine(cpu_unit::Engine engine, std::vector<int> &program, bool trusted, bool fusion, bool paged) {
+  bench_result best = {0, 0};
+  for (int attempt = 0; attempt < 3; attempt++) {
+    Core cpu;
+    if (paged) {cpu.set_memory_mode(cpu_unit::MemoryMode::PAGED);}
+    cpu.init(program, program.size() + 16);
+    cpu.set_engine(engine);
+    cpu.set_fusion(fusion);
+    if (trusted) {cpu.set_trusted(true);}
+    auto start = std::chrono::steady_clock::now();
+    cpu.start_process(false);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    if (attempt == 0 or elapsed.count() < best.seconds) {
+      best = {elapsed.count(), cpu.get_register(3) ^ cpu.get_register(4) ^ cpu.get_register(5) ^ cpu.get_register(1)};
+    }
+  }
+  return best;
+}
+
+// Параллельная программа: ядро 0 запускает cores - 1 ядер, каждое ядро (и само ядро 0)
+// делает iterations шагов цикла без общих данных и один раз прибавляет свой счётчик к ячейке 200 через fadd
+std::vector<int> make_parallel_program(int cores, int iterations) {
+  std::vector<int> program;
+  auto ins = [&program](int op, int a = 0, int b = 0, int c = 0) {program.insert(program.end(), {op, a, b, c});};
+  ins(22, 2, 0);                                     // loc   r2 worker (адрес ниже)
+  ins(22, 3, 0);                                     // loc   r3 0
+  for (int i = 1; i < cores; i++) {ins(73, 4, 2, 3);}  // spawn r4 r2 r3 (номера ядер 1..cores-1)
+  ins(22, 4, 0);                                     // loc   r4 0
+  std::size_t join_loop = program.size();
+  ins(21, 4, 4, 1);                                  // addc  r4 r4 1
+  ins(22, 5, cores);                                 // loc   r5 cores
+  ins(30, 4, 5);                                     // cmp   r4 r5
+  ins(31, 0, 0);                                     // jmp   = worker (ядро 0 тоже работает после join всех)
+  std::size_t after_join = program.size() - 4;
+  ins(74, 4);                                        // join  r4
+  ins(32, static_cast<int>(join_loop));              // goto  join_loop
+  std::size_t worker = program.size();
+  program[2] = static_cast<int>(worker);
+  program[after_join + 2] = static_cast<int>(worker);
+  ins(22, 1, 0);                                     // loc   r1 0
+  ins(22, 6, iterations);                            // loc   r6 iterations
+  ins(22, 7, 200);                                   // loc   r7 200
+  std::size_t loop = program.size();
+  ins(21, 1, 1, 1);                                  // addc  r1 r1 1
+  ins(30, 1, 6);                                     // cmp   r1 r6
+  ins(31, -1, static_cast<int>(loop));               // jmp   < loop
+  ins(71, 8, 7, 1);                                  // fadd  r8 r7 r1
+  ins(0);                                            // halt
+  return program;
+}
+
+// Масштабирование машины: одна и та же общая работа делится между 1..max_cores ядрами
+// Ядро 0 сначала дожидается остальных, потом делает свою часть, поэтому время - время всей работы
+void bench_cores(cpu_unit::Engine engine, int total_iterations, int max_cores) {
+  for (int cores = 1; cores <= max_cores; cores *= 2) {
+    std::vector<int> program = make_parallel_program(cores, total_iterations / cores);
+    machine_unit::machine m(cores);
+    m.boot().set_engine(engine);
+    m.init(program, 256);
+    auto start = std::chrono::steady_clock::now();
+    m.run(false);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << "machine " << cores << " cores: " << elapsed.count() << " s\n";
+  }
+}
+
+// Рекурсивное fib(n) в r2: native = true - на call/ret/push/pop/stkr,
+// false - те же действия со стеком через addc/strr/lodr/goto, как без стековых инструкций
+std::vector<int> make_fib_program(int n, bool native) {
+  std::vector<int> program;
+  std::vector<std::size_t> fib_refs; // Операнды с адресом fib
+  auto ins = [&program](int op, int a = 0, int b = 0, int c = 0) {program.insert(program.end(), {op, a, b, c});};
+  auto call_fib = [&]() {
+    if (native) {
+      fib_refs.push_back(program.size() + 1);
+      ins(62, 0);                                            // call  fib
+      return;
+    }
+    ins(21, 15, 15, -1);                                     // addc  r15 r15 -1
+    ins(22, 12, static_cast<int>(program.size()) + 12);      // loc   r12 return
+    ins(8, 15, 12);                                          // strr  r15 r12
+    fib_refs.push_back(program.size() + 1);
+    ins(32, 0);                                              // goto  fib
+  };
+  auto push = [&](int reg) {
+    if (native) {ins(60, reg); return;}                      // push  reg
+    ins(21, 15, 15, -1);                                     // addc  r15 r15 -1
+    ins(8, 15, reg);                                         // strr  r15 reg
+  };
+  auto pop = [&](int reg) {
+    if (native) {ins(61, reg); return;}                      // pop   reg
+    ins(6, reg, 15);                                         // lodr  reg r15
+    ins(21, 15, 15, 1);                                      // addc  r15 r15 1
+  };
+  auto ret = [&]() {
+    if (native) {ins(63); return;}                           // ret
+    pop(12);
+    ins(21, 14, 12, -4);                                     // addc  r14 r12 -4 (переход на r12)
+  };
+  ins(22, 1, n);                                             // loc   r1 n
+  call_fib();
+  ins(0);                                                    // halt
+  std::size_t fib = program.size();
+  ins(22, 3, 2);                                             // fib: loc r3 2
+  ins(30, 1, 3);                                             // cmp   r1 r3
+  std::size_t base_jump = program.size();
+  ins(31, -1, 0);                                            // jmp   < base
+  push(1);
+  ins(21, 1, 1, -1);                                         // addc  r1 r1 -1
+  call_fib();                                                // r2 = fib(n - 1)
+  push(2);
+  if (native) {
+    ins(64, 1, 1);                                           // stkr  r1 1 (n)
+  } else {
+    ins(21, 12, 15, 1);                                      // addc  r12 r15 1
+    ins(6, 1, 12);                                           // lodr  r1 r12
+  }
+  ins(21, 1, 1, -2);                                         // addc  r1 r1 -2
+  call_fib();                                                // r2 = fib(n - 2)
+  pop(4);
+  ins(20, 2, 2, 4);                                          // add   r2 r2 r4
+  pop(1);
+  ret();
+  program[base_jump + 2] = static_cast<int>(program.size());
+  ins(9, 2, 1);                                              // base: mov r2 r1
+  ret();
+  for (std::size_t ref : fib_refs) {program[ref] = static_cast<int>(fib);}
+  return program;
+}
+
+// Вызовы функций: fib(n) на стековых инструкциях и на их эмуляции обычными инструкциями
+void bench_calls(int n) {
+  for (cpu_unit::Engine engine : {cpu_unit::Engine::SWITCH, cpu_unit::Engine::THREADED}) {
+    for (bool native : {false, true}) {
+      std::vector<int> program = make_fib_program(n, native);
+      double best = 0;
+      int result = 0;
+      for (int attempt = 0; attempt < 3; attempt++) {
+        cpu_unit::core cpu;
+        cpu.init(program, program.size() + 4096);
+        cpu.set_engine(engine);
+        auto start = std::chrono::steady_clock::now();
+        cpu.start_process(false);
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        if (attempt == 0 or elapsed.count() < best) {best = elapsed.count();}
+        result = cpu.get_register(2);
+      }
+      std::cout << "fib(" << n << ") " << (engine == cpu_unit::Engine::SWITCH ? "switch" : "threaded")
+                << (native ? ", call/ret: " : ", emulated calls: ") << best << " s (result " << result << ")\n";
+    }
+  }
+}
+
+// Цена таймера: тот же цикл без таймера и с таймером, чей обработчик (за halt) сразу делает iret
+void bench_timer(int iterations) {
+  long long count;
+  std::vector<int> program = make_loop_program(iterations, count);
+  const int handler = static_cast<int>(program.size());
+  program.insert(program.end(), {82, 0, 0, 0});  // iret
+  for (cpu_unit::Engine engine : {cpu_unit::Engine::THREADED, cpu_unit::Engine::JIT}) {
+    for (long long period : {0LL, 10000LL, 100LL}) {
+      double best = 0;
+      for (int attempt = 0; attempt < 3; attempt++) {
+        cpu_unit::core cpu;
+        cpu.init(program, program.size() + 16);
+        cpu.set_engine(engine);
+        cpu.set_register(13, handler);
+        cpu.set_timer(period);
+        auto start = std::chrono::steady_clock::now();
+        cpu.start_process(false);
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        if (attempt == 0 or elapsed.count() < best) {best = elapsed.count();}
+      }
+      std::cout << (engine == cpu_unit::Engine::JIT ? "jit" : "threaded") << " timer "
+                << (period == 0 ? std::string("off") : "every " + std::to_string(period)) << ": "
+                << count / best / 1e6 << " Minstr/s (" << best << " s)\n";
+    }
+  }
+}
+
+// Цена профилирования: цикл на движке с кэшем без профилировщика и с ним, шитый движок для сравнения
+void bench_profile(int iterations) {
+  long long count;
+  std::vector<int> program = make_loop_program(iterations, count);
+  struct {const char *name; cpu_unit::Engine engine; bool profiled;} runs[] = {
+    {"threaded", cpu_unit::Engine::THREADED, false},
+    {"predecoded", cpu_unit::Engine::PREDECODED, false},
+    {"predecoded, profiled", cpu_unit::Engine::PREDECODED, true},
+    {"switch, profiled", cpu_unit::Engine::SWITCH, true},
+  };
+  for (auto &r : runs) {
+    double best = 0;
+    for (int attempt = 0; attempt < 3; attempt++) {
+      cpu_unit::core cpu;
+      cpu.set_profiling(r.profiled);
+      cpu.init(program, program.size() + 16);
+      cpu.set_engine(r.engine);
+      auto start = std::chrono::steady_clock::now();
+      cpu.start_process(false);
+      std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+      if (attempt == 0 or elapsed.count() < best) {best = elapsed.count();}
+    }
+    std::cout << "profile bench " << r.name << ": " << count / best / 1e6 << " Minstr/s (" << best << " s)\n";
+  }
+}
+
+// Цена записи трассы исполнения: цикл без трассы, с трассой в файл и её воспроизведение
+void bench_trace(int iterations) {
+  long long count;
+  std::vector<int> program = make_loop_program(iterations, count);
+  std::string name = (std::filesystem::temp_directory_path() / "xvprocbench.trace").string();
+  struct {const char *name; cpu_unit::Engine engine; int mode;} runs[] = {
+    {"predecoded", cpu_unit::Engine::PREDECODED, 0},
+    {"predecoded, traced", cpu_unit::Engine::PREDECODED, 1},
+    {"predecoded, replayed", cpu_unit::Engine::PREDECODED, 2},
+  };
+  for (auto &r : runs) {
+    double best = 0;
+    for (int attempt = 0; attempt < 3; attempt++) {
+      cpu_unit::core cpu;
+      if (r.mode == 1) {cpu.set_trace(name);}
+      if (r.mode == 2) {cpu.set_replay(name);}
+      cpu.init(program, program.size() + 16);
+      cpu.set_engine(r.engine);
+      auto start = std::chrono::steady_clock::now();
+      cpu.start_process(false);
+      if (r.mode == 2) {cpu.check_replay();}
+      std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+      if (attempt == 0 or elapsed.count() < best) {best = elapsed.count();}
+    }
+    std::cout << "trace bench " << r.name << ": " << count / best / 1e6 << " Minstr/s (" << best << " s)\n";
+  }
+  std::filesystem::remove(name);
+}
+
+// Программа с долгой подготовкой: заполняет words ячеек после себя и останавливается,
+// затем (продолжение после halt) пишет r4 в каждую stride-ю из них и снова останавливается
+std::vector<int> make_prefix_program(int words, int stride) {
+  const int base = 68;  // a и b лежат за кодом обоих вариантов
+  std::vector<int> program = {
+    22, 1, base, 0,          // 0:  loc  r1 base
+    22, 2, base + words, 0,  // 4:  loc  r2 base + words
+    8, 1, 1, 0,              // 8:  strr r1 r1
+    21, 1, 1, 1,             // 12: addc r1 r1 1
+    30, 1, 2, 0,             // 16: cmp  r1 r2
+    31, -1, 8, 0,            // 20: jmp  < 8
+    0, 0, 0, 0,              // 24: halt (конец подготовки)
+    22, 1, base, 0,          // 28: loc  r1 base
+    22, 3, stride, 0,        // 32: loc  r3 stride
+    8, 1, 4, 0,              // 36: strr r1 r4
+    20, 1, 1, 3,             // 40: add  r1 r1 r3
+    30, 1, 2, 0,             // 44: cmp  r1 r2
+    31, -1, 36, 0,           // 48: jmp  < 36
+    0, 0, 0, 0               // 52: halt
+  };
+  program.resize(base, 0);
+  return program;
+}
+
+// Множество вариантов одного начала: каждый вариант заново проходит подготовку или клонирует подготовленное ядро
+// Клон делит страницы ОЗУ с оригиналом и копирует только те, в которые пишет вариант
+void bench_clone(int words, int variants) {
+  const int stride = 64 * static_cast<int>(cpu_unit::memory::page_words);
+  std::vector<int> program = make_prefix_program(words, stride);
+  std::size_t ram_size = program.size() + words + 16;
+  auto measure = [](auto &&run) {
+    double best = 0;
+    for (int attempt = 0; attempt < 3; attempt++) {
+      auto start = std::chrono::steady_clock::now();
+      run();
+      std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+      if (attempt == 0 or elapsed.count() < best) {best = elapsed.count();}
+    }
+    return best;
+  };
+  long long checksum_reinit = 0;
+  long long checksum_clone[2] = {};
+  double reinit_time = measure([&]() {
+    checksum_reinit = 0;
+    for (int v = 0; v < variants; v++) {
+      cpu_unit::core cpu;
+      cpu.set_memory_mode(cpu_unit::MemoryMode::PAGED);
+      cpu.init(program, ram_size);
+      cpu.set_engine(cpu_unit::Engine::THREADED);
+      cpu.start_process(false);
+      cpu.set_register(14, 28);
+      cpu.set_register(4, v);
+      cpu.start_process(false);
+      checksum_reinit += cpu.shared_memory()->get_from_memory(program.size()) + cpu.get_register(1);
+    }
+  });
+  // Подготовленное ядро с плоским ОЗУ при первом клоне переводит его в страничное и дальше делит страницы так же
+  double clone_time[2] = {};
+  const cpu_unit::MemoryMode modes[2] = {cpu_unit::MemoryMode::PAGED, cpu_unit::MemoryMode::FLAT};
+  for (int k = 0; k < 2; k++) {
+    cpu_unit::core prepared;
+    prepared.set_memory_mode(modes[k]);
+    prepared.init(program, ram_size);
+    prepared.set_engine(cpu_unit::Engine::THREADED);
+    prepared.start_process(false);
+    clone_time[k] = measure([&]() {
+      long long checksum = 0;
+      for (int v = 0; v < variants; v++) {
+        cpu_unit::core cpu;
+        cpu.clone_from(prepared);
+        cpu.set_register(4, v);
+        cpu.start_process(false);
+        checksum += cpu.shared_memory()->get_from_memory(program.size()) + cpu.get_register(1);
+      }
+      checksum_clone[k] = checksum;
+    });
+  }
+  std::cout << "clone " << variants << " variants of " << words << " prepared words: re-init " << reinit_time * 1e3
+            << " ms, clone " << clone_time[0] * 1e3 << " ms, clone from flat RAM " << clone_time[1] * 1e3 << " ms"
+            << (checksum_reinit == checksum_clone[0] and checksum_reinit == checksum_clone[1] ? "" : " RESULT MISMATCH") << "\n";
+}
+
+// Программа копирования файла filename в терминал через порт 1 (fileunit)
+// bulk = false - по символу на prtg/prts, bulk = true - блоками по 4096 через prtr/prtw
+std::vector<int> make_copy_program(const std::string &filename, bool bulk, std::size_t &ram_size) {
+  std::vector<int> program;
+  auto ins = [&program](int op, int a = 0, int b = 0, int c = 0) {program.insert(program.end(), {op, a, b, c});};
+  for (char ch : filename) {
+    ins(22, 1, static_cast<unsigned char>(ch));  // loc  r1 ch
+    ins(50, 1, 1);                               // prts r1 1 (имя файла)
+  }
+  ins(51, 1, 1);                                 // prcs 1 1 (открыть для чтения)
+  const int block = 4096;
+  std::size_t loop = program.size();
+  std::size_t exit_jump;
+  if (bulk) {
+    ins(22, 2, 0);                               // loc  r2 buffer (адрес ниже)
+    loop = program.size();
+    ins(22, 3, block);                           // loc  r3 block
+    ins(55, 2, 3, 1);                            // prtr r2 r3 1
+    ins(22, 4, 0);                               // loc  r4 0
+    ins(30, 3, 4);                               // cmp  r3 r4
+    exit_jump = program.size();
+    ins(31, 0, 0);                               // jmp  = end
+    ins(54, 2, 3, 0);                            // prtw r2 r3 0
+  } else {
+    ins(52, 1, 1);                               // prtg r1 1
+    ins(22, 2, -1);                              // loc  r2 -1
+    ins(30, 1, 2);                               // cmp  r1 r2
+    exit_jump = program.size();
+    ins(31, 0, 0);                               // jmp  = end
+    ins(50, 1, 0);                               // prts r1 0
+  }
+  ins(32, static_cast<int>(loop));               // goto loop
+  program[exit_jump + 2] = static_cast<int>(program.size());
+  ins(0);                                        // halt
+  std::size_t buffer = program.size();
+  if (bulk) {program[loop - 4 + 2] = static_cast<int>(buffer);}
+  ram_size = buffer + block + 16;
+  return program;
+}
+
+// Копирование файла размером bytes через ВМ посимвольно и блоками
+void bench_copy(std::size_t bytes) {
+  std::string name = (std::filesystem::temp_directory_path() / "xvprocbench_copy.bin").string();
+  std::string content(bytes, '\0');
+  for (std::size_t i = 0; i < bytes; i++) {content[i] = static_cast<char>((i * 7919) >> 3);}
+  {
+    std::ofstream f(name, std::ios::binary);
+    f.write(content.data(), content.size());
+  }
+  for (bool bulk : {false, true}) {
+    std::size_t ram_size;
+    std::vector<int> program = make_copy_program(name, bulk, ram_size);
+    std::istringstream in;
+    std::ostringstream out;
+    cpu_unit::core cpu;
+    cpu.set_terminal(in, out);
+    cpu.init(program, ram_size);
+    cpu.set_engine(cpu_unit::Engine::THREADED);
+    auto start = std::chrono::steady_clock::now();
+    cpu.start_process(false);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << "copy " << bytes << " bytes " << (bulk ? "by blocks (prtr/prtw)" : "by characters (prtg/prts)") << ": "
+              << elapsed.count() << " s, " << bytes / elapsed.count() / 1e6 << " MB/s"
+              << (out.str() == content ? "" : " RESULT MISMATCH") << "\n";
+  }
+  std::filesystem::remove(name);
+}
+
+// Чтение файла в ОЗУ кусками по chunk ячеек: синхронный fileunit (prtr) против асинхронного порта
+// с несколькими запросами в полёте (io_uring и пул потоков)
+void bench_async_read(std::size_t words, std::size_t chunk) {
+  std::string name = (std::filesystem::temp_directory_path() / "xvprocbench_async.bin").string();
+  {
+    std::vector<int> content(words);
+    for (std::size_t i = 0; i < words; i++) {content[i] = static_cast<int>(i * 2654435761u);}
+    std::ofstream f(name, std::ios::binary);
+    f.write(reinterpret_cast<const char *>(content.data()), content.size() * sizeof(int));
+  }
+  auto report = [words](const char *what, double seconds) {
+    std::cout << "file read " << what << ": " << words * sizeof(int) / seconds / 1e6 << " MB/s\n";
+  };
+  {
+    // fileunit отдаёт байт на ячейку, поэтому ему нужно в 4 раза больше ячеек
+    std::vector<int> buffer(chunk * sizeof(int));
+    utility_units::fileunit port;
+    for (char c : name) {port.send_value(c);}
+    port.send_signal(1);
+    auto start = std::chrono::steady_clock::now();
+    while (port.ret_block(buffer.data(), buffer.size()) == buffer.size()) {}
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    report("sync (fileunit, prtr)", elapsed.count());
+  }
+  for (bool ring : {true, false}) {
+    const std::size_t depth = 8;
+    auto ram = std::make_shared<cpu_unit::memory>();
+    ram->init(chunk * depth);
+    utility_units::async_file port(ram, chunk * depth, 0, ring);
+    for (char c : name) {port.send_value(c);}
+    port.send_signal(1);
+    auto start = std::chrono::steady_clock::now();
+    std::size_t next = 0, finished = 0;
+    auto submit = [&](int slot) {
+      int params[4] = {slot, static_cast<int>(slot * chunk), static_cast<int>(chunk), static_cast<int>(next)};
+      for (int v : params) {port.send_value(v);}
+      port.send_signal(4);
+      next += chunk;
+    };
+    for (std::size_t slot = 0; slot < depth and next < words; slot++) {submit(static_cast<int>(slot));}
+    while (finished < next) {
+      port.send_signal(6);
+      int completion[2];
+      while (port.ret_block(completion, 2) == 2) {
+        finished += chunk;
+        if (next < words) {submit(completion[0]);}
+      }
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    report(ring ? "async (io_uring if available)" : "async (thread pool)", elapsed.count());
+  }
+  std::filesystem::remove(name);
+}
+
+// Векторные инструкции: a[i] += b[i] и сумма a по words ячейкам, repeats раз,
+// циклом из lodr/add/strr против vadd/vsum на каждом наборе ядер
+// Возвращает код программы (массивы лежат в ОЗУ за ним), в count записывает количество исполняемых инструкций
+std::vector<int> make_vector_program(int words, int repeats, bool vector, long long &count) {
+  const int base = 68;  // a и b лежат за кодом обоих вариантов
+  std::vector<int> program;
+  if (vector) {
+    program = {
+      22, 9, repeats, 0,       // 0:  loc   r9 repeats
+      22, 1, base, 0,          // 4:  loc   r1 a
+      22, 2, base + words, 0,  // 8:  loc   r2 b
+      22, 3, words, 0,         // 12: loc   r3 words
+      90, 1, 2, 3,             // 16: vadd  r1 r2 r3
+      95, 12, 1, 3,            // 20: vsum  r12 r1 r3
+      20, 10, 10, 12,          // 24: add   r10 r10 r12
+      21, 8, 8, 1,             // 28: addc  r8 r8 1
+      30, 8, 9, 0,             // 32: cmp   r8 r9
+      31, -1, 16, 0,           // 36: jmp   < 16
+      0, 0, 0, 0               // 40: halt
+    };
+    count = 4 + 6LL * repeats + 1;
+  } else {
+    program = {
+      22, 9, repeats, 0,       // 0:  loc   r9 repeats
+      22, 1, base, 0,          // 4:  loc   r1 a
+      22, 2, base + words, 0,  // 8:  loc   r2 b
+      22, 3, base + words, 0,  // 12: loc   r3 a + words
+      6, 4, 1, 0,              // 16: lodr  r4 r1
+      6, 5, 2, 0,              // 20: lodr  r5 r2
+      20, 4, 4, 5,             // 24: add   r4 r4 r5
+      8, 1, 4, 0,              // 28: strr  r1 r4
+      20, 10, 10, 4,           // 32: add   r10 r10 r4
+      21, 1, 1, 1,             // 36: addc  r1 r1 1
+      21, 2, 2, 1,             // 40: addc  r2 r2 1
+      30, 1, 3, 0,             // 44: cmp   r1 r3
+      31, -1, 16, 0,           // 48: jmp   < 16
+      21, 8, 8, 1,             // 52: addc  r8 r8 1
+      30, 8, 9, 0,             // 56: cmp   r8 r9
+      31, -1, 4, 0,            // 60: jmp   < 4
+      0, 0, 0, 0               // 64: halt
+    };
+    count = 1 + repeats * (3 + 9LL * words + 3) + 1;
+  }
+  program.resize(base);
+  return program;
+}
+
+void bench_vector(int words, int repeats) {
+  struct {const char *name; bool vector; cpu_unit::Engine engine; cpu_unit::VectorLevel level;} runs[] = {
+    {"threaded, lodr/add/strr", false, cpu_unit::Engine::THREADED, cpu_unit::VectorLevel::SCALAR},
+    {"jit, lodr/add/strr", false, cpu_unit::Engine::JIT, cpu_unit::VectorLevel::SCALAR},
+    {"vadd/vsum, scalar", true, cpu_unit::Engine::THREADED, cpu_unit::VectorLevel::SCALAR},
+    {"vadd/vsum, sse4.1", true, cpu_unit::Engine::THREADED, cpu_unit::VectorLevel::SSE41},
+    {"vadd/vsum, avx2", true, cpu_unit::Engine::THREADED, cpu_unit::VectorLevel::AVX2},
+  };
+  cpu_unit::VectorLevel supported = cpu_unit::detect_vector_level();
+  int reference = 0;
+  bool first = true;
+  for (auto &r : runs) {
+    if (r.level > supported) {continue;}
+    long long count;
+    std::vector<int> program = make_vector_program(words, repeats, r.vector, count);
+    double best = 0;
+    int checksum = 0;
+    for (int attempt = 0; attempt < 3; attempt++) {
+      cpu_unit::core cpu;
+      cpu.init(program, program.size() + 2 * words);
+      for (int i = 0; i < words; i++) {
+        cpu.shared_memory()->set_to_memory(program.size() + i, i);
+        cpu.shared_memory()->set_to_memory(program.size() + words + i, 3 * i + 1);
+      }
+      cpu.set_engine(r.engine);
+      cpu.set_vector_level(r.level);
+      auto start = std::chrono::steady_clock::now();
+      cpu.start_process(false);
+      std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+      if (attempt == 0 or elapsed.count() < best) {best = elapsed.count();}
+      checksum = cpu.get_register(10);
+    }
+    if (first) {reference = checksum; first = false;}
+    std::cout << "vector bench " << r.name << ": " << static_cast<double>(words) * repeats / best / 1e6 << " Mcells/s ("
+              << best << " s, " << count << " instructions)" << (checksum == reference ? "" : " RESULT MISMATCH") << "\n";
+  }
+}
+
+// Вывод count символов через порт терминала: простой терминал на iostream против буферизованного на дескрипторе
+// Вывод идёт в /dev/null, замеряется только путь символа через порт
+void bench_terminal(std::size_t count) {
+  std::ofstream null_stream("/dev/null");
+  int null_fd = ::open("/dev/null", O_WRONLY);
+  if (not null_stream or null_fd < 0) {
+    std::cout << "terminal: /dev/null is not available\n";
+    return;
+  }
+  auto measure = [count](utility_units::virtual_port &port) {
+    auto start = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < count; i++) {port.send_value(i % 10 == 9 ? '\n' : 'a' + static_cast<int>(i % 10));}
+    port.flush();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+  };
+  {
+    utility_units::terminal port(std::cin, null_stream);
+    double seconds = measure(port);
+    std::cout << "terminal output (iostream): " << count / seconds / 1e6 << " Mchar/s\n";
+  }
+  {
+    utility_units::buffered_terminal port(0, null_fd);
+    double seconds = measure(port);
+    std::cout << "terminal output (buffered): " << count / seconds / 1e6 << " Mchar/s\n";
+  }
+  ::close(null_fd);
+}
+
+// Время старта (загрузка + init) большой программы из текста и из бинарного образа
+// Программа - цикл из make_loop_program, дополненный нулями до words ячеек
+void bench_startup(std::size_t words) {
+  long long count;
+  std::vector<int> program = make_loop_program(1, count);
+  program.resize(words, 0);
+  std::filesystem::path dir = std::filesystem::temp_directory_path();
+  std::string text_name = (dir / "xvprocbench_startup.txt").string();
+  std::string image_name = (dir / "xvprocbench_startup.xvi").string();
+  {
+    std::ofstream f(text_name);
+    for (int v : program) {f << v << "\n";}
+  }
+  loader_unit::write_image(image_name, program, 0);
+
+  auto measure = [](auto &&load) {
+    double best = 0;
+    for (int attempt = 0; attempt < 3; attempt++) {
+      auto start = std::chrono::steady_clock::now();
+      load();
+      std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+      if (attempt == 0 or elapsed.count() < best) {best = elapsed.count();}
+    }
+    return best;
+  };
+  double text_time = measure([&]() {
+    std::vector<int> loaded;
+    loader_unit::load_text_program(text_name, loaded);
+    cpu_unit::core cpu;
+    cpu.init(loaded, words + 16);
+  });
+  double image_time = measure([&]() {
+    loader_unit::program_image image(image_name);
+    cpu_unit::core cpu;
+    cpu.init(image, words + 16);
+  });
+  std::cout << "startup " << words << " words: text " << text_time * 1e3 << " ms, image "
+            << image_time * 1e3 << " ms\n";
+  std::filesystem::remove(text_name);
+  std::filesystem::remove(image_name);
+}
+
+int main(int argc, char **argv) {
+  int iterations = argc > 1 ? std::atoi(argv[1]) : 20000000;
+  std::size_t startup_words = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 4 << 20;
+  long long count;
+  std::vector<int> program = make_loop_program(iterations, count);
+
+  // lean - ядро cpu_unit::lean_core, как у xvprocexe -trusted -lean
+  struct {const char *name; cpu_unit::Engine engine; bool trusted; bool fusion; bool paged; bool lean;} engines[] = {
+    {"switch", cpu_unit::Engine::SWITCH, false, true, false, false},
+    {"switch (lean core)", cpu_unit::Engine::SWITCH, true, true, false, true},
+    {"switch (paged memory)", cpu_unit::Engine::SWITCH, false, true, true, false},
+    {"predecoded", cpu_unit::Engine::PREDECODED, false, true, false, false},
+    {"predecoded (lean core)", cpu_unit::Engine::PREDECODED, true, true, false, true},
+    {"threaded", cpu_unit::Engine::THREADED, false, true, false, false},
+    {"threaded (no fusion)", cpu_unit::Engine::THREADED, false, false, false, false},
+    {"threaded (trusted, no fusion)", cpu_unit::Engine::THREADED, true, false, false, false},
+    {"threaded (lean core, no fusion)", cpu_unit::Engine::THREADED, true, false, false, true},
+    {"threaded (paged memory)", cpu_unit::Engine::THREADED, false, true, true, false},
+    {"jit", cpu_unit::Engine::JIT, false, true, false, false},
+  };
+
+  int reference = 0;
+  bool first = true;
+  for (auto &e : engines) {
+    bench_result r = e.lean ? run_engine<cpu_unit::lean_core>(e.engine, program, e.trusted, e.fusion, e.paged)
+                            : run_engine<cpu_unit::core>(e.engine, program, e.trusted, e.fusion, e.paged);
+    if (first) {reference = r.checksum; first = false;}
+    std::cout << e.name << ": " << count / r.seconds / 1e6 << " Minstr/s ("
+              << r.seconds << " s)" << (r.checksum == reference ? "" : " RESULT MISMATCH") << "\n";
+  }
+  bench_startup(startup_words);
+  bench_copy(8 << 20);
+  bench_calls(27);
+  bench_timer(iterations);
+  bench_profile(iterations);
+  bench_trace(iterations / 10);
+  bench_clone(1 << 20, 20);
+  bench_vector(4096, 2000);
+  bench_terminal(50 << 20);
+  bench_async_read(64 << 20, 1 << 18);
+  int max_cores = std::thread::hardware_concurrency() > 1 ? std::thread::hardware_concurrency() : 2;
+  bench_cores(cpu_unit::Engine::THREADED, iterations, max_cores > 8 ? 8 : max_cores);
+  return 0;
+}
@@ -1,15 +1,43 @@
 #pragma once
 
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cstdint>
+#include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <stdexcept>
 #include <sys/types.h>
 #include <vector> // До последнего не хотел его использовать
 #include <memory>
+#include <functional>
+#include <limits>
+#include <type_traits>
+#include <fstream>
+#include <sstream>
+#include <string>
 #include "utility_units.hpp"
+#include "async_port.hpp"
+#include "map_port.hpp"
+#include "jit.hpp"
+#include "loader.hpp"
+#include "memory.hpp"
+#include "profiler.hpp"
+#include "trace.hpp"
+#include "vector.hpp"
+#include "word.hpp"
 #include <iostream>
 #include <iomanip>
 
 #define raddr std::size_t
+
+// Прямая шитая диспетчеризация через адреса меток (расширение GCC/Clang "labels as values")
+#if defined(__GNUC__)
+#define XVPROC_COMPUTED_GOTO 1
+#else
+#define XVPROC_COMPUTED_GOTO 0
+#endif
 /*
  Набор инструкций
 
@@ -32,6 +60,9 @@
  mult    accumulator    reg1            reg2    : умножение, ложит результат в аккумулятор
  div     accumulator    reg1            reg2    : деление, ложит частное в аккумулятор
  mod     accumulator    reg1            reg2    : деление, ложит остаток в аккумулятор
+ Сложение, вычитание и умножение - по модулю 2^W (W - ширина слова ядра, см. word.hpp),
+ частное округляется к нулю, остаток имеет знак делимого, наименьшее слово / -1 - само наименьшее слово, остаток 0
+ Деление на ноль (div и mod) - ошибка 8 с остановкой, аккумулятор не меняется
 
  - Сравнения и условные переходы
  cmp     reg1           reg2            0       : сравнение, меняет флаг
@@ -48,21 +79,72 @@
  ptcs   reg             port            0       : отправить в порт управляющий сигнал из регистра
  prtg   reg             port            0       : получение значения в регистр с порта
  prts   reg             port            0       : получить с устройства сигнал состояния
-
- !- Операции работы со стеком
- !push   reg             0               0       : добавить в стек значение
- !pop    reg             offset          0       : получить со стека значение
- !call   reg             0               0       : вызвать функцию, автоматически сверху в стек добавляет адресс интрукции
- !ret    0               0               0       : выход из функции, переход обратно, адресс берётся с вершины стека
-
-
- !- Работа с очередью инструкций
- !intr   0               0               0       : вызов прерывания, добавляет в стек адресс инструкции
- !scall  0               0               0       : вызов системного вызова, срабатывает автоматически при достижения таймера, так же ложит в стек номер инструкции
-
- !- Обработка системных ошибок
- !serr   type            0               0       : установить флаг ошибки на какое-то значение
- !cerr   0               0               0       : очистить флаг ошибки
+ prtw   adr_reg         len_reg         port    : отправить в порт len_reg ячеек ОЗУ с адреса из adr_reg одной инструкцией
+ prtr   adr_reg         len_reg         port    : получить с порта до len_reg значений в ОЗУ с адреса из adr_reg,
+                                                  в len_reg ложит количество полученных (меньше запрошенного - данные кончились)
+
+ - Атомарные операции и многоядерность (машина из нескольких ядер с общим ОЗУ, см. machine.hpp)
+ cas    adr_reg         expected_reg    new_reg : если в ОЗУ по адресу из adr_reg лежит expected_reg, записать туда new_reg
+                                                  в expected_reg ложит прежнее значение ячейки, флаг сравнения 0 при успехе, иначе 1
+ fadd   accumulator     adr_reg         reg     : прибавить reg к ячейке ОЗУ, в аккумулятор ложит прежнее значение
+ fence  0               0               0       : полный барьер памяти
+ spawn  id_reg          entry_reg       arg_reg : запустить ядро с адреса из entry_reg, в его r1 - значение arg_reg
+                                                  в id_reg ложит номер ядра или -1, если ядро запустить нельзя
+ join   id_reg          0               0       : дождаться остановки ядра
+ cas, fadd и fence последовательно согласованы (seq_cst) между всеми ядрами. Обычные lodi/lodr/stri/strr между ядрами
+ не упорядочены: запись одного ядра гарантированно видна другому, если после неё ядро выполнило cas/fadd/fence,
+ а другое ядро увидело это через cas/fadd или выполнило fence. Всё записанное до spawn видно запущенному ядру,
+ всё записанное ядром до остановки видно после join
+
+ - Операции работы со стеком
+ Стек растёт вниз, r15 - адрес вершины (последней записанной ячейки), пустой стек - r15 на конце области стека
+ push   reg             0               0       : добавить в стек значение регистра
+ pop    reg             0               0       : снять значение с вершины стека в регистр
+ call   gotoadr         0               0       : вызвать функцию: положить в стек адрес следующей инструкции и перейти
+ ret    0               0               0       : выход из функции, переход по адресу с вершины стека
+ stkr   reg             offset          0       : прочитать ячейку стека r15 + offset (0 - вершина), не снимая её
+ Каждая ячейка стека проверяется по области стека (set_stack) и по границам amin при setl,
+ выход за них останавливает процессор с err_flag = 7
+
+ - Векторные операции над диапазонами ОЗУ (len_reg ячеек с адресов из регистров)
+ vadd   dst_reg         src_reg         len_reg : dst[i] = dst[i] + src[i]
+ vsub   dst_reg         src_reg         len_reg : dst[i] = dst[i] - src[i]
+ vmul   dst_reg         src_reg         len_reg : dst[i] = dst[i] * src[i]
+ vand   dst_reg         src_reg         len_reg : dst[i] = dst[i] and src[i] (логическое, как and)
+ vor    dst_reg         src_reg         len_reg : dst[i] = dst[i] or src[i] (логическое, как or)
+ vsum   accumulator     adr_reg         len_reg : сумма ячеек в аккумулятор
+ vmin   accumulator     adr_reg         len_reg : наименьшая ячейка в аккумулятор (пустой диапазон - наибольшее слово)
+ vmax   accumulator     adr_reg         len_reg : наибольшая ячейка в аккумулятор (пустой диапазон - наименьшее слово)
+ vfill  adr_reg         reg             len_reg : заполнить диапазон значением регистра
+ vcopy  dst_reg         src_reg         len_reg : скопировать диапазон (перекрытие допустимо, как memmove)
+ Источник читается целиком до записи, поэтому перекрытие диапазонов не меняет результат
+ Диапазон проверяется один раз: отрицательная длина или выход за границы amin при setl - ошибка 1 у чтения
+ и 3 у записи (инструкция не исполняется), выход за ОЗУ - исключение, как у prtw/prtr
+
+
+ - Прерывания
+ intr   number          0               0       : вызвать обработчик number из таблицы прерываний (0-15), без обработчика ничего не делает
+ scall  0               0               0       : системный вызов, обработчик по адресу из r13
+ iret   0               0               0       : возврат из прерывания
+ seti   number          reg             0       : установить обработчик number по адресу из регистра (-1 снимает его)
+ timer  reg             0               0       : каждые reg инструкций вызывать системный обработчик из r13 (0 выключает таймер)
+ Вход в обработчик кладёт в стек флаг сравнения и адрес возврата (на вершину): для intr/scall - следующая инструкция,
+ для таймера - ещё не исполненная, для ошибки - следующая за ошибочной. До iret другие прерывания не приходят,
+ сработавший за это время таймер приходит сразу после iret
+ Ошибка с кодом err_flag, для которой задан обработчик с тем же номером, вызывает его вместо остановки процессора
+ (или вместо молчаливого продолжения у ошибок amin), ошибка внутри обработчика работает как без обработчика
+
+ - Обработка системных ошибок
+ serr   type            0               0       : установить флаг ошибки на какое-то значение
+ cerr   0               0               0       : очистить флаг ошибки
+
+ - Ширина слова
+ Регистры, ячейки ОЗУ и операнды инструкций - слова ядра: 32 бита (core), 16 бит (core16) или 64 бита (core64)
+ Адрес - неотрицательное слово, поэтому ОЗУ не больше наибольшего слова (у core16 - 32767 ячеек)
+ Порты получают значения int (у core16 - младшие 16 бит ответа), а core64 - значения long long (virtual_port::send_wide),
+ сигналы портов (prcs/prcg) всегда int. Порты 2 и 3 (async_file, mapped_file) работают с ячейками int32
+ и есть только у ядер со словом 32 бита (core, lean_core), как JIT, перевод в C++ и трасса:
+ движки JIT и перевода у core16 и core64 исполняют программу интерпретатором с кэшем
 */
 
 
@@ -97,122 +179,464 @@ namespace cpu_unit {
         PRTS = 50,
         PRCS = 51,
         PRTG = 52,
-        PRCG = 53
+        PRCG = 53,
+        PRTW = 54,
+        PRTR = 55,
+        PUSH = 60,
+        POP = 61,
+        CALL = 62,
+        RET = 63,
+        STKR = 64,
+        CAS = 70,
+        FADD = 71,
+        FENCE = 72,
+        SPAWN = 73,
+        JOIN = 74,
+        VADD = 90,
+        VSUB = 91,
+        VMUL = 92,
+        VAND = 93,
+        VOR = 94,
+        VSUM = 95,
+        VMIN = 96,
+        VMAX = 97,
+        VFILL = 98,
+        VCOPY = 99,
+        INTR = 80,
+        SCALL = 81,
+        IRET = 82,
+        SETI = 83,
+        TIMER = 84,
+        SERR = 85,
+        CERR = 86
     };
 
-    inline bool check_reg_addr(std::size_t regaddr) {
-        return regaddr >= 16;  // Регистры 0-15
+    // Мнемоника инструкции по коду операции, nullptr для неизвестного кода
+    inline const char *opcode_name(int opcode) {
+        switch (static_cast<OpCode>(opcode)) {
+            case OpCode::HALT: return "halt";
+            case OpCode::LODI: return "lodi";
+            case OpCode::LODR: return "lodr";
+            case OpCode::STRI: return "stri";
+            case OpCode::STRR: return "strr";
+            case OpCode::MOV:  return "mov";
+            case OpCode::AMIN: return "amin";
+            case OpCode::SETL: return "setl";
+            case OpCode::SETF: return "setf";
+            case OpCode::ADD:  return "add";
+            case OpCode::ADDC: return "addc";
+            case OpCode::LOC:  return "loc";
+            case OpCode::SUB:  return "sub";
+            case OpCode::MULT: return "mult";
+            case OpCode::DIV:  return "div";
+            case OpCode::MOD:  return "mod";
+            case OpCode::CMP:  return "cmp";
+            case OpCode::JMP:  return "jmp";
+            case OpCode::GOTO: return "goto";
+            case OpCode::LCMP: return "lcmp";
+            case OpCode::OR:   return "or";
+            case OpCode::AND:  return "and";
+            case OpCode::NOT:  return "not";
+            case OpCode::PRTS: return "prts";
+            case OpCode::PRCS: return "prcs";
+            case OpCode::PRTG: return "prtg";
+            case OpCode::PRCG: return "prcg";
+            case OpCode::PRTW: return "prtw";
+            case OpCode::PRTR: return "prtr";
+            case OpCode::PUSH: return "push";
+            case OpCode::POP:  return "pop";
+            case OpCode::CALL: return "call";
+            case OpCode::RET:  return "ret";
+            case OpCode::STKR: return "stkr";
+            case OpCode::CAS:  return "cas";
+            case OpCode::FADD: return "fadd";
+            case OpCode::FENCE: return "fence";
+            case OpCode::SPAWN: return "spawn";
+            case OpCode::JOIN: return "join";
+            case OpCode::VADD: return "vadd";
+            case OpCode::VSUB: return "vsub";
+            case OpCode::VMUL: return "vmul";
+            case OpCode::VAND: return "vand";
+            case OpCode::VOR:  return "vor";
+            case OpCode::VSUM: return "vsum";
+            case OpCode::VMIN: return "vmin";
+            case OpCode::VMAX: return "vmax";
+            case OpCode::VFILL: return "vfill";
+            case OpCode::VCOPY: return "vcopy";
+            case OpCode::INTR: return "intr";
+            case OpCode::SCALL: return "scall";
+            case OpCode::IRET: return "iret";
+            case OpCode::SETI: return "seti";
+            case OpCode::TIMER: return "timer";
+            case OpCode::SERR: return "serr";
+            case OpCode::CERR: return "cerr";
+        }
+        return nullptr;
     }
 
-    // Класс памяти
-    class memory {
-    private:
-        // Максимальный адрес
-        std::size_t size_ram;
-        // Массив ячеек
-        int *m;
-    public:
-        // инициализатор, принимает размер памяти и программу
-        void init(std::size_t size, std::vector<int> &program) {
-            size_ram = size;
-            m = new int[size_ram];
-            for (std::size_t i = 0; i < program.size(); i++) {
-                m[i] = program[i];
-            }
-        }
+    // Движок исполнения инструкций
+    enum class Engine : int {
+        SWITCH = 0,     // Эталонный: каждая инструкция заново читается из ОЗУ и декодируется
+        PREDECODED = 1, // Инструкции области программы декодируются один раз и берутся из кэша
+        THREADED = 2,   // Шитый код поверх кэша: каждый обработчик сам переходит к следующему
+        JIT = 3         // Горячие базовые блоки компилируются в машинный код x86-64, остальное как PREDECODED
+    };
 
-        // Геттер из ячейки по адресу
-        // adr - адрес ячейки
-        // Бросается исключение при неверном адресе
-        int get_from_memory(std::size_t adr) {
-            if (adr < size_ram) {
-                return m[adr];
-            }
-            else {
-                throw std::runtime_error("Attempt to access non-existent memory");
-            }
+    // Причина остановки процессора
+    enum class ExitReason : int {
+        HALT = 0,           // Инструкция halt
+        ERROR = 1,          // Ошибка без обработчика, код в err_flag
+        END_OF_MEMORY = 2,  // Указатель инструкции ушёл за конец ОЗУ
+        BUDGET = 3,         // Исполнен весь бюджет инструкций
+        DEADLINE = 4        // Истёк срок работы
+    };
+
+    inline const char *exit_reason_name(ExitReason reason) {
+        switch (reason) {
+            case ExitReason::HALT: return "halt";
+            case ExitReason::ERROR: return "error";
+            case ExitReason::END_OF_MEMORY: return "end of memory";
+            case ExitReason::BUDGET: return "instruction budget exhausted";
+            case ExitReason::DEADLINE: return "time limit exceeded";
         }
+        return "unknown";
+    }
 
+    // Ограничения одного запуска start_process(), 0 - без ограничения
+    // Бюджет проверяется тем же обратным отсчётом, что и таймер (скомпилированный блок JIT может превысить его
+    // на длину блока), часы - раз в несколько десятков тысяч инструкций. Ожидание на портах срок не прерывает
+    struct run_limits {
+        long long instructions = 0;
+        double seconds = 0;
+    };
 
-        // Сеттер из ячейки по адресу
-        // adr - адрес ячейки
-        // value - значение
-        // Бросается исключение при неверном адресе
-        void set_to_memory(std::size_t adr, int value) {
-            if (adr < size_ram) {
-                m[adr] = value;
-            }
-            else {
-                throw std::runtime_error("Attempt to access non-existent memory");
+    // Итог запуска: причина остановки, исполненные инструкции, регистры и флаг ошибки после остановки
+    // Регистры хранятся в long long, чтобы итог был общим для ядер любой ширины слова
+    struct run_result {
+        ExitReason reason = ExitReason::HALT;
+        long long instructions = 0;
+        long long registers[16] = {};
+        int err_flag = 0;
+    };
+
+    // Представление ОЗУ ядра
+    enum class MemoryMode : int {
+        AUTO = 0,   // Плоское, а ОЗУ больше memory::flat_limit - страничное
+        FLAT = 1,   // Всегда плоское (нужно JIT и общему ОЗУ нескольких ядер)
+        PAGED = 2   // Всегда страничное: страницы выделяются при первой записи, JIT не используется
+    };
+
+    // Программа, заранее переведённая в C++ (см. aot.hpp и xvaot)
+    // Функция run исполняет инструкции с адреса registers[14], пока может, и возвращает адрес первой неисполненной:
+    // инструкции без перевода, ошибки и вычисляемые переходы на непереведённый адрес исполняет ядро.
+    // Регистры, флаг сравнения и обратный отсчёт она читает и записывает через кадр, r14 - только возвратом
+    struct native_frame {
+        int *registers;
+        int *cmp_flag;
+        int *memory;
+        std::size_t memory_size;
+        std::size_t stack_low;
+        std::size_t stack_high;
+        long long *countdown;
+    };
+
+    struct native_program {
+        int (*run)(native_frame &) = nullptr;
+        std::size_t code_size = 0;               // Размер области программы, из которой получен перевод
+        std::uint64_t code_hash = 0;             // program_hash() этой области
+        std::size_t memory_words = 0;            // Наименьший размер ОЗУ: прямые адреса проверены для него
+        const unsigned char *code_map = nullptr; // Отметки ячеек переведённых инструкций (code_size штук)
+    };
+
+    // Хэш области программы (FNV-1a по ячейкам): перевод подключается только к той программе, из которой получен
+    inline std::uint64_t program_hash(const std::function<int(std::size_t)> &word, std::size_t count) {
+        std::uint64_t h = 14695981039346656037ULL;
+        for (std::size_t i = 0; i < count; i++) {
+            std::uint32_t w = static_cast<std::uint32_t>(word(i));
+            for (int b = 0; b < 4; b++) {
+                h ^= (w >> (8 * b)) & 0xff;
+                h *= 1099511628211ULL;
             }
         }
+        return h;
+    }
 
-        // Деструктор
-        ~memory() {
-            delete[] m;
+    // Может ли программа включить границы amin: есть ли в области программы ячейка с кодом setl
+    // Инструкции могут начинаться с любого адреса, поэтому смотрятся все ячейки, и ответ "да" бывает лишним, а "нет" точен
+    inline bool program_uses_bounds(const std::function<int(std::size_t)> &word, std::size_t count) {
+        for (std::size_t i = 0; i < count; i++) {
+            if (word(i) == static_cast<int>(OpCode::SETL)) {return true;}
         }
+        return false;
+    }
 
+    inline bool check_reg_addr(std::size_t regaddr) {
+        return regaddr >= 16;  // Регистры 0-15
+    }
+
+    // Политики ядра: что ядро умеет, решается при компиляции, и ненужные проверки исчезают из движков
+    // bounds - границы amin (setl/setf); без них setl бросает исключение, а проверок адресов по amin в коде нет
+    // hooks - отладочный вывод, наблюдатель, профилирование, запись и воспроизведение трассы;
+    //         без них эти режимы нельзя включить, а движки не проверяют их на каждой инструкции
+    // Проверки регистров и адресов за ОЗУ остаются в любом ядре: их снимает только доверенный режим
+    // word - слово ядра (см. word.hpp)
+    struct checked_policy {
+        static constexpr bool bounds = true;
+        static constexpr bool hooks = true;
+        using word = int;
+    };
+
+    // Ядро для проверенных программ (xvprocexe и xvbatch с -trusted -lean) без amin и отладочных режимов
+    struct lean_policy {
+        static constexpr bool bounds = false;
+        static constexpr bool hooks = false;
+        using word = int;
+    };
+
+    // Ядро с проверками и словом Word: 16 бит для плотных данных, 64 бита для больших адресных пространств
+    template <typename Word>
+    struct word_policy : checked_policy {
+        using word = Word;
     };
 
+    template <typename Policy>
+    class basic_core {
+        public:
+            using word = typename Policy::word;
+            using word_memory = basic_memory<word>;
+
+            // Ядро со словом int32: только ему доступны JIT, перевод в C++, трасса и порты 2 и 3
+            static constexpr bool word32 = std::is_same<word, int>::value;
 
-    class core {
         private:
             // Регистры, их 16 штук
             // 15 - адрес стека
             // 14 - адрес инструкции
             // 13 - адрес системных вызовов
-            int registers[16];
+            word registers[16];
 
             // Флаг сравнения
             int cmp_flag = 0;
 
             // Текущие декодированные значения
-            int decoded[4];
+            word decoded[4];
 
             // Ограничение доступа к памяти
-            int memory_addres_min;
-            int memory_addres_max;
+            word memory_addres_min = 0;
+            word memory_addres_max = 0;
             // Если true, то процессор смотрит, есть ли доступ к адресу перед get_from_memory()
             bool safe_address_mode = false;
 
-            // Включены ли системные вызовы, при false просто игнорирует системные вызовы (пока не реализованы)
+            // Включён ли таймер системных вызовов (инструкция timer или set_timer)
             bool syscals = false;
 
-            // (пока не реализовано)
-            // Флаг ошибки, должен обрабатываться при системном вызове
+            // Флаг ошибки, при обработчике в intr_table вызывает прерывание с тем же номером
             // 0 - нет ошибки
             // 1 - ошибка сегментации
             // 3 - ошибка регистра
             // 4 - ошибка указателя текущей инструкции
             // 5 - ошибка инструкции (неверная инструкция)
+            // 6 - неверный порт
+            // 7 - ошибка стека (переполнение, снятие с пустого стека, выход за границы amin)
+            // 8 - деление на ноль
             int err_flag = 0;
 
-            // Пока не реализовано
-            // Таблица прерываний
-            int intr_table[16];
+            // Таблица прерываний: адреса обработчиков по номеру, -1 - обработчика нет
+            word intr_table[16];
+
+            // Идёт обработка прерывания: прерывания ошибок и таймер ждут iret, ошибка в обработчике останавливает процессор
+            bool in_interrupt = false;
+
+            // Период таймера в инструкциях и сработавший во время обработки прерывания таймер
+            long long timer_period = 0;
+            bool timer_pending = false;
+
+            // Обратный отсчёт до обслуживания: движки уменьшают его при выборке каждой инструкции
+            // и вызывают service(), когда он становится отрицательным. Без таймера, ошибок и ограничений он не кончается,
+            // поэтому все эти проверки стоят одного вычитания и перехода на инструкцию
+            static constexpr long long no_countdown = 0x7fffffffffffffffLL;
+            long long countdown = no_countdown;
+            // Значение countdown в начале текущего отрезка: slice - countdown - выбрано инструкций с его начала
+            long long slice = no_countdown;
+
+            // Сколько ещё инструкций можно выбрать до события, событие наступает, когда счётчик становится отрицательным
+            // no_countdown - события нет: таймер выключен, нет бюджета или срока
+            long long timer_left = no_countdown;
+            long long budget_left = no_countdown;
+            long long poll_left = no_countdown;
+
+            // Часы проверяются раз в deadline_poll инструкций, чтобы срок ничего не стоил обычному пути
+            static constexpr long long deadline_poll = 1 << 16;
+            std::chrono::steady_clock::time_point deadline;
+
+            // Исполнено инструкций за start_process() до начала текущего отрезка
+            long long retired = 0;
+
+            // Причина последней остановки
+            ExitReason stop_reason = ExitReason::HALT;
+
+            // Ошибка, ждущая своего обработчика: код и адрес инструкции
+            int pending_fault = 0;
+            word fault_pc = 0;
 
             std::size_t memory_size;
 
-            // Оперативная память
-            memory RAM;
+            // Оперативная память, может быть общей для ядер одной машины
+            std::shared_ptr<word_memory> RAM;
+
+            // Флаг работы процессора, сбрасывается при HALT или ошибке
+            bool is_work = false;
+
+            // Выбранный движок исполнения
+            Engine engine = Engine::SWITCH;
+
+            // Предекодированная инструкция
+            // handler - обработчик, nullptr если запись ещё не декодирована или устарела
+            // op - код операции
+            // target - адрес метки обработчика в шитом движке (заполняется только им)
+            // a, b, c - операнды инструкции в том виде, в котором их принимает обработчик
+            // ext - операнды второй и третьей инструкции сверхинструкции (по три на инструкцию)
+            struct decoded_instruction;
+            using handler_type = void (basic_core::*)(const decoded_instruction &);
+            struct decoded_instruction {
+                handler_type handler = nullptr;
+                const void *target = nullptr;
+                int op = 0;
+                word a = 0;
+                word b = 0;
+                word c = 0;
+                word ext[6] = {};
+            };
+
+            // Сливать ли цепочки инструкций из таблицы fusion_table() в сверхинструкции
+            bool fusion = true;
+
+            // Потоки терминала (порт 0), nullptr - терминал напрямую на дескрипторах 0 и 1 (см. buffered_terminal)
+            std::istream *terminal_in = nullptr;
+            std::ostream *terminal_out = nullptr;
+
+            // Представление ОЗУ, создаваемого init()
+            MemoryMode memory_mode = MemoryMode::AUTO;
+
+            // Запуск и ожидание других ядер машины (spawn/join), задаются machine_unit::machine
+            std::function<int(word, word)> spawner;
+            std::function<void(word)> joiner;
+
+            // Область стека [stack_low, stack_high), задаётся при init из stack_base/stack_words (см. set_stack)
+            std::size_t stack_base = 0;
+            std::size_t stack_words = 0;
+            std::size_t stack_low = 0;
+            std::size_t stack_high = 0;
+
+            // Теневой стек возвратов шитого движка: на каждый call запоминается вершина стека, адрес возврата
+            // и запись кэша инструкции возврата. Если ret снимает со стека то же, что положил call,
+            // переход идёт сразу на запись кэша, иначе (стек изменён программой) теневой стек сбрасывается
+            struct shadow_return {
+                word sp;
+                word adr;
+                decoded_instruction *entry;
+            };
+            static constexpr std::size_t shadow_depth = 256;
+            std::vector<shadow_return> shadow;
+
+            // Доверенный режим: код, прошедший проверку verify_program(), исполняется без проверок
+            // регистров и прямых адресов, а ошибки динамических адресов не бросают исключений
+            bool trusted = false;
+
+            // Отметки адресов области программы, чьи инструкции прошли проверку
+            std::vector<char> verified;
+
+            // Размер области программы (количество ячеек, загруженных при init)
+            std::size_t program_size = 0;
+
+            // Кэш предекодированных инструкций, одна запись на каждый адрес области программы
+            // Заполняется лениво, запись сбрасывается при записи в ОЗУ по одному из её четырёх адресов
+            std::vector<decoded_instruction> icache;
+
+            // Скомпилированные блоки области программы
+            jit_cache jit;
+
+            // Программа, переведённая в C++, и можно ли ей пользоваться: программа в ОЗУ та же, из которой получен перевод,
+            // и ни одна переведённая инструкция не перезаписана
+            native_program native;
+            bool native_intact = false;
+
+            // Наблюдатель за исполнением в эталонном движке
+            std::function<void(std::size_t, const word *)> observer;
+
+            // Ядра векторных инструкций для этого процессора (см. vector.hpp)
+            const basic_vector_kernels<word> *vectors = &vector_kernels_for_cpu_word<word>();
+            // Копия источника векторной инструкции (перекрытие с приёмником, страничное ОЗУ)
+            std::vector<word> vector_buffer;
 
             // Устройства подключённые к процессору
             std::vector<std::unique_ptr<utility_units::virtual_port>> ports;
 
+            // Профилировщик (см. profiler.hpp), nullptr - профилирование выключено
+            // Считает эталонный движок и движок с кэшем (шитый и JIT при профилировании заменяются им), сверхинструкции не сливаются
+            std::unique_ptr<utility_units::profiler> profile;
+
+            // Трасса исполнения (см. trace.hpp): запись в файл или сверка с воспроизводимой трассой, nullptr - выключена
+            // Исполняется теми же движками, что и профилирование
+            std::unique_ptr<utility_units::trace_sink> trace;
+            // Файл для записи трассы и трасса для воспроизведения (её ввод портов забирается при исполнении)
+            std::string trace_path;
+            std::unique_ptr<utility_units::trace_log> replay;
+            utility_units::trace_checker *replay_check = nullptr;
+            // Регистры и флаг сравнения на последней записи трассы
+            word trace_registers[16] = {};
+            int trace_flag = 0;
+
+            // Режимы, которые политика может убрать при компиляции (см. checked_policy)
+
+                // Проверяются ли границы amin
+                bool bounded() const {
+                    if constexpr (Policy::bounds) {return safe_address_mode;} else {return false;}
+                }
+
+                bool profiling() const {
+                    if constexpr (Policy::hooks) {return profile != nullptr;} else {return false;}
+                }
+
+                bool tracing() const {
+                    if constexpr (Policy::hooks) {return trace != nullptr;} else {return false;}
+                }
+
+                // Включение отладочного режима в ядре без hooks
+                static void require_hooks(const char *what) {
+                    if constexpr (not Policy::hooks) {throw std::runtime_error(std::string(what) + " needs the checked core");}
+                }
+
+                // Включение режима, который есть только у ядра со словом int32
+                static void require_word32(const char *what) {
+                    if constexpr (not word32) {throw std::runtime_error(std::string(what) + " needs the 32-bit core");}
+                }
+
+                // Код операции из слова, слово вне int (у core64) - заведомо неверный код
+                // Коды от fusion_opcode_base заняты записями кэша (сверхинструкции и доверенный режим),
+                // поэтому такое слово в ОЗУ - тоже неверный код, а не обработчик без проверок
+                static int opcode_of(word value) {
+                    if constexpr (sizeof(word) > sizeof(int)) {
+                        if (not fits_word<int>(value)) {return -1;}
+                    }
+                    if (value >= fusion_opcode_base) {return -1;}
+                    return static_cast<int>(value);
+                }
+
             // Инструкции для работы с памятью
 
                 // Загрузить из ОЗУ в регистр, адрес - константа, при safe_address_mode проверяет на доступность адреса
                 // accumulator - адрес регистра куда сохранить
                 // static_adress - адрес откуда брать
                 void lodi(raddr accumulator, std::size_t static_adress) {
-                    if (safe_address_mode) {
+                    if (bounded()) {
                         if (static_adress >= memory_addres_min and static_adress <= memory_addres_max) {
-                            registers[accumulator] = RAM.get_from_memory(static_adress);
+                            registers[accumulator] = RAM->get_from_memory(static_adress);
                         } else {
-                            err_flag = 1;
+                            fault(1, false);
                         }
                     } else {
-                        registers[accumulator] = RAM.get_from_memory(static_adress);
+                        registers[accumulator] = RAM->get_from_memory(static_adress);
                     }
                     registers[14] += 4; // Увеличиваем указатель инструкции на шаг
                 }
@@ -221,15 +645,15 @@ namespace cpu_unit {
                 // accumulator - адрес регистра куда сохранить
                 // reg_addressator - адрес регистра хранящего адрес откуда брать
                 void lodr(raddr accumulator, raddr reg_addressator) {
-                    if (safe_address_mode) {
+                    if (bounded()) {
                         if (registers[reg_addressator] >= memory_addres_min and registers[reg_addressator] <= memory_addres_max) {
-                            registers[accumulator] = RAM.get_from_memory(registers[reg_addressator]);
-                            std::cout << RAM.get_from_memory(registers[reg_addressator]) << " " <<reg_addressator << std::endl;
+                            registers[accumulator] = RAM->get_from_memory(registers[reg_addressator]);
+                            std::cout << RAM->get_from_memory(registers[reg_addressator]) << " " <<reg_addressator << std::endl;
                         } else {
-                            err_flag = 1;
+                            fault(1, false);
                         }
                     } else {
-                        registers[accumulator] = RAM.get_from_memory(registers[reg_addressator]);
+                        registers[accumulator] = RAM->get_from_memory(registers[reg_addressator]);
                     }
                     registers[14] += 4; // Увеличиваем указатель инструкции на шаг
                 }
@@ -238,14 +662,16 @@ namespace cpu_unit {
                 // static_adress - адрес
                 // reg - адрес регистра где хранится значение
                 void stri(std::size_t static_adress, raddr reg) {
-                    if (safe_address_mode) {
+                    if (bounded()) {
                         if (static_adress >= memory_addres_min and static_adress <= memory_addres_max) {
-                            RAM.set_to_memory(static_adress, registers[reg]);
+                            RAM->set_to_memory(static_adress, registers[reg]);
+                            invalidate_code(static_adress);
                         } else {
-                            err_flag = 3;
+                            fault(3, false);
                         }
                     } else {
-                        RAM.set_to_memory(static_adress, registers[reg]);
+                        RAM->set_to_memory(static_adress, registers[reg]);
+                        invalidate_code(static_adress);
                     }
                     registers[14] += 4; // Увеличиваем указатель инструкции на шаг
                 }
@@ -254,14 +680,16 @@ namespace cpu_unit {
                 // reg_addressator - адрес регистра, где хранится адрес
                 // reg - адрес регистра где хранится значение
                 void strr(raddr reg_addressator, raddr reg) {
-                    if (safe_address_mode) {
+                    if (bounded()) {
                         if (registers[reg_addressator] >= memory_addres_min and registers[reg_addressator] <= memory_addres_max) {
-                            RAM.set_to_memory(registers[reg_addressator], registers[reg]);
+                            RAM->set_to_memory(registers[reg_addressator], registers[reg]);
+                            invalidate_code(registers[reg_addressator]);
                         } else {
-                            err_flag = 3;
+                            fault(3, false);
                         }
                     } else {
-                        RAM.set_to_memory(registers[reg_addressator], registers[reg]);
+                        RAM->set_to_memory(registers[reg_addressator], registers[reg]);
+                        invalidate_code(registers[reg_addressator]);
                     }
                     registers[14] += 4; // Увеличиваем указатель инструкции на шаг
                 }
@@ -287,6 +715,7 @@ namespace cpu_unit {
 
                 // Включение проверки адреса
                 void setl() {
+                    if constexpr (not Policy::bounds) {throw std::runtime_error("setl needs the checked core");}
                     safe_address_mode = true;
                     registers[14] += 4; // Увеличиваем указатель инструкции на шаг
                 }
@@ -305,7 +734,7 @@ namespace cpu_unit {
                 // sum2 - адрес регистра второго слагаемого
                 void add(raddr accumulator, raddr sum1, raddr sum2) {
                     if (check_reg_addr(accumulator) or check_reg_addr(sum1) or check_reg_addr(sum2)) {return;}
-                    registers[accumulator] = registers[sum1] + registers[sum2];
+                    registers[accumulator] = word_add(registers[sum1], registers[sum2]);
                     registers[14] += 4; // Увеличиваем указатель инструкции на шаг
                 }
 
@@ -313,16 +742,16 @@ namespace cpu_unit {
                 // accumulator - адрес регистра результата
                 // sum1 - адрес регистра первого слагаемого
                 // value - значение
-                void addc(raddr accumulator, raddr sum1, int value) {
+                void addc(raddr accumulator, raddr sum1, word value) {
                     if (check_reg_addr(accumulator) or check_reg_addr(sum1)) {return;}
-                    registers[accumulator] = registers[sum1] + value;
+                    registers[accumulator] = word_add(registers[sum1], value);
                     registers[14] += 4; // Увеличиваем указатель инструкции на шаг
                 }
 
                 // Запись в регистр константы
                 // accumulator - адрес регистра назначения
                 // value - значение
-                void loc(raddr accumulator, int value) {
+                void loc(raddr accumulator, word value) {
                     if (check_reg_addr(accumulator)) {return;}
                     registers[accumulator] = value;
                     registers[14] += 4; // Увеличиваем указатель инструкции на шаг
@@ -334,7 +763,7 @@ namespace cpu_unit {
                 // sub2 - адрес регистра второго слагаемого
                 void sub(raddr accumulator, raddr sub1, raddr sub2) {
                     if (check_reg_addr(accumulator) or check_reg_addr(sub1) or check_reg_addr(sub2)) {return;}
-                    registers[accumulator] = registers[sub1] - registers[sub2];
+                    registers[accumulator] = word_sub(registers[sub1], registers[sub2]);
                     registers[14] += 4; // Увеличиваем указатель инструкции на шаг
                 }
 
@@ -344,7 +773,7 @@ namespace cpu_unit {
                 // mult2 - адрес регистра второго слагаемого
                 void mult(raddr accumulator, raddr mult1, raddr mult2) {
                     if (check_reg_addr(accumulator) or check_reg_addr(mult1) or check_reg_addr(mult2)) {return;}
-                    registers[accumulator] = registers[mult1] * registers[mult2];
+                    registers[accumulator] = word_mul(registers[mult1], registers[mult2]);
                     registers[14] += 4; // Увеличиваем указатель инструкции на шаг
                 }
 
@@ -352,9 +781,14 @@ namespace cpu_unit {
                 // accumulator - адрес регистра результата
                 // div1 - адрес регистра первого слагаемого
                 // div2 - адрес регистра второго слагаемого
+                // Деление на ноль - ошибка 8, аккумулятор не меняется
                 void div(raddr accumulator, raddr div1, raddr div2) {
                     if (check_reg_addr(accumulator) or check_reg_addr(div1) or check_reg_addr(div2)) {return;}
-                    registers[accumulator] = registers[div1] / registers[div2];
+                    if (registers[div2] == 0) {
+                        fault(8, true);
+                        return;
+                    }
+                    registers[accumulator] = word_div(registers[div1], registers[div2]);
                     registers[14] += 4; // Увеличиваем указатель инструкции на шаг
                 }
 
@@ -362,9 +796,14 @@ namespace cpu_unit {
                 // accumulator - адрес регистра результата
                 // mod1 - адрес регистра первого слагаемого
                 // mod2 - адрес регистра второго слагаемого
+                // Деление на ноль - ошибка 8, как у div
                 void mod(raddr accumulator, raddr mod1, raddr mod2) {
                     if (check_reg_addr(accumulator) or check_reg_addr(mod1) or check_reg_addr(mod2)) {return;}
-                    registers[accumulator] = registers[mod1] % registers[mod2];
+                    if (registers[mod2] == 0) {
+                        fault(8, true);
+                        return;
+                    }
+                    registers[accumulator] = word_mod(registers[mod1], registers[mod2]);
                     registers[14] += 4; // Увеличиваем указатель инструкции на шаг
                 }
 
@@ -390,7 +829,7 @@ namespace cpu_unit {
                 // Условный переход
                 // condition - условие (= 0; > 1; < -1; >= 2; <= -2; != 3)
                 // gotoaddr - адресс перехода
-                void jmp(int condition, std::size_t gotoaddr) {
+                void jmp(word condition, std::size_t gotoaddr) {
                     if (condition == 0 and cmp_flag == 0) {
                         registers[14] = gotoaddr;
                     } else if (condition == 1 and cmp_flag == 1) {
@@ -463,28 +902,28 @@ namespace cpu_unit {
                 // Отправить на порт значение
                 // reg - адрес отправляемого значения
                 // port - порт
-                void prts(raddr reg, int port) {
+                void prts(raddr reg, word port) {
                     check_reg_addr(reg);
                     if (port < 0 || static_cast<size_t>(port) >= ports.size()) {
                         // Ошибка: порт не существует
-                        err_flag = 6; // Неверный порт
+                        fault(6, true); // Неверный порт
                         return;
                     }
-                    ports[port]->send_value(registers[reg]);
+                    send_word(*ports[port], registers[reg]);
                     registers[14] += 4;
                 }
 
                 // Отправить на порт сигнал
                 // signal - код сигнала
                 // port - порт
-                void prcs(int signal, int port) {
+                void prcs(word signal, word port) {
                     if (port < 0 || static_cast<size_t>(port) >= ports.size()) {
                         // Ошибка: порт не существует
-                        err_flag = 6; // Неверный порт
+                        fault(6, true); // Неверный порт
                         return;
                     }
-                    if (ports.size() > port) {
-                        ports[port]->send_signal(signal);
+                    if (ports.size() > static_cast<size_t>(port)) {
+                        ports[port]->send_signal(static_cast<int>(signal));
                     }
                     registers[14] += 4;
                 }
@@ -492,15 +931,15 @@ namespace cpu_unit {
                 // Получить с порта значение
                 // reg - регистр назначения
                 // port - порт
-                void prtg(raddr reg, int port) {
+                void prtg(raddr reg, word port) {
                     if (port < 0 || static_cast<size_t>(port) >= ports.size()) {
                         // Ошибка: порт не существует
-                        err_flag = 6; // Неверный порт
+                        fault(6, true); // Неверный порт
                         return;
                     }
                     check_reg_addr(reg);
-                    if (ports.size() > port) {
-                        ports[port]->ret_value(registers[reg]);
+                    if (ports.size() > static_cast<size_t>(port)) {
+                        receive_word(*ports[port], registers[reg]);
                     }
                     registers[14] += 4;
                 }
@@ -508,35 +947,1566 @@ namespace cpu_unit {
                 // Получить состояние с порта в регистр
                 // reg - регистр назначения
                 // port - порт
-                void prcg(raddr reg, int port) {
+                void prcg(raddr reg, word port) {
                     if (port < 0 || static_cast<size_t>(port) >= ports.size()) {
                         // Ошибка: порт не существует
-                        err_flag = 6; // Неверный порт
+                        fault(6, true); // Неверный порт
                         return;
                     }
                     check_reg_addr(reg);
-                    if (ports.size() > port) {
-                        ports[port]->ret_signal(registers[reg]);
+                    if (ports.size() > static_cast<size_t>(port)) {
+                        int state = 0;
+                        ports[port]->ret_signal(state);
+                        registers[reg] = static_cast<word>(state);
+                    }
+                    registers[14] += 4;
+                }
+
+                // Обмен значениями с устройством: ядро со словом int32 и узкое слово пользуются значениями int
+                // (узкое слово получает младшие биты ответа), 64-битное - значениями long long (send_wide/ret_wide)
+                static void send_word(utility_units::virtual_port &device, word value) {
+                    if constexpr (sizeof(word) > sizeof(int)) {device.send_wide(value);} else {device.send_value(value);}
+                }
+
+                static void receive_word(utility_units::virtual_port &device, word &answer) {
+                    if constexpr (word32) {
+                        device.ret_value(answer);
+                    } else if constexpr (sizeof(word) > sizeof(int)) {
+                        long long value = 0;
+                        device.ret_wide(value);
+                        answer = static_cast<word>(value);
+                    } else {
+                        int value = 0;
+                        device.ret_value(value);
+                        answer = wrap_word<word>(static_cast<unsigned long long>(value));
+                    }
+                }
+
+                // Блочная передача куска ячеек, узкое слово идёт через буфер значений int
+                static void send_words(utility_units::virtual_port &device, const word *data, std::size_t count) {
+                    if constexpr (word32) {
+                        device.send_block(data, count);
+                    } else if constexpr (sizeof(word) > sizeof(int)) {
+                        device.send_wide_block(data, count);
+                    } else {
+                        int chunk[256];
+                        for (std::size_t done = 0; done < count;) {
+                            std::size_t n = std::min<std::size_t>(count - done, 256);
+                            for (std::size_t i = 0; i < n; i++) {chunk[i] = data[done + i];}
+                            device.send_block(chunk, n);
+                            done += n;
+                        }
+                    }
+                }
+
+                // Возвращает количество полученных значений, как virtual_port::ret_block
+                static std::size_t receive_words(utility_units::virtual_port &device, word *data, std::size_t count) {
+                    if constexpr (word32) {
+                        return device.ret_block(data, count);
+                    } else if constexpr (sizeof(word) > sizeof(int)) {
+                        return device.ret_wide_block(data, count);
+                    } else {
+                        int chunk[256];
+                        std::size_t got = 0;
+                        while (got < count) {
+                            std::size_t n = std::min<std::size_t>(count - got, 256);
+                            std::size_t k = device.ret_block(chunk, n);
+                            for (std::size_t i = 0; i < k; i++) {data[got + i] = wrap_word<word>(static_cast<unsigned long long>(chunk[i]));}
+                            got += k;
+                            if (k < n) {break;}
+                        }
+                        return got;
+                    }
+                }
+
+                // Последний адрес диапазона из len ячеек с адреса adr (len >= 0) без переполнения у 64-битного слова
+                static long long range_last(long long adr, long long len) {
+                    if (len == 0) {return adr == LLONG_MIN ? adr : adr - 1;}
+                    if (adr > 0 and len - 1 > LLONG_MAX - adr) {return LLONG_MAX;}
+                    return adr + (len - 1);
+                }
+
+                // Проверка диапазона блочной передачи: границы amin как у lodr/strr, выход за ОЗУ - исключение
+                // error - код ошибки при выходе за amin
+                bool block_range_ok(word adr, word len, int error) {
+                    if (len < 0) {
+                        fault(error, false);
+                        return false;
+                    }
+                    if (bounded() and not (adr >= memory_addres_min and range_last(adr, len) <= memory_addres_max)) {
+                        fault(error, false);
+                        return false;
+                    }
+                    if (adr < 0 or static_cast<std::size_t>(adr) + static_cast<std::size_t>(len) > memory_size) {
+                        throw std::runtime_error("Attempt to access non-existent memory");
+                    }
+                    return true;
+                }
+
+                // Отправить на порт блок ячеек ОЗУ
+                // adr_reg - регистр с адресом начала блока
+                // len_reg - регистр с количеством ячеек
+                // port - порт
+                void prtw(raddr adr_reg, raddr len_reg, word port) {
+                    if (check_reg_addr(adr_reg) or check_reg_addr(len_reg)) {return;}
+                    if (port < 0 || static_cast<size_t>(port) >= ports.size()) {
+                        // Ошибка: порт не существует
+                        fault(6, true); // Неверный порт
+                        return;
+                    }
+                    word adr = registers[adr_reg];
+                    word len = registers[len_reg];
+                    if (block_range_ok(adr, len, 1)) {
+                        utility_units::virtual_port &device = *ports[port];
+                        RAM->read_spans(adr, len, [&device](const word *data, std::size_t count) {send_words(device, data, count);});
+                    }
+                    registers[14] += 4;
+                }
+
+                // Получить с порта блок значений в ОЗУ
+                // adr_reg - регистр с адресом начала блока
+                // len_reg - регистр с наибольшим количеством значений, в него ложится количество полученных
+                // port - порт
+                void prtr(raddr adr_reg, raddr len_reg, word port) {
+                    if (check_reg_addr(adr_reg) or check_reg_addr(len_reg)) {return;}
+                    if (port < 0 || static_cast<size_t>(port) >= ports.size()) {
+                        // Ошибка: порт не существует
+                        fault(6, true); // Неверный порт
+                        return;
+                    }
+                    word adr = registers[adr_reg];
+                    word len = registers[len_reg];
+                    if (block_range_ok(adr, len, 3)) {
+                        utility_units::virtual_port &device = *ports[port];
+                        std::size_t got = RAM->write_spans(adr, len, [&device](word *data, std::size_t count) {return receive_words(device, data, count);});
+                        registers[len_reg] = static_cast<word>(got);
+                        invalidate_range(adr, got);
+                    }
+                    registers[14] += 4;
+                }
+
+            // Атомарные операции и многоядерность
+
+                // Проверка адреса атомарной операции: границы amin как у strr, выход за ОЗУ - исключение
+                bool atomic_address_ok(word adr) {
+                    if (bounded() and not (adr >= memory_addres_min and adr <= memory_addres_max)) {
+                        fault(3, false);
+                        return false;
+                    }
+                    if (static_cast<std::size_t>(adr) >= memory_size) {
+                        throw std::runtime_error("Attempt to access non-existent memory");
+                    }
+                    return true;
+                }
+
+                // Атомарное сравнение с обменом
+                // adr_reg - регистр с адресом ячейки
+                // expected_reg - регистр ожидаемого значения, в него ложится прежнее значение ячейки
+                // new_reg - регистр нового значения
+                // Флаг сравнения 0, если обмен произошёл, иначе 1
+                void cas(raddr adr_reg, raddr expected_reg, raddr new_reg) {
+                    if (check_reg_addr(adr_reg) or check_reg_addr(expected_reg) or check_reg_addr(new_reg)) {return;}
+                    word adr = registers[adr_reg];
+                    if (atomic_address_ok(adr)) {
+                        word expected = registers[expected_reg];
+                        word old = RAM->compare_exchange(adr, expected, registers[new_reg]);
+                        cmp_flag = old == expected ? 0 : 1;
+                        registers[expected_reg] = old;
+                        invalidate_code(adr);
+                    }
+                    registers[14] += 4;
+                }
+
+                // Атомарное прибавление к ячейке
+                // accumulator - регистр для прежнего значения ячейки
+                // adr_reg - регистр с адресом ячейки
+                // reg - регистр прибавляемого значения
+                void fadd(raddr accumulator, raddr adr_reg, raddr reg) {
+                    if (check_reg_addr(accumulator) or check_reg_addr(adr_reg) or check_reg_addr(reg)) {return;}
+                    word adr = registers[adr_reg];
+                    if (atomic_address_ok(adr)) {
+                        registers[accumulator] = RAM->fetch_add(adr, registers[reg]);
+                        invalidate_code(adr);
+                    }
+                    registers[14] += 4;
+                }
+
+                // Полный барьер памяти
+                void fence() {
+                    memory::fence();
+                    registers[14] += 4;
+                }
+
+                // Запуск ядра машины
+                // id_reg - регистр для номера ядра (-1, если ядро не запущено: нет машины или свободных ядер)
+                // entry_reg - регистр с адресом первой инструкции ядра
+                // arg_reg - регистр со значением для r1 нового ядра
+                void spawn(raddr id_reg, raddr entry_reg, raddr arg_reg) {
+                    if (check_reg_addr(id_reg) or check_reg_addr(entry_reg) or check_reg_addr(arg_reg)) {return;}
+                    word entry = registers[entry_reg];
+                    word arg = registers[arg_reg];
+                    registers[id_reg] = spawner ? spawner(entry, arg) : -1;
+                    registers[14] += 4;
+                }
+
+                // Ожидание остановки ядра машины
+                // id_reg - регистр с номером ядра, неизвестный номер не ждёт
+                void join(raddr id_reg) {
+                    if (check_reg_addr(id_reg)) {return;}
+                    if (joiner) {joiner(registers[id_reg]);}
+                    registers[14] += 4;
+                }
+
+            // Векторные операции
+
+                // Проход поэлементной операции: kernel(приёмник, источник, n) по кускам диапазонов
+                // Плоское ОЗУ без перекрытия обрабатывается одним куском прямо в памяти,
+                // иначе источник копируется (при перекрытии - целиком, иначе по странице), а приёмник идёт по страницам
+                template <typename F>
+                void vector_pass(std::size_t dst, std::size_t src, std::size_t len, F kernel) {
+                    if (len == 0) {return;}
+                    word *m = RAM->data();
+                    bool overlap = src != dst and src < dst + len and dst < src + len;
+                    if (m != nullptr and not overlap) {
+                        kernel(m + dst, static_cast<const word *>(m + src), len);
+                        return;
+                    }
+                    std::size_t chunk = overlap ? len : memory::page_words;
+                    for (std::size_t done = 0; done < len; done += chunk) {
+                        std::size_t n = std::min(chunk, len - done);
+                        vector_buffer.resize(n);
+                        word *to = vector_buffer.data();
+                        RAM->read_spans(src + done, n, [&to](const word *from, std::size_t k) {
+                            std::memcpy(to, from, k * sizeof(word));
+                            to += k;
+                        });
+                        const word *from = vector_buffer.data();
+                        RAM->write_spans(dst + done, n, [&from, &kernel](word *cells, std::size_t k) {
+                            kernel(cells, from, k);
+                            from += k;
+                            return k;
+                        });
+                    }
+                }
+
+                // Поэлементная операция dst = dst op src над len_reg ячейками
+                void vector_binary_op(raddr dst_reg, raddr src_reg, raddr len_reg, basic_vector_binary<word> kernel) {
+                    if (check_reg_addr(dst_reg) or check_reg_addr(src_reg) or check_reg_addr(len_reg)) {return;}
+                    word dst = registers[dst_reg];
+                    word src = registers[src_reg];
+                    word len = registers[len_reg];
+                    if (block_range_ok(src, len, 1) and block_range_ok(dst, len, 3)) {
+                        vector_pass(dst, src, len, kernel);
+                        invalidate_range(dst, len);
+                    }
+                    registers[14] += 4;
+                }
+
+                // Свёртка len_reg ячеек с адреса из adr_reg в аккумулятор, init - значение для пустого диапазона
+                void vector_reduce_op(raddr accumulator, raddr adr_reg, raddr len_reg, basic_vector_reduce<word> kernel, word init) {
+                    if (check_reg_addr(accumulator) or check_reg_addr(adr_reg) or check_reg_addr(len_reg)) {return;}
+                    word adr = registers[adr_reg];
+                    word len = registers[len_reg];
+                    if (block_range_ok(adr, len, 1)) {
+                        word acc = init;
+                        RAM->read_spans(adr, len, [&acc, kernel](const word *data, std::size_t count) {acc = kernel(data, count, acc);});
+                        registers[accumulator] = acc;
+                    }
+                    registers[14] += 4;
+                }
+
+                // Заполнение len_reg ячеек с адреса из adr_reg значением регистра reg
+                void vfill(raddr adr_reg, raddr reg, raddr len_reg) {
+                    if (check_reg_addr(adr_reg) or check_reg_addr(reg) or check_reg_addr(len_reg)) {return;}
+                    word adr = registers[adr_reg];
+                    word len = registers[len_reg];
+                    if (block_range_ok(adr, len, 3)) {
+                        word value = registers[reg];
+                        auto fill = vectors->fill;
+                        RAM->write_spans(adr, len, [value, fill](word *data, std::size_t count) {
+                            fill(data, value, count);
+                            return count;
+                        });
+                        invalidate_range(adr, len);
+                    }
+                    registers[14] += 4;
+                }
+
+                // Копирование len_reg ячеек с адреса из src_reg на адрес из dst_reg
+                void vcopy(raddr dst_reg, raddr src_reg, raddr len_reg) {
+                    if (check_reg_addr(dst_reg) or check_reg_addr(src_reg) or check_reg_addr(len_reg)) {return;}
+                    word dst = registers[dst_reg];
+                    word src = registers[src_reg];
+                    word len = registers[len_reg];
+                    if (block_range_ok(src, len, 1) and block_range_ok(dst, len, 3)) {
+                        if (RAM->data() != nullptr) {
+                            std::memmove(RAM->data() + dst, RAM->data() + src, static_cast<std::size_t>(len) * sizeof(word));
+                        } else {
+                            vector_pass(dst, src, len, [](word *to, const word *from, std::size_t n) {std::memcpy(to, from, n * sizeof(word));});
+                        }
+                        invalidate_range(dst, len);
+                    }
+                    registers[14] += 4;
+                }
+
+            // Операции работы со стеком
+
+                // Проверка ячейки стека: область стека и границы amin при setl, иначе ошибка 7 с остановкой
+                bool stack_cell_ok(long long adr) {
+                    if (adr < static_cast<long long>(stack_low) or adr >= static_cast<long long>(stack_high)
+                        or (bounded() and (adr < memory_addres_min or adr > memory_addres_max))) {
+                        fault(7, true);
+                        return false;
+                    }
+                    return true;
+                }
+
+                // Адрес ячейки со смещением delta от вершины стека, при переполнении (64-битное слово) - -1, вне стека
+                long long stack_at(long long delta) const {
+                    long long adr = 0;
+                    if (__builtin_add_overflow(static_cast<long long>(registers[15]), delta, &adr)) {return -1;}
+                    return adr;
+                }
+
+                // Добавить в стек значение регистра
+                // reg - адрес регистра
+                void push(raddr reg) {
+                    if (check_reg_addr(reg)) {return;}
+                    long long adr = stack_at(-1);
+                    if (not stack_cell_ok(adr)) {return;}
+                    RAM->put(adr, registers[reg]);
+                    invalidate_code(adr);
+                    registers[15] = static_cast<word>(adr);
+                    registers[14] += 4;
+                }
+
+                // Снять значение с вершины стека
+                // reg - адрес регистра для значения
+                void pop(raddr reg) {
+                    if (check_reg_addr(reg)) {return;}
+                    long long adr = registers[15];
+                    if (not stack_cell_ok(adr)) {return;}
+                    word value = RAM->at(adr);
+                    registers[15] = static_cast<word>(adr + 1);
+                    registers[reg] = value;
+                    registers[14] += 4;
+                }
+
+                // Вызов функции: адрес следующей инструкции кладётся в стек
+                // gotoaddr - адрес функции
+                // Возвращает false, если стек переполнен
+                bool call(word gotoaddr) {
+                    long long adr = stack_at(-1);
+                    if (not stack_cell_ok(adr)) {return false;}
+                    RAM->put(adr, static_cast<word>(registers[14] + 4));
+                    invalidate_code(adr);
+                    registers[15] = static_cast<word>(adr);
+                    registers[14] = gotoaddr;
+                    if (profiling()) {profile->enter(gotoaddr);}
+                    return true;
+                }
+
+                // Возврат из функции по адресу с вершины стека
+                // Возвращает false, если стек пуст
+                bool ret() {
+                    long long adr = registers[15];
+                    if (not stack_cell_ok(adr)) {return false;}
+                    registers[14] = RAM->at(adr);
+                    registers[15] = static_cast<word>(adr + 1);
+                    if (profiling()) {profile->leave();}
+                    return true;
+                }
+
+                // Прочитать ячейку стека, не снимая её
+                // reg - адрес регистра для значения
+                // offset - смещение от вершины стека
+                void stkr(raddr reg, word offset) {
+                    if (check_reg_addr(reg)) {return;}
+                    long long adr = stack_at(offset);
+                    if (not stack_cell_ok(adr)) {return;}
+                    registers[reg] = RAM->at(adr);
+                    registers[14] += 4;
+                }
+
+            // Прерывания
+
+                // Ошибка исполнения: ставит err_flag, а если у ошибки есть обработчик и прерывание не обрабатывается,
+                // назначает вызов обработчика перед следующей инструкцией (обнуляя обратный отсчёт)
+                // Иначе ошибка с остановкой (stop) останавливает процессор, остальные только оставляют флаг
+                void fault(int code, bool stop) {
+                    err_flag = code;
+                    if (not in_interrupt and pending_fault == 0 and intr_table[code] >= 0) {
+                        pending_fault = code;
+                        fault_pc = registers[14];
+                        sync_clock();
+                        schedule();
+                    } else if (stop) {
+                        stop_reason = ExitReason::ERROR;
+                        is_work = false;
+                    }
+                }
+
+                // Перенос выбранных с начала отрезка инструкций в счётчики событий
+                void sync_clock() {
+                    long long done = slice - countdown;
+                    retired += done;
+                    timer_left -= done;
+                    budget_left -= done;
+                    poll_left -= done;
+                    slice = countdown;
+                }
+
+                // Новый отрезок до ближайшего события, ждущее прерывание обслуживается на следующей инструкции
+                void schedule() {
+                    slice = std::min(timer_left, std::min(budget_left, poll_left));
+                    if (pending_fault != 0 or (timer_pending and not in_interrupt)) {slice = 0;}
+                    countdown = slice;
+                }
+
+                // Вход в обработчик: в стек кладутся флаг сравнения и адрес возврата (на вершине), прерывания маскируются
+                // Возвращает false, если в стеке нет места (процессор остановлен с ошибкой 7)
+                bool interrupt(word handler, word return_adr) {
+                    in_interrupt = true;
+                    long long adr = stack_at(-2);
+                    if (not stack_cell_ok(adr) or not stack_cell_ok(adr + 1)) {return false;}
+                    RAM->put(adr + 1, cmp_flag);
+                    RAM->put(adr, return_adr);
+                    invalidate_code(adr + 1);
+                    invalidate_code(adr);
+                    registers[15] = static_cast<word>(adr);
+                    registers[14] = handler;
+                    if (profiling()) {profile->enter(handler);}
+                    return true;
+                }
+
+                // Обслуживание по концу обратного отсчёта: ограничения, затем ждущая ошибка, затем таймер
+                // Ошибка возвращается на инструкцию после ошибочной, таймер - на ещё не исполненную
+                // Вызывается движком перед исполнением уже выбранной инструкции (она учтена в счётчиках),
+                // после него исполняется инструкция по r14, если процессор не остановлен
+                void service() {
+                    sync_clock();
+                    if (budget_left < 0) {
+                        halt_before(ExitReason::BUDGET);
+                        return;
+                    }
+                    if (poll_left < 0) {
+                        poll_left = deadline_poll;
+                        if (std::chrono::steady_clock::now() >= deadline) {
+                            halt_before(ExitReason::DEADLINE);
+                            return;
+                        }
+                    }
+                    if (pending_fault != 0) {
+                        int code = pending_fault;
+                        pending_fault = 0;
+                        interrupt(intr_table[code], static_cast<word>(fault_pc + 4));
+                    }
+                    if (timer_left < 0) {
+                        // Инструкции, исполненные сверх периода (сверхинструкцией или блоком JIT), идут в счёт следующего
+                        timer_left += timer_period;
+                        if (timer_left < 0) {timer_left = 0;}
+                        timer_pending = true;
+                    }
+                    if (timer_pending and not in_interrupt) {
+                        timer_pending = false;
+                        interrupt(registers[13], registers[14]);
+                    }
+                    schedule();
+                }
+
+                // Остановка по ограничению до исполнения выбранной инструкции: r14 остаётся на ней,
+                // и следующий start_process() продолжит с неё
+                void halt_before(ExitReason reason) {
+                    retired -= 1;
+                    budget_left += 1;
+                    timer_left += 1;
+                    stop_reason = reason;
+                    is_work = false;
+                    schedule();
+                }
+
+                // Остановка на выборке за концом ОЗУ: инструкции нет, поэтому она не считается исполненной
+                void end_of_memory() {
+                    countdown += 1;
+                    stop_reason = ExitReason::END_OF_MEMORY;
+                    is_work = false;
+                }
+
+                // Инструкция по r14 целиком лежит в ОЗУ, сравнение в size_t: отрицательный r14 - тоже за концом
+                bool pc_in_memory() const {
+                    return registers[14] >= 0 and static_cast<std::size_t>(registers[14]) + 3 < memory_size;
+                }
+
+                // Программное прерывание
+                // number - номер в таблице прерываний, без обработчика или во время обработки прерывания ничего не делает
+                void intr(word number) {
+                    if (number < 0 or number >= 16) {fault(5, true); return;}
+                    if (intr_table[number] < 0 or in_interrupt) {
+                        registers[14] += 4;
+                        return;
+                    }
+                    interrupt(intr_table[number], static_cast<word>(registers[14] + 4));
+                }
+
+                // Системный вызов: прерывание с обработчиком по адресу из r13
+                void scall() {
+                    if (in_interrupt) {
+                        registers[14] += 4;
+                        return;
+                    }
+                    interrupt(registers[13], static_cast<word>(registers[14] + 4));
+                }
+
+                // Возврат из прерывания: снимает адрес возврата и флаг сравнения, снимает маску прерываний
+                // Таймер, сработавший во время обработки, срабатывает сразу после возврата
+                // Возвращает false, если стек пуст
+                bool iret() {
+                    long long adr = registers[15];
+                    if (not stack_cell_ok(adr) or not stack_cell_ok(adr + 1)) {return false;}
+                    registers[14] = RAM->at(adr);
+                    cmp_flag = RAM->at(adr + 1);
+                    registers[15] = static_cast<word>(adr + 2);
+                    in_interrupt = false;
+                    if (profiling()) {profile->leave();}
+                    if (timer_pending) {
+                        sync_clock();
+                        schedule();
+                    }
+                    return true;
+                }
+
+                // Установка обработчика прерывания
+                // number - номер в таблице прерываний
+                // reg - регистр с адресом обработчика, -1 снимает обработчик
+                void seti(word number, raddr reg) {
+                    if (number < 0 or number >= 16) {fault(5, true); return;}
+                    if (check_reg_addr(reg)) {return;}
+                    intr_table[number] = registers[reg];
+                    registers[14] += 4;
+                }
+
+                // Запуск таймера системных вызовов
+                // reg - регистр с периодом в инструкциях, 0 и меньше выключает таймер
+                void timer(raddr reg) {
+                    if (check_reg_addr(reg)) {return;}
+                    registers[14] += 4;
+                    arm_timer(registers[reg]);
+                }
+
+                void arm_timer(long long period) {
+                    sync_clock();
+                    syscals = period > 0;
+                    timer_period = syscals ? period : 0;
+                    timer_left = syscals ? period : no_countdown;
+                    timer_pending = false;
+                    schedule();
+                }
+
+                // Установка и сброс флага ошибки без прерывания
+                void serr(int type) {
+                    err_flag = type;
+                    registers[14] += 4;
+                }
+
+                void cerr() {
+                    err_flag = 0;
+                    registers[14] += 4;
+                }
+
+            // Инструкции доверенного режима
+            // Регистры, номера портов и прямые адреса уже проверены verify_program(),
+            // динамические адреса lodr/strr проверяются без исключений: при выходе за ОЗУ
+            // ставится err_flag = 1 и процессор останавливается. Границы amin соблюдаются как обычно
+
+                // Прямой адрес в границах amin, границы сравниваются как size_t, как у lodi/stri
+                bool static_in_bounds(std::size_t static_adress) const {
+                    return static_adress >= static_cast<std::size_t>(memory_addres_min)
+                        and static_adress <= static_cast<std::size_t>(memory_addres_max);
+                }
+
+                void t_lodi(raddr accumulator, std::size_t static_adress) {
+                    if (bounded() and not static_in_bounds(static_adress)) {
+                        fault(1, false);
+                    } else {
+                        registers[accumulator] = RAM->at(static_adress);
+                    }
+                    registers[14] += 4;
+                }
+
+                void t_lodr(raddr accumulator, raddr reg_addressator) {
+                    std::size_t adr = registers[reg_addressator];
+                    if (bounded() and not (registers[reg_addressator] >= memory_addres_min and registers[reg_addressator] <= memory_addres_max)) {
+                        fault(1, false);
+                    } else if (adr >= memory_size) {
+                        fault(1, true);
+                        return;
+                    } else {
+                        registers[accumulator] = RAM->at(adr);
                     }
                     registers[14] += 4;
                 }
 
+                void t_stri(std::size_t static_adress, raddr reg) {
+                    if (bounded() and not static_in_bounds(static_adress)) {
+                        fault(3, false);
+                    } else {
+                        RAM->put(static_adress, registers[reg]);
+                        invalidate_code(static_adress);
+                    }
+                    registers[14] += 4;
+                }
+
+                void t_strr(raddr reg_addressator, raddr reg) {
+                    std::size_t adr = registers[reg_addressator];
+                    if (bounded() and not (registers[reg_addressator] >= memory_addres_min and registers[reg_addressator] <= memory_addres_max)) {
+                        fault(3, false);
+                    } else if (adr >= memory_size) {
+                        fault(1, true);
+                        return;
+                    } else {
+                        RAM->put(adr, registers[reg]);
+                        invalidate_code(adr);
+                    }
+                    registers[14] += 4;
+                }
+
+                void t_mov(raddr reg1, raddr reg2) {registers[reg1] = registers[reg2]; registers[14] += 4;}
+                void t_add(raddr a, raddr b, raddr c) {registers[a] = word_add(registers[b], registers[c]); registers[14] += 4;}
+                void t_addc(raddr a, raddr b, word value) {registers[a] = word_add(registers[b], value); registers[14] += 4;}
+                void t_loc(raddr a, word value) {registers[a] = value; registers[14] += 4;}
+                void t_sub(raddr a, raddr b, raddr c) {registers[a] = word_sub(registers[b], registers[c]); registers[14] += 4;}
+                void t_mult(raddr a, raddr b, raddr c) {registers[a] = word_mul(registers[b], registers[c]); registers[14] += 4;}
+                // Деление на ноль проверяется и без проверок программы: делитель известен только при исполнении
+                void t_div(raddr a, raddr b, raddr c) {
+                    if (registers[c] == 0) {fault(8, true); return;}
+                    registers[a] = word_div(registers[b], registers[c]);
+                    registers[14] += 4;
+                }
+                void t_mod(raddr a, raddr b, raddr c) {
+                    if (registers[c] == 0) {fault(8, true); return;}
+                    registers[a] = word_mod(registers[b], registers[c]);
+                    registers[14] += 4;
+                }
+                void t_cmp(raddr a, raddr b) {
+                    cmp_flag = registers[a] == registers[b] ? 0 : (registers[a] > registers[b] ? 1 : -1);
+                    registers[14] += 4;
+                }
+                void t_lcmp(raddr reg) {registers[reg] = cmp_flag; registers[14] += 4;}
+                void t_or(raddr a, raddr b, raddr c) {registers[a] = registers[b] or registers[c]; registers[14] += 4;}
+                void t_and(raddr a, raddr b, raddr c) {registers[a] = registers[b] and registers[c]; registers[14] += 4;}
+                void t_not(raddr a, raddr b) {registers[a] = not registers[b]; registers[14] += 4;}
+                void t_prts(raddr reg, word port) {send_word(*ports[port], registers[reg]); registers[14] += 4;}
+                void t_prcs(word signal, word port) {ports[port]->send_signal(static_cast<int>(signal)); registers[14] += 4;}
+                void t_prtg(raddr reg, word port) {receive_word(*ports[port], registers[reg]); registers[14] += 4;}
+                void t_prcg(raddr reg, word port) {
+                    int state = 0;
+                    ports[port]->ret_signal(state);
+                    registers[reg] = static_cast<word>(state);
+                    registers[14] += 4;
+                }
+
+            // Проверка программы при загрузке
+
+                // Обход всех статически достижимых из точки входа инструкций области программы
+                // Для каждой проверяются номера регистров, прямые адреса lodi/stri и номера портов,
+                // при ошибке бросается исключение с адресом инструкции
+                // Запись в регистр 14 (вычисляемый переход) обрывает обход по этому пути,
+                // такие цели и инструкции вне области программы остаются непроверенными и исполняются с проверками
+                void verify_program() {
+                    verified.assign(program_size, 0);
+                    std::vector<std::size_t> work = {static_cast<std::size_t>(registers[14])};
+                    auto fail = [](std::size_t adr, const char *what) {
+                        throw std::runtime_error("Verification failed at address " + std::to_string(adr) + ": " + what);
+                    };
+                    auto reg = [](word r) {return r >= 0 and r < 16;};
+                    while (not work.empty()) {
+                        std::size_t adr = work.back();
+                        work.pop_back();
+                        if (adr + 3 >= program_size or verified[adr]) {continue;}
+                        int op = opcode_of(RAM->get_from_memory(adr));
+                        word a = RAM->get_from_memory(adr+1);
+                        word b = RAM->get_from_memory(adr+2);
+                        word c = RAM->get_from_memory(adr+3);
+                        bool port_ok = b >= 0 and static_cast<std::size_t>(b) < ports.size();
+                        word dest = -1; // Регистр-приёмник, если он есть
+                        bool falls = true;
+                        switch (static_cast<OpCode>(op)) {
+                            case OpCode::HALT: falls = false; break;
+                            case OpCode::LODI:
+                                if (not reg(a)) {fail(adr, "bad register");}
+                                if (static_cast<std::size_t>(b) >= memory_size) {fail(adr, "address out of memory");}
+                                dest = a; break;
+                            case OpCode::STRI:
+                                if (not reg(b)) {fail(adr, "bad register");}
+                                if (static_cast<std::size_t>(a) >= memory_size) {fail(adr, "address out of memory");}
+                                break;
+                            case OpCode::LODR: case OpCode::MOV: case OpCode::NOT:
+                                if (not reg(a) or not reg(b)) {fail(adr, "bad register");}
+                                dest = a; break;
+                            case OpCode::STRR: case OpCode::AMIN: case OpCode::CMP:
+                                if (not reg(a) or not reg(b)) {fail(adr, "bad register");}
+                                break;
+                            case OpCode::SETL: case OpCode::SETF: break;
+                            case OpCode::ADD: case OpCode::SUB: case OpCode::MULT: case OpCode::DIV:
+                            case OpCode::MOD: case OpCode::OR: case OpCode::AND:
+                                if (not reg(a) or not reg(b) or not reg(c)) {fail(adr, "bad register");}
+                                dest = a; break;
+                            case OpCode::ADDC:
+                                if (not reg(a) or not reg(b)) {fail(adr, "bad register");}
+                                dest = a; break;
+                            case OpCode::LOC: case OpCode::LCMP:
+                                if (not reg(a)) {fail(adr, "bad register");}
+                                dest = a; break;
+                            case OpCode::JMP: work.push_back(static_cast<std::size_t>(b)); break;
+                            case OpCode::GOTO: work.push_back(static_cast<std::size_t>(a)); falls = false; break;
+                            case OpCode::PRTS: case OpCode::PRTG: case OpCode::PRCG:
+                                if (not reg(a)) {fail(adr, "bad register");}
+                                if (not port_ok) {fail(adr, "bad port");}
+                                dest = static_cast<OpCode>(op) == OpCode::PRTS ? -1 : a; break;
+                            case OpCode::PRCS:
+                                if (not port_ok) {fail(adr, "bad port");}
+                                break;
+                            case OpCode::PRTW: case OpCode::PRTR:
+                                if (not reg(a) or not reg(b)) {fail(adr, "bad register");}
+                                if (c < 0 or static_cast<std::size_t>(c) >= ports.size()) {fail(adr, "bad port");}
+                                dest = static_cast<OpCode>(op) == OpCode::PRTR ? b : -1; break;
+                            case OpCode::CAS: case OpCode::FADD: case OpCode::SPAWN:
+                                if (not reg(a) or not reg(b) or not reg(c)) {fail(adr, "bad register");}
+                                dest = static_cast<OpCode>(op) == OpCode::CAS ? b : a; break;
+                            case OpCode::JOIN:
+                                if (not reg(a)) {fail(adr, "bad register");}
+                                break;
+                            case OpCode::FENCE: break;
+                            case OpCode::VADD: case OpCode::VSUB: case OpCode::VMUL: case OpCode::VAND: case OpCode::VOR:
+                            case OpCode::VFILL: case OpCode::VCOPY:
+                                if (not reg(a) or not reg(b) or not reg(c)) {fail(adr, "bad register");}
+                                break;
+                            case OpCode::VSUM: case OpCode::VMIN: case OpCode::VMAX:
+                                if (not reg(a) or not reg(b) or not reg(c)) {fail(adr, "bad register");}
+                                dest = a; break;
+                            case OpCode::PUSH:
+                                if (not reg(a)) {fail(adr, "bad register");}
+                                break;
+                            case OpCode::POP: case OpCode::STKR:
+                                if (not reg(a)) {fail(adr, "bad register");}
+                                dest = a; break;
+                            // Функция возвращается на следующую инструкцию, поэтому обход идёт по обоим путям
+                            case OpCode::CALL: work.push_back(static_cast<std::size_t>(a)); break;
+                            case OpCode::RET: case OpCode::IRET: falls = false; break;
+                            // Обработчики прерываний задаются регистрами и не проверяются
+                            case OpCode::INTR:
+                                if (a < 0 or a >= 16) {fail(adr, "bad interrupt");}
+                                break;
+                            case OpCode::SETI:
+                                if (a < 0 or a >= 16) {fail(adr, "bad interrupt");}
+                                if (not reg(b)) {fail(adr, "bad register");}
+                                break;
+                            case OpCode::TIMER:
+                                if (not reg(a)) {fail(adr, "bad register");}
+                                break;
+                            case OpCode::SCALL: case OpCode::SERR: case OpCode::CERR: break;
+                            default: fail(adr, "bad opcode");
+                        }
+                        verified[adr] = 1;
+                        if (dest == 14) {continue;}
+                        if (falls) {work.push_back(adr + 4);}
+                    }
+                }
+
+                // Доверенный режим включён, и инструкция по адресу adr прошла проверку
+                bool verified_at(std::size_t adr) const {
+                    return trusted and adr < verified.size() and verified[adr];
+                }
+
+            // Снимки и клоны
+
+                // Состояние ядра без ОЗУ (регистры, флаги, прерывания, таймер, стек, порты) для снимка и клона
+                // Ядро, остановленное на halt, продолжится со следующей инструкции: так программа готовит
+                // себя один раз, а каждый запуск из снимка или клона начинается сразу после подготовки
+                void write_state(utility_units::state_writer &out) {
+                    bool after_halt = stop_reason == ExitReason::HALT and registers[14] >= 0
+                        and static_cast<std::size_t>(registers[14]) + 3 < memory_size
+                        and RAM->get_from_memory(registers[14]) == static_cast<word>(OpCode::HALT);
+                    for (std::size_t i = 0; i < 16; i++) {out.put(i == 14 and after_halt ? static_cast<word>(registers[14] + 4) : registers[i]);}
+                    out.put(cmp_flag);
+                    out.put(err_flag);
+                    out.put(memory_addres_min);
+                    out.put(memory_addres_max);
+                    out.put(safe_address_mode);
+                    for (word handler : intr_table) {out.put(handler);}
+                    out.put(in_interrupt);
+                    out.put(pending_fault);
+                    out.put(fault_pc);
+                    out.put(static_cast<long long>(stack_low));
+                    out.put(static_cast<long long>(stack_high));
+                    sync_clock();
+                    out.put(timer_period);
+                    out.put(syscals ? timer_left : 0);
+                    out.put(timer_pending);
+                    out.put(trusted);
+                    out.put(static_cast<long long>(ports.size()));
+                    for (auto &port : ports) {port->save_state(out);}
+                }
+
+                // Чтение состояния после attach(), ОЗУ уже на месте
+                void read_state(utility_units::state_reader &in) {
+                    constexpr long long word_min = std::numeric_limits<word>::min();
+                    constexpr long long word_max = std::numeric_limits<word>::max();
+                    for (word &r : registers) {r = static_cast<word>(in.get(word_min, word_max));}
+                    cmp_flag = static_cast<int>(in.get());
+                    err_flag = static_cast<int>(in.get());
+                    memory_addres_min = static_cast<word>(in.get(word_min, word_max));
+                    memory_addres_max = static_cast<word>(in.get(word_min, word_max));
+                    safe_address_mode = in.get() != 0;
+                    if (safe_address_mode and not Policy::bounds) {throw std::runtime_error("Snapshot with setl needs the checked core");}
+                    for (word &handler : intr_table) {handler = static_cast<word>(in.get(word_min, word_max));}
+                    in_interrupt = in.get() != 0;
+                    pending_fault = static_cast<int>(in.get());
+                    fault_pc = static_cast<word>(in.get(word_min, word_max));
+                    stack_low = static_cast<std::size_t>(in.get(0, static_cast<long long>(memory_size)));
+                    stack_high = static_cast<std::size_t>(in.get(static_cast<long long>(stack_low), static_cast<long long>(memory_size)));
+                    long long period = in.get(0, no_countdown);
+                    long long left = in.get(0, no_countdown);
+                    bool pending = in.get() != 0;
+                    bool was_trusted = in.get() != 0;
+                    arm_timer(period);
+                    if (period > 0) {timer_left = left;}
+                    timer_pending = pending;
+                    schedule();
+                    std::size_t port_count = static_cast<std::size_t>(in.get(0, 1024));
+                    if (port_count != ports.size()) {throw std::runtime_error("Snapshot has another set of ports");}
+                    for (auto &port : ports) {port->load_state(in);}
+                    // Доверенный режим заново проверяет программу: она могла измениться до снимка
+                    if (was_trusted) {set_trusted(true);}
+                }
+
+            // Трасса исполнения
+
+                // Запись изменившихся с прошлой записи регистров (кроме r14) и флага сравнения
+                void trace_state() {
+                    // Чаще всего инструкция меняет один регистр или ни одного, поэтому сначала сравнение целиком
+                    // (r14 не пишется, его копия просто догоняет)
+                    trace_registers[14] = registers[14];
+                    if (std::memcmp(registers, trace_registers, sizeof(registers)) != 0) {
+                        trace_changed();
+                    }
+                    if (cmp_flag != trace_flag) {
+                        trace->flag(cmp_flag);
+                        trace_flag = cmp_flag;
+                    }
+                }
+
+                void trace_changed() {
+                    for (std::size_t r = 0; r < 16; r++) {
+                        if (registers[r] != trace_registers[r]) {
+                            trace->reg(static_cast<int>(r), registers[r]);
+                            trace_registers[r] = registers[r];
+                        }
+                    }
+                }
+
+                // Запись трассы или сверка с воспроизводимой начинается с загруженной программы
+                // Порты 0 и 1 при воспроизведении отдают ввод из трассы (вывод терминала идёт в терминал),
+                // порты 2 и 3 пишут в ОЗУ сами, поэтому остаются настоящими устройствами, а их ввод только сверяется
+                void attach_trace(std::size_t code_size) {
+                    trace.reset();
+                    replay_check = nullptr;
+                    if (trace_path.empty() and not replay) {return;}
+                    std::vector<int> code(code_size);
+                    for (std::size_t i = 0; i < code_size; i++) {code[i] = RAM->get_from_memory(i);}
+                    if (replay) {
+                        replay->check(code, memory_size);
+                        auto checker = std::make_unique<utility_units::trace_checker>(*replay);
+                        replay_check = checker.get();
+                        trace = std::move(checker);
+                        ports[0] = std::make_unique<utility_units::replay_port>(*replay, 0, std::move(ports[0]));
+                        ports[1] = std::make_unique<utility_units::replay_port>(*replay, 1);
+                    } else {
+                        trace = std::make_unique<utility_units::trace_writer>(trace_path, code, memory_size);
+                    }
+                    for (std::size_t i = 0; i < ports.size(); i++) {
+                        ports[i] = std::make_unique<utility_units::traced_port>(std::move(ports[i]), *trace, i);
+                    }
+                    for (std::size_t i = 0; i < 16; i++) {trace_registers[i] = registers[i];}
+                    trace_flag = cmp_flag;
+                }
+
+            // Кэш предекодированных инструкций
+
+                // Сброс записей кэша для записи в ОЗУ блоком, вне области программы ничего не делает
+                void invalidate_range(std::size_t adr, std::size_t count) {
+                    if (tracing()) {
+                        for (std::size_t i = adr; i < adr + count; i++) {trace->memory(i, RAM->get_from_memory(i));}
+                    }
+                    std::size_t end = std::min(adr + count, program_size);
+                    for (std::size_t i = adr; i < end; i++) {invalidate_code(i);}
+                }
+
+                // Сброс записей кэша, которые покрывают адрес adr (инструкция занимает 4 ячейки)
+                // Вызывается после каждой записи в ОЗУ ядром, поэтому вне области программы ничего не делает (кроме записи в трассу)
+                // Сверхинструкция покрывает до fusion_max_length инструкций, поэтому сбрасываются все записи,
+                // чья цепочка может задевать adr
+                void invalidate_code(std::size_t adr) {
+                    if (tracing()) {trace->memory(adr, RAM->get_from_memory(adr));}
+                    if (native_intact and adr < native.code_size and native.code_map[adr]) {native_intact = false;}
+                    if (adr >= icache.size()) {return;}
+                    jit.invalidate(adr);
+                    constexpr std::size_t reach = 4 * fusion_max_length - 1;
+                    std::size_t first = adr >= reach ? adr - reach : 0;
+                    for (std::size_t i = first; i <= adr; i++) {
+                        icache[i].handler = nullptr;
+                        icache[i].target = nullptr;
+                    }
+                    // Изменённые инструкции больше не считаются проверенными
+                    if (not verified.empty()) {
+                        for (std::size_t i = adr >= 3 ? adr - 3 : 0; i <= adr; i++) {verified[i] = 0;}
+                    }
+                }
+
+                // Обработчики предекодированных инструкций, операнды уже лежат в записи
+                void h_lodi(const decoded_instruction &d) {lodi(d.a, d.b);}
+                void h_lodr(const decoded_instruction &d) {lodr(d.a, d.b);}
+                void h_stri(const decoded_instruction &d) {stri(d.a, d.b);}
+                void h_strr(const decoded_instruction &d) {strr(d.a, d.b);}
+                void h_mov(const decoded_instruction &d) {mov(d.a, d.b);}
+                void h_amin(const decoded_instruction &d) {amin(d.a, d.b);}
+                void h_setl(const decoded_instruction &) {setl();}
+                void h_setf(const decoded_instruction &) {setf();}
+                void h_add(const decoded_instruction &d) {add(d.a, d.b, d.c);}
+                void h_addc(const decoded_instruction &d) {addc(d.a, d.b, d.c);}
+                void h_loc(const decoded_instruction &d) {loc(d.a, d.b);}
+                void h_sub(const decoded_instruction &d) {sub(d.a, d.b, d.c);}
+                void h_mult(const decoded_instruction &d) {mult(d.a, d.b, d.c);}
+                void h_div(const decoded_instruction &d) {div(d.a, d.b, d.c);}
+                void h_mod(const decoded_instruction &d) {mod(d.a, d.b, d.c);}
+                void h_cmp(const decoded_instruction &d) {cmp(d.a, d.b);}
+                void h_jmp(const decoded_instruction &d) {jmp(d.a, d.b);}
+                void h_goto(const decoded_instruction &d) {gotop(d.a);}
+                void h_lcmp(const decoded_instruction &d) {lcmp(d.a);}
+                void h_or(const decoded_instruction &d) {logor(d.a, d.b, d.c);}
+                void h_and(const decoded_instruction &d) {logand(d.a, d.b, d.c);}
+                void h_not(const decoded_instruction &d) {lognot(d.a, d.b);}
+                void h_prts(const decoded_instruction &d) {prts(d.a, d.b);}
+                void h_prcs(const decoded_instruction &d) {prcs(d.a, d.b);}
+                void h_prtg(const decoded_instruction &d) {prtg(d.a, d.b);}
+                void h_prcg(const decoded_instruction &d) {prcg(d.a, d.b);}
+                void h_prtw(const decoded_instruction &d) {prtw(d.a, d.b, d.c);}
+                void h_prtr(const decoded_instruction &d) {prtr(d.a, d.b, d.c);}
+                void h_cas(const decoded_instruction &d) {cas(d.a, d.b, d.c);}
+                void h_fadd(const decoded_instruction &d) {fadd(d.a, d.b, d.c);}
+                void h_fence(const decoded_instruction &) {fence();}
+                void h_spawn(const decoded_instruction &d) {spawn(d.a, d.b, d.c);}
+                void h_join(const decoded_instruction &d) {join(d.a);}
+                void h_vadd(const decoded_instruction &d) {vector_binary_op(d.a, d.b, d.c, vectors->add);}
+                void h_vsub(const decoded_instruction &d) {vector_binary_op(d.a, d.b, d.c, vectors->sub);}
+                void h_vmul(const decoded_instruction &d) {vector_binary_op(d.a, d.b, d.c, vectors->mul);}
+                void h_vand(const decoded_instruction &d) {vector_binary_op(d.a, d.b, d.c, vectors->logand);}
+                void h_vor(const decoded_instruction &d) {vector_binary_op(d.a, d.b, d.c, vectors->logor);}
+                void h_vsum(const decoded_instruction &d) {vector_reduce_op(d.a, d.b, d.c, vectors->sum, 0);}
+                void h_vmin(const decoded_instruction &d) {vector_reduce_op(d.a, d.b, d.c, vectors->min, std::numeric_limits<word>::max());}
+                void h_vmax(const decoded_instruction &d) {vector_reduce_op(d.a, d.b, d.c, vectors->max, std::numeric_limits<word>::min());}
+                void h_vfill(const decoded_instruction &d) {vfill(d.a, d.b, d.c);}
+                void h_vcopy(const decoded_instruction &d) {vcopy(d.a, d.b, d.c);}
+                void h_push(const decoded_instruction &d) {push(d.a);}
+                void h_pop(const decoded_instruction &d) {pop(d.a);}
+                void h_call(const decoded_instruction &d) {call(d.a);}
+                void h_ret(const decoded_instruction &) {ret();}
+                void h_stkr(const decoded_instruction &d) {stkr(d.a, d.b);}
+                void h_intr(const decoded_instruction &d) {intr(d.a);}
+                void h_scall(const decoded_instruction &) {scall();}
+                void h_iret(const decoded_instruction &) {iret();}
+                void h_seti(const decoded_instruction &d) {seti(d.a, d.b);}
+                void h_timer(const decoded_instruction &d) {timer(d.a);}
+                void h_serr(const decoded_instruction &d) {serr(d.a);}
+                void h_cerr(const decoded_instruction &) {cerr();}
+                void h_halt(const decoded_instruction &) {is_work = false;}
+
+                // Обработчики сверхинструкций, вызывают те же методы подряд,
+                // поэтому регистр 14 и cmp_flag меняются ровно как при раздельном исполнении
+                // Обратный отсчёт таймера уменьшается на все инструкции цепочки
+                void h_cmp_jmp(const decoded_instruction &d) {
+                    countdown -= 1;
+                    cmp(d.a, d.b);
+                    jmp(d.ext[0], d.ext[1]);
+                }
+                void h_loc_prts(const decoded_instruction &d) {
+                    countdown -= 1;
+                    loc(d.a, d.b);
+                    prts(d.ext[0], d.ext[1]);
+                }
+                void h_lodr_prts(const decoded_instruction &d) {
+                    countdown -= 1;
+                    // Проверенный lodr в доверенном режиме за ОЗУ останавливает процессор, как без слияния,
+                    // и prts не исполняется и не считается
+                    if (verified_at(registers[14])) {
+                        t_lodr(d.a, d.b);
+                        if (not is_work) {
+                            countdown += 1;
+                            return;
+                        }
+                    } else {
+                        lodr(d.a, d.b);
+                    }
+                    // Ошибка lodr с обработчиком: prts исполнится после возврата из прерывания
+                    if (pending_fault == 0) {prts(d.ext[0], d.ext[1]);}
+                }
+                void h_addc_cmp_jmp(const decoded_instruction &d) {
+                    countdown -= 2;
+                    addc(d.a, d.b, d.c);
+                    cmp(d.ext[0], d.ext[1]);
+                    jmp(d.ext[3], d.ext[4]);
+                }
+                void h_invalid(const decoded_instruction &) {fault(5, true);}
+
+                // Обработчики доверенного режима
+                void h_t_lodi(const decoded_instruction &d) {t_lodi(d.a, d.b);}
+                void h_t_lodr(const decoded_instruction &d) {t_lodr(d.a, d.b);}
+                void h_t_stri(const decoded_instruction &d) {t_stri(d.a, d.b);}
+                void h_t_strr(const decoded_instruction &d) {t_strr(d.a, d.b);}
+                void h_t_mov(const decoded_instruction &d) {t_mov(d.a, d.b);}
+                void h_t_add(const decoded_instruction &d) {t_add(d.a, d.b, d.c);}
+                void h_t_addc(const decoded_instruction &d) {t_addc(d.a, d.b, d.c);}
+                void h_t_loc(const decoded_instruction &d) {t_loc(d.a, d.b);}
+                void h_t_sub(const decoded_instruction &d) {t_sub(d.a, d.b, d.c);}
+                void h_t_mult(const decoded_instruction &d) {t_mult(d.a, d.b, d.c);}
+                void h_t_div(const decoded_instruction &d) {t_div(d.a, d.b, d.c);}
+                void h_t_mod(const decoded_instruction &d) {t_mod(d.a, d.b, d.c);}
+                void h_t_cmp(const decoded_instruction &d) {t_cmp(d.a, d.b);}
+                void h_t_lcmp(const decoded_instruction &d) {t_lcmp(d.a);}
+                void h_t_or(const decoded_instruction &d) {t_or(d.a, d.b, d.c);}
+                void h_t_and(const decoded_instruction &d) {t_and(d.a, d.b, d.c);}
+                void h_t_not(const decoded_instruction &d) {t_not(d.a, d.b);}
+                void h_t_prts(const decoded_instruction &d) {t_prts(d.a, d.b);}
+                void h_t_prcs(const decoded_instruction &d) {t_prcs(d.a, d.b);}
+                void h_t_prtg(const decoded_instruction &d) {t_prtg(d.a, d.b);}
+                void h_t_prcg(const decoded_instruction &d) {t_prcg(d.a, d.b);}
+
+                // Обработчик доверенного режима по коду операции, nullptr если у инструкции нет проверок
+                static handler_type trusted_handler_for(int opcode) {
+                    switch (static_cast<OpCode>(opcode)) {
+                        case OpCode::LODI:  return &basic_core::h_t_lodi;
+                        case OpCode::LODR:  return &basic_core::h_t_lodr;
+                        case OpCode::STRI:  return &basic_core::h_t_stri;
+                        case OpCode::STRR:  return &basic_core::h_t_strr;
+                        case OpCode::MOV:   return &basic_core::h_t_mov;
+                        case OpCode::ADD:   return &basic_core::h_t_add;
+                        case OpCode::ADDC:  return &basic_core::h_t_addc;
+                        case OpCode::LOC:   return &basic_core::h_t_loc;
+                        case OpCode::SUB:   return &basic_core::h_t_sub;
+                        case OpCode::MULT:  return &basic_core::h_t_mult;
+                        case OpCode::DIV:   return &basic_core::h_t_div;
+                        case OpCode::MOD:   return &basic_core::h_t_mod;
+                        case OpCode::CMP:   return &basic_core::h_t_cmp;
+                        case OpCode::LCMP:  return &basic_core::h_t_lcmp;
+                        case OpCode::OR:    return &basic_core::h_t_or;
+                        case OpCode::AND:   return &basic_core::h_t_and;
+                        case OpCode::NOT:   return &basic_core::h_t_not;
+                        case OpCode::PRTS:  return &basic_core::h_t_prts;
+                        case OpCode::PRCS:  return &basic_core::h_t_prcs;
+                        case OpCode::PRTG:  return &basic_core::h_t_prtg;
+                        case OpCode::PRCG:  return &basic_core::h_t_prcg;
+                        default:            return nullptr;
+                    }
+                }
+
+                // Код операции без отметки доверенного режима
+                static int base_opcode(int opcode) {
+                    if (opcode >= trusted_opcode_base) {return opcode - trusted_opcode_base;}
+                    return opcode;
+                }
+
+                // Подбор обработчика по коду операции
+                static handler_type handler_for(int opcode) {
+                    switch (static_cast<OpCode>(opcode)) {
+                        case OpCode::LODI:  return &basic_core::h_lodi;
+                        case OpCode::LODR:  return &basic_core::h_lodr;
+                        case OpCode::STRI:  return &basic_core::h_stri;
+                        case OpCode::STRR:  return &basic_core::h_strr;
+                        case OpCode::MOV:   return &basic_core::h_mov;
+                        case OpCode::AMIN:  return &basic_core::h_amin;
+                        case OpCode::SETL:  return &basic_core::h_setl;
+                        case OpCode::SETF:  return &basic_core::h_setf;
+                        case OpCode::ADD:   return &basic_core::h_add;
+                        case OpCode::ADDC:  return &basic_core::h_addc;
+                        case OpCode::LOC:   return &basic_core::h_loc;
+                        case OpCode::SUB:   return &basic_core::h_sub;
+                        case OpCode::MULT:  return &basic_core::h_mult;
+                        case OpCode::DIV:   return &basic_core::h_div;
+                        case OpCode::MOD:   return &basic_core::h_mod;
+                        case OpCode::CMP:   return &basic_core::h_cmp;
+                        case OpCode::JMP:   return &basic_core::h_jmp;
+                        case OpCode::GOTO:  return &basic_core::h_goto;
+                        case OpCode::LCMP:  return &basic_core::h_lcmp;
+                        case OpCode::OR:    return &basic_core::h_or;
+                        case OpCode::AND:   return &basic_core::h_and;
+                        case OpCode::NOT:   return &basic_core::h_not;
+                        case OpCode::PRTS:  return &basic_core::h_prts;
+                        case OpCode::PRCS:  return &basic_core::h_prcs;
+                        case OpCode::PRTG:  return &basic_core::h_prtg;
+                        case OpCode::PRCG:  return &basic_core::h_prcg;
+                        case OpCode::PRTW:  return &basic_core::h_prtw;
+                        case OpCode::PRTR:  return &basic_core::h_prtr;
+                        case OpCode::CAS:   return &basic_core::h_cas;
+                        case OpCode::FADD:  return &basic_core::h_fadd;
+                        case OpCode::FENCE: return &basic_core::h_fence;
+                        case OpCode::SPAWN: return &basic_core::h_spawn;
+                        case OpCode::JOIN:  return &basic_core::h_join;
+                        case OpCode::VADD:  return &basic_core::h_vadd;
+                        case OpCode::VSUB:  return &basic_core::h_vsub;
+                        case OpCode::VMUL:  return &basic_core::h_vmul;
+                        case OpCode::VAND:  return &basic_core::h_vand;
+                        case OpCode::VOR:   return &basic_core::h_vor;
+                        case OpCode::VSUM:  return &basic_core::h_vsum;
+                        case OpCode::VMIN:  return &basic_core::h_vmin;
+                        case OpCode::VMAX:  return &basic_core::h_vmax;
+                        case OpCode::VFILL: return &basic_core::h_vfill;
+                        case OpCode::VCOPY: return &basic_core::h_vcopy;
+                        case OpCode::PUSH:  return &basic_core::h_push;
+                        case OpCode::POP:   return &basic_core::h_pop;
+                        case OpCode::CALL:  return &basic_core::h_call;
+                        case OpCode::RET:   return &basic_core::h_ret;
+                        case OpCode::STKR:  return &basic_core::h_stkr;
+                        case OpCode::INTR:  return &basic_core::h_intr;
+                        case OpCode::SCALL: return &basic_core::h_scall;
+                        case OpCode::IRET:  return &basic_core::h_iret;
+                        case OpCode::SETI:  return &basic_core::h_seti;
+                        case OpCode::TIMER: return &basic_core::h_timer;
+                        case OpCode::SERR:  return &basic_core::h_serr;
+                        case OpCode::CERR:  return &basic_core::h_cerr;
+                        case OpCode::HALT:  return &basic_core::h_halt;
+                        default:            return &basic_core::h_invalid;
+                    }
+                }
+
+                // Декодирование инструкции по адресу adr в запись d
+                void predecode(std::size_t adr, decoded_instruction &d) {
+                    d.a = RAM->get_from_memory(adr+1);
+                    d.b = RAM->get_from_memory(adr+2);
+                    d.c = RAM->get_from_memory(adr+3);
+                    d.op = opcode_of(RAM->get_from_memory(adr));
+                    d.target = nullptr;
+                    d.handler = handler_for(d.op);
+                    if (fusion and not profiling() and not tracing() and adr < icache.size()) {fuse(adr, d);}
+                    // Проверенная инструкция без слияния получает версию без проверок
+                    if (d.op < fusion_opcode_base and verified_at(adr)) {
+                        handler_type t = trusted_handler_for(d.op);
+                        if (t != nullptr) {
+                            d.handler = t;
+                            d.op += trusted_opcode_base;
+                        }
+                    }
+                }
+
+                // Может ли инструкция стоять в сверхинструкции не последней:
+                // она не должна останавливаться на ошибке и менять регистр 14
+                bool fusable_step(int opcode, word a, word b) const {
+                    auto reg = [](word r) {return r >= 0 and r < 16;};
+                    switch (static_cast<OpCode>(opcode)) {
+                        case OpCode::LOC:  return reg(a) and a != 14;
+                        case OpCode::ADDC: return reg(a) and reg(b) and a != 14;
+                        case OpCode::LODR: return reg(a) and reg(b) and a != 14;
+                        case OpCode::CMP:  return reg(a) and reg(b);
+                        case OpCode::PRTS: return reg(a) and b >= 0 and static_cast<std::size_t>(b) < ports.size();
+                        default:           return false;
+                    }
+                }
+
+                // Попытка заменить инструкцию по адресу adr сверхинструкцией
+                // Проверяются только цепочки, целиком лежащие в области программы
+                void fuse(std::size_t adr, decoded_instruction &d) {
+                    for (const fusion_rule &rule : fusion_table()) {
+                        std::size_t len = rule.length;
+                        if (adr + 4 * len > icache.size()) {continue;}
+                        bool match = true;
+                        for (std::size_t k = 0; k < len and match; k++) {
+                            match = RAM->get_from_memory(adr + 4 * k) == static_cast<word>(rule.pattern[k]);
+                        }
+                        if (not match) {continue;}
+                        word ops[fusion_max_length][3];
+                        for (std::size_t k = 0; k < len; k++) {
+                            for (std::size_t j = 0; j < 3; j++) {ops[k][j] = RAM->get_from_memory(adr + 4 * k + 1 + j);}
+                        }
+                        for (std::size_t k = 0; k + 1 < len and match; k++) {
+                            match = fusable_step(static_cast<int>(rule.pattern[k]), ops[k][0], ops[k][1]);
+                        }
+                        if (not match) {continue;}
+                        for (std::size_t k = 1; k < len; k++) {
+                            for (std::size_t j = 0; j < 3; j++) {d.ext[3 * (k - 1) + j] = ops[k][j];}
+                        }
+                        d.op = fusion_opcode_base + static_cast<int>(&rule - fusion_table().data());
+                        d.handler = rule.handler;
+                        return;
+                    }
+                }
+
+                // Цикл исполнения из кэша предекодированных инструкций
+                // По результату полностью совпадает с process(), но не выбирает инструкцию из ОЗУ каждый раз
+                void process_predecoded() {
+                    decoded_instruction tmp;
+                    decoded_instruction *cache = icache.data();
+                    const std::size_t cache_limit = icache.size() >= 3 ? icache.size() - 3 : 0;
+                    is_work = true;
+                    while (is_work) {
+                        if (--countdown < 0) {
+                            service();
+                            if (not is_work) {break;}
+                        }
+                        if (not pc_in_memory()) {end_of_memory(); break;}
+                        std::size_t pc = registers[14];
+                        decoded_instruction *d = &tmp;
+                        if (pc < cache_limit) {
+                            d = &cache[pc];
+                            if (d->handler == nullptr) {predecode(pc, *d);}
+                        } else {
+                            predecode(pc, tmp);
+                        }
+                        if (profiling()) {profile->instruction(pc, base_opcode(d->op));}
+                        if (tracing()) {trace->instruction(pc, base_opcode(d->op));}
+                        // Частые инструкции исполняются прямо здесь, остальные через обработчик записи
+                        switch (static_cast<OpCode>(d->op)) {
+                            case OpCode::LODI:  lodi(d->a, d->b); break;
+                            case OpCode::LODR:  lodr(d->a, d->b); break;
+                            case OpCode::STRI:  stri(d->a, d->b); break;
+                            case OpCode::STRR:  strr(d->a, d->b); break;
+                            case OpCode::MOV:   mov(d->a, d->b); break;
+                            case OpCode::ADD:   add(d->a, d->b, d->c); break;
+                            case OpCode::ADDC:  addc(d->a, d->b, d->c); break;
+                            case OpCode::LOC:   loc(d->a, d->b); break;
+                            case OpCode::SUB:   sub(d->a, d->b, d->c); break;
+                            case OpCode::MULT:  mult(d->a, d->b, d->c); break;
+                            case OpCode::CMP:   cmp(d->a, d->b); break;
+                            case OpCode::JMP:   jmp(d->a, d->b); break;
+                            case OpCode::GOTO:  gotop(d->a); break;
+                            default:            (this->*d->handler)(*d); break;
+                        }
+                        if (profiling() and base_opcode(d->op) == static_cast<int>(OpCode::JMP)) {
+                            profile->branch(pc, static_cast<std::size_t>(registers[14]) != pc + 4);
+                        }
+                        if (tracing()) {trace_state();}
+                    }
+                }
+
+                // Шитый движок: в записи кэша хранится адрес метки обработчика,
+                // и каждый обработчик после исполнения сразу прыгает на обработчик следующей инструкции,
+                // поэтому у каждой инструкции своя точка косвенного перехода вместо общей у switch
+                // Без расширения GCC работает как process_predecoded()
+                void process_threaded() {
+                #if XVPROC_COMPUTED_GOTO
+                    // Метки обработчиков по коду операции, неизвестные коды ведут на invalid
+                    static const void *const labels[] = {
+                        &&op_halt, &&op_invalid, &&op_invalid, &&op_invalid, &&op_invalid,
+                        &&op_lodi, &&op_lodr, &&op_stri, &&op_strr, &&op_mov,
+                        &&op_amin, &&op_setl, &&op_setf, &&op_invalid, &&op_invalid,
+                        &&op_invalid, &&op_invalid, &&op_invalid, &&op_invalid, &&op_invalid,
+                        &&op_add, &&op_addc, &&op_loc, &&op_sub, &&op_mult,
+                        &&op_div, &&op_mod, &&op_invalid, &&op_invalid, &&op_invalid,
+                        &&op_cmp, &&op_jmp, &&op_goto, &&op_lcmp, &&op_invalid,
+                        &&op_invalid, &&op_invalid, &&op_invalid, &&op_invalid, &&op_invalid,
+                        &&op_or, &&op_and, &&op_not, &&op_invalid, &&op_invalid,
+                        &&op_invalid, &&op_invalid, &&op_invalid, &&op_invalid, &&op_invalid,
+                        &&op_prts, &&op_prcs, &&op_prtg, &&op_prcg, &&op_call,
+                        &&op_call, &&op_invalid, &&op_invalid, &&op_invalid, &&op_invalid,
+                        &&op_push, &&op_pop, &&op_callg, &&op_ret, &&op_stkr
+                    };
+                    constexpr int labels_count = sizeof(labels) / sizeof(labels[0]);
+
+                    // Метки доверенного режима по коду операции, для инструкций без проверок совпадают с обычными
+                    static const void *const trusted_labels[] = {
+                        &&op_halt, &&op_invalid, &&op_invalid, &&op_invalid, &&op_invalid,
+                        &&op_t_lodi, &&op_t_lodr, &&op_t_stri, &&op_t_strr, &&op_t_mov,
+                        &&op_amin, &&op_setl, &&op_setf, &&op_invalid, &&op_invalid,
+                        &&op_invalid, &&op_invalid, &&op_invalid, &&op_invalid, &&op_invalid,
+                        &&op_t_add, &&op_t_addc, &&op_t_loc, &&op_t_sub, &&op_t_mult,
+                        &&op_t_div, &&op_t_mod, &&op_invalid, &&op_invalid, &&op_invalid,
+                        &&op_t_cmp, &&op_jmp, &&op_goto, &&op_t_lcmp, &&op_invalid,
+                        &&op_invalid, &&op_invalid, &&op_invalid, &&op_invalid, &&op_invalid,
+                        &&op_t_or, &&op_t_and, &&op_t_not, &&op_invalid, &&op_invalid,
+                        &&op_invalid, &&op_invalid, &&op_invalid, &&op_invalid, &&op_invalid,
+                        &&op_t_prts, &&op_t_prcs, &&op_t_prtg, &&op_t_prcg, &&op_call,
+                        &&op_call, &&op_invalid, &&op_invalid, &&op_invalid, &&op_invalid,
+                        &&op_push, &&op_pop, &&op_callg, &&op_ret, &&op_stkr
+                    };
+                    static_assert(sizeof(trusted_labels) == sizeof(labels), "label tables must match");
+
+                    decoded_instruction tmp;
+                    const decoded_instruction *d;
+                    decoded_instruction *cache = icache.data();
+                    shadow.clear();
+                    const std::size_t cache_size = icache.size();
+                    is_work = true;
+
+                    // Записи кэша с адресом меньше cache_limit целиком лежат в области программы
+                    const std::size_t cache_limit = cache_size >= 3 ? cache_size - 3 : 0;
+
+                    // Переход к следующей инструкции: выборка записи и прыжок на её обработчик
+                    // Адреса вне кэша уходят на медленный путь с проверкой границы ОЗУ, конец обратного отсчёта - на обслуживание
+                    #define XVPROC_DISPATCH() \
+                        do { \
+                            if (--countdown < 0) {goto op_service;} \
+                            XVPROC_FETCH(); \
+                        } while (0)
+                    #define XVPROC_FETCH() \
+                        do { \
+                            std::size_t pc = registers[14]; \
+                            if (pc >= cache_limit) {goto op_slow;} \
+                            decoded_instruction *e = &cache[pc]; \
+                            if (e->target == nullptr) { \
+                                predecode(pc, *e); \
+                                if (e->op >= 0 and e->op < labels_count) {e->target = labels[e->op];} \
+                                else if (e->op >= trusted_opcode_base and e->op - trusted_opcode_base < labels_count) \
+                                    {e->target = trusted_labels[e->op - trusted_opcode_base];} \
+                                else {e->target = &&op_call;} \
+                            } \
+                            d = e; \
+                            goto *d->target; \
+                        } while (0)
+
+                    XVPROC_DISPATCH();
+
+                    op_lodi: lodi(d->a, d->b); XVPROC_DISPATCH();
+                    op_lodr: lodr(d->a, d->b); XVPROC_DISPATCH();
+                    op_stri: stri(d->a, d->b); XVPROC_DISPATCH();
+                    op_strr: strr(d->a, d->b); XVPROC_DISPATCH();
+                    op_mov:  mov(d->a, d->b); XVPROC_DISPATCH();
+                    op_amin: amin(d->a, d->b); XVPROC_DISPATCH();
+                    op_setl: setl(); XVPROC_DISPATCH();
+                    op_setf: setf(); XVPROC_DISPATCH();
+                    op_add:  add(d->a, d->b, d->c); XVPROC_DISPATCH();
+                    op_addc: addc(d->a, d->b, d->c); XVPROC_DISPATCH();
+                    op_loc:  loc(d->a, d->b); XVPROC_DISPATCH();
+                    op_sub:  sub(d->a, d->b, d->c); XVPROC_DISPATCH();
+                    op_mult: mult(d->a, d->b, d->c); XVPROC_DISPATCH();
+                    op_div:  div(d->a, d->b, d->c); if (not is_work) {goto op_end;} XVPROC_DISPATCH();
+                    op_mod:  mod(d->a, d->b, d->c); if (not is_work) {goto op_end;} XVPROC_DISPATCH();
+                    op_cmp:  cmp(d->a, d->b); XVPROC_DISPATCH();
+                    op_jmp:  jmp(d->a, d->b); XVPROC_DISPATCH();
+                    op_goto: gotop(d->a); XVPROC_DISPATCH();
+                    op_lcmp: lcmp(d->a); XVPROC_DISPATCH();
+                    op_or:   logor(d->a, d->b, d->c); XVPROC_DISPATCH();
+                    op_and:  logand(d->a, d->b, d->c); XVPROC_DISPATCH();
+                    op_not:  lognot(d->a, d->b); XVPROC_DISPATCH();
+                    op_prts: prts(d->a, d->b); if (not is_work) {goto op_end;} XVPROC_DISPATCH();
+                    op_prcs: prcs(d->a, d->b); if (not is_work) {goto op_end;} XVPROC_DISPATCH();
+                    op_prtg: prtg(d->a, d->b); if (not is_work) {goto op_end;} XVPROC_DISPATCH();
+                    op_prcg: prcg(d->a, d->b); if (not is_work) {goto op_end;} XVPROC_DISPATCH();
+                    op_t_lodi: t_lodi(d->a, d->b); XVPROC_DISPATCH();
+                    op_t_lodr: t_lodr(d->a, d->b); if (not is_work) {goto op_end;} XVPROC_DISPATCH();
+                    op_t_stri: t_stri(d->a, d->b); XVPROC_DISPATCH();
+                    op_t_strr: t_strr(d->a, d->b); if (not is_work) {goto op_end;} XVPROC_DISPATCH();
+                    op_t_mov:  t_mov(d->a, d->b); XVPROC_DISPATCH();
+                    op_t_add:  t_add(d->a, d->b, d->c); XVPROC_DISPATCH();
+                    op_t_addc: t_addc(d->a, d->b, d->c); XVPROC_DISPATCH();
+                    op_t_loc:  t_loc(d->a, d->b); XVPROC_DISPATCH();
+                    op_t_sub:  t_sub(d->a, d->b, d->c); XVPROC_DISPATCH();
+                    op_t_mult: t_mult(d->a, d->b, d->c); XVPROC_DISPATCH();
+                    op_t_div:  t_div(d->a, d->b, d->c); if (not is_work) {goto op_end;} XVPROC_DISPATCH();
+                    op_t_mod:  t_mod(d->a, d->b, d->c); if (not is_work) {goto op_end;} XVPROC_DISPATCH();
+                    op_t_cmp:  t_cmp(d->a, d->b); XVPROC_DISPATCH();
+                    op_t_lcmp: t_lcmp(d->a); XVPROC_DISPATCH();
+                    op_t_or:   t_or(d->a, d->b, d->c); XVPROC_DISPATCH();
+                    op_t_and:  t_and(d->a, d->b, d->c); XVPROC_DISPATCH();
+                    op_t_not:  t_not(d->a, d->b); XVPROC_DISPATCH();
+                    op_t_prts: t_prts(d->a, d->b); XVPROC_DISPATCH();
+                    op_t_prcs: t_prcs(d->a, d->b); XVPROC_DISPATCH();
+                    op_t_prtg: t_prtg(d->a, d->b); XVPROC_DISPATCH();
+                    op_t_prcg: t_prcg(d->a, d->b); XVPROC_DISPATCH();
+                    op_push: push(d->a); if (not is_work) {goto op_end;} XVPROC_DISPATCH();
+                    op_pop:  pop(d->a); if (not is_work) {goto op_end;} XVPROC_DISPATCH();
+                    op_stkr: stkr(d->a, d->b); if (not is_work) {goto op_end;} XVPROC_DISPATCH();
+                    op_callg:
+                    {
+                        std::size_t next = static_cast<std::size_t>(registers[14]) + 4;
+                        if (not call(d->a)) {goto op_stack_error;}
+                        if (shadow.size() == shadow_depth) {shadow.clear();}
+                        shadow.push_back({registers[15], static_cast<word>(next), next < cache_limit ? cache + next : nullptr});
+                    }
+                    XVPROC_DISPATCH();
+                    op_ret:
+                    {
+                        word sp = registers[15];
+                        if (not ret()) {goto op_stack_error;}
+                        if (not shadow.empty()) {
+                            shadow_return top = shadow.back();
+                            shadow.pop_back();
+                            if (top.sp == sp and top.adr == registers[14] and top.entry != nullptr and top.entry->target != nullptr) {
+                                if (--countdown < 0) {goto op_service;}
+                                d = top.entry;
+                                goto *d->target;
+                            }
+                            if (top.sp != sp or top.adr != registers[14]) {shadow.clear();}
+                        }
+                    }
+                    XVPROC_DISPATCH();
+                    op_invalid: fault(5, true); if (not is_work) {goto op_end;} XVPROC_DISPATCH();
+                    op_halt: goto op_end;
+                    op_stack_error: if (not is_work) {goto op_end;} XVPROC_DISPATCH();
+
+                    // Таймер или ошибка с обработчиком
+                    op_service:
+                    service();
+                    if (not is_work) {goto op_end;}
+                    XVPROC_FETCH();
+
+                    // Сверхинструкции и коды вне таблицы меток исполняются через обработчик записи
+                    op_call:
+                    (this->*d->handler)(*d);
+                    if (not is_work) {goto op_end;}
+                    XVPROC_DISPATCH();
+
+                    // Инструкция вне области программы: декодируется каждый раз заново
+                    op_slow:
+                    if (not pc_in_memory()) {end_of_memory(); goto op_end;}
+                    predecode(registers[14], tmp);
+                    d = &tmp;
+                    goto *((tmp.op >= 0 and tmp.op < labels_count) ? labels[tmp.op] : &&op_call);
+
+                    #undef XVPROC_DISPATCH
+                    #undef XVPROC_FETCH
+                    op_end:
+                    is_work = false;
+                #else
+                    process_predecoded();
+                #endif
+                }
+
+                // Является ли инструкция концом базового блока (после неё начинается новый блок)
+                static bool ends_block(int opcode) {
+                    opcode = base_opcode(opcode);
+                    if (opcode >= fusion_opcode_base) {
+                        // Код вне таблицы правил - неверная инструкция, она останавливает процессор
+                        std::size_t rule_index = static_cast<std::size_t>(opcode - fusion_opcode_base);
+                        if (rule_index >= fusion_table().size()) {return true;}
+                        const fusion_rule &rule = fusion_table()[rule_index];
+                        return ends_block(static_cast<int>(rule.pattern[rule.length - 1]));
+                    }
+                    switch (static_cast<OpCode>(opcode)) {
+                        case OpCode::JMP: case OpCode::GOTO: case OpCode::HALT: case OpCode::CALL: case OpCode::RET:
+                        case OpCode::INTR: case OpCode::SCALL: case OpCode::IRET:
+                        case OpCode::PRTS: case OpCode::PRCS: case OpCode::PRTG: case OpCode::PRCG:
+                        case OpCode::PRTW: case OpCode::PRTR:
+                        case OpCode::CAS: case OpCode::FADD: case OpCode::FENCE: case OpCode::SPAWN: case OpCode::JOIN:
+                            return true;
+                        default:
+                            return false;
+                    }
+                }
+
+                // Многоуровневое исполнение: на входе в каждый базовый блок считаются его запуски,
+                // горячие блоки компилируются и дальше исполняются машинным кодом,
+                // всё остальное исполняет интерпретатор с кэшем декодированных инструкций
+                // Скомпилированный код не проверяет границы amin, поэтому при setl работает только интерпретатор
+                // Машинный код обращается к плоскому ОЗУ напрямую, со страничной памятью работает только интерпретатор
+                void process_jit() {
+                    if constexpr (not word32) {
+                        // Машинный код JIT работает со словом int32
+                        process_predecoded();
+                    } else {
+                        if (not jit_cache::supported() or RAM->data() == nullptr) {process_predecoded(); return;}
+                        decoded_instruction tmp;
+                        decoded_instruction *cache = icache.data();
+                        const std::size_t cache_limit = icache.size() >= 3 ? icache.size() - 3 : 0;
+                        bool leader = true;
+                        is_work = true;
+                        while (is_work) {
+                            if (--countdown < 0) {
+                                service();
+                                if (not is_work) {break;}
+                                leader = true;
+                            }
+                            if (not pc_in_memory()) {end_of_memory(); break;}
+                            std::size_t pc = registers[14];
+                            if (leader and not bounded()) {
+                                jit_function block = jit.enter(pc, RAM->data(), memory_size);
+                                if (block != nullptr) {
+                                    // Блок не может вызвать ошибку, его инструкции вычитаются из отсчёта разом
+                                    countdown -= static_cast<long long>(jit.length(pc)) - 1;
+                                    registers[14] = block(registers, &cmp_flag);
+                                    continue;
+                                }
+                            }
+                            decoded_instruction *d = &tmp;
+                            if (pc < cache_limit) {
+                                d = &cache[pc];
+                                if (d->handler == nullptr) {predecode(pc, *d);}
+                            } else {
+                                predecode(pc, tmp);
+                            }
+                            leader = ends_block(d->op);
+                            (this->*d->handler)(*d);
+                        }
+                    }
+                }
+
+                // Исполнение программы, переведённой в C++: с каждого адреса сначала вызывается перевод,
+                // а инструкцию, на которой он остановился, исполняет интерпретатор с кэшем декодированных инструкций
+                // Перевод не проверяет границы amin, поэтому при setl работает только интерпретатор,
+                // после записи в переведённую инструкцию - тоже, до конца запуска
+                void process_native() {
+                    if constexpr (not word32) {
+                        // Перевод в C++ сделан для слова int32
+                        process_predecoded();
+                    } else {
+                        if (RAM->data() == nullptr) {process_predecoded(); return;}
+                        native_frame frame = {registers, &cmp_flag, RAM->data(), memory_size, stack_low, stack_high, &countdown};
+                        decoded_instruction tmp;
+                        decoded_instruction *cache = icache.data();
+                        const std::size_t cache_limit = icache.size() >= 3 ? icache.size() - 3 : 0;
+                        bool returned = false;
+                        is_work = true;
+                        while (is_work) {
+                            if (not native_intact) {process_predecoded(); return;}
+                            if (--countdown < 0) {
+                                service();
+                                if (not is_work) {break;}
+                                returned = false;
+                            }
+                            if (not pc_in_memory()) {end_of_memory(); break;}
+                            std::size_t pc = registers[14];
+                            if (not returned and not bounded()) {
+                                // Выбранная инструкция ещё не исполнена: перевод сам вычитает из отсчёта исполненные
+                                countdown += 1;
+                                registers[14] = native.run(frame);
+                                returned = true;
+                                continue;
+                            }
+                            returned = false;
+                            decoded_instruction *d = &tmp;
+                            if (pc < cache_limit) {
+                                d = &cache[pc];
+                                if (d->handler == nullptr) {predecode(pc, *d);}
+                            } else {
+                                predecode(pc, tmp);
+                            }
+                            (this->*d->handler)(*d);
+                        }
+                    }
+                }
+
                 void process(bool debugmode) {
-                    bool is_work = true;
+                    is_work = true;
                     while (is_work) {
+                        if (--countdown < 0) {
+                            service();
+                            if (not is_work) {break;}
+                        }
                         // Декодируем из памяти команду
-                        if (registers[14]+3 >= memory_size) {is_work = false; break;}
-                        decoded[0] = RAM.get_from_memory(registers[14]);
-                        decoded[1] = RAM.get_from_memory(registers[14]+1);
-                        decoded[2] = RAM.get_from_memory(registers[14]+2);
-                        decoded[3] = RAM.get_from_memory(registers[14]+3);
+                        if (not pc_in_memory()) {end_of_memory(); break;}
+                        decoded[0] = RAM->get_from_memory(registers[14]);
+                        decoded[1] = RAM->get_from_memory(registers[14]+1);
+                        decoded[2] = RAM->get_from_memory(registers[14]+2);
+                        decoded[3] = RAM->get_from_memory(registers[14]+3);
+                        if (Policy::hooks and observer) {observer(registers[14], decoded);}
+                        std::size_t pc = registers[14];
+                        if (profiling()) {profile->instruction(pc, opcode_of(decoded[0]));}
+                        if (tracing()) {trace->instruction(pc, opcode_of(decoded[0]));}
 
                         // Выполняем инструкцию
-                        switch (static_cast<OpCode>(decoded[0])) {
+                        switch (static_cast<OpCode>(opcode_of(decoded[0]))) {
                             case OpCode::LODI:  lodi(decoded[1], decoded[2]); break;
-                            case OpCode::LODR:  lodr(decoded[1], decoded[2]); break;
+                            // Проверенные lodr/strr в доверенном режиме, как в движках с кэшем, не бросают исключение за ОЗУ
+                            case OpCode::LODR:  if (verified_at(pc)) {t_lodr(decoded[1], decoded[2]);} else {lodr(decoded[1], decoded[2]);} break;
                             case OpCode::STRI:  stri(decoded[1], decoded[2]); break;
-                            case OpCode::STRR:  strr(decoded[1], decoded[2]); break;
+                            case OpCode::STRR:  if (verified_at(pc)) {t_strr(decoded[1], decoded[2]);} else {strr(decoded[1], decoded[2]);} break;
                             case OpCode::MOV:   mov(decoded[1], decoded[2]); break;
                             case OpCode::AMIN:  amin(decoded[1], decoded[2]); break;
                             case OpCode::SETL:  setl(); break;
@@ -559,11 +2529,44 @@ namespace cpu_unit {
                             case OpCode::PRCS:  prcs(decoded[1], decoded[2]); break;
                             case OpCode::PRTG:  prtg(decoded[1], decoded[2]); break;
                             case OpCode::PRCG:  prcg(decoded[1], decoded[2]); break;
+                            case OpCode::PRTW:  prtw(decoded[1], decoded[2], decoded[3]); break;
+                            case OpCode::PRTR:  prtr(decoded[1], decoded[2], decoded[3]); break;
+                            case OpCode::CAS:   cas(decoded[1], decoded[2], decoded[3]); break;
+                            case OpCode::FADD:  fadd(decoded[1], decoded[2], decoded[3]); break;
+                            case OpCode::FENCE: fence(); break;
+                            case OpCode::SPAWN: spawn(decoded[1], decoded[2], decoded[3]); break;
+                            case OpCode::JOIN:  join(decoded[1]); break;
+                            case OpCode::VADD:  vector_binary_op(decoded[1], decoded[2], decoded[3], vectors->add); break;
+                            case OpCode::VSUB:  vector_binary_op(decoded[1], decoded[2], decoded[3], vectors->sub); break;
+                            case OpCode::VMUL:  vector_binary_op(decoded[1], decoded[2], decoded[3], vectors->mul); break;
+                            case OpCode::VAND:  vector_binary_op(decoded[1], decoded[2], decoded[3], vectors->logand); break;
+                            case OpCode::VOR:   vector_binary_op(decoded[1], decoded[2], decoded[3], vectors->logor); break;
+                            case OpCode::VSUM:  vector_reduce_op(decoded[1], decoded[2], decoded[3], vectors->sum, 0); break;
+                            case OpCode::VMIN:  vector_reduce_op(decoded[1], decoded[2], decoded[3], vectors->min, std::numeric_limits<word>::max()); break;
+                            case OpCode::VMAX:  vector_reduce_op(decoded[1], decoded[2], decoded[3], vectors->max, std::numeric_limits<word>::min()); break;
+                            case OpCode::VFILL: vfill(decoded[1], decoded[2], decoded[3]); break;
+                            case OpCode::VCOPY: vcopy(decoded[1], decoded[2], decoded[3]); break;
+                            case OpCode::PUSH:  push(decoded[1]); break;
+                            case OpCode::POP:   pop(decoded[1]); break;
+                            case OpCode::CALL:  call(decoded[1]); break;
+                            case OpCode::RET:   ret(); break;
+                            case OpCode::STKR:  stkr(decoded[1], decoded[2]); break;
+                            case OpCode::INTR:  intr(decoded[1]); break;
+                            case OpCode::SCALL: scall(); break;
+                            case OpCode::IRET:  iret(); break;
+                            case OpCode::SETI:  seti(decoded[1], decoded[2]); break;
+                            case OpCode::TIMER: timer(decoded[1]); break;
+                            case OpCode::SERR:  serr(decoded[1]); break;
+                            case OpCode::CERR:  cerr(); break;
                             case OpCode::HALT:  is_work = false; break;
-                            default:            err_flag = 5; is_work = false; break;
+                            default:            fault(5, true); break;
+                        }
+                        if (profiling() and decoded[0] == static_cast<word>(OpCode::JMP)) {
+                            profile->branch(pc, static_cast<std::size_t>(registers[14]) != pc + 4);
                         }
+                        if (tracing()) {trace_state();}
                         // Если процесс в режиме дебага, то вывести значения регистров
-                        if (debugmode) {
+                        if (Policy::hooks and debugmode) {
                             std::cout << "Comand: " << decoded[0] << " "<< decoded[1] << " "<< decoded[2] << " "<< decoded[3] << "\n";
                             std::cout << std::setw(4) << registers[0] << std::setw(4) << registers[1] << "\n";
                             std::cout << std::setw(4) << registers[2] << std::setw(4) << registers[3] << "\n";
@@ -581,38 +2584,527 @@ namespace cpu_unit {
                     }
                 }
 
+                // Общая часть инициализации после загрузки ОЗУ
+                // code_size - размер области программы (начиная с адреса 0)
+                void attach(std::size_t code_size) {
+                    // Кэш предекодированных инструкций покрывает всю загруженную программу,
+                    // но выделяется только при запуске движка с кэшем (см. prepare_caches)
+                    program_size = code_size;
+                    icache.clear();
+                    jit.reset(0);
+                    // Подключение портов
+                    ports.clear();
+                    if (terminal_in == nullptr) {
+                        ports.push_back(std::make_unique<utility_units::buffered_terminal>());
+                    } else {
+                        ports.push_back(std::make_unique<utility_units::buffered_terminal>(*terminal_in, *terminal_out));
+                    }
+                    ports.push_back(std::make_unique<utility_units::fileunit>());
+                    // Асинхронный файл и отображение файла пишут в ОЗУ ячейками int32
+                    if constexpr (word32) {
+                        ports.push_back(std::make_unique<utility_units::async_file>(RAM, memory_size, code_size));
+                        ports.push_back(std::make_unique<utility_units::mapped_file>(RAM, memory_size, code_size));
+                    }
+                    if (profiling()) {
+                        profile->reset(code_size, ports.size());
+                        for (std::size_t i = 0; i < ports.size(); i++) {
+                            ports[i] = std::make_unique<utility_units::profiled_port>(std::move(ports[i]), *profile, i);
+                        }
+                    }
+                    for (std::size_t i = 0; i < 16; i++) {registers[i] = 0;}
+                    // Стек по умолчанию - всё ОЗУ после программы, пустой стек - r15 на конце области
+                    if (stack_words == 0) {
+                        stack_low = code_size;
+                        stack_high = memory_size;
+                    } else {
+                        if (stack_base + stack_words > memory_size) {throw std::runtime_error("Stack does not fit in memory");}
+                        stack_low = stack_base;
+                        stack_high = stack_base + stack_words;
+                    }
+                    registers[15] = static_cast<word>(stack_high);
+                    shadow.clear();
+                    // Прерывания выключены до первых seti/timer
+                    for (word &handler : intr_table) {handler = -1;}
+                    err_flag = 0;
+                    in_interrupt = false;
+                    timer_pending = false;
+                    pending_fault = 0;
+                    slice = countdown = no_countdown;
+                    budget_left = poll_left = no_countdown;
+                    arm_timer(0);
+                    attach_trace(code_size);
+                    native_intact = word32 and native.run != nullptr and native.code_size == code_size and memory_size >= native.memory_words
+                        and program_hash([this](std::size_t i) {return RAM->get_from_memory(i);}, code_size) == native.code_hash;
+                }
+
+                bool use_paged_memory() const {
+                    return memory_mode == MemoryMode::PAGED or (memory_mode == MemoryMode::AUTO and memory_size > word_memory::flat_limit);
+                }
+
+                // Каждый адрес ОЗУ должен помещаться в слово (у core16 - до 32767 ячеек)
+                static void check_memory_size(std::size_t ram_size) {
+                    if (ram_size - 1 > static_cast<std::size_t>(std::numeric_limits<word>::max())) {
+                        throw std::runtime_error("Memory of " + std::to_string(ram_size) + " words does not fit the "
+                            + std::to_string(word_bits<word>()) + "-bit word");
+                    }
+                }
+
+                // Выделение кэшей под программу для выбранного движка
+                // Эталонному движку кэши не нужны, и старт большой программы не тратит на них время
+                void prepare_caches() {
+                    if (icache.size() != program_size) {icache.assign(program_size, decoded_instruction());}
+                    if (engine == Engine::JIT and jit.size() != program_size) {jit.reset(program_size);}
+                }
+
         public:
+            // Максимальная длина сверхинструкции в инструкциях
+            static constexpr std::size_t fusion_max_length = 3;
+            // Коды сверхинструкций в записях кэша: fusion_opcode_base + номер правила
+            static constexpr int fusion_opcode_base = 1000;
+            // Коды инструкций доверенного режима в записях кэша: trusted_opcode_base + код операции
+            static constexpr int trusted_opcode_base = 2000;
+
+            // Правило слияния: цепочка кодов операций подряд, исполняемая одним обработчиком
+            // Правила проверяются по порядку, поэтому длинные цепочки стоят раньше своих префиксов
+            struct fusion_rule {
+                const char *name;
+                std::size_t length;
+                OpCode pattern[fusion_max_length];
+                handler_type handler;
+            };
+
+            // Таблица сверхинструкций, дополняется по отчётам xvngram
+            static const std::vector<fusion_rule> &fusion_table() {
+                static const std::vector<fusion_rule> table = {
+                    {"addc+cmp+jmp", 3, {OpCode::ADDC, OpCode::CMP, OpCode::JMP}, &basic_core::h_addc_cmp_jmp},
+                    {"cmp+jmp",      2, {OpCode::CMP, OpCode::JMP},               &basic_core::h_cmp_jmp},
+                    {"loc+prts",     2, {OpCode::LOC, OpCode::PRTS},              &basic_core::h_loc_prts},
+                    {"lodr+prts",    2, {OpCode::LODR, OpCode::PRTS},             &basic_core::h_lodr_prts},
+                };
+                return table;
+            }
+
             // Метод инициализатор
             // program - программа
             // ram_size - размер выделяемой ОЗУ
             // если размер ОЗУ слишком малый (<4), то бросается исключение
             // если размер программы больше чем ОЗУ, то Бросается исключение
-            void init(std::vector<int> &program, std::size_t ram_size) {
+            void init(const std::vector<word> &program, std::size_t ram_size) {
                 // Проверка на минимальный объём
                 if (ram_size < 4) {
                     throw std::runtime_error("Too little memory allocated (min = 4)");
                 }
+                check_memory_size(ram_size);
+                // Проверка на размеры программы и памяти
+                if (program.size() > ram_size) {
+                    throw std::runtime_error("Init error...");
+                }
                 // инициализируем память
                 memory_size = ram_size;
-                RAM.init(memory_size, program);
-                // Проверка на размеры программы и памяти
-                if (program.size() > memory_size) {
+                RAM = std::make_shared<word_memory>();
+                RAM->init(memory_size, program, use_paged_memory());
+                attach(program.size());
+            }
+
+            // Метод инициализатор из бинарного образа
+            // Сегменты образа отображаются в ОЗУ прямо из файла копированием при записи, без разбора и копий,
+            // ядро с другой шириной слова копирует ячейки int32 (у core16 - с проверкой, что значение помещается)
+            // image - открытый образ (после init его можно закрыть)
+            // ram_size - размер выделяемой ОЗУ
+            // исключения те же, что у init из вектора
+            void init(const loader_unit::program_image &image, std::size_t ram_size) {
+                const loader_unit::image_header &h = image.header();
+                if (ram_size < 4) {
+                    throw std::runtime_error("Too little memory allocated (min = 4)");
+                }
+                if (h.code_words > ram_size or (h.data_offset != 0 and h.data_address + h.data_words > ram_size)) {
                     throw std::runtime_error("Init error...");
                 }
-                // Подключение портов
-                ports.push_back(std::make_unique<utility_units::terminal>());
-                ports.push_back(std::make_unique<utility_units::fileunit>());
-                for (std::size_t i = 0; i < 16; i++) {registers[i] = 0;}
+                check_memory_size(ram_size);
+                memory_size = ram_size;
+                RAM = std::make_shared<word_memory>();
+                RAM->init(memory_size, use_paged_memory());
+                auto cell = [](int value, std::size_t adr) {
+                    if (not fits_word<word>(value)) {throw loader_unit::word_range_error("Image", adr, value, word_bits<word>());}
+                    return static_cast<word>(value);
+                };
+                if (not (word32 and RAM->map_file(0, image.fd(), h.code_offset, h.code_words))) {
+                    for (std::size_t i = 0; i < h.code_words; i++) {RAM->set_to_memory(i, cell(image.code_word(i), i));}
+                }
+                if (h.data_offset != 0 and not (word32 and RAM->map_file(h.data_address, image.fd(), h.data_offset, h.data_words))) {
+                    for (std::size_t i = 0; i < h.data_words; i++) {
+                        RAM->set_to_memory(h.data_address + i, cell(image.data_word(i), h.data_address + i));
+                    }
+                }
+                attach(h.code_words);
+                registers[14] = static_cast<word>(h.entry);
+            }
+
+            // Метод инициализатор ядра над уже загруженным общим ОЗУ (дополнительные ядра машины)
+            // ram - ОЗУ другого ядра (shared_memory()), должно быть плоским
+            // code_size - размер области программы
+            // Точку входа и аргумент задаёт set_register()
+            void init(std::shared_ptr<word_memory> ram, std::size_t ram_size, std::size_t code_size) {
+                RAM = std::move(ram);
+                RAM->pin();
+                memory_size = ram_size;
+                attach(code_size);
+            }
+
+            // Метод инициализатор из снимка (см. snapshot.hpp и save_snapshot)
+            // Размер ОЗУ, программа, регистры, флаги, прерывания, таймер и состояние портов берутся из снимка,
+            // настройки ядра (движок, представление ОЗУ, терминал, трасса) - как при обычном init
+            // При повреждённом или оборванном снимке бросается исключение
+            void restore(const std::string &path) {
+                std::ifstream file(path, std::ios::binary);
+                char magic[4] = {};
+                file.read(magic, 4);
+                std::uint32_t version = 0;
+                file.read(reinterpret_cast<char *>(&version), sizeof(version));
+                if (not file or std::memcmp(magic, "XVSN", 4) != 0 or version == 0 or version > utility_units::snapshot_version) {
+                    throw std::runtime_error("Not a snapshot: " + path);
+                }
+                utility_units::state_reader in(file);
+                std::size_t ram_size = static_cast<std::size_t>(in.get(4, 0x7fffffffffffffffLL));
+                std::size_t code_size = static_cast<std::size_t>(in.get(0, static_cast<long long>(ram_size)));
+                // Снимки первой версии писало только ядро со словом int32
+                long long bits = version >= 2 ? in.get() : 32;
+                if (bits != word_bits<word>()) {
+                    throw std::runtime_error("Snapshot of the " + std::to_string(bits) + "-bit core needs the same word width: " + path);
+                }
+                check_memory_size(ram_size);
+                memory_size = ram_size;
+                RAM = std::make_shared<word_memory>();
+                RAM->init(memory_size, use_paged_memory());
+                const long long pages = static_cast<long long>((memory_size + word_memory::page_words - 1) / word_memory::page_words);
+                std::vector<word> run;
+                for (long long page = in.get(-1, pages - 1); page >= 0; page = in.get(-1, pages - 1)) {
+                    std::size_t base = static_cast<std::size_t>(page) * word_memory::page_words;
+                    std::size_t words = std::min(word_memory::page_words, memory_size - base);
+                    for (long long runs = in.get(1, word_memory::page_words); runs > 0; runs--) {
+                        std::size_t offset = static_cast<std::size_t>(in.get(0, words - 1));
+                        run.resize(static_cast<std::size_t>(in.get(1, words - offset)));
+                        in.get_words(run.data(), run.size());
+                        const word *from = run.data();
+                        RAM->write_spans(base + offset, run.size(), [&from](word *to, std::size_t n) {
+                            std::memcpy(to, from, n * sizeof(word));
+                            from += n;
+                            return n;
+                        });
+                    }
+                }
+                attach(code_size);
+                read_state(in);
+            }
+
+            // Метод инициализатор копией остановленного ядра source (клон для множества вариантов одного начала)
+            // ОЗУ делится с source копированием при записи по страницам (см. basic_memory::clone, копия всегда страничная),
+            // плоское ОЗУ source при первом клоне становится страничным, и дальше source и все клоны делят страницы
+            // (движки source без плоского ОЗУ переходят с JIT и перевода в C++ на кэш инструкций)
+            // Регистры, флаги, прерывания, таймер и состояние портов копируются как в снимке, настройки - как copy_settings
+            // Клон и source дальше независимы и могут работать в разных потоках
+            void clone_from(basic_core &source) {
+                // Состояние пишется до копии ОЗУ: порт, который нельзя сохранить (открытый асинхронный файл), бросает исключение
+                // раньше, чем плоское ОЗУ source станет страничным
+                std::stringstream state;
+                utility_units::state_writer out(state);
+                source.write_state(out);
+                copy_settings(source);
+                memory_mode = MemoryMode::PAGED;
+                stack_base = source.stack_base;
+                stack_words = source.stack_words;
+                memory_size = source.memory_size;
+                RAM = source.RAM->clone();
+                attach(source.program_size);
+                utility_units::state_reader in(state);
+                read_state(in);
+            }
+
+            // Запись снимка ядра в path (после остановки start_process, машина из одного ядра)
+            // Ядро, остановленное на halt, в снимке продолжится со следующей инструкции (см. write_state)
+            // Файл пишется рядом под временным именем и переименовывается, поэтому прерванная запись не портит прошлый снимок
+            void save_snapshot(const std::string &path) {
+                std::string temporary = path + ".tmp";
+                try {
+                    std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+                    if (not file) {throw std::runtime_error("Cannot write snapshot " + path);}
+                    file.write("XVSN", 4);
+                    std::uint32_t version = utility_units::snapshot_version;
+                    file.write(reinterpret_cast<const char *>(&version), sizeof(version));
+                    utility_units::state_writer out(file);
+                    out.put(static_cast<long long>(memory_size));
+                    out.put(static_cast<long long>(program_size));
+                    out.put(word_bits<word>());
+                    // Ненулевые отрезки страниц, разделённые хотя бы snapshot_gap нулями
+                    std::vector<std::pair<std::size_t, std::size_t>> runs;
+                    RAM->for_each_page([&out, &runs](std::size_t page, const word *cells, std::size_t words) {
+                        runs.clear();
+                        std::size_t i = 0;
+                        while (i < words) {
+                            if (cells[i] == 0) {
+                                i++;
+                                continue;
+                            }
+                            std::size_t start = i;
+                            std::size_t end = i + 1;
+                            for (i = end; i < words and i < end + utility_units::snapshot_gap; i++) {
+                                if (cells[i] != 0) {end = i + 1;}
+                            }
+                            i = end;
+                            runs.emplace_back(start, end - start);
+                        }
+                        if (runs.empty()) {return;}
+                        out.put(static_cast<long long>(page));
+                        out.put(static_cast<long long>(runs.size()));
+                        for (auto &r : runs) {
+                            out.put(static_cast<long long>(r.first));
+                            out.put(static_cast<long long>(r.second));
+                            out.put_words(cells + r.first, r.second);
+                        }
+                    });
+                    out.put(-1);
+                    write_state(out);
+                    if (not file.flush()) {throw std::runtime_error("Cannot write snapshot " + path);}
+                } catch (...) {
+                    std::remove(temporary.c_str());
+                    throw;
+                }
+                if (std::rename(temporary.c_str(), path.c_str()) != 0) {
+                    std::remove(temporary.c_str());
+                    throw std::runtime_error("Cannot write snapshot " + path);
+                }
+            }
+
+            // ОЗУ ядра, чтобы разделить его с другими ядрами
+            std::shared_ptr<word_memory> shared_memory() const {
+                return RAM;
+            }
+
+            std::size_t program_length() const {
+                return program_size;
+            }
+
+            // Значение регистра (для сравнения результатов и замеров)
+            word get_register(raddr reg) const {
+                return registers[reg];
+            }
+
+            // Запись в регистр до запуска (точка входа, аргументы)
+            void set_register(raddr reg, word value) {
+                registers[reg] = value;
+            }
+
+            // Перенос настроек (движок, слияние, представление ОЗУ, потоки терминала) с другого ядра, вызывать до init()
+            // Доверенный режим не переносится: его включают после init(), когда известна точка входа
+            void copy_settings(const basic_core &other) {
+                engine = other.engine;
+                fusion = other.fusion;
+                memory_mode = other.memory_mode;
+                terminal_in = other.terminal_in;
+                terminal_out = other.terminal_out;
+                native = other.native;
+                vectors = other.vectors;
+            }
+
+            bool is_trusted() const {
+                return trusted;
+            }
+
+            // Обработчики spawn и join, без них spawn возвращает -1, а join ничего не ждёт
+            // spawn(entry, arg) возвращает номер запущенного ядра или -1
+            void set_machine_hooks(std::function<int(word, word)> spawn, std::function<void(word)> join) {
+                spawner = std::move(spawn);
+                joiner = std::move(join);
+            }
+
+            // Включение доверенного режима: движки с кэшем исполняют проверенный код без проверок,
+            // эталонный движок (и отладка) - с проверками, но выход проверенных lodr/strr за ОЗУ у всех движков
+            // одинаково останавливает процессор с err_flag = 1 вместо исключения
+            // Программа сразу проверяется, при ошибке бросается исключение, и режим не включается
+            // Вызывать после init()
+            void set_trusted(bool enabled) {
+                if (enabled) {verify_program();}
+                trusted = enabled;
+                icache.clear();
+            }
+
+            // Перенаправление терминала (порт 0) в заданные потоки, по умолчанию - дескрипторы 0 и 1 в обход iostream
+            // Потоки должны жить дольше ядра, вызывать до init()
+            void set_terminal(std::istream &input, std::ostream &output) {
+                terminal_in = &input;
+                terminal_out = &output;
+            }
+
+            // Область стека: words ячеек с адреса base, r15 после init - на её конце (стек пуст)
+            // words = 0 - стек по умолчанию от конца программы до конца ОЗУ. Вызывать до init()
+            void set_stack(std::size_t base, std::size_t words) {
+                stack_base = base;
+                stack_words = words;
+            }
+
+            // Таймер системных вызовов: каждые period инструкций вызывается обработчик по адресу из r13,
+            // как инструкцией timer. 0 выключает таймер. Вызывать после init()
+            // Сверхинструкции и блоки JIT считаются по числу инструкций в них, но прерывание приходит только после них целиком
+            void set_timer(long long period) {
+                arm_timer(period);
+            }
+
+            // Обработчик прерывания number (адрес или -1), как инструкцией seti. Вызывать после init()
+            void set_interrupt(int number, word handler) {
+                if (number < 0 or number >= 16) {throw std::runtime_error("Bad interrupt number");}
+                intr_table[number] = handler;
+            }
+
+            // Флаг ошибки после остановки (0 - нет ошибки)
+            int error_flag() const {
+                return err_flag;
+            }
+
+            // Профилирование (см. profiler.hpp), вызывать до init()
+            void set_profiling(bool enabled) {
+                if (enabled) {require_hooks("Profiling");}
+                if (enabled and not profile) {profile = std::make_unique<utility_units::profiler>();}
+                if (not enabled) {profile.reset();}
+            }
+
+            // Отчёт профилировщика (top самых частых адресов и переходов) и свёрнутые стеки для flamegraph
+            void write_profile(std::ostream &report, std::ostream &collapsed, std::size_t top) const {
+                if (not profile) {throw std::runtime_error("Profiling is not enabled");}
+                auto describe = [this](std::size_t adr) {
+                    if (adr + 3 >= memory_size) {return std::string("?");}
+                    word op = RAM->get_from_memory(adr);
+                    const char *mnemonic = opcode_name(opcode_of(op));
+                    std::string text = mnemonic ? mnemonic : std::to_string(op);
+                    for (std::size_t i = 1; i < 4; i++) {text += " " + std::to_string(RAM->get_from_memory(adr + i));}
+                    return text;
+                };
+                profile->write_report(report, top, describe, opcode_name);
+                profile->write_collapsed(collapsed);
+            }
+
+            // Запись трассы исполнения в файл path (см. trace.hpp), пустой путь выключает запись. Вызывать до init()
+            // Трасса пишется эталонным движком или движком с кэшем без сверхинструкций, как при профилировании
+            void set_trace(const std::string &path) {
+                require_hooks("Tracing");
+                if (not path.empty()) {require_word32("Tracing");}
+                trace_path = path;
+                replay.reset();
+            }
+
+            // Воспроизведение трассы path: порты 0 и 1 получают ввод из неё, а исполнение сверяется с ней,
+            // расхождение бросает исключение. Вызывать до init(), запускать с бюджетом replay_instructions()
+            void set_replay(const std::string &path) {
+                require_hooks("Replay");
+                require_word32("Replay");
+                replay = std::make_unique<utility_units::trace_log>(path);
+                trace_path.clear();
+            }
+
+            // Количество инструкций в воспроизводимой трассе
+            long long replay_instructions() const {
+                return replay ? replay->instructions() : 0;
+            }
+
+            // Проверка после воспроизведения, что трасса пройдена до конца
+            void check_replay() {
+                if (replay_check == nullptr) {throw std::runtime_error("Replay is not enabled");}
+                replay_check->complete();
+            }
+
+            // Представление ОЗУ (см. MemoryMode), вызывать до init()
+            void set_memory_mode(MemoryMode mode) {
+                memory_mode = mode;
+            }
+
+            // Включение слияния инструкций в сверхинструкции для движков с кэшем (по умолчанию включено)
+            void set_fusion(bool enabled) {
+                fusion = enabled;
+            }
+
+            // Набор ядер векторных инструкций (по умолчанию - лучший для этого процессора), нужен для замеров и сверки
+            void set_vector_level(VectorLevel level) {
+                vectors = &vector_kernels_for_word<word>(level);
+            }
+
+            // Наблюдатель за эталонным движком: вызывается перед исполнением каждой инструкции
+            // с её адресом и четырьмя словами (используется xvngram)
+            void set_observer(std::function<void(std::size_t, const word *)> callback) {
+                require_hooks("Observer");
+                observer = std::move(callback);
+            }
+
+            // Перевод программы в C++ (см. aot.hpp), вызывать до init()
+            // Он исполняется вместо движков с кэшем, если загружена та же программа, а ОЗУ плоское и не меньше memory_words
+            void set_native(const native_program &program) {
+                native = program;
+            }
+
+            // Выбор движка исполнения, по умолчанию эталонный SWITCH
+            void set_engine(Engine e) {
+                engine = e;
             }
 
             // Метод запуска процесса вычислений
-            // debugmode - режим дебага, при нём выводятся регистры
-            void start_process(bool debugmode) {
+            // debugmode - режим дебага, при нём выводятся регистры (всегда исполняется эталонным движком)
+            // limits - бюджет инструкций и срок, по их исчерпании процессор останавливается перед очередной инструкцией,
+            // и повторный вызов продолжает исполнение с неё
+            // После остановки буферы портов сбрасываются
+            run_result start_process(bool debugmode, const run_limits &limits = run_limits()) {
+                if (debugmode) {require_hooks("Debug mode");}
+                sync_clock();
+                retired = 0;
+                budget_left = limits.instructions > 0 ? limits.instructions : no_countdown;
+                poll_left = no_countdown;
+                if (limits.seconds > 0) {
+                    deadline = std::chrono::steady_clock::now()
+                        + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(limits.seconds));
+                    poll_left = deadline_poll;
+                }
+                stop_reason = ExitReason::HALT;
+                schedule();
+                // Регистры, заданные между запусками (set_register), попадают в трассу до первой инструкции
+                if (tracing()) {trace_state();}
+                // Дебаг сам пишет в std::cout и читает std::cin, терминал на дескрипторах смешал бы их буферы
+                if (debugmode and terminal_in == nullptr and not ports.empty() and not trace) {
+                    ports[0] = std::make_unique<utility_units::terminal>(std::cin, std::cout);
+                }
                 if (debugmode) std::cout << "Process start!\n";
-                process(debugmode);
+                if (debugmode or engine == Engine::SWITCH) {
+                    process(debugmode);
+                } else {
+                    prepare_caches();
+                    if (profiling() or tracing()) {
+                        process_predecoded();
+                    } else if (native_intact) {
+                        process_native();
+                    } else if (engine == Engine::THREADED) {
+                        process_threaded();
+                    } else if (engine == Engine::JIT) {
+                        process_jit();
+                    } else {
+                        process_predecoded();
+                    }
+                }
+                for (auto &port : ports) {port->flush();}
                 if (debugmode) std::cout << "Process end!\n";
+                sync_clock();
+                if (tracing()) {trace->finish(static_cast<int>(stop_reason), retired);}
+                run_result result;
+                result.reason = stop_reason;
+                result.instructions = retired;
+                for (std::size_t i = 0; i < 16; i++) {result.registers[i] = registers[i];}
+                result.err_flag = err_flag;
+                return result;
             }
 
 
     };
+
+    // Ядро с проверками и отладкой для любых программ и ядро без них для проверенных программ
+    using core = basic_core<checked_policy>;
+    using lean_core = basic_core<lean_policy>;
+
+    // Ядра с проверками и словом 16 и 64 бита (см. word.hpp)
+    using core16 = basic_core<word_policy<std::int16_t>>;
+    using core64 = basic_core<word_policy<long long>>;
 }
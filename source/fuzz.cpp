@@ -0,0 +1,354 @@
+#include <climits>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "core.hpp"
+
+// Сверка движков исполнения с эталонным на случайных программах
+// Запуск: xvfuzz [programs] [seed]
+// Каждая программа исполняется эталонным движком SWITCH и движками с кэшем (с проверками и в доверенном режиме,
+// доверенные сверяются с SWITCH в доверенном режиме), итоги должны совпасть: причина остановки, число инструкций, регистры, флаги, вывод терминала и всё ОЗУ
+// В программах есть неверные коды операций (в том числе коды записей кэша), переходы в данные и запись в код,
+// поэтому движки сверяются и там, где у них свои пути: медленный путь, проверка программы, выход за ОЗУ
+// При расхождении печатается программа и оба итога, код возврата 1
+
+// Итог запуска для сверки
+struct outcome {
+  bool skipped = false;   // Движок не может исполнить программу (доверенный режим не принял её)
+  bool bad_register = false;  // Эталон дошёл до инструкции с неверным номером регистра
+  std::string exception;  // Исключение вместо остановки
+  cpu_unit::run_result result;
+  std::string output;
+  std::uint64_t memory_hash = 0;
+};
+
+struct engine_config {
+  const char *name;
+  cpu_unit::Engine engine;
+  bool fusion;
+  bool trusted;
+  bool lean;
+};
+
+const engine_config engines[] = {
+  {"predecode",                  cpu_unit::Engine::PREDECODED, true,  false, false},
+  {"predecode -nofusion",        cpu_unit::Engine::PREDECODED, false, false, false},
+  {"threaded",                   cpu_unit::Engine::THREADED,   true,  false, false},
+  {"threaded -nofusion",         cpu_unit::Engine::THREADED,   false, false, false},
+  {"jit",                        cpu_unit::Engine::JIT,        true,  false, false},
+  {"jit -nofusion",              cpu_unit::Engine::JIT,        false, false, false},
+  {"predecode -trusted",         cpu_unit::Engine::PREDECODED, true,  true,  false},
+  {"threaded -trusted",          cpu_unit::Engine::THREADED,   true,  true,  false},
+  {"jit -trusted",               cpu_unit::Engine::JIT,        true,  true,  false},
+  {"threaded -trusted lean_core", cpu_unit::Engine::THREADED,  true,  true,  true},
+};
+
+// Номера регистров проверяются только при проверке программы (verify_program()), движки с проверками
+// обращаются к регистру с неверным номером за пределами массива регистров, и итог у движков свой
+bool registers_valid(const int *w) {
+  using cpu_unit::OpCode;
+  auto reg = [](int r) {return r >= 0 and r < 16;};
+  switch (static_cast<OpCode>(w[0])) {
+    case OpCode::LODI: case OpCode::LOC: case OpCode::LCMP: case OpCode::PUSH: case OpCode::POP: case OpCode::STKR:
+    case OpCode::PRTS: case OpCode::PRTG: case OpCode::PRCG: case OpCode::JOIN: case OpCode::TIMER:
+      return reg(w[1]);
+    case OpCode::STRI: case OpCode::SETI:
+      return reg(w[2]);
+    case OpCode::LODR: case OpCode::MOV: case OpCode::NOT: case OpCode::STRR: case OpCode::AMIN: case OpCode::CMP:
+    case OpCode::ADDC: case OpCode::PRTW: case OpCode::PRTR:
+      return reg(w[1]) and reg(w[2]);
+    case OpCode::ADD: case OpCode::SUB: case OpCode::MULT: case OpCode::DIV: case OpCode::MOD: case OpCode::OR:
+    case OpCode::AND: case OpCode::CAS: case OpCode::FADD: case OpCode::SPAWN:
+    case OpCode::VADD: case OpCode::VSUB: case OpCode::VMUL: case OpCode::VAND: case OpCode::VOR: case OpCode::VFILL:
+    case OpCode::VCOPY: case OpCode::VSUM: case OpCode::VMIN: case OpCode::VMAX:
+      return reg(w[1]) and reg(w[2]) and reg(w[3]);
+    default:
+      return true;
+  }
+}
+
+// Ограничение на программу: зациклившиеся программы останавливаются по бюджету
+constexpr long long instruction_budget = 3000;
+
+template <typename Core>
+outcome run_program(const std::vector<int> &program, std::size_t ram_size, cpu_unit::Engine engine, bool fusion, bool trusted,
+                    long long budget = instruction_budget) {
+  outcome o;
+  std::istringstream input;
+  std::ostringstream output;
+  Core cpu;
+  cpu.set_terminal(input, output);
+  cpu.set_engine(engine);
+  cpu.set_fusion(fusion);
+  // Эталон останавливается перед такой инструкцией, программа в сверку не идёт
+  if (engine == cpu_unit::Engine::SWITCH) {
+    cpu.set_observer([&o](std::size_t, const typename Core::word *w) {
+      if (not registers_valid(w)) {
+        o.bad_register = true;
+        throw std::runtime_error("bad register");
+      }
+    });
+  }
+  cpu.init(program, ram_size);
+  if (trusted) {
+    try {
+      cpu.set_trusted(true);
+    } catch (std::runtime_error &) {
+      o.skipped = true;
+      return o;
+    }
+  }
+  cpu_unit::run_limits limits;
+  limits.instructions = budget;
+  try {
+    o.result = cpu.start_process(false, limits);
+  } catch (std::runtime_error &e) {
+    o.exception = e.what();
+    return o;
+  }
+  o.output = output.str();
+  std::shared_ptr<cpu_unit::memory> ram = cpu.shared_memory();
+  std::uint64_t hash = 1469598103934665603ULL;
+  for (std::size_t i = 0; i < ram_size; i++) {
+    hash = (hash ^ static_cast<std::uint32_t>(ram->get_from_memory(i))) * 1099511628211ULL;
+  }
+  o.memory_hash = hash;
+  return o;
+}
+
+std::string describe(const outcome &o) {
+  if (o.skipped) {return "skipped";}
+  if (not o.exception.empty()) {return "exception: " + o.exception;}
+  std::string text = std::string(cpu_unit::exit_reason_name(o.result.reason)) + ", "
+    + std::to_string(o.result.instructions) + " instructions, err " + std::to_string(o.result.err_flag) + ", registers";
+  for (long long r : o.result.registers) {text += " " + std::to_string(r);}
+  text += ", output \"" + o.output + "\", memory " + std::to_string(o.memory_hash);
+  return text;
+}
+
+bool same(const outcome &a, const outcome &b) {
+  if (a.exception != b.exception) {return false;}
+  if (not a.exception.empty()) {return true;}
+  return a.result.reason == b.result.reason and a.result.instructions == b.result.instructions
+    and a.result.err_flag == b.result.err_flag
+    and std::memcmp(a.result.registers, b.result.registers, sizeof(a.result.registers)) == 0
+    and a.output == b.output and a.memory_hash == b.memory_hash;
+}
+
+// Генератор случайных программ: инструкции подряд, за ними ячейки данных,
+// ОЗУ - программа и немного места под стек
+class program_generator {
+private:
+  std::mt19937 random;
+  std::size_t code_words = 0;
+  std::size_t ram_size = 0;
+
+  int pick(int low, int high) {
+    return std::uniform_int_distribution<int>(low, high)(random);
+  }
+
+  bool chance(int percent) {
+    return pick(0, 99) < percent;
+  }
+
+  // Регистр: в основном обычные, изредка r14 и r15
+  // Неверные номера попадаются только при исполнении данных и середины инструкций
+  int reg() {
+    int p = pick(0, 99);
+    if (p < 92) {return pick(0, 12);}
+    if (p < 96) {return 15;}
+    return 14;
+  }
+
+  // Адрес перехода: чаще инструкция, иногда данные, середина инструкции или конец ОЗУ
+  int jump_target() {
+    int p = pick(0, 99);
+    if (p < 75) {return 4 * pick(0, static_cast<int>(code_words / 4) - 1);}
+    if (p < 90) {return pick(static_cast<int>(code_words), static_cast<int>(ram_size) - 1);}
+    if (p < 97) {return pick(0, static_cast<int>(ram_size) - 1);}
+    return static_cast<int>(ram_size) - pick(0, 3);
+  }
+
+  // Адрес ячейки: в основном внутри ОЗУ (и в коде), изредка за его пределами
+  int address() {
+    int p = pick(0, 99);
+    if (p < 94) {return pick(0, static_cast<int>(ram_size) - 1);}
+    if (p < 97) {return static_cast<int>(ram_size) + pick(0, 8);}
+    return -pick(1, 8);
+  }
+
+  int value() {
+    int p = pick(0, 99);
+    if (p < 60) {return pick(-8, 64);}
+    if (p < 80) {return address();}
+    if (p < 90) {return invalid_opcode();}
+    return chance(50) ? INT_MAX - pick(0, 4) : INT_MIN + pick(0, 4);
+  }
+
+  // Коды вне набора инструкций, в том числе коды сверхинструкций и доверенного режима в записях кэша
+  int invalid_opcode() {
+    static const int codes[] = {1, 4, 13, 49, 100, 999, 1000, 1001, 1003, 1005, 1999, 2000, 2005, 2007, 2022, 2999, 3000, 99999, -1, -2000};
+    return codes[pick(0, sizeof(codes) / sizeof(codes[0]) - 1)];
+  }
+
+  void instruction(std::vector<int> &out) {
+    using cpu_unit::OpCode;
+    auto ins = [&out](OpCode op, int a = 0, int b = 0, int c = 0) {out.insert(out.end(), {static_cast<int>(op), a, b, c});};
+    switch (pick(0, 33)) {
+      case 0: case 1: ins(OpCode::LOC, reg(), value()); break;
+      case 2: ins(OpCode::ADDC, reg(), reg(), pick(-4, 8)); break;
+      case 3: ins(OpCode::ADD, reg(), reg(), reg()); break;
+      case 4: ins(OpCode::SUB, reg(), reg(), reg()); break;
+      case 5: ins(OpCode::MULT, reg(), reg(), reg()); break;
+      case 6: ins(OpCode::DIV, reg(), reg(), reg()); break;
+      case 7: ins(OpCode::MOD, reg(), reg(), reg()); break;
+      case 8: ins(chance(50) ? OpCode::OR : OpCode::AND, reg(), reg(), reg()); break;
+      case 9: ins(chance(50) ? OpCode::NOT : OpCode::MOV, reg(), reg()); break;
+      case 10: case 11: ins(OpCode::CMP, reg(), reg()); break;
+      case 12: ins(OpCode::LCMP, reg()); break;
+      case 13: case 14: ins(OpCode::JMP, pick(-1, 1), jump_target()); break;
+      case 15: ins(OpCode::GOTO, jump_target()); break;
+      case 16: ins(OpCode::LODI, reg(), address()); break;
+      case 17: ins(OpCode::STRI, address(), reg()); break;
+      case 18: ins(OpCode::LODR, reg(), reg()); break;
+      case 19: ins(OpCode::STRR, reg(), reg()); break;
+      case 20: ins(OpCode::PUSH, reg()); break;
+      case 21: ins(OpCode::POP, reg()); break;
+      case 22: ins(OpCode::CALL, jump_target()); break;
+      case 23: ins(OpCode::RET); break;
+      case 24: ins(OpCode::STKR, reg(), pick(-2, 3)); break;
+      case 25: ins(OpCode::PRTS, reg(), chance(95) ? 0 : pick(4, 9)); break;
+      case 26: ins(OpCode::SETI, pick(0, 8), reg()); break;
+      case 27: ins(OpCode::INTR, pick(0, 8)); break;
+      case 28: ins(chance(50) ? OpCode::IRET : OpCode::CERR); break;
+      case 29: ins(OpCode::SERR, pick(0, 8)); break;
+      case 30: ins(chance(50) ? OpCode::VSUM : OpCode::VFILL, reg(), reg(), reg()); break;
+      case 31: ins(chance(70) ? OpCode::AMIN : OpCode::SETL, reg(), reg()); break;
+      case 32: out.insert(out.end(), {invalid_opcode(), reg(), address(), 0}); break;
+      default: ins(OpCode::HALT); break;
+    }
+  }
+
+public:
+  explicit program_generator(unsigned seed) : random(seed) {}
+
+  std::size_t ram() const {
+    return ram_size;
+  }
+
+  std::vector<int> next() {
+    std::size_t instructions = pick(4, 40);
+    std::size_t data_words = pick(0, 32);
+    code_words = 4 * instructions;
+    ram_size = code_words + data_words + pick(8, 64);
+    std::vector<int> program;
+    // Терминал в числовом режиме, чтобы вывод prts читался при расхождении
+    program.insert(program.end(), {static_cast<int>(cpu_unit::OpCode::PRCS), 1, 0, 0});
+    while (program.size() < code_words) {instruction(program);}
+    program.resize(code_words);
+    for (std::size_t i = 0; i < data_words; i++) {program.push_back(chance(30) ? invalid_opcode() : value());}
+    return program;
+  }
+};
+
+// Сверка всех движков с эталоном на одной программе, при расхождении печатает программу и оба итога
+// runs - счётчик сверенных запусков
+bool check_program(const std::vector<int> &program, std::size_t ram_size, const outcome &reference,
+                   const std::string &title, long long &runs) {
+  bool uses_bounds = cpu_unit::program_uses_bounds([&program](std::size_t i) {return program[i];}, program.size());
+  // Доверенный режим останавливается с ошибкой 1 там, где эталон с проверками бросает исключение выхода за ОЗУ,
+  // поэтому доверенные движки сверяются с доверенным эталоном
+  outcome trusted_reference = run_program<cpu_unit::core>(program, ram_size, cpu_unit::Engine::SWITCH, true, true);
+  for (const engine_config &config : engines) {
+    const outcome &base = config.trusted ? trusted_reference : reference;
+    if (base.skipped or base.bad_register) {continue;}
+    if (config.lean and uses_bounds) {continue;}
+    outcome got = config.lean
+      ? run_program<cpu_unit::lean_core>(program, ram_size, config.engine, config.fusion, config.trusted)
+      : run_program<cpu_unit::core>(program, ram_size, config.engine, config.fusion, config.trusted);
+    // Ядро без проверок amin останавливается на setl, записанном программой в свой код
+    if (got.skipped or (config.lean and got.exception == "setl needs the checked core")) {continue;}
+    runs++;
+    // Сверхинструкция или блок JIT на границе бюджета исполняются целиком, поэтому движок может
+    // остановиться позже эталона: тогда он сверяется с эталоном, исполненным до того же числа инструкций
+    outcome expected = base;
+    if (base.exception.empty() and got.exception.empty() and base.result.reason == cpu_unit::ExitReason::BUDGET
+        and got.result.reason == cpu_unit::ExitReason::BUDGET and got.result.instructions > instruction_budget) {
+      expected = run_program<cpu_unit::core>(program, ram_size, cpu_unit::Engine::SWITCH, true, config.trusted, got.result.instructions);
+    }
+    if (not same(expected, got)) {
+      std::cout << "Mismatch in " << title << " (ram " << ram_size << "), engine " << config.name << "\n";
+      for (std::size_t i = 0; i < program.size(); i += 4) {
+        std::cout << "  " << i << ":";
+        for (std::size_t j = i; j < i + 4 and j < program.size(); j++) {std::cout << " " << program[j];}
+        std::cout << "\n";
+      }
+      std::cout << (config.trusted ? "switch -trusted: " : "switch: ") << describe(expected) << "\n" << config.name << ": " << describe(got) << "\n";
+      return false;
+    }
+  }
+  return true;
+}
+
+// Слова с кодами записей кэша в ОЗУ - неверные инструкции (ошибка 5) во всех движках
+// Прежде такое слово уходило в обработчик сверхинструкции или доверенного режима без проверок,
+// и с адресом 100000000 шитый движок читал за пределами ОЗУ
+bool check_cache_codes(long long &runs) {
+  using cpu_unit::OpCode;
+  const int halt = static_cast<int>(OpCode::HALT);
+  for (int code : {1000, 1005, 1999, 2000, 2005, 2999, 99999}) {
+    const std::vector<int> programs[] = {
+      // Код с начала программы
+      {code, 1, 100000000, 0, halt, 0, 0, 0},
+      // Переход в данные: проверка программы его видит, доверенный режим программу не принимает
+      {static_cast<int>(OpCode::GOTO), 8, 0, 0, halt, 0, 0, 0, code, 1, 100000000, 0},
+      // Вычисляемый переход: ячейка не проверена, доверенные движки исполняют её с проверками
+      {static_cast<int>(OpCode::LOC), 14, 4, 0, halt, 0, 0, 0, code, 1, 100000000, 0},
+    };
+    for (const std::vector<int> &program : programs) {
+      const std::size_t ram_size = 64;
+      std::string title = "cache code " + std::to_string(code) + " program";
+      outcome reference = run_program<cpu_unit::core>(program, ram_size, cpu_unit::Engine::SWITCH, true, false);
+      if (reference.result.reason != cpu_unit::ExitReason::ERROR or reference.result.err_flag != 5) {
+        std::cout << "Unexpected reference result for " << title << ": " << describe(reference) << "\n";
+        return false;
+      }
+      if (not check_program(program, ram_size, reference, title, runs)) {return false;}
+    }
+  }
+  return true;
+}
+
+int main(int argc, char **argv) {
+  long long programs = argc > 1 ? std::atoll(argv[1]) : 2000;
+  unsigned seed = argc > 2 ? static_cast<unsigned>(std::strtoul(argv[2], nullptr, 10)) : 1;
+  if (programs < 0) {
+    std::cerr << "Invalid arguments\n";
+    std::cout << "Usage: " << argv[0] << " [programs] [seed]\n";
+    return 1;
+  }
+
+  long long runs = 0;
+  long long undefined = 0;
+  if (not check_cache_codes(runs)) {return 1;}
+  program_generator generator(seed);
+  for (long long n = 0; n < programs; n++) {
+    std::vector<int> program = generator.next();
+    std::size_t ram_size = generator.ram();
+    outcome reference = run_program<cpu_unit::core>(program, ram_size, cpu_unit::Engine::SWITCH, true, false);
+    if (reference.bad_register) {
+      undefined++;
+      continue;
+    }
+    std::string title = "program " + std::to_string(n) + " (seed " + std::to_string(seed) + ")";
+    if (not check_program(program, ram_size, reference, title, runs)) {return 1;}
+  }
+  std::cout << programs << " programs, " << runs << " engine runs match the reference engine, "
+            << undefined << " programs skipped for bad register numbers\n";
+  return 0;
+}
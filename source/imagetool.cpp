@@ -0,0 +1,73 @@
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "loader.hpp"
+
+// Перевод текстовой программы в бинарный образ и просмотр образов
+// Запуск:
+//   xvimage input.txt output.xvi [entry] [-data data.txt address]
+//   xvimage -info image.xvi
+// Образ загружается эмулятором через mmap без разбора чисел (см. source/loader.hpp)
+
+int print_info(const std::string &filename) {
+  loader_unit::program_image image(filename);
+  const loader_unit::image_header &h = image.header();
+  std::cout << "version: " << h.version << "\n"
+            << "entry: " << h.entry << "\n"
+            << "code: " << h.code_words << " words at offset " << h.code_offset << "\n";
+  if (h.data_offset != 0) {
+    std::cout << "data: " << h.data_words << " words at offset " << h.data_offset
+              << ", address " << h.data_address << "\n";
+  }
+  for (auto &sym : image.symbols()) {
+    std::cout << "symbol " << sym.name << " = " << sym.address << "\n";
+  }
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  if (argc == 3 and std::strcmp(argv[1], "-info") == 0) {
+    try {
+      return print_info(argv[2]);
+    } catch (std::runtime_error &e) {
+      std::cerr << e.what() << "\n";
+      return 2;
+    }
+  }
+  if (argc < 3) {
+    std::cerr << "Invalid arguments\n";
+    std::cout << "Usage: " << argv[0] << " input.txt output.xvi [entry] [-data data.txt address]\n"
+              << "       " << argv[0] << " -info image.xvi\n";
+    return 1;
+  }
+
+  std::vector<int> code, data;
+  std::uint64_t entry = 0, data_address = 0;
+  loader_unit::load_text_program(argv[1], code);
+  for (int i = 3; i < argc; i++) {
+    if (std::strcmp(argv[i], "-data") == 0 and i + 2 < argc) {
+      loader_unit::load_text_program(argv[i + 1], data);
+      data_address = std::strtoull(argv[i + 2], nullptr, 10);
+      i += 2;
+    } else if (i == 3 and argv[i][0] != '-') {
+      entry = std::strtoull(argv[i], nullptr, 10);
+    } else {
+      std::cerr << "Unknown flag: " << argv[i] << "\n";
+      return 1;
+    }
+  }
+  if (code.empty()) {
+    std::cerr << "Empty program " << argv[1] << "\n";
+    return 2;
+  }
+
+  try {
+    loader_unit::write_image(argv[2], code, entry, data, data_address);
+  } catch (std::runtime_error &e) {
+    std::cerr << e.what() << "\n";
+    return 2;
+  }
+  return 0;
+}
@@ -0,0 +1,393 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#if defined(__x86_64__) && defined(__linux__)
+#include <sys/mman.h>
+#define XVPROC_JIT 1
+#else
+#define XVPROC_JIT 0
+#endif
+
+/*
+ JIT компиляция горячих базовых блоков в машинный код x86-64
+
+ Блок начинается с адреса, на который пришёл переход, и заканчивается на jmp/goto
+ (переход включается в блок) или перед первой инструкцией, которую компилятор не поддерживает
+ (halt, порты, lodr/strr, деление и т.д.) - её исполняет интерпретатор.
+ Поддерживаются: loc, add, addc, sub, mult, cmp, jmp, goto, mov, lodi, stri.
+
+ Скомпилированный блок - функция int block(int *registers, int *cmp_flag),
+ возвращающая адрес следующей инструкции. Используемые блоком гостевые регистры
+ и флаг сравнения на время блока лежат в регистрах процессора.
+
+ Блок никогда не пишет в область программы (такие stri не компилируются),
+ поэтому сбрасываются блоки только записями из интерпретатора.
+*/
+
+namespace cpu_unit {
+
+    // Скомпилированный блок: принимает регистры и флаг сравнения, возвращает адрес следующей инструкции
+    using jit_function = int (*)(int *registers, int *cmp_flag);
+
+    // Генератор машинного кода x86-64, только 32-битные операции над регистрами
+    class x86_emitter {
+    public:
+        std::vector<std::uint8_t> code;
+
+        // Коды условий для setcc/cmovcc
+        enum cond : std::uint8_t {E = 0x4, NE = 0x5, BE = 0x6, L = 0xC, GE = 0xD, LE = 0xE, G = 0xF};
+
+        void byte(std::uint8_t b) {code.push_back(b);}
+
+        void imm32(std::int32_t v) {
+            std::uint32_t u = static_cast<std::uint32_t>(v);
+            for (int i = 0; i < 4; i++) {byte(static_cast<std::uint8_t>(u >> (8 * i)));}
+        }
+
+        // Префикс REX, если нужен доступ к r8-r15
+        void rex(bool w, int reg, int rm) {
+            std::uint8_t r = 0x40 | (w ? 8 : 0) | ((reg & 8) ? 4 : 0) | ((rm & 8) ? 1 : 0);
+            if (r != 0x40) {byte(r);}
+        }
+
+        // op r/m32, r32 в регистровой форме (mov, add, sub, cmp)
+        void rr(std::uint8_t opcode, int dst, int src) {
+            rex(false, src, dst);
+            byte(opcode);
+            byte(0xC0 | ((src & 7) << 3) | (dst & 7));
+        }
+
+        void mov(int dst, int src) {if (dst != src) {rr(0x89, dst, src);}}
+        void add(int dst, int src) {rr(0x01, dst, src);}
+        void sub(int dst, int src) {rr(0x29, dst, src);}
+        void cmp(int a, int b) {rr(0x39, a, b);}
+
+        // imul r32, r/m32
+        void imul(int dst, int src) {
+            rex(false, dst, src);
+            byte(0x0F); byte(0xAF);
+            byte(0xC0 | ((dst & 7) << 3) | (src & 7));
+        }
+
+        // mov r32, imm32 (флаги не меняет)
+        void mov_imm(int dst, std::int32_t v) {
+            rex(false, 0, dst);
+            byte(0xB8 + (dst & 7));
+            imm32(v);
+        }
+
+        // add r/m32, imm32
+        void add_imm(int dst, std::int32_t v) {
+            rex(false, 0, dst);
+            byte(0x81);
+            byte(0xC0 | (dst & 7));
+            imm32(v);
+        }
+
+        // cmp r/m32, imm8
+        void cmp_imm8(int dst, std::int8_t v) {
+            rex(false, 0, dst);
+            byte(0x83);
+            byte(0xC0 | (7 << 3) | (dst & 7));
+            byte(static_cast<std::uint8_t>(v));
+        }
+
+        // cmovcc r32, r/m32
+        void cmov(cond c, int dst, int src) {
+            rex(false, dst, src);
+            byte(0x0F); byte(0x40 + c);
+            byte(0xC0 | ((dst & 7) << 3) | (src & 7));
+        }
+
+        // mov r32, [base + disp32] / mov [base + disp32], r32, base не rsp/r12
+        void load(int dst, int base, std::int32_t disp) {
+            rex(false, dst, base);
+            byte(0x8B);
+            byte(0x80 | ((dst & 7) << 3) | (base & 7));
+            imm32(disp);
+        }
+
+        void store(int base, std::int32_t disp, int src) {
+            rex(false, src, base);
+            byte(0x89);
+            byte(0x80 | ((src & 7) << 3) | (base & 7));
+            imm32(disp);
+        }
+
+        // mov rax, imm64
+        void mov_rax_imm64(std::uint64_t v) {
+            byte(0x48); byte(0xB8);
+            for (int i = 0; i < 8; i++) {byte(static_cast<std::uint8_t>(v >> (8 * i)));}
+        }
+
+        void push(int r) {rex(false, 0, r); byte(0x50 + (r & 7));}
+        void pop(int r) {rex(false, 0, r); byte(0x58 + (r & 7));}
+        void ret() {byte(0xC3);}
+    };
+
+    // Кэш скомпилированных блоков для области программы
+    class jit_cache {
+    public:
+        // Сколько раз блок должен начаться, прежде чем его скомпилируют
+        static constexpr std::uint32_t threshold = 64;
+        // Максимальная длина блока в инструкциях
+        static constexpr std::size_t max_block = 64;
+
+        static constexpr bool supported() {return XVPROC_JIT == 1;}
+
+        jit_cache() = default;
+        jit_cache(const jit_cache &) = delete;
+        jit_cache &operator=(const jit_cache &) = delete;
+
+        ~jit_cache() {
+            clear();
+        }
+
+        // Подготовка кэша под область программы размером code_size
+        void reset(std::size_t code_size) {
+            clear();
+            entries.assign(code_size, entry());
+            covered.assign(code_size, 0);
+        }
+
+        // Размер покрываемой области программы
+        std::size_t size() const {
+            return entries.size();
+        }
+
+        // Скомпилированный блок по адресу pc или nullptr
+        // Если блок ещё не скомпилирован, считает вход в блок и компилирует при достижении порога
+        // ram - плоский массив ОЗУ размером ram_size
+        jit_function enter(std::size_t pc, int *ram, std::size_t ram_size) {
+            if (pc >= entries.size()) {return nullptr;}
+            entry &e = entries[pc];
+            if (e.code != nullptr) {return e.code;}
+            if (e.hits < threshold and ++e.hits == threshold) {
+                compile(pc, ram, ram_size);
+            }
+            return e.code;
+        }
+
+        // Количество инструкций скомпилированного блока с адреса pc
+        std::size_t length(std::size_t pc) const {
+            return entries[pc].length;
+        }
+
+        // Сброс блоков, покрывающих адрес adr (запись в ОЗУ из интерпретатора)
+        void invalidate(std::size_t adr) {
+            if (adr >= covered.size() or not covered[adr]) {return;}
+            for (std::size_t i = 0; i < blocks.size();) {
+                if (adr >= blocks[i].start and adr < blocks[i].end) {
+                    release(blocks[i]);
+                    blocks[i] = blocks.back();
+                    blocks.pop_back();
+                } else {
+                    i++;
+                }
+            }
+            // Пересчёт покрытия: оставшиеся блоки могли делить ячейки с удалёнными
+            std::fill(covered.begin(), covered.end(), 0);
+            for (auto &b : blocks) {
+                for (std::size_t a = b.start; a < b.end; a++) {covered[a] = 1;}
+            }
+        }
+
+    private:
+        struct entry {
+            jit_function code = nullptr;
+            std::uint32_t hits = 0;
+            std::uint32_t length = 0;
+        };
+
+        struct block {
+            std::size_t start;
+            std::size_t end;      // Первый адрес после блока
+            void *mapping;
+            std::size_t mapping_size;
+        };
+
+        std::vector<entry> entries;
+        std::vector<char> covered;
+        std::vector<block> blocks;
+
+        void release(block &b) {
+            entries[b.start].code = nullptr;
+            entries[b.start].hits = 0;
+        #if XVPROC_JIT
+            munmap(b.mapping, b.mapping_size);
+        #endif
+        }
+
+        void clear() {
+            for (auto &b : blocks) {release(b);}
+            blocks.clear();
+        }
+
+        // Поддерживает ли компилятор инструкцию по адресу pc
+        static bool compilable(const int *w, std::size_t code_size, std::size_t ram_size) {
+            auto reg_ok = [](int r) {return r >= 0 and r < 16 and r != 14;};
+            switch (w[0]) {
+                case 22: return reg_ok(w[1]);                                      // loc
+                case 9:  return reg_ok(w[1]) and reg_ok(w[2]);                     // mov
+                case 21: return reg_ok(w[1]) and reg_ok(w[2]);                     // addc
+                case 20: case 23: case 24:                                         // add, sub, mult
+                    return reg_ok(w[1]) and reg_ok(w[2]) and reg_ok(w[3]);
+                case 30: return reg_ok(w[1]) and reg_ok(w[2]);                     // cmp
+                case 5:                                                            // lodi
+                    return reg_ok(w[1]) and static_cast<std::size_t>(w[2]) < ram_size;
+                case 7:                                                            // stri
+                    return reg_ok(w[2]) and static_cast<std::size_t>(w[1]) < ram_size
+                        and static_cast<std::size_t>(w[1]) >= code_size;
+                case 31: case 32: return true;                                     // jmp, goto
+                default: return false;
+            }
+        }
+
+    #if XVPROC_JIT
+        // Регистры x86-64
+        enum host : int {RAX = 0, RCX = 1, RDX = 2, RBX = 3, RBP = 5, RSI = 6, RDI = 7,
+                         R8 = 8, R9 = 9, R10 = 10, R11 = 11, R12 = 12, R13 = 13, R14 = 14, R15 = 15};
+
+        // Компиляция блока с адреса pc, при неудаче запись остаётся без кода и больше не пробуется
+        void compile(std::size_t pc, int *ram, std::size_t ram_size) {
+            const std::size_t code_size = entries.size();
+            // Регистры процессора под гостевые регистры, первые 4 не нужно сохранять
+            static const int pool[] = {RCX, R8, R9, R10, RBX, RBP, R12, R13, R14, R15};
+            constexpr int pool_size = sizeof(pool) / sizeof(pool[0]);
+            const int flag = R11;
+
+            int map[16];
+            for (int &m : map) {m = -1;}
+            bool dirty[16] = {};
+            int used = 0;
+
+            // Разметка блока и распределение регистров
+            std::size_t end = pc;
+            bool terminated = false;
+            while (not terminated and end + 3 < code_size and (end - pc) / 4 < max_block) {
+                const int *w = ram + end;
+                if (not compilable(w, code_size, ram_size)) {break;}
+                int regs[3];
+                int n = 0;
+                switch (w[0]) {
+                    case 22: regs[n++] = w[1]; break;
+                    case 9: case 21: case 30: regs[n++] = w[1]; regs[n++] = w[2]; break;
+                    case 20: case 23: case 24: regs[n++] = w[1]; regs[n++] = w[2]; regs[n++] = w[3]; break;
+                    case 5: regs[n++] = w[1]; break;
+                    case 7: regs[n++] = w[2]; break;
+                    default: terminated = true; break;
+                }
+                int need = 0;
+                for (int i = 0; i < n; i++) {
+                    bool seen = map[regs[i]] >= 0;
+                    for (int j = 0; j < i; j++) {seen = seen or regs[j] == regs[i];}
+                    if (not seen) {need++;}
+                }
+                if (used + need > pool_size) {break;}
+                for (int i = 0; i < n; i++) {
+                    if (map[regs[i]] < 0) {map[regs[i]] = pool[used++];}
+                }
+                switch (w[0]) {
+                    case 22: case 9: case 21: case 20: case 23: case 24: case 5: dirty[w[1]] = true; break;
+                    default: break;
+                }
+                end += 4;
+            }
+            if (end == pc) {return;}
+
+            x86_emitter e;
+            // Пролог: сохранение используемых callee-saved регистров, загрузка гостевых регистров и флага
+            for (int i = 4; i < used; i++) {e.push(pool[i]);}
+            for (int g = 0; g < 16; g++) {
+                if (map[g] >= 0) {e.load(map[g], RDI, g * 4);}
+            }
+            e.load(flag, RSI, 0);
+
+            bool exit_set = false;
+            for (std::size_t a = pc; a < end; a += 4) {
+                const int *w = ram + a;
+                switch (w[0]) {
+                    case 22: e.mov_imm(map[w[1]], w[2]); break;
+                    case 9: e.mov(map[w[1]], map[w[2]]); break;
+                    case 20: e.mov(RAX, map[w[2]]); e.add(RAX, map[w[3]]); e.mov(map[w[1]], RAX); break;
+                    case 21: e.mov(RAX, map[w[2]]); e.add_imm(RAX, w[3]); e.mov(map[w[1]], RAX); break;
+                    case 23: e.mov(RAX, map[w[2]]); e.sub(RAX, map[w[3]]); e.mov(map[w[1]], RAX); break;
+                    case 24: e.mov(RAX, map[w[2]]); e.imul(RAX, map[w[3]]); e.mov(map[w[1]], RAX); break;
+                    case 30:
+                        // flag = (a > b) ? 1 : (a < b) ? -1 : 0, mov imm не трогает флаги процессора
+                        e.cmp(map[w[1]], map[w[2]]);
+                        e.mov_imm(flag, 0);
+                        e.mov_imm(RDX, 1);
+                        e.cmov(x86_emitter::G, flag, RDX);
+                        e.mov_imm(RDX, -1);
+                        e.cmov(x86_emitter::L, flag, RDX);
+                        break;
+                    case 5:
+                        e.mov_rax_imm64(reinterpret_cast<std::uint64_t>(ram + w[2]));
+                        e.load(map[w[1]], RAX, 0);
+                        break;
+                    case 7:
+                        e.mov_rax_imm64(reinterpret_cast<std::uint64_t>(ram + w[1]));
+                        e.store(RAX, 0, map[w[2]]);
+                        break;
+                    case 31: {
+                        e.mov_imm(RAX, static_cast<std::int32_t>(a + 4));
+                        // Флаг сравнивается с точными значениями, как в core::jmp(): после iret или снимка
+                        // в нём может быть любое число, а не только -1, 0 и 1
+                        // 2 и -2 - флаг (флаг + 1 для -2) без знака не больше 1
+                        x86_emitter::cond c = x86_emitter::E;
+                        bool never = false;
+                        switch (w[1]) {
+                            case 0: e.cmp_imm8(flag, 0); break;
+                            case 1: e.cmp_imm8(flag, 1); break;
+                            case -1: e.cmp_imm8(flag, -1); break;
+                            case 2: e.cmp_imm8(flag, 1); c = x86_emitter::BE; break;
+                            case -2: e.mov(RDX, flag); e.add_imm(RDX, 1); e.cmp_imm8(RDX, 1); c = x86_emitter::BE; break;
+                            case 3: e.cmp_imm8(flag, 0); c = x86_emitter::NE; break;
+                            default: never = true; break;
+                        }
+                        if (not never) {
+                            e.mov_imm(RDX, w[2]);
+                            e.cmov(c, RAX, RDX);
+                        }
+                        exit_set = true;
+                        break;
+                    }
+                    case 32: e.mov_imm(RAX, w[1]); exit_set = true; break;
+                    default: break;
+                }
+            }
+            if (not exit_set) {e.mov_imm(RAX, static_cast<std::int32_t>(end));}
+
+            // Эпилог: выгрузка изменённых регистров и флага, адрес следующей инструкции в eax
+            for (int g = 0; g < 16; g++) {
+                if (map[g] >= 0 and dirty[g]) {e.store(RDI, g * 4, map[g]);}
+            }
+            e.store(RSI, 0, flag);
+            for (int i = used - 1; i >= 4; i--) {e.pop(pool[i]);}
+            e.ret();
+
+            // Размещение кода в исполняемой памяти
+            std::size_t size = (e.code.size() + 4095) & ~static_cast<std::size_t>(4095);
+            void *mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (mem == MAP_FAILED) {return;}
+            std::memcpy(mem, e.code.data(), e.code.size());
+            if (mprotect(mem, size, PROT_READ | PROT_EXEC) != 0) {
+                munmap(mem, size);
+                return;
+            }
+            blocks.push_back({pc, end, mem, size});
+            for (std::size_t a = pc; a < end; a++) {covered[a] = 1;}
+            entries[pc].code = reinterpret_cast<jit_function>(mem);
+            entries[pc].length = static_cast<std::uint32_t>((end - pc) / 4);
+        }
+    #else
+        void compile(std::size_t, int *, std::size_t) {}
+    #endif
+    };
+}
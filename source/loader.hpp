@@ -0,0 +1,248 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "word.hpp"
+
+/*
+ Загрузка программ
+
+ Текстовый формат: числа через пробельные символы, загружаются в ОЗУ с адреса 0
+ Каждое число должно помещаться в слово ядра (16, 32 или 64 бита, см. word.hpp)
+
+ Бинарный образ (все числа little-endian):
+   заголовок image_header
+   сегмент кода   - code_words ячеек int32, загружается с адреса 0 (ядро с другой шириной слова копирует ячейки)
+   сегмент данных - data_words ячеек int32, загружается с адреса data_address
+   таблица символов - symtab_count записей: uint64 адрес, uint32 длина имени, имя без нуля в конце
+ Сегменты кода и данных начинаются с границы страницы и дополнены нулями до конца страницы,
+ поэтому их можно отобразить в ОЗУ напрямую через mmap без разбора и копирования
+*/
+
+namespace loader_unit {
+
+    // Размер страницы образа, сегменты выровнены по нему
+    constexpr std::size_t image_page = 4096;
+
+    // Текущая версия формата
+    constexpr std::uint32_t image_version = 1;
+
+    struct image_header {
+        char magic[4];              // "XVPI"
+        std::uint32_t version;
+        std::uint32_t header_size;  // sizeof(image_header), для будущих расширений
+        std::uint32_t flags;        // пока 0
+        std::uint64_t entry;        // Адрес первой инструкции
+        std::uint64_t code_offset;
+        std::uint64_t code_words;
+        std::uint64_t data_offset;  // 0, если сегмента данных нет
+        std::uint64_t data_words;
+        std::uint64_t data_address;
+        std::uint64_t symtab_offset;  // 0, если таблицы символов нет
+        std::uint64_t symtab_count;
+    };
+
+    // Символ образа: имя метки и её адрес
+    struct image_symbol {
+        std::string name;
+        std::uint64_t address;
+    };
+
+    // Ячейка, не помещающаяся в слово ядра
+    inline std::runtime_error word_range_error(const std::string &filename, std::size_t index, long long value, int bits) {
+        return std::runtime_error(filename + ": value " + std::to_string(value) + " at address " + std::to_string(index)
+                                  + " does not fit a " + std::to_string(bits) + "-bit word");
+    }
+
+    // Загрузка программы из текстового файла в вектор слов ядра (int, int16_t или long long, см. word.hpp)
+    // filename - имя файла, содержащего программу (последовательность чисел)
+    // output - вектор, в который будет загружена программа
+    // Число, которое не помещается в слово, бросает исключение
+    template <typename Word>
+    inline void load_text_program(const std::string &filename, std::vector<Word> &output) {
+        long long value; // Временная переменная для хранения считанного числа
+        std::ifstream f(filename); // Открытие файла для чтения
+        while (f >> value) { // Чтение чисел из файла до конца
+            if (not cpu_unit::fits_word<Word>(value)) {
+                throw word_range_error(filename, output.size(), value, cpu_unit::word_bits<Word>());
+            }
+            output.push_back(static_cast<Word>(value)); // Добавление числа в вектор программы
+        }
+    }
+
+    // Программа, загруженная в широкие слова, для ядра со словом Word
+    // Число, которое не помещается в слово, бросает исключение
+    template <typename Word, typename Wide>
+    inline std::vector<Word> narrow_program(const std::vector<Wide> &program, const std::string &filename) {
+        std::vector<Word> result(program.size());
+        for (std::size_t i = 0; i < program.size(); i++) {
+            if (not cpu_unit::fits_word<Word>(program[i])) {
+                throw word_range_error(filename, i, program[i], cpu_unit::word_bits<Word>());
+            }
+            result[i] = static_cast<Word>(program[i]);
+        }
+        return result;
+    }
+
+    // Является ли файл бинарным образом (проверяется только сигнатура)
+    inline bool is_image(const std::string &filename) {
+        char magic[4] = {};
+        std::ifstream f(filename, std::ios::binary);
+        f.read(magic, 4);
+        return f.gcount() == 4 and std::memcmp(magic, "XVPI", 4) == 0;
+    }
+
+    inline std::uint64_t align_page(std::uint64_t bytes) {
+        return (bytes + image_page - 1) / image_page * image_page;
+    }
+
+    // Запись образа
+    // code - сегмент кода (с адреса 0), entry - точка входа
+    // data, data_address - необязательный сегмент данных
+    // symbols - необязательная таблица символов
+    inline void write_image(const std::string &filename, const std::vector<int> &code, std::uint64_t entry,
+                            const std::vector<int> &data = {}, std::uint64_t data_address = 0,
+                            const std::vector<image_symbol> &symbols = {}) {
+        static_assert(sizeof(int) == 4, "image cells are int32");
+        image_header h = {};
+        std::memcpy(h.magic, "XVPI", 4);
+        h.version = image_version;
+        h.header_size = sizeof(image_header);
+        h.entry = entry;
+        h.code_offset = image_page;
+        h.code_words = code.size();
+        std::uint64_t end = h.code_offset + align_page(code.size() * 4);
+        if (not data.empty()) {
+            h.data_offset = end;
+            h.data_words = data.size();
+            h.data_address = data_address;
+            end += align_page(data.size() * 4);
+        }
+        if (not symbols.empty()) {
+            h.symtab_offset = end;
+            h.symtab_count = symbols.size();
+        }
+
+        std::vector<char> file(end, 0);
+        std::memcpy(file.data(), &h, sizeof(h));
+        // Ячейки пишутся побайтно, чтобы формат не зависел от порядка байт машины
+        auto put_words = [&file](std::uint64_t offset, const std::vector<int> &words) {
+            for (std::size_t i = 0; i < words.size(); i++) {
+                std::uint32_t u = static_cast<std::uint32_t>(words[i]);
+                for (int b = 0; b < 4; b++) {file[offset + 4 * i + b] = static_cast<char>(u >> (8 * b));}
+            }
+        };
+        put_words(h.code_offset, code);
+        if (not data.empty()) {put_words(h.data_offset, data);}
+        for (auto &sym : symbols) {
+            char buf[12];
+            for (int b = 0; b < 8; b++) {buf[b] = static_cast<char>(sym.address >> (8 * b));}
+            std::uint32_t len = sym.name.size();
+            for (int b = 0; b < 4; b++) {buf[8 + b] = static_cast<char>(len >> (8 * b));}
+            file.insert(file.end(), buf, buf + 12);
+            file.insert(file.end(), sym.name.begin(), sym.name.end());
+        }
+
+        std::ofstream f(filename, std::ios::binary | std::ios::trunc);
+        if (not f.write(file.data(), file.size())) {
+            throw std::runtime_error("Cannot write image " + filename);
+        }
+    }
+
+    // Открытый бинарный образ: файл отображён в память только для чтения
+    // Сегменты проверены при открытии, ОЗУ отображает их из того же файла через fd()
+    class program_image {
+    private:
+        int file = -1;
+        const char *base = nullptr;
+        std::size_t size = 0;
+        image_header h = {};
+
+    public:
+        explicit program_image(const std::string &filename) {
+            file = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+            if (file < 0) {throw std::runtime_error("Cannot open image " + filename);}
+            struct stat st;
+            if (fstat(file, &st) != 0 or static_cast<std::size_t>(st.st_size) < sizeof(image_header)) {
+                close(file);
+                throw std::runtime_error("Bad image " + filename);
+            }
+            size = st.st_size;
+            void *p = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, file, 0);
+            if (p == MAP_FAILED) {
+                close(file);
+                throw std::runtime_error("Cannot map image " + filename);
+            }
+            base = static_cast<const char *>(p);
+            std::memcpy(&h, base, sizeof(h));
+            if (std::memcmp(h.magic, "XVPI", 4) != 0 or h.version != image_version or h.header_size != sizeof(image_header)
+                or not segment_ok(h.code_offset, h.code_words)
+                or (h.data_offset != 0 and not segment_ok(h.data_offset, h.data_words))) {
+                release();
+                throw std::runtime_error("Bad image " + filename);
+            }
+        }
+
+        program_image(const program_image &) = delete;
+        program_image &operator=(const program_image &) = delete;
+
+        ~program_image() {
+            release();
+        }
+
+        const image_header &header() const {return h;}
+
+        // Дескриптор файла образа, для отображения сегментов в ОЗУ
+        int fd() const {return file;}
+
+        // Ячейка сегмента (для машин, где нельзя отобразить сегмент напрямую)
+        int code_word(std::size_t i) const {return word(h.code_offset, i);}
+        int data_word(std::size_t i) const {return word(h.data_offset, i);}
+
+        // Таблица символов
+        std::vector<image_symbol> symbols() const {
+            std::vector<image_symbol> result;
+            std::uint64_t pos = h.symtab_offset;
+            for (std::uint64_t i = 0; h.symtab_offset != 0 and i < h.symtab_count; i++) {
+                if (pos + 12 > size) {throw std::runtime_error("Bad image symbol table");}
+                image_symbol sym;
+                sym.address = 0;
+                std::uint32_t len = 0;
+                for (int b = 0; b < 8; b++) {sym.address |= static_cast<std::uint64_t>(static_cast<unsigned char>(base[pos + b])) << (8 * b);}
+                for (int b = 0; b < 4; b++) {len |= static_cast<std::uint32_t>(static_cast<unsigned char>(base[pos + 8 + b])) << (8 * b);}
+                pos += 12;
+                if (pos + len > size) {throw std::runtime_error("Bad image symbol table");}
+                sym.name.assign(base + pos, len);
+                pos += len;
+                result.push_back(sym);
+            }
+            return result;
+        }
+
+    private:
+        // Сегмент выровнен и вместе с дополнением до страницы лежит в файле
+        bool segment_ok(std::uint64_t offset, std::uint64_t words) const {
+            return offset % image_page == 0 and offset + align_page(words * 4) <= size;
+        }
+
+        int word(std::uint64_t offset, std::size_t i) const {
+            const unsigned char *p = reinterpret_cast<const unsigned char *>(base + offset + 4 * i);
+            return static_cast<int>(p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<std::uint32_t>(p[3]) << 24));
+        }
+
+        void release() {
+            if (base != nullptr) {munmap(const_cast<char *>(base), size);}
+            if (file >= 0) {close(file);}
+            base = nullptr;
+            file = -1;
+        }
+    };
+}
@@ -0,0 +1,196 @@
+#pragma once
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include "core.hpp"
+
+/*
+ Машина из нескольких ядер с общим ОЗУ
+
+ Ядро 0 (boot) исполняет программу с её точки входа в потоке, вызвавшем run(),
+ инструкция spawn запускает следующее ядро в своём потоке ОС с заданного адреса,
+ join ждёт его остановки. Ядер не больше, чем задано при создании машины, номера не переиспользуются
+ У каждого ядра свой стек: области по stack_size ячеек с конца ОЗУ, ядро boot - самая верхняя
+ Все ядра работают с одним плоским ОЗУ, порядок видимости записей описан у инструкций cas/fadd/fence в core.hpp
+ У каждого ядра свои регистры, порты (терминалы разных ядер пишут в одни потоки, каждый через свой буфер) и кэши движков: код, изменённый другим ядром,
+ кэширующие движки не замечают, самоизменяющийся код между ядрами поддерживает только эталонный движок
+ Core - вид ядра (cpu_unit::core, cpu_unit::lean_core, cpu_unit::core16 или cpu_unit::core64), machine - машина из ядер с проверками
+ Точка входа, аргумент и номер ядра у spawn/join - слова ядра
+*/
+
+namespace machine_unit {
+
+    template <typename Core>
+    class basic_machine {
+    public:
+        using word = typename Core::word;
+
+    private:
+        struct slot {
+            Core cpu;
+            std::thread thread;
+            bool done = false;
+            std::string error;
+            cpu_unit::run_result result;
+        };
+
+        std::size_t max_cores;
+        std::size_t ram_size = 0;
+
+        // Размер стека каждого ядра, 0 - поровну делить ОЗУ после программы (не больше default_stack)
+        std::size_t stack_size = 0;
+        std::size_t core_stack = 0;
+
+        // Ограничения запуска, у каждого ядра свои бюджет и срок
+        cpu_unit::run_limits limits;
+
+        // slots[0] - ядро boot, ядра только добавляются
+        std::vector<std::unique_ptr<slot>> slots;
+        std::mutex lock;
+        std::condition_variable stopped;
+
+        void hook(Core &cpu) {
+            cpu.set_machine_hooks([this](word entry, word arg) {return spawn(entry, arg);},
+                                  [this](word id) {join(id);});
+        }
+
+        void run_slot(slot &s, bool debugmode) {
+            try {
+                s.result = s.cpu.start_process(debugmode, limits);
+            } catch (std::exception &e) {
+                s.error = e.what();
+            }
+            std::lock_guard<std::mutex> guard(lock);
+            s.done = true;
+            stopped.notify_all();
+        }
+
+        // Запуск ядра с адреса entry, в r1 - arg; возвращает номер ядра или -1
+        int spawn(word entry, word arg) {
+            std::lock_guard<std::mutex> guard(lock);
+            if (slots.size() >= max_cores) {return -1;}
+            Core &boot_cpu = slots[0]->cpu;
+            auto s = std::make_unique<slot>();
+            s->cpu.copy_settings(boot_cpu);
+            s->cpu.set_stack(ram_size - (slots.size() + 1) * core_stack, core_stack);
+            hook(s->cpu);
+            s->cpu.init(boot_cpu.shared_memory(), ram_size, boot_cpu.program_length());
+            s->cpu.set_register(14, entry);
+            s->cpu.set_register(1, arg);
+            if (boot_cpu.is_trusted()) {s->cpu.set_trusted(true);}
+            slot &started = *s;
+            slots.push_back(std::move(s));
+            started.thread = std::thread(&basic_machine::run_slot, this, std::ref(started), false);
+            return static_cast<int>(slots.size() - 1);
+        }
+
+        // Ожидание остановки ядра id, неизвестный номер не ждёт
+        void join(word id) {
+            std::unique_lock<std::mutex> guard(lock);
+            if (id < 0 or static_cast<std::size_t>(id) >= slots.size()) {return;}
+            slot &s = *slots[id];
+            stopped.wait(guard, [&s]() {return s.done;});
+        }
+
+        // Стеки ядер делят ОЗУ после программы code_size, у машины из одного ядра стек по умолчанию как у ядра
+        void plan_stacks(std::size_t code_size, std::size_t size) {
+            if (stack_size == 0 and max_cores == 1) {return;}
+            core_stack = stack_size;
+            if (core_stack == 0) {
+                core_stack = size > code_size ? (size - code_size) / max_cores : 0;
+                if (core_stack > default_stack) {core_stack = default_stack;}
+            }
+            if (core_stack * max_cores + code_size > size) {throw std::runtime_error("Stacks do not fit in memory");}
+            boot().set_stack(size - core_stack, core_stack);
+        }
+
+    public:
+        // Размер стека ядра по умолчанию у машины из нескольких ядер
+        static constexpr std::size_t default_stack = 4096;
+
+        // cores - наибольшее число ядер (с boot), при 1 spawn всегда возвращает -1
+        explicit basic_machine(std::size_t cores) : max_cores(cores < 1 ? 1 : cores) {
+            slots.push_back(std::make_unique<slot>());
+            hook(slots[0]->cpu);
+        }
+
+        basic_machine(const basic_machine &) = delete;
+        basic_machine &operator=(const basic_machine &) = delete;
+
+        ~basic_machine() {
+            for (auto &s : slots) {
+                if (s->thread.joinable()) {s->thread.join();}
+            }
+        }
+
+        // Ядро boot: его настройки (движок, слияние, терминал, доверенный режим) получают все ядра
+        Core &boot() {
+            return slots[0]->cpu;
+        }
+
+        // Размер стека каждого ядра (с конца ОЗУ), вызывать до init()
+        void set_stack_size(std::size_t words) {
+            stack_size = words;
+        }
+
+        // Загрузка программы в ОЗУ, у машины из нескольких ядер оно всегда плоское
+        // (машина из одного ядра ничем не отличается от отдельного ядра)
+        void init(const std::vector<word> &program, std::size_t size) {
+            if (max_cores > 1) {boot().set_memory_mode(cpu_unit::MemoryMode::FLAT);}
+            plan_stacks(program.size(), size);
+            boot().init(program, size);
+            ram_size = size;
+        }
+
+        void init(const loader_unit::program_image &image, std::size_t size) {
+            if (max_cores > 1) {boot().set_memory_mode(cpu_unit::MemoryMode::FLAT);}
+            plan_stacks(image.header().code_words, size);
+            boot().init(image, size);
+            ram_size = size;
+        }
+
+        // Восстановление ядра boot из снимка (см. core::restore), снимок хранит одно ядро
+        void restore(const std::string &path) {
+            if (max_cores > 1) {throw std::runtime_error("Snapshots need a single core");}
+            boot().restore(path);
+        }
+
+        // Исполнение: boot в текущем потоке, затем ожидание всех запущенных ядер
+        // Ошибка любого ядра бросается исключением после остановки всех ядер
+        // limits действуют на каждое ядро отдельно, возвращается итог ядра boot
+        cpu_unit::run_result run(bool debugmode, const cpu_unit::run_limits &run_limits = cpu_unit::run_limits()) {
+            limits = run_limits;
+            run_slot(*slots[0], debugmode);
+            // Ядро добавляется до того, как запустившее его ядро остановится,
+            // поэтому после ожидания всех известных ядер новых уже не будет
+            for (std::size_t i = 1;; i++) {
+                slot *s;
+                {
+                    std::lock_guard<std::mutex> guard(lock);
+                    if (i >= slots.size()) {break;}
+                    s = slots[i].get();
+                }
+                s->thread.join();
+            }
+            for (std::size_t i = 0; i < slots.size(); i++) {
+                if (slots[i]->error.empty()) {continue;}
+                if (i == 0) {throw std::runtime_error(slots[i]->error);}
+                throw std::runtime_error("Core " + std::to_string(i) + ": " + slots[i]->error);
+            }
+            return slots[0]->result;
+        }
+
+        // Количество запущенных ядер (с boot)
+        std::size_t cores_started() {
+            std::lock_guard<std::mutex> guard(lock);
+            return slots.size();
+        }
+    };
+
+    using machine = basic_machine<cpu_unit::core>;
+}
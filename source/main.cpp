@@ -1,82 +1,283 @@
+#include <chrono>
+#include <cstdlib>
 #include <cstring>
 #include <fstream>
+#include <memory>
 #include <string>
 #include <vector>
 #include <stdexcept>
-#include "core.hpp"
-
-// Функция для загрузки программы из файла в вектор целых чисел
-// filename - имя файла, содержащего программу (последовательность чисел)
-// output - вектор, в который будет загружена программа
-void load_program(std::string &filename, std::vector<int> &output) {
-  int value; // Временная переменная для хранения считанного числа
-  std::ifstream f(filename); // Открытие файла для чтения
-  while (f >> value) { // Чтение чисел из файла до конца
-    output.push_back(value); // Добавление числа в вектор программы
-  }
-  // Файл автоматически закрывается при выходе из области видимости
-}
+#include <type_traits>
+#include "machine.hpp"
 
 int main(int argc, char **argv) {
   // Проверка количества аргументов командной строки
   // Ожидаемые аргументы:
-  // 1. Имя файла с программой
+  // 1. Имя файла с программой (текст, бинарный образ xvimage или снимок, тогда размер ОЗУ берётся из него)
   // 2. Размер памяти (ОЗУ) для эмулятора
-  // 3. (опционально) Флаг -debug для включения отладочного режима
-  if (not (argc == 3 or argc == 4)) {
+  // 3. (опционально) Флаги:
+  //    -debug      - отладочный режим
+  //    -predecode  - исполнение из кэша предекодированных инструкций
+  //    -threaded   - шитый код поверх кэша предекодированных инструкций
+  //    -jit        - компиляция горячих базовых блоков в машинный код (x86-64)
+  //    -nofusion   - не сливать частые цепочки инструкций в сверхинструкции
+  //    -trusted    - проверить программу при загрузке и исполнять проверенный код без проверок
+  //    -lean       - с -trusted: исполнять программу без setl ядром lean_core (setl, построенный во время работы, - исключение)
+  //    -paged      - страничное ОЗУ (страницы выделяются при первой записи), само включается для огромного ОЗУ
+  //    -cores N    - машина до N ядер с общим ОЗУ (ядра запускает инструкция spawn)
+  //    -stack N    - стек каждого ядра - N ячеек с конца ОЗУ (по умолчанию всё ОЗУ после программы)
+  //    -limit N    - остановить каждое ядро после N инструкций
+  //    -timeout S  - остановить каждое ядро через S секунд
+  //    -profile P  - профилировать ядро boot: отчёт в P.profile, свёрнутые стеки для flamegraph в P.folded
+  //    -trace F    - записать трассу исполнения ядра boot в файл F
+  //    -replay F   - воспроизвести трассу F: ввод портов 0 и 1 берётся из неё, исполнение сверяется с ней
+  //    -snapshot F - записать снимок ядра в файл F после остановки
+  //    -checkpoint N - записывать снимок -snapshot каждые N инструкций
+  //    -word W     - ширина слова ядра: 16, 32 (по умолчанию) или 64 бита (см. word.hpp)
+  if (argc < 3) {
     std::cerr << "Invalid arguments\n";
-    std::cout << "Usage: " << argv[0] << " filename ram_size -debug(or not)\n";
+    std::cout << "Usage: " << argv[0] << " filename ram_size [-debug] [-predecode | -threaded | -jit] [-nofusion] [-trusted [-lean]] [-paged] [-cores N] [-stack N] [-limit N] [-timeout S] [-profile P] [-trace F | -replay F] [-snapshot F [-checkpoint N]] [-word 16|32|64]\n";
     return 1; // Возврат кода ошибки: неверные аргументы
   }
 
-  std::vector<int> program; // Вектор для хранения загруженной программы
+  std::vector<long long> program; // Вектор для хранения загруженной программы, сужается до слова ядра при инициализации
+  std::unique_ptr<loader_unit::program_image> image; // Бинарный образ, если файл в этом формате
+  bool is_snapshot = false; // Файл - снимок ядра
   std::size_t size; // Переменная для размера памяти
   std::string filename = argv[1]; // Получение имени файла программы из аргументов
 
   // Попытка загрузить программу и преобразовать аргумент размера памяти
   try {
-    load_program(filename, program); // Загрузка программы из файла
-    size = std::stoi(argv[2]); // Преобразование строки в число (размер памяти)
+    if (utility_units::is_snapshot(filename)) {
+      is_snapshot = true; // Снимок читается при инициализации
+    } else if (loader_unit::is_image(filename)) {
+      image = std::make_unique<loader_unit::program_image>(filename); // Отображение образа в память
+    } else {
+      loader_unit::load_text_program(filename, program); // Загрузка программы из файла
+    }
+    size = std::stoul(argv[2]); // Преобразование строки в число (размер памяти)
   } catch (std::runtime_error &e) {
     // Обработка ошибок при загрузке файла или преобразовании числа
     std::cerr << e.what();
     return 2; // Возврат кода ошибки: ошибка загрузки программы
   }
 
-  cpu_unit::core cpu0; // Создание экземпляра процессорного ядра (эмулятора)
+  bool is_debug = false; // Флаг отладочного режима по умолчанию выключен
+  bool is_trusted = false; // Доверенный режим включается после загрузки программы
+  bool is_lean = false; // Ядро без проверок amin и отладочных режимов, только по явной просьбе
+  bool is_paged = false; // Страничное ОЗУ при любом размере
+  bool fusion = true; // Сверхинструкции
+  cpu_unit::Engine engine = cpu_unit::Engine::SWITCH; // Движок исполнения
+  unsigned long cores = 1; // Наибольшее число ядер машины
+  unsigned long stack = 0; // Размер стека ядра, 0 - по умолчанию
+  cpu_unit::run_limits limits; // Бюджет инструкций и срок, 0 - без ограничения
+  std::string profile; // Префикс файлов профиля, пустой - без профилирования
+  std::string trace; // Файл трассы для записи
+  std::string replay; // Файл трассы для воспроизведения
+  std::string snapshot; // Файл снимка
+  long long checkpoint = 0; // Период снимков в инструкциях, 0 - только после остановки
+  int word_width = 32; // Ширина слова ядра в битах
 
-  try {
-    // Инициализация эмулятора:
-    // - Загрузка программы в память
-    // - Выделение ОЗУ указанного размера
-    // - Инициализация регистров
-    // - Подключение виртуальных устройств (терминал, файловая система)
-    cpu0.init(program, size);
-
-    bool is_debug = false; // Флаг отладочного режима по умолчанию выключен
-
-    // Проверка наличия третьего аргумента (флага отладки)
-    if (argc == 4) {
-      // Сравнение аргумента со строкой "-debug"
-      if (std::strcmp(argv[3], "-debug") == 0) {
-        is_debug = true; // Включение отладочного режима
+  // Разбор необязательных флагов после размера памяти
+  for (int i = 3; i < argc; i++) {
+    if (std::strcmp(argv[i], "-debug") == 0) {
+      is_debug = true; // Включение отладочного режима
+    } else if (std::strcmp(argv[i], "-predecode") == 0) {
+      engine = cpu_unit::Engine::PREDECODED; // Исполнение из кэша декодированных инструкций
+    } else if (std::strcmp(argv[i], "-threaded") == 0) {
+      engine = cpu_unit::Engine::THREADED; // Шитый код
+    } else if (std::strcmp(argv[i], "-jit") == 0) {
+      engine = cpu_unit::Engine::JIT; // Компиляция горячих блоков
+    } else if (std::strcmp(argv[i], "-nofusion") == 0) {
+      fusion = false; // Без сверхинструкций
+    } else if (std::strcmp(argv[i], "-trusted") == 0) {
+      is_trusted = true; // Проверка при загрузке, дальше без проверок
+    } else if (std::strcmp(argv[i], "-lean") == 0) {
+      is_lean = true;
+    } else if (std::strcmp(argv[i], "-paged") == 0) {
+      is_paged = true;
+    } else if (std::strcmp(argv[i], "-cores") == 0 and i + 1 < argc) {
+      cores = std::strtoul(argv[++i], nullptr, 10); // Ядра запускаются инструкцией spawn
+      if (cores < 1) {
+        std::cerr << "Bad core count\n";
+        return 1;
+      }
+    } else if (std::strcmp(argv[i], "-stack") == 0 and i + 1 < argc) {
+      stack = std::strtoul(argv[++i], nullptr, 10);
+    } else if (std::strcmp(argv[i], "-limit") == 0 and i + 1 < argc) {
+      limits.instructions = std::strtoll(argv[++i], nullptr, 10);
+    } else if (std::strcmp(argv[i], "-timeout") == 0 and i + 1 < argc) {
+      limits.seconds = std::strtod(argv[++i], nullptr);
+    } else if (std::strcmp(argv[i], "-profile") == 0 and i + 1 < argc) {
+      profile = argv[++i];
+    } else if (std::strcmp(argv[i], "-trace") == 0 and i + 1 < argc) {
+      trace = argv[++i];
+    } else if (std::strcmp(argv[i], "-replay") == 0 and i + 1 < argc) {
+      replay = argv[++i];
+    } else if (std::strcmp(argv[i], "-snapshot") == 0 and i + 1 < argc) {
+      snapshot = argv[++i];
+    } else if (std::strcmp(argv[i], "-checkpoint") == 0 and i + 1 < argc) {
+      checkpoint = std::strtoll(argv[++i], nullptr, 10);
+    } else if (std::strcmp(argv[i], "-word") == 0 and i + 1 < argc) {
+      word_width = std::atoi(argv[++i]);
+      if (word_width != 16 and word_width != 32 and word_width != 64) {
+        std::cerr << "Bad word width\n";
+        return 1;
       }
+    } else {
+      std::cerr << "Unknown flag: " << argv[i] << "\n";
+      return 1;
     }
+  }
 
-    // Запуск процесса выполнения программы в эмуляторе
-    // В отладочном режиме будет выводиться состояние регистров после каждой инструкции
-    cpu0.start_process(is_debug);
-
-  } catch (std::runtime_error &e) {
-    // Обработка ошибок, которые могут возникнуть во время инициализации или выполнения:
-    // - Недостаточный размер памяти (<4)
-    // - Программа больше выделенной памяти
-    // - Ошибки доступа к памяти во время выполнения
-    // - Неверные инструкции
-    std::cerr << e.what();
-    return 3; // Возврат кода ошибки: ошибка выполнения программы
+  if (is_lean and not is_trusted) {
+    std::cerr << "-lean needs -trusted\n";
+    return 1;
+  }
+  if (is_lean and (is_debug or is_snapshot or not profile.empty() or not trace.empty() or not replay.empty() or word_width != 32)) {
+    std::cerr << "-lean excludes -debug, -profile, -trace, -replay, snapshots and -word 16|64\n";
+    return 1;
   }
+  if (not trace.empty() and not replay.empty()) {
+    std::cerr << "-trace and -replay are exclusive\n";
+    return 1;
+  }
+  if (checkpoint > 0 and snapshot.empty()) {
+    std::cerr << "-checkpoint needs -snapshot\n";
+    return 1;
+  }
+  if (not snapshot.empty() and cores > 1) {
+    std::cerr << "Snapshots need a single core\n";
+    return 1;
+  }
+
+  // Машина с общим ОЗУ, ядро 0 исполняет программу с точки входа
+  // Машина из одного ядра работает ровно как отдельное ядро
+  // С -lean доверенная программа без setl исполняется ядром lean_core, где проверок amin и отладочных режимов нет совсем
+  // Слово 16 и 64 бита - ядра core16 и core64 (только с проверками)
+  auto execute = [&](auto &machine) -> int {
+    using word = typename std::remove_reference_t<decltype(machine)>::word;
+    machine.set_stack_size(stack);
+    auto &cpu0 = machine.boot();
+    cpu0.set_engine(engine);
+    cpu0.set_fusion(fusion);
+    if (is_paged) {
+      cpu0.set_memory_mode(cpu_unit::MemoryMode::PAGED);
+    }
+    cpu0.set_profiling(not profile.empty());
+
+    cpu_unit::run_result result;
+    try {
+      // Инициализация эмулятора:
+      // - Загрузка программы в память
+      // - Выделение ОЗУ указанного размера
+      // - Инициализация регистров
+      // - Подключение виртуальных устройств (терминал, файловая система)
+      if (not trace.empty()) {
+        cpu0.set_trace(trace);
+      } else if (not replay.empty()) {
+        cpu0.set_replay(replay);
+      }
+      if (is_snapshot) {
+        machine.restore(filename); // Состояние ядра целиком из снимка
+      } else if (image) {
+        machine.init(*image, size); // Сегменты образа отображаются в ОЗУ без разбора
+      } else {
+        machine.init(loader_unit::narrow_program<word>(program, filename), size);
+      }
+      if (is_trusted) {
+        cpu0.set_trusted(true);
+      }
 
-  // Программа успешно завершила выполнение
-  return 0;
+      // Воспроизведение идёт ровно столько инструкций, сколько записано в трассе
+      if (not replay.empty()) {
+        limits.instructions = cpu0.replay_instructions();
+      }
+
+      // Запуск процесса выполнения программы в эмуляторе
+      // В отладочном режиме будет выводиться состояние регистров после каждой инструкции
+      // Запущенные инструкцией spawn ядра дожидаются до выхода
+      if (checkpoint > 0) {
+        // Исполнение отрезками по checkpoint инструкций со снимком после каждого,
+        // ограничения -limit и -timeout действуют на весь запуск
+        auto start = std::chrono::steady_clock::now();
+        long long done = 0;
+        while (true) {
+          cpu_unit::run_limits part;
+          part.instructions = checkpoint;
+          if (limits.instructions > 0 and limits.instructions - done < checkpoint) {part.instructions = limits.instructions - done;}
+          if (limits.seconds > 0) {
+            part.seconds = limits.seconds - std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            if (part.seconds <= 0) {part.seconds = 1e-9;}
+          }
+          result = machine.run(is_debug, part);
+          done += result.instructions;
+          result.instructions = done;
+          bool user_limit = limits.instructions > 0 and done >= limits.instructions;
+          if (result.reason != cpu_unit::ExitReason::BUDGET or user_limit) {break;}
+          cpu0.save_snapshot(snapshot);
+        }
+      } else {
+        result = machine.run(is_debug, limits);
+      }
+      if (not snapshot.empty()) {
+        cpu0.save_snapshot(snapshot);
+      }
+
+      if (not replay.empty()) {
+        cpu0.check_replay();
+        std::cerr << "Replay matches the trace: " << result.instructions << " instructions\n";
+        // Остановка по бюджету здесь означает конец трассы, а не исчерпанное ограничение
+        if (result.reason == cpu_unit::ExitReason::BUDGET) {result.reason = cpu_unit::ExitReason::HALT;}
+      }
+
+      // Профиль пишется и после остановки по ограничению: зациклившуюся программу тоже нужно разобрать
+      if (not profile.empty()) {
+        std::ofstream report(profile + ".profile");
+        std::ofstream folded(profile + ".folded");
+        if (not report or not folded) {throw std::runtime_error("Cannot write profile " + profile);}
+        cpu0.write_profile(report, folded, 20);
+      }
+
+    } catch (std::runtime_error &e) {
+      // Обработка ошибок, которые могут возникнуть во время инициализации или выполнения:
+      // - Недостаточный размер памяти (<4)
+      // - Программа больше выделенной памяти
+      // - Ошибки доступа к памяти во время выполнения
+      // - Неверные инструкции
+      std::cerr << e.what();
+      return 3; // Возврат кода ошибки: ошибка выполнения программы
+    }
+
+    // Ограничение исчерпано: программа не завершилась сама
+    if (result.reason == cpu_unit::ExitReason::BUDGET or result.reason == cpu_unit::ExitReason::DEADLINE) {
+      std::cerr << "Stopped: " << cpu_unit::exit_reason_name(result.reason) << " after "
+                << result.instructions << " instructions at address " << result.registers[14] << "\n";
+      return 4;
+    }
+
+    // Программа успешно завершила выполнение
+    return 0;
+  };
+
+  if (word_width == 16) {
+    machine_unit::basic_machine<cpu_unit::core16> machine(cores);
+    return execute(machine);
+  }
+  if (word_width == 64) {
+    machine_unit::basic_machine<cpu_unit::core64> machine(cores);
+    return execute(machine);
+  }
+  bool lean = is_lean;
+  if (lean and image) {
+    lean = not cpu_unit::program_uses_bounds([&image](std::size_t i) {return image->code_word(i);}, image->header().code_words)
+           and not cpu_unit::program_uses_bounds([&image](std::size_t i) {return image->data_word(i);}, image->header().data_words);
+  } else if (lean) {
+    lean = not cpu_unit::program_uses_bounds([&program](std::size_t i) {return static_cast<int>(program[i]);}, program.size());
+  }
+  if (lean) {
+    machine_unit::basic_machine<cpu_unit::lean_core> machine(cores);
+    return execute(machine);
+  }
+  machine_unit::machine machine(cores);
+  return execute(machine);
 }
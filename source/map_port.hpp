@@ -0,0 +1,190 @@
+#pragma once
+
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "memory.hpp"
+#include "utility_units.hpp"
+
+/*
+ Порт отображения файлов в ОЗУ (порт 3)
+
+ Файл отображается на диапазон ячеек, после чего lodi/lodr/stri/strr работают прямо со страницами файла, без копий
+ Ячейка - 4 байта файла (int32 в порядке байт машины), как у асинхронного порта
+
+ Протокол: prts передаёт символы имени файла, затем adr count offset (для отображения)
+ или только adr (для остальных команд), команда забирает всё переданное
+ - prcs 1 - отобразить только для чтения: записи в ячейки не попадают в файл
+   (отображаются только страницы, где есть данные файла, остальная часть диапазона не меняется)
+ - prcs 2 - отобразить для чтения и записи: файл создаётся и при необходимости удлиняется до offset + count ячеек
+ - prcs 3 - записать изменения отображения с адреса adr в файл
+ - prcs 0 - снять отображение с адреса adr: изменения записываются в файл, ячейки диапазона снова нулевые
+ - prtg - сколько ячеек файла отображено последней командой отображения
+ - prcg - 0 или ошибка последней команды: -1 - файл не открылся, -2 - неверный запрос (adr и offset должны быть
+   кратны memory::page_words, диапазон - в ОЗУ, за областью программы и не пересекаться с другими отображениями,
+   adr у prcs 0 и 3 - начало отображения), -3 - неверная команда, -4 - отобразить не удалось
+
+ Отображаются целые страницы: хвост последней страницы за count тоже берётся из файла
+ При остановке процессора изменения всех отображений записываются в файлы, при удалении порта отображения снимаются
+*/
+
+namespace utility_units {
+
+    class mapped_file : public virtual_port {
+    private:
+        struct region {
+            std::size_t adr;
+            std::size_t words;
+            // Отображённая часть диапазона (у отображения только для чтения может быть меньше words)
+            std::size_t mapped;
+        };
+
+        std::shared_ptr<cpu_unit::memory> ram;
+        std::size_t ram_size;
+        std::size_t code_limit;
+
+        std::vector<int> values;
+        std::vector<region> regions;
+        int mapped_cells = 0;
+
+        static std::size_t round_to_pages(std::size_t words) {
+            const std::size_t page = cpu_unit::memory::page_words;
+            return (words + page - 1) / page * page;
+        }
+
+        region *find(std::size_t adr) {
+            for (auto &r : regions) {
+                if (r.adr == adr) {return &r;}
+            }
+            return nullptr;
+        }
+
+        void map(bool writable) {
+            if (values.size() < 3) {
+                return_state = -2;
+                return;
+            }
+            long long adr = values[values.size() - 3];
+            long long count = values[values.size() - 2];
+            long long offset = values[values.size() - 1];
+            std::string filename;
+            for (std::size_t i = 0; i + 3 < values.size(); i++) {filename += char(values[i]);}
+            const long long page = cpu_unit::memory::page_words;
+            if (adr < 0 or count <= 0 or offset < 0 or adr % page != 0 or offset % page != 0
+                or static_cast<std::size_t>(adr) < code_limit or static_cast<std::size_t>(adr + count) > ram_size) {
+                return_state = -2;
+                return;
+            }
+            std::size_t end = static_cast<std::size_t>(adr) + round_to_pages(count);
+            for (auto &r : regions) {
+                if (static_cast<std::size_t>(adr) < r.adr + round_to_pages(r.words) and r.adr < end) {
+                    return_state = -2;
+                    return;
+                }
+            }
+            int fd = open(filename.c_str(), (writable ? O_RDWR | O_CREAT : O_RDONLY) | O_CLOEXEC, 0644);
+            if (fd < 0) {
+                return_state = -1;
+                return;
+            }
+            struct stat info;
+            std::uint64_t from = static_cast<std::uint64_t>(offset) * sizeof(int);
+            std::uint64_t need = from + static_cast<std::uint64_t>(count) * sizeof(int);
+            std::size_t mapped = static_cast<std::size_t>(count);
+            bool ok = fstat(fd, &info) == 0;
+            if (ok and writable and static_cast<std::uint64_t>(info.st_size) < need) {
+                ok = ftruncate(fd, static_cast<off_t>(need)) == 0;
+            } else if (ok and not writable) {
+                // Страницы целиком за концом файла не отображаются
+                std::uint64_t size = static_cast<std::uint64_t>(info.st_size);
+                std::size_t available = size > from ? static_cast<std::size_t>((size - from + sizeof(int) - 1) / sizeof(int)) : 0;
+                if (available < mapped) {mapped = available;}
+            }
+            ok = ok and ram->map_region(static_cast<std::size_t>(adr), mapped, fd, from, writable);
+            // Отображение держит файл и после закрытия дескриптора
+            close(fd);
+            if (not ok) {
+                return_state = -4;
+                return;
+            }
+            regions.push_back({static_cast<std::size_t>(adr), static_cast<std::size_t>(count), mapped});
+            mapped_cells = static_cast<int>(mapped);
+            return_state = 0;
+        }
+
+        void unmap(region &r) {
+            if (r.mapped != 0) {ram->unmap_region(r.adr, r.mapped);}
+        }
+
+    public:
+        // ram - ОЗУ процессора размером size, code_size - область программы, на которую отображать нельзя
+        mapped_file(std::shared_ptr<cpu_unit::memory> memory, std::size_t size, std::size_t code_size)
+            : ram(std::move(memory)), ram_size(size), code_limit(code_size) {}
+
+        mapped_file(const mapped_file &) = delete;
+        mapped_file &operator=(const mapped_file &) = delete;
+
+        void send_value(int value) override {
+            values.push_back(value);
+        }
+
+        void send_signal(int value) override {
+            if (value == 1 or value == 2) {
+                map(value == 2);
+            } else if (value == 0 or value == 3) {
+                region *r = values.empty() or values.back() < 0 ? nullptr : find(static_cast<std::size_t>(values.back()));
+                if (r == nullptr) {
+                    return_state = -2;
+                } else if (value == 3) {
+                    if (r->mapped != 0) {ram->sync_region(r->adr, r->mapped);}
+                    return_state = 0;
+                } else {
+                    unmap(*r);
+                    regions.erase(regions.begin() + (r - regions.data()));
+                    return_state = 0;
+                }
+            } else {
+                return_state = -3;
+            }
+            values.clear();
+        }
+
+        void ret_value(int &answer) override {
+            answer = mapped_cells;
+        }
+
+        void ret_signal(int &answer) override {
+            answer = return_state;
+        }
+
+        void flush() override {
+            for (auto &r : regions) {
+                if (r.mapped != 0) {ram->sync_region(r.adr, r.mapped);}
+            }
+        }
+
+        // Отображения в снимок не переносятся: их ячейки попали бы в него копией без связи с файлом
+        void save_state(state_writer &out) override {
+            if (not regions.empty()) {throw std::runtime_error("Cannot snapshot port 3 with mapped files");}
+            out.put(return_state);
+            out.put(mapped_cells);
+            out.put(static_cast<long long>(values.size()));
+            for (int v : values) {out.put(v);}
+        }
+
+        void load_state(state_reader &in) override {
+            return_state = static_cast<int>(in.get());
+            mapped_cells = static_cast<int>(in.get());
+            values.resize(static_cast<std::size_t>(in.get(0, 1 << 20)));
+            for (int &v : values) {v = static_cast<int>(in.get());}
+        }
+
+        ~mapped_file() override {
+            for (auto &r : regions) {unmap(r);}
+        }
+    };
+}
@@ -0,0 +1,569 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+#include <sys/mman.h>
+#include "word.hpp"
+
+/*
+ ОЗУ эмулятора
+
+ Два представления за одним интерфейсом:
+ - плоское: один массив (анонимное отображение, ядро ОС выделяет нулевые страницы при первом обращении),
+   нужно JIT компилятору, который обращается к ячейкам напрямую
+ - страничное: таблица страниц по page_words ячеек, страница выделяется и обнуляется при первой записи,
+   чтение невыделенной страницы даёт нули и ничего не выделяет
+   Последние страницы для чтения и для записи запоминаются в маленьком программном TLB,
+   поэтому обращения подряд в одну страницу стоят одного сравнения
+ Страничное представление позволяет дать программе огромное ОЗУ и платить только за тронутые страницы
+ Копия ОЗУ (clone) всегда страничная: страницы страничного ОЗУ она делит с оригиналом до первой записи
+ в них с любой стороны (копирование при записи). Плоское ОЗУ перед первой копией переводится в страничное
+ (make_paged), и дальше оригинал и все копии делят страницы; плоское ОЗУ, которое перевести нельзя
+ (общее для нескольких ядер или с отображёнными файлами), копирует в копию свои ненулевые страницы
+ У обоих представлений диапазон страниц можно заменить отображённым файлом (map_region), тогда
+ обычные чтения и записи ячеек идут прямо в страницы файла без копий
+
+ Плоское ОЗУ может быть общим для нескольких ядер (machine_unit::machine): обычные чтения и записи ячеек
+ атомарны, но не упорядочены между ядрами (relaxed), упорядочивают их compare_exchange, fetch_add и fence (seq_cst)
+ Страничное ОЗУ общим быть не может: таблица страниц и TLB не защищены от одновременного доступа
+
+ Ячейка - слово ядра (basic_memory<Cell>, см. word.hpp), memory - ОЗУ из ячеек int32
+ Узкие ячейки вдвое уменьшают и плоское ОЗУ, и страницы, а страница в page_words ячеек остаётся единицей отображения
+*/
+
+// Редкие пути (промахи TLB) не встраиваются, чтобы не раздувать горячие циклы движков
+#if defined(__GNUC__)
+#define XVPROC_NOINLINE __attribute__((noinline))
+#else
+#define XVPROC_NOINLINE
+#endif
+
+namespace cpu_unit {
+
+    // Класс памяти, Cell - слово ядра (см. word.hpp)
+    template <typename Cell>
+    class basic_memory {
+    public:
+        // Размер страницы в ячейках, по страницам в ОЗУ отображаются файлы и выделяется страничная память
+        static constexpr std::size_t page_words = 1024;
+        static constexpr std::size_t page_shift = 10;
+
+        // Размер ОЗУ (в ячейках), начиная с которого память по умолчанию страничная
+        static constexpr std::size_t flat_limit = std::size_t(1) << 26;
+
+    private:
+        // Максимальный адрес
+        std::size_t size_ram = 0;
+
+        // Плоское представление: массив ячеек и размер отображения в байтах (кратен странице)
+        Cell *m = nullptr;
+        std::size_t mapped_bytes = 0;
+
+        // Плоское ОЗУ нельзя перевести в страничное: его делят ядра машины (pin) или в него отображены файлы
+        bool pinned = false;
+        bool flat_files = false;
+
+        // Страница страничного представления, её делят копии ОЗУ до первой записи
+        struct page_block {
+            std::atomic<int> owners{1};
+            Cell cells[page_words] = {};
+        };
+
+        // Владеющая ссылка на страницу, копия ссылки делит страницу
+        // Копии ОЗУ могут работать в разных потоках, поэтому счётчик владельцев атомарный
+        class page_ref {
+        private:
+            page_block *block = nullptr;
+
+        public:
+            page_ref() = default;
+
+            page_ref(const page_ref &other) : block(other.block) {
+                if (block != nullptr) {block->owners.fetch_add(1, std::memory_order_relaxed);}
+            }
+
+            page_ref &operator=(page_ref other) {
+                std::swap(block, other.block);
+                return *this;
+            }
+
+            ~page_ref() {
+                reset();
+            }
+
+            void reset() {
+                if (block != nullptr and block->owners.fetch_sub(1, std::memory_order_acq_rel) == 1) {delete block;}
+                block = nullptr;
+            }
+
+            // Новая нулевая страница
+            void allocate() {
+                reset();
+                block = new page_block();
+            }
+
+            // Страница больше ни с кем не делится, в неё можно писать
+            bool exclusive() const {
+                return block->owners.load(std::memory_order_acquire) == 1;
+            }
+
+            // Своя копия общей страницы
+            void unshare() {
+                page_block *copy = new page_block();
+                std::copy(block->cells, block->cells + page_words, copy->cells);
+                reset();
+                block = copy;
+            }
+
+            explicit operator bool() const {
+                return block != nullptr;
+            }
+
+            Cell *get() const {
+                return block != nullptr ? block->cells : nullptr;
+            }
+        };
+
+        // Страничное представление: таблица страниц, пустая ссылка - страница ещё не выделена
+        bool paged = false;
+        std::vector<page_ref> pages;
+        std::size_t resident = 0;
+
+        // Страницы из внешних буферов (отображённых файлов) поверх таблицы страниц, пусто - таких нет
+        struct external_region {std::size_t adr; void *base; std::size_t bytes;};
+        std::vector<Cell *> external;
+        std::vector<external_region> regions;
+
+        // Программный TLB: прямое отображение номера страницы на её ячейки
+        static constexpr std::size_t tlb_size = 16;
+        static constexpr std::size_t no_page = SIZE_MAX;
+        struct read_entry {std::size_t page = no_page; const Cell *base = nullptr;};
+        struct write_entry {std::size_t page = no_page; Cell *base = nullptr;};
+        read_entry read_tlb[tlb_size];
+        write_entry write_tlb[tlb_size];
+
+        // Ячейка для атомарной операции, у страничной памяти страница выделяется
+        Cell *cell(std::size_t adr) {
+            if (m != nullptr) {return m + adr;}
+            std::size_t page = adr >> page_shift;
+            const write_entry &e = write_tlb[page & (tlb_size - 1)];
+            Cell *base = e.page == page ? e.base : write_miss(page);
+            return base + (adr & (page_words - 1));
+        }
+
+        // Неупорядоченные (relaxed) чтение и запись ячейки плоского ОЗУ, которое могут менять другие ядра
+        // На x86-64 и AArch64 это обычные mov/ldr/str
+        static Cell load_relaxed(const Cell *p) {
+        #if defined(__GNUC__)
+            return __atomic_load_n(p, __ATOMIC_RELAXED);
+        #else
+            return *p;
+        #endif
+        }
+
+        static void store_relaxed(Cell *p, Cell value) {
+        #if defined(__GNUC__)
+            __atomic_store_n(p, value, __ATOMIC_RELAXED);
+        #else
+            *p = value;
+        #endif
+        }
+
+    #if !defined(__GNUC__)
+        // Без встроенных атомарных операций компилятора атомарные инструкции сериализуются
+        static std::mutex &atomic_lock() {
+            static std::mutex lock;
+            return lock;
+        }
+    #endif
+
+        // Общая нулевая страница для чтения невыделенных страниц
+        static const Cell *zero_page() {
+            static const Cell zeros[page_words] = {};
+            return zeros;
+        }
+
+        // Выделение size_ram нулевых ячеек, физическая память берётся ядром ОС при первом обращении
+        void allocate() {
+            release();
+            if (paged) {
+                pages.resize((size_ram + page_words - 1) / page_words);
+                return;
+            }
+            mapped_bytes = region_bytes(size_ram);
+            void *p = mmap(nullptr, mapped_bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+            if (p == MAP_FAILED) {
+                mapped_bytes = 0;
+                throw std::runtime_error("Cannot allocate memory");
+            }
+            m = static_cast<Cell *>(p);
+        }
+
+        void flush_tlb() {
+            for (std::size_t i = 0; i < tlb_size; i++) {
+                read_tlb[i] = read_entry();
+                write_tlb[i] = write_entry();
+            }
+        }
+
+        void release() {
+            if (m != nullptr) {munmap(m, mapped_bytes);}
+            m = nullptr;
+            mapped_bytes = 0;
+            flat_files = false;
+            for (auto &r : regions) {munmap(r.base, r.bytes);}
+            regions.clear();
+            external.clear();
+            pages.clear();
+            resident = 0;
+            flush_tlb();
+        }
+
+        // Размер отображения words ячеек в байтах, целыми страницами
+        static std::size_t region_bytes(std::size_t words) {
+            const std::size_t page_bytes = page_words * sizeof(Cell);
+            return (words * sizeof(Cell) + page_bytes - 1) / page_bytes * page_bytes;
+        }
+
+        // Внешняя страница поверх страничного представления, nullptr - нет
+        Cell *external_page(std::size_t page) const {
+            return external.empty() ? nullptr : external[page];
+        }
+
+        // Промах TLB: страница для чтения, невыделенная читается как нулевая
+        XVPROC_NOINLINE const Cell *read_miss(std::size_t page) {
+            read_entry &e = read_tlb[page & (tlb_size - 1)];
+            e.page = page;
+            Cell *outer = external_page(page);
+            e.base = outer != nullptr ? outer : pages[page] ? pages[page].get() : zero_page();
+            return e.base;
+        }
+
+        // Промах TLB: страница для записи, выделяется и обнуляется при первом обращении,
+        // общая с копией ОЗУ страница сначала копируется
+        XVPROC_NOINLINE Cell *write_miss(std::size_t page) {
+            write_entry &e = write_tlb[page & (tlb_size - 1)];
+            if (Cell *outer = external_page(page)) {
+                e.page = page;
+                e.base = outer;
+                return outer;
+            }
+            if (not pages[page]) {
+                pages[page].allocate();
+                resident++;
+                // Запись TLB для чтения могла указывать на нулевую страницу
+                read_tlb[page & (tlb_size - 1)].page = no_page;
+            } else if (not pages[page].exclusive()) {
+                pages[page].unshare();
+                read_tlb[page & (tlb_size - 1)].page = no_page;
+            }
+            e.page = page;
+            e.base = pages[page].get();
+            return e.base;
+        }
+
+    public:
+        basic_memory() = default;
+        basic_memory(const basic_memory &) = delete;
+        basic_memory &operator=(const basic_memory &) = delete;
+
+        // инициализатор, принимает размер памяти и программу
+        // paged_mode - страничное представление вместо плоского
+        void init(std::size_t size, const std::vector<Cell> &program, bool paged_mode = false) {
+            init(size, paged_mode);
+            for (std::size_t i = 0; i < program.size(); i++) {
+                put(i, program[i]);
+            }
+        }
+
+        // инициализатор пустой (нулевой) памяти, содержимое потом отображается через map_file()
+        void init(std::size_t size, bool paged_mode = false) {
+            size_ram = size;
+            paged = paged_mode;
+            allocate();
+        }
+
+        // Отображение words ячеек Cell из файла fd со смещения offset в ОЗУ с адреса adr копированием при записи:
+        // файл не меняется, а страницы копируются только при первой записи в них
+        // Возвращает false, если отобразить нельзя (страничная память, адрес или смещение не выровнены по странице,
+        // машина не little-endian), тогда ячейки нужно скопировать вызывающему
+        bool map_file(std::size_t adr, int fd, std::uint64_t offset, std::size_t words) {
+            if (paged) {return false;}
+            return map_region(adr, words, fd, offset, false);
+        }
+
+        // Отображение файла fd со смещения offset (в байтах) на ячейки [adr, adr + words) у обоих представлений
+        // shared - записи в ячейки попадают в файл, иначе файл только читается, а записанные страницы копируются
+        // Отображаются целые страницы (adr и offset выровнены по странице), их прежнее содержимое пропадает
+        // Страницы за концом файла отображать нельзя (обращение к ним - SIGBUS), это проверяет вызывающий
+        // Возвращает false, если отобразить нельзя, как у map_file
+        bool map_region(std::size_t adr, std::size_t words, int fd, std::uint64_t offset, bool shared) {
+        #if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+            const std::size_t page_bytes = page_words * sizeof(Cell);
+            if (words == 0) {return true;}
+            if (adr % page_words != 0 or offset % page_bytes != 0 or adr + words > size_ram) {return false;}
+            std::size_t bytes = region_bytes(words);
+            int flags = shared ? MAP_SHARED : MAP_PRIVATE;
+            if (not paged) {
+                if (mmap(m + adr, bytes, PROT_READ | PROT_WRITE, flags | MAP_FIXED, fd, offset) == MAP_FAILED) {return false;}
+                flat_files = true;
+                return true;
+            }
+            void *p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, flags, fd, offset);
+            if (p == MAP_FAILED) {return false;}
+            if (external.empty()) {external.resize(pages.size(), nullptr);}
+            for (std::size_t i = 0; i < bytes / page_bytes; i++) {
+                std::size_t page = (adr >> page_shift) + i;
+                if (pages[page]) {
+                    pages[page].reset();
+                    resident--;
+                }
+                external[page] = static_cast<Cell *>(p) + i * page_words;
+            }
+            regions.push_back({adr, p, bytes});
+            flush_tlb();
+            return true;
+        #else
+            return false;
+        #endif
+        }
+
+        // Запись изменённых ячеек отображения с адреса adr (из map_region с shared) в файл
+        void sync_region(std::size_t adr, std::size_t words) {
+            if (not paged) {
+                msync(m + adr, region_bytes(words), MS_SYNC);
+                return;
+            }
+            for (auto &r : regions) {
+                if (r.adr == adr) {msync(r.base, r.bytes, MS_SYNC);}
+            }
+        }
+
+        // Снятие отображения с адреса adr: записи уходят в файл, ячейки снова нулевые
+        void unmap_region(std::size_t adr, std::size_t words) {
+            sync_region(adr, words);
+            std::size_t bytes = region_bytes(words);
+            if (not paged) {
+                void *p = mmap(m + adr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
+                if (p == MAP_FAILED) {throw std::runtime_error("Cannot allocate memory");}
+                return;
+            }
+            for (std::size_t i = 0; i < regions.size(); i++) {
+                if (regions[i].adr != adr) {continue;}
+                for (std::size_t k = 0; k < regions[i].bytes / (page_words * sizeof(Cell)); k++) {
+                    external[(adr >> page_shift) + k] = nullptr;
+                }
+                munmap(regions[i].base, regions[i].bytes);
+                regions.erase(regions.begin() + i);
+                break;
+            }
+            flush_tlb();
+        }
+
+        // Геттер из ячейки по адресу
+        // adr - адрес ячейки
+        // Бросается исключение при неверном адресе
+        Cell get_from_memory(std::size_t adr) {
+            if (adr < size_ram) {
+                return at(adr);
+            }
+            else {
+                throw std::runtime_error("Attempt to access non-existent memory");
+            }
+        }
+
+
+        // Сеттер из ячейки по адресу
+        // adr - адрес ячейки
+        // value - значение
+        // Бросается исключение при неверном адресе
+        void set_to_memory(std::size_t adr, Cell value) {
+            if (adr < size_ram) {
+                put(adr, value);
+            }
+            else {
+                throw std::runtime_error("Attempt to access non-existent memory");
+            }
+        }
+
+        // Чтение и запись без проверки адреса, только для адресов, уже проверенных вызывающим
+        // У страничной памяти попадание в TLB - одно сравнение, промах уходит в read_miss/write_miss
+        Cell at(std::size_t adr) {
+            if (m != nullptr) {return load_relaxed(m + adr);}
+            std::size_t page = adr >> page_shift;
+            const read_entry &e = read_tlb[page & (tlb_size - 1)];
+            const Cell *base = e.page == page ? e.base : read_miss(page);
+            return base[adr & (page_words - 1)];
+        }
+
+        void put(std::size_t adr, Cell value) {
+            if (m != nullptr) {store_relaxed(m + adr, value); return;}
+            std::size_t page = adr >> page_shift;
+            const write_entry &e = write_tlb[page & (tlb_size - 1)];
+            Cell *base = e.page == page ? e.base : write_miss(page);
+            base[adr & (page_words - 1)] = value;
+        }
+
+        // Обход диапазона [adr, adr + count) непрерывными кусками (у плоского ОЗУ - один кусок, у страничного - по страницам)
+        // для блочных передач портов, адреса уже проверены вызывающим
+        // read_spans не выделяет страниц (невыделенные читаются нулями), f(const Cell *, std::size_t)
+        template <typename F>
+        void read_spans(std::size_t adr, std::size_t count, F f) {
+            if (m != nullptr) {
+                if (count > 0) {f(static_cast<const Cell *>(m + adr), count);}
+                return;
+            }
+            while (count > 0) {
+                std::size_t offset = adr & (page_words - 1);
+                std::size_t n = std::min(count, page_words - offset);
+                std::size_t page = adr >> page_shift;
+                const read_entry &e = read_tlb[page & (tlb_size - 1)];
+                const Cell *base = e.page == page ? e.base : read_miss(page);
+                f(base + offset, n);
+                adr += n;
+                count -= n;
+            }
+        }
+
+        // f(Cell *, std::size_t) возвращает, сколько ячеек заполнено; обход прекращается на неполном куске
+        // Возвращает общее количество заполненных ячеек
+        template <typename F>
+        std::size_t write_spans(std::size_t adr, std::size_t count, F f) {
+            if (m != nullptr) {return count > 0 ? f(m + adr, count) : 0;}
+            std::size_t total = 0;
+            while (count > 0) {
+                std::size_t offset = adr & (page_words - 1);
+                std::size_t n = std::min(count, page_words - offset);
+                std::size_t got = f(cell(adr), n);
+                total += got;
+                if (got < n) {break;}
+                adr += n;
+                count -= n;
+            }
+            return total;
+        }
+
+        // Атомарные операции над ячейкой по уже проверенному адресу, все последовательно согласованы (seq_cst)
+
+        // Если в ячейке expected, записывает desired; возвращает прежнее значение ячейки
+        Cell compare_exchange(std::size_t adr, Cell expected, Cell desired) {
+            Cell *p = cell(adr);
+        #if defined(__GNUC__)
+            __atomic_compare_exchange_n(p, &expected, desired, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+            return expected;
+        #else
+            std::lock_guard<std::mutex> guard(atomic_lock());
+            Cell old = *p;
+            if (old == expected) {*p = desired;}
+            return old;
+        #endif
+        }
+
+        // Прибавляет value к ячейке (с переполнением по модулю 2^W), возвращает прежнее значение
+        Cell fetch_add(std::size_t adr, Cell value) {
+            Cell *p = cell(adr);
+        #if defined(__GNUC__)
+            return __atomic_fetch_add(p, value, __ATOMIC_SEQ_CST);
+        #else
+            std::lock_guard<std::mutex> guard(atomic_lock());
+            Cell old = *p;
+            *p = word_add(old, value);
+            return old;
+        #endif
+        }
+
+        // Полный барьер памяти
+        static void fence() {
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+        }
+
+        // Указатель на массив ячеек для JIT компилятора, nullptr у страничной памяти
+        Cell *data() {
+            return m;
+        }
+
+        bool is_paged() const {
+            return paged;
+        }
+
+        // Количество выделенных страниц страничной памяти
+        std::size_t resident_pages() const {
+            return resident;
+        }
+
+        // Плоское ОЗУ становится общим для нескольких ядер и должно остаться плоским
+        void pin() {
+            pinned = true;
+        }
+
+        // Перевод плоского ОЗУ в страничное на месте: ненулевые страницы копируются в таблицу страниц,
+        // массив освобождается. Вызывающий отвечает за то, что указателей из data() больше нет
+        // Возвращает false, если перевести нельзя (см. pin, отображённые файлы)
+        bool make_paged() {
+            if (paged) {return true;}
+            if (pinned or flat_files) {return false;}
+            std::vector<page_ref> table((size_ram + page_words - 1) / page_words);
+            std::size_t count = 0;
+            for_each_page([&table, &count](std::size_t page, const Cell *cells, std::size_t words) {
+                if (std::all_of(cells, cells + words, [](Cell v) {return v == 0;})) {return;}
+                table[page].allocate();
+                count++;
+                std::copy(cells, cells + words, table[page].get());
+            });
+            release();
+            paged = true;
+            pages = std::move(table);
+            resident = count;
+            return true;
+        }
+
+        // Копия ОЗУ для клона ядра (см. описание в начале файла), после неё оригинал тоже копирует общие страницы при записи
+        // Плоское ОЗУ сначала переводится в страничное (make_paged), поэтому указатели из data() после копии неверны
+        // Отображённые файлы в копию попадают содержимым, без связи с файлом
+        std::shared_ptr<basic_memory> clone() {
+            make_paged();
+            auto copy = std::make_shared<basic_memory>();
+            copy->init(size_ram, true);
+            for_each_page([this, &copy](std::size_t page, const Cell *cells, std::size_t words) {
+                if (paged and external_page(page) == nullptr) {
+                    copy->pages[page] = pages[page];
+                    copy->resident++;
+                    return;
+                }
+                if (std::all_of(cells, cells + words, [](Cell v) {return v == 0;})) {return;}
+                copy->pages[page].allocate();
+                copy->resident++;
+                std::copy(cells, cells + words, copy->pages[page].get());
+            });
+            // Записи TLB для записи указывают на страницы, ставшие общими
+            flush_tlb();
+            return copy;
+        }
+
+        // Обход страниц, в которых могут быть ненулевые ячейки: f(номер страницы, ячейки, их количество)
+        // У плоского ОЗУ это все страницы, у страничного - выделенные и внешние (невыделенные заведомо нулевые)
+        template <typename F>
+        void for_each_page(F f) {
+            std::size_t count = (size_ram + page_words - 1) / page_words;
+            for (std::size_t page = 0; page < count; page++) {
+                const Cell *base = m != nullptr ? m + page * page_words : external_page(page);
+                if (base == nullptr) {base = pages[page].get();}
+                if (base == nullptr) {continue;}
+                f(page, base, std::min(page_words, size_ram - page * page_words));
+            }
+        }
+
+        // Деструктор
+        ~basic_memory() {
+            release();
+        }
+
+    };
+
+    using memory = basic_memory<int>;
+}
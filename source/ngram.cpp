@@ -0,0 +1,112 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "core.hpp"
+
+// Отчёт о самых частых цепочках инструкций (n-граммах) в динамической трассе программы
+// По нему дополняется таблица сверхинструкций core::fusion_table()
+// Запуск: xvngram filename ram_size [max_n] [top]
+// Считаются только цепочки, исполненные подряд без перехода: только такие можно слить
+
+// Ключ n-граммы: по 16 бит на код операции
+std::uint64_t ngram_key(const std::vector<int> &window, std::size_t n) {
+  std::uint64_t key = 0;
+  for (std::size_t i = window.size() - n; i < window.size(); i++) {
+    key = (key << 16) | static_cast<std::uint16_t>(window[i]);
+  }
+  return key;
+}
+
+std::string ngram_name(std::uint64_t key, std::size_t n) {
+  std::string name;
+  for (std::size_t i = 0; i < n; i++) {
+    int op = static_cast<std::int16_t>(key >> (16 * (n - 1 - i)));
+    const char *mnemonic = cpu_unit::opcode_name(op);
+    if (i > 0) {name += "+";}
+    name += mnemonic ? mnemonic : std::to_string(op);
+  }
+  return name;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 3) {
+    std::cerr << "Invalid arguments\n";
+    std::cout << "Usage: " << argv[0] << " filename ram_size [max_n] [top]\n";
+    return 1;
+  }
+  std::string filename = argv[1];
+  std::size_t size = std::stoul(argv[2]);
+  std::size_t max_n = argc > 3 ? std::stoul(argv[3]) : cpu_unit::core::fusion_max_length;
+  std::size_t top = argc > 4 ? std::stoul(argv[4]) : 20;
+  if (max_n < 2 or max_n > 4) {
+    std::cerr << "max_n must be in 2..4\n";
+    return 1;
+  }
+
+  std::vector<int> program;
+  std::unique_ptr<loader_unit::program_image> image;
+  try {
+    if (loader_unit::is_image(filename)) {
+      image = std::make_unique<loader_unit::program_image>(filename);
+    } else {
+      loader_unit::load_text_program(filename, program);
+    }
+  } catch (std::runtime_error &e) {
+    std::cerr << e.what() << "\n";
+    return 2;
+  }
+
+  // counts[n] - частоты n-грамм длины n
+  std::vector<std::unordered_map<std::uint64_t, std::uint64_t>> counts(max_n + 1);
+  std::vector<int> window;
+  std::size_t expected_pc = 0;
+  std::uint64_t total = 0;
+
+  cpu_unit::core cpu;
+  try {
+    if (image) {
+      cpu.init(*image, size);
+    } else {
+      cpu.init(program, size);
+    }
+    cpu.set_observer([&](std::size_t pc, const int *decoded) {
+      total++;
+      // Переход рвёт цепочку
+      if (pc != expected_pc) {window.clear();}
+      expected_pc = pc + 4;
+      window.push_back(decoded[0]);
+      if (window.size() > max_n) {window.erase(window.begin());}
+      for (std::size_t n = 2; n <= window.size(); n++) {
+        counts[n][ngram_key(window, n)]++;
+      }
+    });
+    cpu.start_process(false);
+  } catch (std::runtime_error &e) {
+    std::cerr << e.what() << "\n";
+    return 3;
+  }
+
+  // Уже слитые цепочки помечаются в отчёте
+  std::vector<std::string> fused;
+  for (auto &rule : cpu_unit::core::fusion_table()) {fused.push_back(rule.name);}
+
+  std::cout << "\n--- n-gram report: " << total << " instructions ---\n";
+  for (std::size_t n = 2; n <= max_n; n++) {
+    std::vector<std::pair<std::uint64_t, std::uint64_t>> sorted(counts[n].begin(), counts[n].end());
+    std::sort(sorted.begin(), sorted.end(), [](auto &x, auto &y) {return x.second > y.second;});
+    std::cout << n << "-grams:\n";
+    for (std::size_t i = 0; i < sorted.size() and i < top; i++) {
+      std::string name = ngram_name(sorted[i].first, n);
+      bool is_fused = std::find(fused.begin(), fused.end(), name) != fused.end();
+      std::cout << "  " << name << ": " << sorted[i].second << " ("
+                << 100.0 * sorted[i].second / (total ? total : 1) << "%)" << (is_fused ? " [fused]" : "") << "\n";
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,281 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <iomanip>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "utility_units.hpp"
+
+/*
+ Профилировщик гостевой программы (не выборочный: учитывается каждая инструкция)
+
+ Считает исполнения по адресам инструкций и по кодам операций, переходы и непереходы jmp по адресам,
+ время и объём обмена каждого порта, а для flamegraph - инструкции по цепочкам вызовов:
+ call и вход в прерывание открывают кадр функции по адресу перехода, ret и iret закрывают его
+ Цепочки вызовов хранятся деревом кадров, поэтому вызов стоит одного поиска среди детей текущего кадра
+
+ Счётчики адресов области программы - плоские массивы, адреса вне её (код, записанный в данные) - в хэш-таблице
+*/
+
+namespace utility_units {
+
+    class profiler {
+    public:
+        // Статистика порта: вызовы, переданные в порт и полученные из него значения, время внутри порта
+        struct port_stats {
+            std::uint64_t calls = 0;
+            std::uint64_t values_out = 0;
+            std::uint64_t values_in = 0;
+            std::chrono::steady_clock::duration time{0};
+        };
+
+        // Коды операций меньше opcode_slots считаются отдельно, остальные (неверные) - в последней ячейке
+        static constexpr int opcode_slots = 128;
+
+        // Подготовка к новой программе: code_size - размер области программы, port_count - число портов
+        void reset(std::size_t code_size, std::size_t port_count) {
+            by_address.assign(code_size, 0);
+            taken.assign(code_size, 0);
+            not_taken.assign(code_size, 0);
+            outside.clear();
+            outside_branches.clear();
+            std::fill(std::begin(by_opcode), std::end(by_opcode), 0);
+            ports.assign(port_count, port_stats());
+            frames.clear();
+            frames.push_back({-1, 0, 0, {}});
+            current = 0;
+            total = 0;
+            settled = 0;
+        }
+
+        // Исполнение инструкции op по адресу pc
+        void instruction(std::size_t pc, int op) {
+            if (pc < by_address.size()) {
+                by_address[pc]++;
+            } else {
+                outside[pc]++;
+            }
+            by_opcode[op >= 0 and op < opcode_slots ? op : opcode_slots]++;
+            total++;
+        }
+
+        // Исход условного перехода по адресу pc
+        void branch(std::size_t pc, bool was_taken) {
+            if (pc < by_address.size()) {
+                (was_taken ? taken : not_taken)[pc]++;
+            } else {
+                branch_stats &b = outside_branches[pc];
+                (was_taken ? b.taken : b.not_taken)++;
+            }
+        }
+
+        // Вход в функцию или обработчик прерывания по адресу entry
+        // Инструкции кадра считаются не по одной, а разницей total между сменами кадра
+        void enter(int entry) {
+            settle();
+            for (std::size_t child : frames[current].children) {
+                if (frames[child].entry == entry) {
+                    current = child;
+                    return;
+                }
+            }
+            frames.push_back({entry, current, 0, {}});
+            frames[current].children.push_back(frames.size() - 1);
+            current = frames.size() - 1;
+        }
+
+        // Выход из функции, на корневом кадре (ret без call) ничего не делает
+        void leave() {
+            settle();
+            if (current != 0) {current = frames[current].parent;}
+        }
+
+        port_stats &port(std::size_t i) {
+            return ports[i];
+        }
+
+        std::uint64_t instructions() const {
+            return total;
+        }
+
+        // Отчёт: top самых частых адресов, гистограмма кодов операций, переходы jmp и порты
+        // describe - текст инструкции по адресу, name - мнемоника кода операции (nullptr для неизвестного)
+        void write_report(std::ostream &out, std::size_t top, const std::function<std::string(std::size_t)> &describe,
+                          const char *(*name)(int)) const {
+            auto percent = [this](std::uint64_t n) {return total == 0 ? 0.0 : 100.0 * n / total;};
+            out << "instructions: " << total << "\n";
+
+            std::vector<std::pair<std::size_t, std::uint64_t>> hot;
+            for (std::size_t a = 0; a < by_address.size(); a++) {
+                if (by_address[a] != 0) {hot.emplace_back(a, by_address[a]);}
+            }
+            for (auto &o : outside) {hot.emplace_back(o.first, o.second);}
+            std::sort(hot.begin(), hot.end(), [](const auto &x, const auto &y) {
+                return x.second != y.second ? x.second > y.second : x.first < y.first;
+            });
+            if (hot.size() > top) {hot.resize(top);}
+            out << "\nhot addresses (top " << top << "):\n";
+            for (auto &h : hot) {
+                out << std::setw(10) << h.first << std::setw(14) << h.second << std::setw(8) << std::fixed << std::setprecision(2)
+                    << percent(h.second) << "%  " << describe(h.first) << "\n";
+            }
+
+            std::vector<std::pair<int, std::uint64_t>> ops;
+            for (int op = 0; op <= opcode_slots; op++) {
+                if (by_opcode[op] != 0) {ops.emplace_back(op, by_opcode[op]);}
+            }
+            std::sort(ops.begin(), ops.end(), [](const auto &x, const auto &y) {return x.second > y.second;});
+            out << "\nopcodes:\n";
+            for (auto &o : ops) {
+                const char *mnemonic = o.first < opcode_slots ? name(o.first) : nullptr;
+                std::string label = mnemonic ? mnemonic : (o.first < opcode_slots ? std::to_string(o.first) : std::string("invalid"));
+                out << std::setw(10) << label << std::setw(14) << o.second << std::setw(8) << percent(o.second) << "%\n";
+            }
+
+            std::vector<std::pair<std::size_t, branch_stats>> branches;
+            for (std::size_t a = 0; a < by_address.size(); a++) {
+                if (taken[a] != 0 or not_taken[a] != 0) {branches.push_back({a, {taken[a], not_taken[a]}});}
+            }
+            for (auto &b : outside_branches) {branches.push_back(b);}
+            std::sort(branches.begin(), branches.end(), [](const auto &x, const auto &y) {
+                std::uint64_t nx = x.second.taken + x.second.not_taken;
+                std::uint64_t ny = y.second.taken + y.second.not_taken;
+                return nx != ny ? nx > ny : x.first < y.first;
+            });
+            if (branches.size() > top) {branches.resize(top);}
+            out << "\njmp (address, taken, not taken):\n";
+            for (auto &b : branches) {
+                out << std::setw(10) << b.first << std::setw(14) << b.second.taken << std::setw(14) << b.second.not_taken << "\n";
+            }
+
+            out << "\nports (port, calls, values out, values in, bytes, seconds):\n";
+            for (std::size_t i = 0; i < ports.size(); i++) {
+                const port_stats &p = ports[i];
+                if (p.calls == 0) {continue;}
+                out << std::setw(10) << i << std::setw(14) << p.calls << std::setw(14) << p.values_out << std::setw(14) << p.values_in
+                    << std::setw(14) << (p.values_out + p.values_in) * sizeof(int) << std::setw(14) << std::setprecision(6)
+                    << std::chrono::duration<double>(p.time).count() << "\n";
+            }
+            out << std::defaultfloat;
+        }
+
+        // Свёрнутые стеки для flamegraph.pl и совместимых инструментов: строка "main;f_40;f_88 count" на кадр
+        void write_collapsed(std::ostream &out) const {
+            std::vector<std::string> paths(frames.size());
+            for (std::size_t i = 0; i < frames.size(); i++) {
+                // Родитель создаётся раньше детей, поэтому его путь уже готов
+                paths[i] = i == 0 ? "main" : paths[frames[i].parent] + ";f_" + std::to_string(frames[i].entry);
+                std::uint64_t self = frames[i].self + (i == current ? total - settled : 0);
+                if (self != 0) {out << paths[i] << " " << self << "\n";}
+            }
+        }
+
+    private:
+        struct branch_stats {
+            std::uint64_t taken = 0;
+            std::uint64_t not_taken = 0;
+        };
+
+        // Кадр дерева вызовов: адрес входа, родитель, инструкции в самом кадре, дети
+        struct frame {
+            int entry;
+            std::size_t parent;
+            std::uint64_t self;
+            std::vector<std::size_t> children;
+        };
+
+        std::vector<std::uint64_t> by_address;
+        std::vector<std::uint64_t> taken;
+        std::vector<std::uint64_t> not_taken;
+        std::unordered_map<std::size_t, std::uint64_t> outside;
+        std::unordered_map<std::size_t, branch_stats> outside_branches;
+        std::uint64_t by_opcode[opcode_slots + 1] = {};
+        std::vector<port_stats> ports;
+        std::vector<frame> frames;
+        std::size_t current = 0;
+        std::uint64_t total = 0;
+        // total на последней смене кадра
+        std::uint64_t settled = 0;
+
+        void settle() {
+            frames[current].self += total - settled;
+            settled = total;
+        }
+    };
+
+    // Порт-обёртка профилировщика: передаёт всё устройству, считая вызовы, значения и время внутри него
+    class profiled_port : public virtual_port {
+    private:
+        std::unique_ptr<virtual_port> device;
+        profiler &owner;
+        std::size_t index;
+
+        // Замер одного обращения: out и in - сколько значений ушло в порт и пришло из него
+        template <typename F>
+        void measure(std::uint64_t out, std::uint64_t in, F &&call) {
+            auto start = std::chrono::steady_clock::now();
+            call();
+            profiler::port_stats &s = owner.port(index);
+            s.time += std::chrono::steady_clock::now() - start;
+            s.calls++;
+            s.values_out += out;
+            s.values_in += in;
+        }
+
+    public:
+        profiled_port(std::unique_ptr<virtual_port> port, profiler &stats, std::size_t number)
+            : device(std::move(port)), owner(stats), index(number) {}
+
+        void send_value(int value) override {measure(1, 0, [&]() {device->send_value(value);});}
+        void send_signal(int value) override {measure(0, 0, [&]() {device->send_signal(value);});}
+        void ret_value(int &answer) override {measure(0, 1, [&]() {device->ret_value(answer);});}
+        void ret_signal(int &answer) override {measure(0, 0, [&]() {device->ret_signal(answer);});}
+
+        void send_block(const int *data, std::size_t count) override {
+            measure(count, 0, [&]() {device->send_block(data, count);});
+        }
+
+        std::size_t ret_block(int *data, std::size_t count) override {
+            auto start = std::chrono::steady_clock::now();
+            std::size_t got = device->ret_block(data, count);
+            profiler::port_stats &s = owner.port(index);
+            s.time += std::chrono::steady_clock::now() - start;
+            s.calls++;
+            s.values_in += got;
+            return got;
+        }
+
+        void send_wide(long long value) override {measure(1, 0, [&]() {device->send_wide(value);});}
+        void ret_wide(long long &answer) override {measure(0, 1, [&]() {device->ret_wide(answer);});}
+
+        void send_wide_block(const long long *data, std::size_t count) override {
+            measure(count, 0, [&]() {device->send_wide_block(data, count);});
+        }
+
+        std::size_t ret_wide_block(long long *data, std::size_t count) override {
+            auto start = std::chrono::steady_clock::now();
+            std::size_t got = device->ret_wide_block(data, count);
+            profiler::port_stats &s = owner.port(index);
+            s.time += std::chrono::steady_clock::now() - start;
+            s.calls++;
+            s.values_in += got;
+            return got;
+        }
+
+        // Сброс буферов при остановке не считается обращением программы, но его время идёт в порт
+        void flush() override {
+            auto start = std::chrono::steady_clock::now();
+            device->flush();
+            owner.port(index).time += std::chrono::steady_clock::now() - start;
+        }
+
+        void save_state(state_writer &out) override {device->save_state(out);}
+        void load_state(state_reader &in) override {device->load_state(in);}
+    };
+}
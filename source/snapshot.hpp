@@ -0,0 +1,99 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+
+/*
+ Снимок состояния ядра (cpu_unit::core::save_snapshot / restore)
+
+ Все числа в порядке байт машины:
+   "XVSN", версия (uint32)
+   размер ОЗУ и размер области программы (int64), с версии 2 - ширина слова ядра в битах (int64, в версии 1 всегда 32)
+   ОЗУ: записи страниц по memory::page_words ячеек, только страницы с ненулевыми ячейками:
+     номер страницы (int64), число отрезков (int64), отрезки: смещение в странице и длина (int64), ячейки шириной слова
+     отрезки разделяются хотя бы snapshot_gap нулевыми ячейками, нули внутри отрезка хранятся как есть
+     конец ОЗУ - номер страницы -1
+   состояние ядра (регистры, флаги, прерывания, таймер, стек) - int64 по порядку save_snapshot
+   количество портов, затем состояние каждого порта (virtual_port::save_state)
+ Почти пустое ОЗУ любого размера занимает в снимке только свои ненулевые отрезки
+*/
+
+namespace utility_units {
+
+    constexpr std::uint32_t snapshot_version = 2;
+
+    // Нулевые ячейки подряд, на которых отрезок ОЗУ в снимке разрывается
+    constexpr std::size_t snapshot_gap = 4;
+
+    inline bool is_snapshot(const std::string &filename) {
+        char magic[4] = {};
+        std::ifstream f(filename, std::ios::binary);
+        f.read(magic, 4);
+        return f.gcount() == 4 and std::memcmp(magic, "XVSN", 4) == 0;
+    }
+
+    // Запись снимка
+    class state_writer {
+    private:
+        std::ostream &out;
+
+    public:
+        explicit state_writer(std::ostream &stream) : out(stream) {}
+
+        void put(long long value) {
+            std::int64_t v = value;
+            out.write(reinterpret_cast<const char *>(&v), sizeof(v));
+        }
+
+        void put_string(const std::string &text) {
+            put(static_cast<long long>(text.size()));
+            out.write(text.data(), static_cast<std::streamsize>(text.size()));
+        }
+
+        template <typename Word>
+        void put_words(const Word *data, std::size_t count) {
+            out.write(reinterpret_cast<const char *>(data), static_cast<std::streamsize>(count * sizeof(Word)));
+        }
+    };
+
+    // Чтение снимка, обрыв файла бросает исключение
+    class state_reader {
+    private:
+        std::istream &in;
+
+        void read(void *to, std::size_t bytes) {
+            in.read(static_cast<char *>(to), static_cast<std::streamsize>(bytes));
+            if (static_cast<std::size_t>(in.gcount()) != bytes) {throw std::runtime_error("Snapshot is truncated");}
+        }
+
+    public:
+        explicit state_reader(std::istream &stream) : in(stream) {}
+
+        long long get() {
+            std::int64_t v;
+            read(&v, sizeof(v));
+            return v;
+        }
+
+        // Значение из диапазона [low, high], иначе снимок считается повреждённым
+        long long get(long long low, long long high) {
+            long long v = get();
+            if (v < low or v > high) {throw std::runtime_error("Snapshot is corrupted");}
+            return v;
+        }
+
+        std::string get_string() {
+            std::string text(static_cast<std::size_t>(get(0, 1 << 20)), '\0');
+            read(&text[0], text.size());
+            return text;
+        }
+
+        template <typename Word>
+        void get_words(Word *data, std::size_t count) {
+            read(data, count * sizeof(Word));
+        }
+    };
+}
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace utility_units {
+
+    // Пул потоков с кражей работы
+    // У каждого потока своя очередь: задачи раздаются по кругу, поток берёт свои задачи с конца очереди,
+    // а когда своя очередь пуста - крадёт из начала чужих. Так длинные задачи не держат короткие
+    // в одной очереди, и все потоки заняты, пока есть работа
+    // Задачи не должны бросать исключений (ошибки задачи обрабатывает сама)
+    class thread_pool {
+    private:
+        struct worker_queue {
+            std::mutex lock;
+            std::deque<std::function<void()>> tasks;
+        };
+
+        std::vector<std::unique_ptr<worker_queue>> queues;
+        std::vector<std::thread> threads;
+
+        // queued - задачи в очередях, pending - ещё не завершённые задачи
+        std::atomic<std::size_t> queued{0};
+        std::atomic<std::size_t> pending{0};
+        std::atomic<std::size_t> next_queue{0};
+        bool stopping = false;
+
+        // Сон свободных потоков и ожидание завершения всех задач
+        std::mutex signal_lock;
+        std::condition_variable has_work;
+        std::condition_variable all_done;
+
+        // Задача из своей очереди (с конца) или украденная из чужой (с начала)
+        bool take(std::size_t self, std::function<void()> &task) {
+            {
+                worker_queue &own = *queues[self];
+                std::lock_guard<std::mutex> guard(own.lock);
+                if (not own.tasks.empty()) {
+                    task = std::move(own.tasks.back());
+                    own.tasks.pop_back();
+                    queued--;
+                    return true;
+                }
+            }
+            for (std::size_t k = 1; k < queues.size(); k++) {
+                worker_queue &victim = *queues[(self + k) % queues.size()];
+                std::lock_guard<std::mutex> guard(victim.lock);
+                if (not victim.tasks.empty()) {
+                    task = std::move(victim.tasks.front());
+                    victim.tasks.pop_front();
+                    queued--;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        void work(std::size_t self) {
+            std::function<void()> task;
+            while (true) {
+                if (take(self, task)) {
+                    task();
+                    task = nullptr;
+                    if (--pending == 0) {
+                        std::lock_guard<std::mutex> guard(signal_lock);
+                        all_done.notify_all();
+                    }
+                    continue;
+                }
+                std::unique_lock<std::mutex> guard(signal_lock);
+                has_work.wait(guard, [this]() {return stopping or queued > 0;});
+                if (stopping and queued == 0) {return;}
+            }
+        }
+
+    public:
+        // count - количество потоков (0 - по числу ядер машины)
+        explicit thread_pool(std::size_t count = 0) {
+            if (count == 0) {count = std::thread::hardware_concurrency();}
+            if (count == 0) {count = 1;}
+            for (std::size_t i = 0; i < count; i++) {queues.push_back(std::make_unique<worker_queue>());}
+            for (std::size_t i = 0; i < count; i++) {threads.emplace_back(&thread_pool::work, this, i);}
+        }
+
+        thread_pool(const thread_pool &) = delete;
+        thread_pool &operator=(const thread_pool &) = delete;
+
+        std::size_t size() const {
+            return threads.size();
+        }
+
+        // Добавление задачи, очереди выбираются по кругу
+        void submit(std::function<void()> task) {
+            worker_queue &q = *queues[next_queue++ % queues.size()];
+            pending++;
+            // Счётчик растёт до вставки, чтобы не уйти в минус, если задачу сразу заберут
+            {
+                std::lock_guard<std::mutex> guard(signal_lock);
+                queued++;
+            }
+            {
+                std::lock_guard<std::mutex> guard(q.lock);
+                q.tasks.push_back(std::move(task));
+            }
+            has_work.notify_one();
+        }
+
+        // Ожидание завершения всех добавленных задач
+        void wait() {
+            std::unique_lock<std::mutex> guard(signal_lock);
+            all_done.wait(guard, [this]() {return pending == 0;});
+        }
+
+        ~thread_pool() {
+            wait();
+            {
+                std::lock_guard<std::mutex> guard(signal_lock);
+                stopping = true;
+            }
+            has_work.notify_all();
+            for (auto &t : threads) {t.join();}
+        }
+    };
+}
@@ -0,0 +1,511 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include "utility_units.hpp"
+
+/*
+ Двоичная трасса исполнения и её воспроизведение
+
+ Трасса - поток 32-битных слов в порядке байт машины. Заголовок: магическое число, версия,
+ размер области программы, размер ОЗУ (два слова) и контрольная сумма программы, затем записи
+ Первое слово записи - вид (младшие 8 бит) и операнд (старшие 24 бита), следом значения:
+ - INSTRUCTION [код операции] адрес - начало инструкции
+ - STEP [код операции] - начало инструкции сразу за прошлой (адрес на 4 больше), самая частая запись
+ - REGISTER [номер] значение - регистр изменился (кроме r14: адрес виден по следующей инструкции)
+ - FLAG значение - изменился флаг сравнения
+ - MEMORY адрес значение - запись в ОЗУ
+ - PORT_OUT / PORT_IN [порт] количество значения... - значения, переданные в порт и полученные из него
+ - SIGNAL_OUT / SIGNAL_IN [порт] значение - prcs и prcg
+ - END [причина остановки] инструкции (два слова) - конец запуска start_process
+ Изменения регистров пишутся после инструкции сравнением с прошлым состоянием, поэтому изменения
+ при входе в прерывание попадают в запись следующей инструкции
+
+ Запись идёт через буфер ядра в кольцо без блокировок, которое разбирает в файл отдельный поток
+ Полное кольцо останавливает ядро до освобождения места: трасса не теряет записей
+*/
+
+namespace utility_units {
+
+    enum class TraceRecord : std::uint32_t {
+        INSTRUCTION = 1,
+        REGISTER = 2,
+        FLAG = 3,
+        MEMORY = 4,
+        PORT_OUT = 5,
+        PORT_IN = 6,
+        SIGNAL_OUT = 7,
+        SIGNAL_IN = 8,
+        END = 9,
+        STEP = 10
+    };
+
+    // Кольцо слов для одного писателя и одного читателя без блокировок
+    class word_ring {
+    private:
+        std::vector<std::uint32_t> data;
+        std::size_t mask;
+        // Счётчики только растут, позиция в кольце - по маске
+        alignas(64) std::atomic<std::size_t> head{0};
+        alignas(64) std::atomic<std::size_t> tail{0};
+
+    public:
+        // capacity - степень двойки
+        explicit word_ring(std::size_t capacity) : data(capacity), mask(capacity - 1) {}
+
+        // Писатель: ждёт места, пока читатель не освободит его
+        void push(const std::uint32_t *words, std::size_t count) {
+            std::size_t t = tail.load(std::memory_order_relaxed);
+            while (count != 0) {
+                std::size_t free = data.size() - (t - head.load(std::memory_order_acquire));
+                if (free == 0) {
+                    std::this_thread::yield();
+                    continue;
+                }
+                std::size_t n = std::min({count, free, data.size() - (t & mask)});
+                std::memcpy(&data[t & mask], words, n * sizeof(std::uint32_t));
+                t += n;
+                words += n;
+                count -= n;
+                tail.store(t, std::memory_order_release);
+            }
+        }
+
+        // Читатель: отдаёт consume непрерывный кусок готовых слов, возвращает его длину
+        template <typename F>
+        std::size_t pop(F &&consume) {
+            std::size_t h = head.load(std::memory_order_relaxed);
+            std::size_t n = std::min(tail.load(std::memory_order_acquire) - h, data.size() - (h & mask));
+            if (n != 0) {
+                consume(&data[h & mask], n);
+                head.store(h + n, std::memory_order_release);
+            }
+            return n;
+        }
+    };
+
+    // Получатель записей трассы: ядро пишет слова в буфер, полный буфер уходит в consume()
+    class trace_sink {
+    public:
+        static constexpr std::uint32_t magic = 0x52545658;  // "XVTR"
+        static constexpr std::uint32_t version = 1;
+        static constexpr std::size_t header_words = 6;
+
+        virtual ~trace_sink() = default;
+
+        void instruction(std::size_t pc, int op) {
+            if (pc == next_pc) {
+                *reserve(1) = tag(TraceRecord::STEP, op);
+            } else {
+                std::uint32_t *w = reserve(2);
+                w[0] = tag(TraceRecord::INSTRUCTION, op);
+                w[1] = static_cast<std::uint32_t>(pc);
+            }
+            next_pc = pc + 4;
+        }
+
+        void reg(int number, int value) {
+            std::uint32_t *w = reserve(2);
+            w[0] = tag(TraceRecord::REGISTER, number);
+            w[1] = static_cast<std::uint32_t>(value);
+        }
+
+        void flag(int value) {
+            std::uint32_t *w = reserve(2);
+            w[0] = tag(TraceRecord::FLAG, 0);
+            w[1] = static_cast<std::uint32_t>(value);
+        }
+
+        void memory(std::size_t adr, int value) {
+            std::uint32_t *w = reserve(3);
+            w[0] = tag(TraceRecord::MEMORY, 0);
+            w[1] = static_cast<std::uint32_t>(adr);
+            w[2] = static_cast<std::uint32_t>(value);
+        }
+
+        void values(TraceRecord kind, std::size_t port, const int *data, std::size_t count) {
+            put(tag(kind, static_cast<int>(port)));
+            put(static_cast<std::uint32_t>(count));
+            for (std::size_t i = 0; i < count; i++) {put(static_cast<std::uint32_t>(data[i]));}
+        }
+
+        void signal(TraceRecord kind, std::size_t port, int value) {
+            put(tag(kind, static_cast<int>(port)));
+            put(static_cast<std::uint32_t>(value));
+        }
+
+        // Конец запуска с причиной reason после instructions инструкций
+        virtual void finish(int reason, long long instructions) = 0;
+
+        void flush() {
+            if (used != 0) {
+                consume(buffer, used);
+                used = 0;
+            }
+        }
+
+        static std::uint32_t tag(TraceRecord kind, int operand) {
+            return static_cast<std::uint32_t>(kind) | static_cast<std::uint32_t>(operand) << 8;
+        }
+
+        static TraceRecord kind(std::uint32_t word) {
+            return static_cast<TraceRecord>(word & 0xff);
+        }
+
+        // Операнд со знаком (код операции может быть отрицательным)
+        static int operand(std::uint32_t word) {
+            return static_cast<std::int32_t>(word) >> 8;
+        }
+
+        // Длина записи, начинающейся с words[0] (у блоков значений нужно и слово количества)
+        static std::size_t length(const std::uint32_t *words) {
+            switch (kind(words[0])) {
+                case TraceRecord::MEMORY: case TraceRecord::END: return 3;
+                case TraceRecord::PORT_OUT: case TraceRecord::PORT_IN: return 2 + words[1];
+                case TraceRecord::STEP: return 1;
+                default: return 2;
+            }
+        }
+
+        // Контрольная сумма программы (FNV-1a по словам)
+        static std::uint32_t checksum(const std::vector<int> &code) {
+            std::uint32_t h = 2166136261u;
+            for (int w : code) {
+                h ^= static_cast<std::uint32_t>(w);
+                h *= 16777619u;
+            }
+            return h;
+        }
+
+    protected:
+        virtual void consume(const std::uint32_t *words, std::size_t count) = 0;
+
+        void put(std::uint32_t word) {
+            *reserve(1) = word;
+        }
+
+        // Место под n слов записи в буфере (n не больше буфера)
+        std::uint32_t *reserve(std::size_t n) {
+            if (used + n > buffer_words) {flush();}
+            std::uint32_t *w = buffer + used;
+            used += n;
+            return w;
+        }
+
+    private:
+        static constexpr std::size_t buffer_words = 4096;
+        std::uint32_t buffer[buffer_words];
+        std::size_t used = 0;
+        // Адрес инструкции сразу за прошлой записанной
+        std::size_t next_pc = ~std::size_t(0);
+    };
+
+    // Запись трассы в файл: буфер ядра уходит в кольцо, поток-писатель разбирает кольцо в файл
+    class trace_writer : public trace_sink {
+    private:
+        std::ofstream file;
+        word_ring ring;
+        std::atomic<bool> stopping{false};
+        std::thread writer;
+
+        void drain() {
+            auto write = [this](const std::uint32_t *words, std::size_t count) {
+                file.write(reinterpret_cast<const char *>(words), static_cast<std::streamsize>(count * sizeof(std::uint32_t)));
+            };
+            for (;;) {
+                // Флаг читается до кольца: после него в кольце уже всё, что записало ядро
+                bool last = stopping.load(std::memory_order_acquire);
+                if (ring.pop(write) != 0) {continue;}
+                if (last) {break;}
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+            }
+            file.flush();
+        }
+
+    protected:
+        void consume(const std::uint32_t *words, std::size_t count) override {
+            ring.push(words, count);
+        }
+
+    public:
+        static constexpr std::size_t ring_words = std::size_t(1) << 20;
+
+        // code - программа (для контрольной суммы), ram_size - размер ОЗУ
+        trace_writer(const std::string &path, const std::vector<int> &code, std::size_t ram_size)
+            : file(path, std::ios::binary | std::ios::trunc), ring(ring_words) {
+            if (not file) {throw std::runtime_error("Cannot write trace " + path);}
+            std::uint32_t header[header_words] = {
+                magic, version, static_cast<std::uint32_t>(code.size()),
+                static_cast<std::uint32_t>(ram_size), static_cast<std::uint32_t>(static_cast<std::uint64_t>(ram_size) >> 32),
+                checksum(code)
+            };
+            file.write(reinterpret_cast<const char *>(header), sizeof(header));
+            writer = std::thread(&trace_writer::drain, this);
+        }
+
+        trace_writer(const trace_writer &) = delete;
+        trace_writer &operator=(const trace_writer &) = delete;
+
+        ~trace_writer() override {
+            flush();
+            stopping.store(true, std::memory_order_release);
+            writer.join();
+        }
+
+        void finish(int reason, long long instructions) override {
+            put(tag(TraceRecord::END, reason));
+            put(static_cast<std::uint32_t>(instructions));
+            put(static_cast<std::uint32_t>(static_cast<std::uint64_t>(instructions) >> 32));
+            flush();
+        }
+    };
+
+    // Прочитанная трасса: записи и полученные портами значения по порядку для воспроизведения
+    class trace_log {
+    public:
+        // Полученные из порта значения: блок PORT_IN или сигнал SIGNAL_IN
+        struct input {
+            TraceRecord kind;
+            std::vector<int> data;
+        };
+
+        explicit trace_log(const std::string &path) {
+            std::ifstream file(path, std::ios::binary | std::ios::ate);
+            if (not file) {throw std::runtime_error("Cannot read trace " + path);}
+            std::streamsize bytes = file.tellg();
+            file.seekg(0);
+            std::vector<std::uint32_t> all(static_cast<std::size_t>(bytes) / sizeof(std::uint32_t));
+            file.read(reinterpret_cast<char *>(all.data()), static_cast<std::streamsize>(all.size() * sizeof(std::uint32_t)));
+            if (all.size() < trace_sink::header_words or all[0] != trace_sink::magic or all[1] != trace_sink::version) {
+                throw std::runtime_error("Not a trace file: " + path);
+            }
+            std::copy(all.begin(), all.begin() + trace_sink::header_words, header);
+            records.assign(all.begin() + trace_sink::header_words, all.end());
+            // Разбор: число инструкций и очереди ввода портов, обрыв в конце (аварийная остановка) отбрасывается
+            std::size_t pos = 0;
+            while (pos < records.size()) {
+                TraceRecord k = trace_sink::kind(records[pos]);
+                bool counted = k == TraceRecord::PORT_OUT or k == TraceRecord::PORT_IN;
+                if (counted and pos + 1 >= records.size()) {break;}
+                std::size_t n = trace_sink::length(&records[pos]);
+                if (pos + n > records.size()) {break;}
+                if (k == TraceRecord::INSTRUCTION or k == TraceRecord::STEP) {
+                    instruction_count++;
+                } else if (k == TraceRecord::PORT_IN or k == TraceRecord::SIGNAL_IN) {
+                    std::size_t port = static_cast<std::size_t>(trace_sink::operand(records[pos]));
+                    input in{k, {}};
+                    const std::uint32_t *first = records.data() + pos + (k == TraceRecord::PORT_IN ? 2 : 1);
+                    const std::uint32_t *last = records.data() + pos + n;
+                    in.data.assign(first, last);
+                    inputs[port].push_back(std::move(in));
+                }
+                pos += n;
+            }
+            records.resize(pos);
+        }
+
+        // Проверка, что трасса записана для этой программы и этого размера ОЗУ
+        void check(const std::vector<int> &code, std::size_t ram_size) const {
+            std::uint64_t recorded_ram = header[3] | static_cast<std::uint64_t>(header[4]) << 32;
+            if (header[2] != code.size() or recorded_ram != ram_size or header[5] != trace_sink::checksum(code)) {
+                throw std::runtime_error("Trace was recorded for another program or memory size");
+            }
+        }
+
+        // Количество инструкций в трассе (бюджет воспроизведения)
+        long long instructions() const {
+            return instruction_count;
+        }
+
+        const std::vector<std::uint32_t> &words() const {
+            return records;
+        }
+
+        // Очередь ввода порта, забирается по мере воспроизведения (ссылка не меняется при обращении к другим портам)
+        std::deque<input> &port_inputs(std::size_t port) {
+            return inputs[port];
+        }
+
+    private:
+        std::uint32_t header[trace_sink::header_words] = {};
+        std::vector<std::uint32_t> records;
+        std::map<std::size_t, std::deque<input>> inputs;
+        long long instruction_count = 0;
+    };
+
+    // Сверка воспроизведения с трассой: ядро пишет записи как при записи трассы, и они сравниваются со словами трассы
+    // Расхождение бросает исключение с номером и адресом инструкции трассы, где оно найдено
+    class trace_checker : public trace_sink {
+    private:
+        const std::vector<std::uint32_t> &expected;
+        std::size_t pos = 0;
+        std::size_t record_end = 0;
+        long long instruction = 0;
+        std::uint32_t pc = 0;
+
+        [[noreturn]] void diverged(const std::string &what) const {
+            throw std::runtime_error("Replay diverged from the trace at instruction " + std::to_string(instruction) +
+                                     " (address " + std::to_string(pc) + "): " + what);
+        }
+
+        // Переход к очередной записи трассы, записи END пропускаются (их пишет только запись трассы)
+        void next_record() {
+            while (pos < expected.size()) {
+                record_end = pos + trace_sink::length(&expected[pos]);
+                TraceRecord k = trace_sink::kind(expected[pos]);
+                if (k == TraceRecord::END) {
+                    pos = record_end;
+                    continue;
+                }
+                if (k == TraceRecord::INSTRUCTION or k == TraceRecord::STEP) {
+                    instruction++;
+                    pc = k == TraceRecord::STEP ? pc + 4 : expected[pos + 1];
+                }
+                return;
+            }
+        }
+
+    protected:
+        void consume(const std::uint32_t *words, std::size_t count) override {
+            for (std::size_t i = 0; i < count; i++) {
+                if (pos == record_end) {next_record();}
+                if (pos >= expected.size()) {diverged("execution continues past the end of the trace");}
+                if (words[i] != expected[pos]) {
+                    diverged("recorded word " + std::to_string(expected[pos]) + ", replayed " + std::to_string(words[i]));
+                }
+                pos++;
+            }
+        }
+
+    public:
+        explicit trace_checker(const trace_log &log) : expected(log.words()) {}
+
+        void finish(int, long long) override {flush();}
+
+        // Проверка, что воспроизведение дошло до конца трассы
+        void complete() {
+            flush();
+            if (pos == record_end) {next_record();}
+            if (pos < expected.size()) {diverged("replay stopped before the end of the trace");}
+        }
+    };
+
+    // Порт-обёртка трассы: передаёт всё устройству и пишет переданные и полученные значения
+    class traced_port : public virtual_port {
+    private:
+        std::unique_ptr<virtual_port> device;
+        trace_sink &trace;
+        std::size_t index;
+
+    public:
+        traced_port(std::unique_ptr<virtual_port> port, trace_sink &sink, std::size_t number)
+            : device(std::move(port)), trace(sink), index(number) {}
+
+        void send_value(int value) override {
+            trace.values(TraceRecord::PORT_OUT, index, &value, 1);
+            device->send_value(value);
+        }
+
+        void send_signal(int value) override {
+            trace.signal(TraceRecord::SIGNAL_OUT, index, value);
+            device->send_signal(value);
+        }
+
+        void ret_value(int &answer) override {
+            device->ret_value(answer);
+            trace.values(TraceRecord::PORT_IN, index, &answer, 1);
+        }
+
+        void ret_signal(int &answer) override {
+            device->ret_signal(answer);
+            trace.signal(TraceRecord::SIGNAL_IN, index, answer);
+        }
+
+        void send_block(const int *data, std::size_t count) override {
+            trace.values(TraceRecord::PORT_OUT, index, data, count);
+            device->send_block(data, count);
+        }
+
+        std::size_t ret_block(int *data, std::size_t count) override {
+            std::size_t got = device->ret_block(data, count);
+            trace.values(TraceRecord::PORT_IN, index, data, got);
+            return got;
+        }
+
+        void flush() override {device->flush();}
+
+        void save_state(state_writer &out) override {device->save_state(out);}
+        void load_state(state_reader &in) override {device->load_state(in);}
+    };
+
+    // Порт воспроизведения: отдаёт значения из трассы вместо устройства
+    // Переданное в порт уходит в output (терминал, чтобы видеть вывод программы) или отбрасывается
+    class replay_port : public virtual_port {
+    private:
+        std::deque<trace_log::input> &inputs;
+        std::unique_ptr<virtual_port> output;
+        std::size_t index;
+
+        trace_log::input next(TraceRecord kind) {
+            if (inputs.empty() or inputs.front().kind != kind) {
+                throw std::runtime_error("Trace has no more input for port " + std::to_string(index));
+            }
+            trace_log::input in = std::move(inputs.front());
+            inputs.pop_front();
+            return in;
+        }
+
+    public:
+        replay_port(trace_log &log, std::size_t number, std::unique_ptr<virtual_port> out = nullptr)
+            : inputs(log.port_inputs(number)), output(std::move(out)), index(number) {}
+
+        void send_value(int value) override {
+            if (output) {output->send_value(value);}
+        }
+
+        void send_signal(int value) override {
+            if (output) {output->send_signal(value);}
+        }
+
+        void ret_value(int &answer) override {
+            trace_log::input in = next(TraceRecord::PORT_IN);
+            if (in.data.size() != 1) {throw std::runtime_error("Trace input of port " + std::to_string(index) + " is a block");}
+            answer = in.data[0];
+        }
+
+        void ret_signal(int &answer) override {
+            answer = next(TraceRecord::SIGNAL_IN).data.at(0);
+        }
+
+        void send_block(const int *data, std::size_t count) override {
+            if (output) {output->send_block(data, count);}
+        }
+
+        std::size_t ret_block(int *data, std::size_t count) override {
+            trace_log::input in = next(TraceRecord::PORT_IN);
+            std::size_t got = std::min(count, in.data.size());
+            std::copy(in.data.begin(), in.data.begin() + got, data);
+            return got;
+        }
+
+        void flush() override {
+            if (output) {output->flush();}
+        }
+
+        // Воспроизведение не продолжается из снимка: ввод порта остался бы в трассе
+        void save_state(state_writer &) override {
+            throw std::runtime_error("Cannot snapshot a replay");
+        }
+    };
+}
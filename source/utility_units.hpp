@@ -1,7 +1,15 @@
 #pragma once
 
+#include <cerrno>
+#include <charconv>
+#include <cstddef>
 #include <fstream>
 #include <iostream>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include <unistd.h>
+#include "snapshot.hpp"
 
 namespace utility_units {
 
@@ -15,16 +23,79 @@ namespace utility_units {
         virtual void send_signal(int value) = 0;
         virtual void ret_value(int &answer) = 0;
         virtual void ret_signal(int &answer) = 0;
-        ~virtual_port() = default;
+
+        // Блочная передача (инструкции prtw/prtr): сразу count значений
+        // По умолчанию сводится к поэлементным send_value/ret_value, устройства переопределяют их буферизованным вводом-выводом
+        virtual void send_block(const int *data, std::size_t count) {
+            for (std::size_t i = 0; i < count; i++) {send_value(data[i]);}
+        }
+
+        // Возвращает количество прочитанных значений, меньше count - данные кончились
+        virtual std::size_t ret_block(int *data, std::size_t count) {
+            for (std::size_t i = 0; i < count; i++) {ret_value(data[i]);}
+            return count;
+        }
+
+        // Значения ядра с 64-битным словом (см. word.hpp), ядра с узким словом пользуются значениями int
+        // По умолчанию устройство видит младшие 32 бита, а читает значения int, устройства с числами переопределяют их
+        virtual void send_wide(long long value) {
+            send_value(static_cast<int>(value));
+        }
+
+        virtual void ret_wide(long long &answer) {
+            int value = 0;
+            ret_value(value);
+            answer = value;
+        }
+
+        virtual void send_wide_block(const long long *data, std::size_t count) {
+            for (std::size_t i = 0; i < count; i++) {send_wide(data[i]);}
+        }
+
+        // Чтение кусками через ret_block, чтобы сохранить его признак конца данных
+        virtual std::size_t ret_wide_block(long long *data, std::size_t count) {
+            int chunk[256];
+            std::size_t got = 0;
+            while (got < count) {
+                std::size_t n = count - got < 256 ? count - got : 256;
+                std::size_t k = ret_block(chunk, n);
+                for (std::size_t i = 0; i < k; i++) {data[got + i] = chunk[i];}
+                got += k;
+                if (k < n) {break;}
+            }
+            return got;
+        }
+
+        // Сброс буферов устройства (вызывается при остановке процессора)
+        virtual void flush() {}
+
+        // Состояние устройства в снимке ядра (см. snapshot.hpp), по умолчанию - только return_state
+        // Устройство, чьё состояние не переносится в снимок (например, открытый асинхронный файл), бросает исключение
+        virtual void save_state(state_writer &out) {
+            out.put(return_state);
+        }
+
+        virtual void load_state(state_reader &in) {
+            return_state = static_cast<int>(in.get());
+        }
+
+        virtual ~virtual_port() = default;
     };
 
     // Класс наследник виртуального порта, позволяет работать с терминалом
     // При состоянии 0 - считывает и выводит символ
     // При состоянии 1 - считывает и выводит число
+    // Простой терминал поверх iostream (символ за операцию, ввод пропускает пробельные символы),
+    // процессор использует buffered_terminal
     class terminal : public virtual_port {
+        std::istream &in;
+        std::ostream &out;
+    public:
+        explicit terminal(std::istream &input = std::cin, std::ostream &output = std::cout) : in(input), out(output) {}
+
         void send_value(int value) override {
-            if (return_state == 0) {std::cout << char(value);}
-            else {std::cout << value;}
+            if (return_state == 0) {out << char(value);}
+            else {out << value;}
         }
 
         void send_signal(int value) override {
@@ -34,16 +105,326 @@ namespace utility_units {
         void ret_value(int &answer) override {
             if (return_state == 0) {
                 char a;
-                std::cin >> a;
+                in >> a;
+                answer = a;
+            } else {
+                in >> answer;
+            }
+        }
+
+        void ret_signal(int &answer) override {
+            answer = return_state;
+        }
+
+        void send_wide(long long value) override {
+            if (return_state == 0) {out << char(value);}
+            else {out << value;}
+        }
+
+        void ret_wide(long long &answer) override {
+            if (return_state == 0) {
+                char a;
+                in >> a;
                 answer = a;
             } else {
-                std::cin >> answer;
+                in >> answer;
+            }
+        }
+
+        // Символы пишутся одним write, числа - как у send_value
+        void send_block(const int *data, std::size_t count) override {
+            if (return_state != 0) {
+                for (std::size_t i = 0; i < count; i++) {out << data[i];}
+                return;
+            }
+            std::string buffer(count, '\0');
+            for (std::size_t i = 0; i < count; i++) {buffer[i] = char(data[i]);}
+            out.write(buffer.data(), count);
+        }
+
+        // Символы читаются одним read как есть, без пропуска пробельных символов (в отличие от ret_value)
+        std::size_t ret_block(int *data, std::size_t count) override {
+            if (return_state != 0) {
+                std::size_t i = 0;
+                while (i < count and in >> data[i]) {i++;}
+                return i;
+            }
+            std::vector<char> buffer(count);
+            in.read(buffer.data(), count);
+            std::size_t got = in.gcount();
+            for (std::size_t i = 0; i < got; i++) {data[i] = buffer[i];}
+            return got;
+        }
+    };
+
+    // Буферизованный терминал, основной терминал процессора (порт 0)
+    // Работает напрямую с дескрипторами (по умолчанию 0 и 1) или с буферами потоков (streambuf), минуя синхронизацию iostream
+    // Вывод копится в своём буфере и сбрасывается при заполнении, по сигналу 2, при остановке процессора,
+    // а у терминала (isatty) ещё и на каждом переводе строки
+    // Сигналы: 0 - символьный режим, 1 - числовой режим, 2 - сбросить вывод (режим не меняется)
+    // В символьном режиме ввод читается побайтно как есть (0..255, -1 в конце ввода), пробельные символы не пропускаются
+    // В числовом режиме пробельные символы перед числом пропускаются
+    // Состояние (ret_signal): текущий режим, -1 - ввод кончился (ret_value вернул -1), -2 - на вводе не число
+    // Следующий сигнал режима сбрасывает состояние ошибки
+    class buffered_terminal : public virtual_port {
+    private:
+        static constexpr std::size_t buffer_size = 1 << 16;
+
+        int in_fd = -1;
+        int out_fd = -1;
+        std::streambuf *in_buf = nullptr;
+        std::streambuf *out_buf = nullptr;
+        bool line_buffered = false;
+        int mode = 0;
+
+        std::vector<char> output;
+        std::size_t output_used = 0;
+        std::vector<char> input;
+        std::size_t input_pos = 0;
+        std::size_t input_end = 0;
+        bool input_eof = false;
+
+        // Запись count байт целиком
+        void write_out(const char *data, std::size_t count) {
+            std::size_t done = 0;
+            while (done < count) {
+                if (out_buf != nullptr) {
+                    std::streamsize n = out_buf->sputn(data + done, count - done);
+                    if (n <= 0) {break;}
+                    done += n;
+                } else {
+                    ssize_t n = ::write(out_fd, data + done, count - done);
+                    if (n < 0 and errno == EINTR) {continue;}
+                    if (n <= 0) {break;}
+                    done += n;
+                }
+            }
+        }
+
+        // Запись всего буфера вывода
+        void drain() {
+            write_out(output.data(), output_used);
+            output_used = 0;
+            if (out_buf != nullptr) {out_buf->pubsync();}
+        }
+
+        void put(const char *data, std::size_t count) {
+            if (output_used + count > buffer_size) {drain();}
+            if (count >= buffer_size) {
+                write_out(data, count);
+                if (out_buf != nullptr) {out_buf->pubsync();}
+                return;
+            }
+            std::char_traits<char>::copy(output.data() + output_used, data, count);
+            output_used += count;
+            if (line_buffered and std::char_traits<char>::find(data, count, '\n') != nullptr) {drain();}
+        }
+
+        // Дочитывание буфера ввода, false - ввод кончился
+        bool fill() {
+            if (input_pos < input_end) {return true;}
+            if (input_eof) {return false;}
+            // Перед чтением с терминала выводится всё накопленное (приглашение к вводу)
+            if (output_used != 0) {drain();}
+            input_pos = 0;
+            input_end = 0;
+            while (true) {
+                if (in_buf != nullptr) {
+                    // Сколько уже есть в буфере потока, но хотя бы один символ (может ждать ввода)
+                    std::streamsize want = in_buf->in_avail();
+                    if (want <= 0) {want = 1;}
+                    if (want > static_cast<std::streamsize>(input.size())) {want = input.size();}
+                    std::streamsize n = in_buf->sgetn(input.data(), want);
+                    if (n > 0) {input_end = n;}
+                    break;
+                }
+                ssize_t n = ::read(in_fd, input.data(), input.size());
+                if (n < 0 and errno == EINTR) {continue;}
+                if (n > 0) {input_end = n;}
+                break;
+            }
+            if (input_end == 0) {input_eof = true;}
+            return input_end > 0;
+        }
+
+        // Следующий байт ввода или -1
+        int next_byte() {
+            if (not fill()) {return -1;}
+            return static_cast<unsigned char>(input[input_pos++]);
+        }
+
+        int peek_byte() {
+            if (not fill()) {return -1;}
+            return static_cast<unsigned char>(input[input_pos]);
+        }
+
+    public:
+        // Терминал на дескрипторах, построчный сброс - только если вывод на терминал
+        explicit buffered_terminal(int input_fd = 0, int output_fd = 1)
+            : in_fd(input_fd), out_fd(output_fd), line_buffered(isatty(output_fd) == 1), output(buffer_size), input(buffer_size) {}
+
+        // Терминал на буферах потоков (например, буферах задач xvbatch)
+        buffered_terminal(std::istream &in, std::ostream &out)
+            : in_buf(in.rdbuf()), out_buf(out.rdbuf()), output(buffer_size), input(buffer_size) {}
+
+        buffered_terminal(const buffered_terminal &) = delete;
+        buffered_terminal &operator=(const buffered_terminal &) = delete;
+
+        void send_value(int value) override {
+            if (mode == 0) {
+                char c = char(value);
+                // Частый случай - символ просто ложится в буфер
+                if (output_used < buffer_size and not (line_buffered and c == '\n')) {
+                    output[output_used++] = c;
+                } else {
+                    put(&c, 1);
+                }
+            } else {
+                char text[16];
+                auto result = std::to_chars(text, text + sizeof(text), value);
+                put(text, result.ptr - text);
+            }
+        }
+
+        void send_signal(int value) override {
+            if (value == 2) {
+                drain();
+                return;
+            }
+            mode = value;
+            return_state = value;
+        }
+
+        // Чтение числа в int или long long, false - ввод кончился или на вводе не число (состояние -1 или -2)
+        template <typename T>
+        bool read_number(T &answer) {
+            int c = peek_byte();
+            while (c == ' ' or c == '\n' or c == '\t' or c == '\r' or c == '\v' or c == '\f') {
+                input_pos++;
+                c = peek_byte();
+            }
+            if (c < 0) {
+                answer = -1;
+                return_state = -1;
+                return false;
+            }
+            // Число собирается в беззнаковом виде, переполнение - по модулю 2^32 (2^64 у long long) как в арифметике процессора
+            bool negative = false;
+            if (c == '-' or c == '+') {
+                negative = c == '-';
+                input_pos++;
+                c = peek_byte();
             }
+            if (c < '0' or c > '9') {
+                if (c >= 0) {input_pos++;}
+                answer = 0;
+                return_state = -2;
+                return false;
+            }
+            std::make_unsigned_t<T> value = 0;
+            while (c >= '0' and c <= '9') {
+                value = value * 10 + static_cast<unsigned>(c - '0');
+                input_pos++;
+                c = peek_byte();
+            }
+            answer = static_cast<T>(negative ? 0u - value : value);
+            return true;
+        }
+
+        // Символьный режим: байт 0..255, в конце ввода -1
+        void ret_value(int &answer) override {
+            if (mode != 0) {
+                read_number(answer);
+                return;
+            }
+            answer = next_byte();
+            if (answer < 0) {return_state = -1;}
         }
 
         void ret_signal(int &answer) override {
             answer = return_state;
         }
+
+        // Значения 64-битного ядра: числа целиком, символы - как у send_value/ret_value
+        void send_wide(long long value) override {
+            if (mode == 0) {
+                send_value(static_cast<int>(value));
+                return;
+            }
+            char text[24];
+            auto result = std::to_chars(text, text + sizeof(text), value);
+            put(text, result.ptr - text);
+        }
+
+        void ret_wide(long long &answer) override {
+            if (mode != 0) {
+                read_number(answer);
+                return;
+            }
+            answer = next_byte();
+            if (answer < 0) {return_state = -1;}
+        }
+
+        std::size_t ret_wide_block(long long *data, std::size_t count) override {
+            if (mode == 0) {return virtual_port::ret_wide_block(data, count);}
+            std::size_t got = 0;
+            while (got < count and read_number(data[got])) {got++;}
+            return got;
+        }
+
+        void send_block(const int *data, std::size_t count) override {
+            if (mode != 0) {
+                virtual_port::send_block(data, count);
+                return;
+            }
+            while (count > 0) {
+                char chunk[4096];
+                std::size_t n = count < sizeof(chunk) ? count : sizeof(chunk);
+                for (std::size_t i = 0; i < n; i++) {chunk[i] = char(data[i]);}
+                put(chunk, n);
+                data += n;
+                count -= n;
+            }
+        }
+
+        // Символьный режим забирает сразу всё, что есть в буфере ввода
+        std::size_t ret_block(int *data, std::size_t count) override {
+            std::size_t got = 0;
+            if (mode != 0) {
+                while (got < count and read_number(data[got])) {got++;}
+                return got;
+            }
+            while (got < count) {
+                if (not fill()) {
+                    return_state = -1;
+                    break;
+                }
+                while (got < count and input_pos < input_end) {
+                    data[got++] = static_cast<unsigned char>(input[input_pos++]);
+                }
+            }
+            return got;
+        }
+
+        void flush() override {
+            if (output_used != 0) {drain();}
+        }
+
+        // В снимок попадают режим и состояние, вывод перед этим сбрасывается, а прочитанный, но не забранный ввод - нет
+        void save_state(state_writer &out) override {
+            flush();
+            out.put(mode);
+            out.put(return_state);
+        }
+
+        void load_state(state_reader &in) override {
+            mode = static_cast<int>(in.get());
+            return_state = static_cast<int>(in.get());
+        }
+
+        ~buffered_terminal() override {
+            flush();
+        }
     };
 
     // Класс наследник виртуального порта, позволяет худо бедно работать с файловой системой
@@ -55,6 +436,7 @@ namespace utility_units {
     // 3 - ошибка открытия файла
     // 4 - файл закрыт из-за попытки записи при режиме чтения или наоборот
     // 5 - неверная команда
+    // Чтение даёт байт файла 0..255, в конце файла -1
     class fileunit : public virtual_port {
     protected:
         std::string filename;
@@ -80,11 +462,10 @@ namespace utility_units {
                         filename.clear();
                         return_state = 4;
                     } else {
-                        try {
-                            f.open(filename, std::ios::in);
+                        f.open(filename, std::ios::in | std::ios::binary);
+                        if (f.is_open()) {
                             return_state = 1;
-                        } catch (std::runtime_error &e) {
-                            f.close();
+                        } else {
                             filename.clear();
                             return_state = 3;
                         }
@@ -97,11 +478,10 @@ namespace utility_units {
                         filename.clear();
                         return_state = 4;
                     } else {
-                        try {
-                            f.open(filename, std::ios::out);
+                        f.open(filename, std::ios::out | std::ios::binary);
+                        if (f.is_open()) {
                             return_state = 2;
-                        } catch (std::runtime_error &e) {
-                            f.close();
+                        } else {
                             filename.clear();
                             return_state = 3;
                         }
@@ -134,10 +514,9 @@ namespace utility_units {
         // Чтение из файла, при попытке чтения в режиме записи падает, если файл не открыт то тоже всё роняет
         void ret_value(int &answer) override {
             if (f.is_open()) {
-                if (return_state == 2) {
+                if (return_state == 1) {
                     char c;
-                    f.get(c);
-                    answer = c;
+                    answer = f.get(c) ? static_cast<unsigned char>(c) : -1;
                 } else {
                     return_state = 5;
                     f.close();
@@ -155,5 +534,71 @@ namespace utility_units {
             answer = return_state;
         }
 
+        // Запись блока одним write, ошибки режима как у send_value
+        void send_block(const int *data, std::size_t count) override {
+            if (not f.is_open() or return_state != 2) {
+                virtual_port::send_block(data, count);
+                return;
+            }
+            std::string buffer(count, '\0');
+            for (std::size_t i = 0; i < count; i++) {buffer[i] = char(data[i]);}
+            f.write(buffer.data(), count);
+        }
+
+        // Чтение блока одним read, в конце файла возвращает меньше count
+        std::size_t ret_block(int *data, std::size_t count) override {
+            if (not f.is_open() or return_state != 1) {
+                int answer = 0;
+                ret_value(answer);
+                return 0;
+            }
+            std::vector<char> buffer(count);
+            f.read(buffer.data(), count);
+            std::size_t got = f.gcount();
+            for (std::size_t i = 0; i < got; i++) {data[i] = static_cast<unsigned char>(buffer[i]);}
+            return got;
+        }
+
+        // В снимок попадают имя файла, состояние и позиция в открытом файле (-1 - конец файла)
+        void save_state(state_writer &out) override {
+            out.put_string(filename);
+            out.put(return_state);
+            out.put(f.is_open());
+            long long position = -1;
+            if (f.is_open() and return_state == 2) {
+                f.flush();
+                position = static_cast<long long>(f.tellp());
+            } else if (f.is_open() and not f.eof()) {
+                position = static_cast<long long>(f.tellg());
+            }
+            out.put(position);
+        }
+
+        // Файл открывается заново: для чтения - с той же позиции, для записи - обрезанным до неё,
+        // поэтому записанное после снимка не остаётся в файле
+        void load_state(state_reader &in) override {
+            f.close();
+            filename = in.get_string();
+            return_state = static_cast<int>(in.get());
+            bool open = in.get() != 0;
+            long long position = in.get();
+            if (not open) {return;}
+            if (return_state == 2) {
+                if (truncate(filename.c_str(), position < 0 ? 0 : position) != 0) {
+                    throw std::runtime_error("Cannot restore file " + filename);
+                }
+                f.open(filename, std::ios::in | std::ios::out | std::ios::binary);
+                f.seekp(0, std::ios::end);
+            } else {
+                f.open(filename, std::ios::in | std::ios::binary);
+                if (position < 0) {
+                    f.seekg(0, std::ios::end);
+                } else {
+                    f.seekg(position);
+                }
+            }
+            if (not f.is_open()) {throw std::runtime_error("Cannot restore file " + filename);}
+        }
+
     };
 }
@@ -0,0 +1,276 @@
+#pragma once
+
+#include <algorithm>
+#include <climits>
+#include <cstddef>
+#include <cstring>
+#include <type_traits>
+#include "word.hpp"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define XVPROC_SIMD 1
+#else
+#define XVPROC_SIMD 0
+#endif
+
+/*
+ Ядра векторных инструкций (vadd, vsub, vmul, vand, vor, vsum, vmin, vmax, vfill)
+
+ Каждое ядро обрабатывает один непрерывный кусок ячеек, разбиение диапазона ОЗУ на куски
+ (страницы, копия источника при перекрытии) делает ядро процессора
+ Набор ядер выбирается один раз при первом обращении по возможностям процессора:
+ AVX2 (8 ячеек за операцию), SSE4.1 (4 ячейки) или обычные циклы на остальных машинах
+ Арифметика - по модулю 2^W, как у скалярных инструкций, and/or - логические (результат 0 или 1)
+ SIMD-ядра есть у слова int32, ядро с другой шириной слова (см. word.hpp) всегда работает обычными циклами
+*/
+
+namespace cpu_unit {
+
+    enum class VectorLevel : int {
+        SCALAR = 0,
+        SSE41 = 1,
+        AVX2 = 2
+    };
+
+    inline const char *vector_level_name(VectorLevel level) {
+        switch (level) {
+            case VectorLevel::SCALAR: return "scalar";
+            case VectorLevel::SSE41: return "sse4.1";
+            case VectorLevel::AVX2: return "avx2";
+        }
+        return "unknown";
+    }
+
+    // Поэлементная операция над кусками: dst[i] = dst[i] op src[i] (dst и src могут совпадать целиком)
+    template <typename Word> using basic_vector_binary = void (*)(Word *dst, const Word *src, std::size_t n);
+    // Свёртка куска, продолжающая значение acc
+    template <typename Word> using basic_vector_reduce = Word (*)(const Word *src, std::size_t n, Word acc);
+
+    // Набор ядер для слова Word (см. word.hpp)
+    template <typename Word>
+    struct basic_vector_kernels {
+        VectorLevel level;
+        basic_vector_binary<Word> add;
+        basic_vector_binary<Word> sub;
+        basic_vector_binary<Word> mul;
+        basic_vector_binary<Word> logand;
+        basic_vector_binary<Word> logor;
+        basic_vector_reduce<Word> sum;
+        basic_vector_reduce<Word> min;
+        basic_vector_reduce<Word> max;
+        void (*fill)(Word *dst, Word value, std::size_t n);
+    };
+
+    using vector_binary = basic_vector_binary<int>;
+    using vector_reduce = basic_vector_reduce<int>;
+    using vector_kernels = basic_vector_kernels<int>;
+
+    // Обычные циклы для слова любой ширины
+    namespace vector_scalar {
+        template <typename Word>
+        inline void add(Word *d, const Word *s, std::size_t n) {
+            for (std::size_t i = 0; i < n; i++) {d[i] = word_add(d[i], s[i]);}
+        }
+        template <typename Word>
+        inline void sub(Word *d, const Word *s, std::size_t n) {
+            for (std::size_t i = 0; i < n; i++) {d[i] = word_sub(d[i], s[i]);}
+        }
+        template <typename Word>
+        inline void mul(Word *d, const Word *s, std::size_t n) {
+            for (std::size_t i = 0; i < n; i++) {d[i] = word_mul(d[i], s[i]);}
+        }
+        template <typename Word>
+        inline void logand(Word *d, const Word *s, std::size_t n) {
+            for (std::size_t i = 0; i < n; i++) {d[i] = d[i] and s[i];}
+        }
+        template <typename Word>
+        inline void logor(Word *d, const Word *s, std::size_t n) {
+            for (std::size_t i = 0; i < n; i++) {d[i] = d[i] or s[i];}
+        }
+        template <typename Word>
+        inline Word sum(const Word *s, std::size_t n, Word acc) {
+            for (std::size_t i = 0; i < n; i++) {acc = word_add(acc, s[i]);}
+            return acc;
+        }
+        template <typename Word>
+        inline Word min(const Word *s, std::size_t n, Word acc) {
+            for (std::size_t i = 0; i < n; i++) {acc = std::min(acc, s[i]);}
+            return acc;
+        }
+        template <typename Word>
+        inline Word max(const Word *s, std::size_t n, Word acc) {
+            for (std::size_t i = 0; i < n; i++) {acc = std::max(acc, s[i]);}
+            return acc;
+        }
+        template <typename Word>
+        inline void fill(Word *d, Word value, std::size_t n) {
+            std::fill(d, d + n, value);
+        }
+    }
+
+    template <typename Word>
+    inline const basic_vector_kernels<Word> &scalar_vector_kernels() {
+        static const basic_vector_kernels<Word> kernels = {
+            VectorLevel::SCALAR, vector_scalar::add<Word>, vector_scalar::sub<Word>, vector_scalar::mul<Word>,
+            vector_scalar::logand<Word>, vector_scalar::logor<Word>, vector_scalar::sum<Word>, vector_scalar::min<Word>,
+            vector_scalar::max<Word>, vector_scalar::fill<Word>
+        };
+        return kernels;
+    }
+
+#if XVPROC_SIMD
+    // Ядра SSE4.1 и AVX2: основной цикл по 4 или 8 ячеек, хвост - обычным циклом
+    // Функции собираются под свой набор инструкций атрибутом target и вызываются только после проверки процессора
+    namespace vector_sse41 {
+        #define XVPROC_SSE41 __attribute__((target("sse4.1")))
+
+        // Логическое значение: 1 для ненулевых ячеек, 0 для нулевых
+        XVPROC_SSE41 inline __m128i truth(__m128i v) {
+            return _mm_andnot_si128(_mm_cmpeq_epi32(v, _mm_setzero_si128()), _mm_set1_epi32(1));
+        }
+
+        #define XVPROC_SSE41_BINARY(name, expr, scalar) \
+            XVPROC_SSE41 inline void name(int *d, const int *s, std::size_t n) { \
+                std::size_t i = 0; \
+                for (; i + 4 <= n; i += 4) { \
+                    __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(d + i)); \
+                    __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(s + i)); \
+                    _mm_storeu_si128(reinterpret_cast<__m128i *>(d + i), expr); \
+                } \
+                vector_scalar::scalar(d + i, s + i, n - i); \
+            }
+
+        XVPROC_SSE41_BINARY(add, _mm_add_epi32(a, b), add)
+        XVPROC_SSE41_BINARY(sub, _mm_sub_epi32(a, b), sub)
+        XVPROC_SSE41_BINARY(mul, _mm_mullo_epi32(a, b), mul)
+        XVPROC_SSE41_BINARY(logand, _mm_and_si128(truth(a), truth(b)), logand)
+        XVPROC_SSE41_BINARY(logor, _mm_or_si128(truth(a), truth(b)), logor)
+        #undef XVPROC_SSE41_BINARY
+
+        #define XVPROC_SSE41_REDUCE(name, init, step, scalar) \
+            XVPROC_SSE41 inline int name(const int *s, std::size_t n, int acc) { \
+                std::size_t i = 0; \
+                if (n >= 4) { \
+                    __m128i v = init; \
+                    for (; i + 4 <= n; i += 4) {v = step(v, _mm_loadu_si128(reinterpret_cast<const __m128i *>(s + i)));} \
+                    int lanes[4]; \
+                    _mm_storeu_si128(reinterpret_cast<__m128i *>(lanes), v); \
+                    acc = vector_scalar::scalar(lanes, 4, acc); \
+                } \
+                return vector_scalar::scalar(s + i, n - i, acc); \
+            }
+
+        XVPROC_SSE41_REDUCE(sum, _mm_setzero_si128(), _mm_add_epi32, sum)
+        XVPROC_SSE41_REDUCE(min, _mm_set1_epi32(INT_MAX), _mm_min_epi32, min)
+        XVPROC_SSE41_REDUCE(max, _mm_set1_epi32(INT_MIN), _mm_max_epi32, max)
+        #undef XVPROC_SSE41_REDUCE
+
+        XVPROC_SSE41 inline void fill(int *d, int value, std::size_t n) {
+            std::size_t i = 0;
+            __m128i v = _mm_set1_epi32(value);
+            for (; i + 4 <= n; i += 4) {_mm_storeu_si128(reinterpret_cast<__m128i *>(d + i), v);}
+            vector_scalar::fill(d + i, value, n - i);
+        }
+        #undef XVPROC_SSE41
+    }
+
+    namespace vector_avx2 {
+        #define XVPROC_AVX2 __attribute__((target("avx2")))
+
+        XVPROC_AVX2 inline __m256i truth(__m256i v) {
+            return _mm256_andnot_si256(_mm256_cmpeq_epi32(v, _mm256_setzero_si256()), _mm256_set1_epi32(1));
+        }
+
+        #define XVPROC_AVX2_BINARY(name, expr, scalar) \
+            XVPROC_AVX2 inline void name(int *d, const int *s, std::size_t n) { \
+                std::size_t i = 0; \
+                for (; i + 8 <= n; i += 8) { \
+                    __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(d + i)); \
+                    __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(s + i)); \
+                    _mm256_storeu_si256(reinterpret_cast<__m256i *>(d + i), expr); \
+                } \
+                vector_scalar::scalar(d + i, s + i, n - i); \
+            }
+
+        XVPROC_AVX2_BINARY(add, _mm256_add_epi32(a, b), add)
+        XVPROC_AVX2_BINARY(sub, _mm256_sub_epi32(a, b), sub)
+        XVPROC_AVX2_BINARY(mul, _mm256_mullo_epi32(a, b), mul)
+        XVPROC_AVX2_BINARY(logand, _mm256_and_si256(truth(a), truth(b)), logand)
+        XVPROC_AVX2_BINARY(logor, _mm256_or_si256(truth(a), truth(b)), logor)
+        #undef XVPROC_AVX2_BINARY
+
+        #define XVPROC_AVX2_REDUCE(name, init, step, scalar) \
+            XVPROC_AVX2 inline int name(const int *s, std::size_t n, int acc) { \
+                std::size_t i = 0; \
+                if (n >= 8) { \
+                    __m256i v = init; \
+                    for (; i + 8 <= n; i += 8) {v = step(v, _mm256_loadu_si256(reinterpret_cast<const __m256i *>(s + i)));} \
+                    int lanes[8]; \
+                    _mm256_storeu_si256(reinterpret_cast<__m256i *>(lanes), v); \
+                    acc = vector_scalar::scalar(lanes, 8, acc); \
+                } \
+                return vector_scalar::scalar(s + i, n - i, acc); \
+            }
+
+        XVPROC_AVX2_REDUCE(sum, _mm256_setzero_si256(), _mm256_add_epi32, sum)
+        XVPROC_AVX2_REDUCE(min, _mm256_set1_epi32(INT_MAX), _mm256_min_epi32, min)
+        XVPROC_AVX2_REDUCE(max, _mm256_set1_epi32(INT_MIN), _mm256_max_epi32, max)
+        #undef XVPROC_AVX2_REDUCE
+
+        XVPROC_AVX2 inline void fill(int *d, int value, std::size_t n) {
+            std::size_t i = 0;
+            __m256i v = _mm256_set1_epi32(value);
+            for (; i + 8 <= n; i += 8) {_mm256_storeu_si256(reinterpret_cast<__m256i *>(d + i), v);}
+            vector_scalar::fill(d + i, value, n - i);
+        }
+        #undef XVPROC_AVX2
+    }
+#endif
+
+    // Лучший набор ядер, который поддерживает процессор
+    inline VectorLevel detect_vector_level() {
+    #if XVPROC_SIMD
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {return VectorLevel::AVX2;}
+        if (__builtin_cpu_supports("sse4.1")) {return VectorLevel::SSE41;}
+    #endif
+        return VectorLevel::SCALAR;
+    }
+
+    // Набор ядер уровня level (уровень выше поддерживаемого сборкой даёт обычные циклы)
+    inline const vector_kernels &vector_kernels_for(VectorLevel level) {
+    #if XVPROC_SIMD
+        static const vector_kernels sse41 = {
+            VectorLevel::SSE41, vector_sse41::add, vector_sse41::sub, vector_sse41::mul, vector_sse41::logand,
+            vector_sse41::logor, vector_sse41::sum, vector_sse41::min, vector_sse41::max, vector_sse41::fill
+        };
+        static const vector_kernels avx2 = {
+            VectorLevel::AVX2, vector_avx2::add, vector_avx2::sub, vector_avx2::mul, vector_avx2::logand,
+            vector_avx2::logor, vector_avx2::sum, vector_avx2::min, vector_avx2::max, vector_avx2::fill
+        };
+        if (level == VectorLevel::AVX2) {return avx2;}
+        if (level == VectorLevel::SSE41) {return sse41;}
+    #endif
+        return scalar_vector_kernels<int>();
+    }
+
+    // Ядра для этого процессора, выбираются при первом вызове
+    inline const vector_kernels &vector_kernels_for_cpu() {
+        static const vector_kernels &kernels = vector_kernels_for(detect_vector_level());
+        return kernels;
+    }
+
+    // Ядра для слова Word: SIMD есть только у слова int32, другие ширины считают обычными циклами
+    template <typename Word>
+    inline const basic_vector_kernels<Word> &vector_kernels_for_word(VectorLevel level) {
+        if constexpr (std::is_same<Word, int>::value) {return vector_kernels_for(level);}
+        else {return scalar_vector_kernels<Word>();}
+    }
+
+    template <typename Word>
+    inline const basic_vector_kernels<Word> &vector_kernels_for_cpu_word() {
+        if constexpr (std::is_same<Word, int>::value) {return vector_kernels_for_cpu();}
+        else {return scalar_vector_kernels<Word>();}
+    }
+}
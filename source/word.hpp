@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+
+/*
+ Слово процессора
+
+ Ширина слова (регистров, ячеек ОЗУ и операндов инструкций) задаётся политикой ядра (см. core.hpp):
+ 16, 32 (по умолчанию) или 64 бита, слово всегда знаковое
+ Арифметика add, addc, sub, mult, fadd, векторных инструкций и счётчики стека - по модулю 2^W,
+ как на настоящем процессоре, без неопределённого поведения C++ при переполнении
+ Деление div/mod округляет частное к нулю, знак остатка - как у делимого,
+ наименьшее слово / -1 даёт само наименьшее слово (переполнение по модулю), остаток при этом 0
+ Деление на ноль проверяет ядро до вызова word_div/word_mod: это ошибка 8 (см. core.hpp)
+*/
+
+namespace cpu_unit {
+
+    // Слово шириной bits бит
+    template <int bits> struct word_of_width;
+    template <> struct word_of_width<16> {using type = std::int16_t;};
+    template <> struct word_of_width<32> {using type = int;};
+    template <> struct word_of_width<64> {using type = long long;};
+
+    template <typename Word>
+    constexpr int word_bits() {
+        return static_cast<int>(sizeof(Word) * 8);
+    }
+
+    // Помещается ли значение в слово без потери
+    template <typename Word>
+    constexpr bool fits_word(long long value) {
+        return value >= static_cast<long long>(std::numeric_limits<Word>::min())
+            and value <= static_cast<long long>(std::numeric_limits<Word>::max());
+    }
+
+    // Младшие W бит значения как слово (перенос по модулю 2^W)
+    // Вычисления идут в unsigned long long, поэтому узкое слово не расширяется до знакового int посередине,
+    // беззнаковое в знаковое переводится по модулю (так делают GCC и Clang, в C++20 это стандарт)
+    template <typename Word>
+    constexpr Word wrap_word(unsigned long long value) {
+        return static_cast<Word>(static_cast<std::make_unsigned_t<Word>>(value));
+    }
+
+    template <typename Word>
+    constexpr Word word_add(Word a, Word b) {
+        return wrap_word<Word>(static_cast<unsigned long long>(a) + static_cast<unsigned long long>(b));
+    }
+
+    template <typename Word>
+    constexpr Word word_sub(Word a, Word b) {
+        return wrap_word<Word>(static_cast<unsigned long long>(a) - static_cast<unsigned long long>(b));
+    }
+
+    template <typename Word>
+    constexpr Word word_mul(Word a, Word b) {
+        return wrap_word<Word>(static_cast<unsigned long long>(a) * static_cast<unsigned long long>(b));
+    }
+
+    // b != 0
+    template <typename Word>
+    constexpr Word word_div(Word a, Word b) {
+        if (b == -1) {return word_sub<Word>(0, a);}
+        return static_cast<Word>(a / b);
+    }
+
+    template <typename Word>
+    constexpr Word word_mod(Word a, Word b) {
+        if (b == -1) {return 0;}
+        return static_cast<Word>(a % b);
+    }
+}